@@ -25,7 +25,7 @@ project (projectName)
     filter "system:linux"
         libdirs { "/usr/lib" }
         buildoptions { "-std=c++17" }
-        links { "glfw", "GLEW", "GL" }
+        links { "glfw", "GLEW", "GL", "pthread" }
     
     filter "system:windows"
         libdirs { "libs", "libs/GLFW" }
@@ -44,3 +44,30 @@ project (projectName)
     filter "configurations:Release"
         defines { "NDEBUG" }
         optimize "On"
+
+-- `premake5 regress` builds the Release configuration and checks it against the regression suite. The reference images
+-- are in tests/regression/references, the timing baselines of this machine are recorded on the first run. With --update
+-- it records new references instead, after an intended change to the images
+newoption {
+    trigger = "update",
+    description = "With regress, record new reference images and timing baselines"
+}
+
+newaction {
+    trigger = "regress",
+    description = "Build the Release configuration and run the regression suite",
+    execute = function()
+        os.chdir(_MAIN_SCRIPT_DIR)
+        local make = (os.host() == "windows") and "mingw32-make" or "make"
+        local binary = path.translate("build/Release/" .. projectName .. ((os.host() == "windows") and ".exe" or ""))
+        if not os.execute('"' .. _PREMAKE_COMMAND .. '" gmake2') or not os.execute(make .. " config=release") then
+            print("Building the Release configuration failed")
+            os.exit(1)
+        end
+
+        os.mkdir("build/regression")
+        local command = binary .. " --regress tests/regression/suite.jsonl --regress-baselines build/regression/baselines.json"
+        if _OPTIONS["update"] then command = command .. " --regress-update" end
+        if not os.execute(command) then os.exit(1) end
+    end
+}
@@ -10,6 +10,9 @@
 #include <iostream>
 #include <stdio.h>
 #include <vector>
+#include <mutex>
+#include <functional>
+#include <algorithm>
 #include <math.h>
 #include <glm/glm.hpp>
 #include "debug.h"
@@ -21,112 +24,363 @@
 #include "camera.h"
 #include "sphere.h"
 #include "material.h"
+#include "options.h"
+#include "exporter.h"
+#include "cameraPath.h"
+#include "bvhBenchmark.h"
+#include "renderThread.h"
+#include "profiler.h"
 
 class App
 {
 public:
 
-    App(int windowWidth, int windowHeight)
+    App(const Options &options)
+        : options(options)
     {
+        PROFILE_SCOPE("App::App");
+
         // GLFW
         glfwSetErrorCallback(errorCallBack);
         glfwInit();
 
-        // GLFW window hints and context creation
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        // GLFW window hints and context creation, newest context first so newer features (e.g. persistent buffers) are available
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        if (options.headless) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);  // Hidden window, we only need its context
 
-        // Full-screen window
-        GLFWmonitor* primaryMonitor = glfwGetPrimaryMonitor();
-        const GLFWvidmode* mode = glfwGetVideoMode(primaryMonitor);
-        window = glfwCreateWindow(mode->width, mode->height, "Ray Tracing", primaryMonitor, NULL);
-        // window = glfwCreateWindow(600, 600, "Ray Tracing", NULL, NULL); // Original..
+        const int versions[][2] = { {4, 6}, {4, 5}, {4, 4}, {4, 3}, {3, 3} };
+        window = NULL;
+        for (int i = 0; i < 5 && !window; i++)
+        {
+            // Failing to get a newer version is expected, only report the last one
+            glfwSetErrorCallback(i < 4 ? NULL : errorCallBack);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, versions[i][0]);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, versions[i][1]);
+            window = createWindow();
+        }
+        glfwSetErrorCallback(errorCallBack);
+
+        if (!window)
+        {
+            std::cerr << "Error: Could not create a window with an OpenGL 3.3 context." << std::endl;
+            exit(1);
+        }
         glfwMakeContextCurrent(window);
         glfwSwapInterval(1);  // Enable vsync
 
-        // Initialize GLAD/GLEW
+        // Initialize GLAD/GLEW (experimental so core profile entry points are loaded)
         // gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+        glewExperimental = GL_TRUE;
         glewInit();
         
         // Enable blending
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        // The editor traces on a thread and context of its own, which creates everything tracing draws with. Textures
+        // and buffers are shared with the window's context, FBOs, VAOs and queries aren't
+        if (!options.headless && options.renderThread)
+        {
+            traceContext = RenderThread::createContext(window);
+            if (!traceContext) std::cerr << "Warning: Could not create a shared OpenGL context, tracing on the UI thread." << std::endl;
+        }
+        if (traceContext)
+        {
+            glfwMakeContextCurrent(traceContext);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
         
         // Properties of the ImGui window containing the OpenGL texture (that we draw on)
-        sceneWindow = Window(windowWidth, windowHeight);
+        sceneWindow = Window(options.width, options.height);
+        viewportSize = glm::ivec2(options.width, options.height);
 
-        initImGui();
         quad.init();
         renderer = Renderer(sceneWindow.aspectRatio);
+        if (!options.scenePath.empty() && !renderer.loadScene(options.scenePath)) exit(1);
+        if (options.generate)
+        {
+            renderer.generator = options.generator;
+            renderer.generateScene();
+        }
+        for (const std::string &path : options.meshPaths)
+        {
+            if (!renderer.loadMesh(path)) exit(1);
+            if (options.instances > 1) renderer.scatterInstances(renderer.scene.meshes.size() - 1, options.instances);
+        }
+        if (options.sphereBuilder >= 0)
+        {
+            // Overrides a tree stored with the scene, so saving keeps the chosen one
+            renderer.scene.sphereTree.builder = options.sphereBuilder;
+            renderer.scene.sphereTree.invalidate();
+        }
+        renderer.environment.strength = options.environmentStrength;
+        if (!options.environmentPath.empty() && !renderer.loadEnvironment(options.environmentPath)) exit(1);
+        if (!options.saveScenePath.empty() && !renderer.scene.save(options.saveScenePath)) exit(1);
+        renderer.tracer = options.tracer;
+        if (renderer.tracer == Renderer::WAVEFRONT && !WavefrontTracer::isSupported())
+            std::cerr << "Warning: The wavefront tracer needs OpenGL 4.3, using the fragment tracer." << std::endl;
+        if (options.maxRayBounce > 0) renderer.maxRayBounce = options.maxRayBounce;
+        renderer.wavefront.persistentThreads = options.persistentGroups > 0;
+        if (options.persistentGroups > 0) renderer.wavefront.persistentGroups = options.persistentGroups;
+        renderer.wavefront.batchSize = options.batchSize;
+        renderer.wavefront.sortRays = options.sortRays;
+        renderer.wavefront.sortHits = options.sortHits;
+        renderer.heatmap.mode = options.heatmap;
+        renderer.heatmap.scale = options.heatmapScale;
+        exporter.init();
+        exporter.snapshotEvery = options.snapshotEvery;
+        if (!options.outPath.empty()) snprintf(exporter.path, sizeof(exporter.path), "%s", options.outPath.c_str());
+
+        if (traceContext)
+        {
+            renderThread.frames.init(sceneWindow.width, sceneWindow.height);
+            glfwMakeContextCurrent(window);
+        }
+        if (!options.headless) initImGui();
     }
 
     ~App()
     {
-        ImGui_ImplOpenGL3_Shutdown();
-        ImGui_ImplGlfw_Shutdown();
-        ImGui::DestroyContext();
+        if (!options.headless)
+        {
+            ImGui_ImplOpenGL3_Shutdown();
+            ImGui_ImplGlfw_Shutdown();
+            ImGui::DestroyContext();
+        }
 
+        renderThread.stop();
+        if (!options.profilePath.empty()) Profiler::writeChromeTrace(options.profilePath);
+        if (traceContext) glfwDestroyWindow(traceContext);
         glfwDestroyWindow(window);
         glfwTerminate();
     }
 
     void loop()
     {
+        if (traceContext) renderThread.start(traceContext, [this]() { traceSlice(); });
+        Profiler::nameThread("UI");
+
         while (!glfwWindowShouldClose(window))
         {
+            int64_t frameStart = Profiler::begin();
             beginFrame();
-            gui();
-
-            ImGui::Begin("Viewport", nullptr, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
             {
-                // Get window size and position
-                ImVec2 windowSize = ImGui::GetContentRegionAvail();
-                ImVec2 windowPos = ImGui::GetCursorScreenPos();
-
-                pollEvents();
-
-                // Get previous frame texture unit and bind it (this way we can use it in the scene shader)
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, sceneWindow.textures[!pingpong]);
-
-                // Bind and clear current frame buffer (this way anything we render gets rendered on this FBO's texture)
-                glBindFramebuffer(GL_FRAMEBUFFER, sceneWindow.FBOs[pingpong]);
-                glViewport(0, 0, sceneWindow.width, sceneWindow.height);
-                glClear(GL_COLOR_BUFFER_BIT);
-                
-                // Render the scene
-                renderer.renderScene(&sceneWindow, 0, &quad);
-
-                // Unbind current FBO and previous texture
-                glBindFramebuffer(GL_FRAMEBUFFER, 0);
-                glBindTexture(GL_TEXTURE_2D, 0);
-                
-                // Display current texture on ImGui window
-                ImGui::ImageButton((GLuint*)(GLuint64)sceneWindow.textures[pingpong], ImVec2(sceneWindow.width, sceneWindow.height), ImVec2(0, 1), ImVec2(1, 0), 0);
-                
-                // Swap pingpong boolean for the next iteration
-                pingpong = !pingpong;
+                // The trace thread waits between slices while the GUI reads and edits the renderer
+                std::unique_lock<std::mutex> guard;
+                if (traceContext) guard = renderThread.acquire();
+
+                gui();
+
+                ImGui::Begin("Viewport", nullptr, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
+                {
+                    pollEvents();
+                    renderer.debugMenu();
+
+                    // Show the newest image from the trace thread, or render the tiles of the scene that fit in this
+                    // frame and convert the result for display
+                    GLuint image = sceneWindow.displayTexture;
+                    if (traceContext) image = renderThread.frames.acquire();
+                    else traceSlice();
+
+                    // Display current texture on ImGui window
+                    ImGui::ImageButton((GLuint*)(GLuint64)image, ImVec2(sceneWindow.width, sceneWindow.height), ImVec2(0, 1), ImVec2(1, 0), 0);
+                    if (showTiles && !lastSliceCompletedPass) tilesOverlay();
+                }
+                ImGui::End();
             }
-            ImGui::End();
-            
+
+            // Outside the lock, swapping waits for vsync
             endFrame();
+            if (traceContext) renderThread.frames.release();
+            Profiler::end("Frame", frameStart);
+            Profiler::endStartup();
+        }
+
+        renderThread.stop();
+    }
+
+    // Accumulates `options.samples` samples per pixel without a GUI and writes the image to `options.outPath`
+    int renderHeadless()
+    {
+        // Nothing to keep responsive, trace whole passes (tiles are still submitted one by one)
+        renderer.tiles.frameBudgetMs = 0.0;
+
+        double start = glfwGetTime();
+        while (renderer.accumulatedSamples < options.samples)
+        {
+            traceFrame();
+            exporter.update();
+        }
+        double renderTime = glfwGetTime() - start;
+
+        exporter.exportImage(lastPass(), sceneWindow.width, sceneWindow.height, options.outPath, renderer.doGammaCorrection);
+        exporter.finish();
+        if (renderer.heatmap.isOn())
+        {
+            // Summarize the final image rather than whichever pass was read back last
+            renderer.heatmap.finish();
+            renderer.heatmap.onPassComplete(lastPass(), sceneWindow.width, sceneWindow.height);
+            renderer.heatmap.finish();
+            renderer.heatmap.print();
+        }
+
+        std::cout << "Rendered " << renderer.accumulatedSamples << " spp at " << sceneWindow.width << "x" << sceneWindow.height
+                  << " in " << renderTime << "s, wrote " << exporter.written() << " image(s)" << std::endl;
+
+        return exporter.written() > 0 ? 0 : 1;
+    }
+
+    int benchmarkBVH()
+    {
+        return BVHBenchmark::run(renderer.scene, options.bvhBenchmarkThreads);
+    }
+
+
+    // * Offline rendering, driven by the modes in sequenceMode.h, batchMode.h, regressionMode.h, serverMode.h and
+    // distributedMode.h
+
+    Options options;
+    Window sceneWindow;
+    Renderer renderer;
+
+    // Traces the part of the current pass that fits in this frame, returns true when the pass completed
+    bool traceFrame()
+    {
+        // Get previous frame texture unit and bind it (this way we can use it in the scene shader)
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, sceneWindow.textures[!pingpong]);
+
+        // A pass can take several frames, start it from the last complete image so untraced tiles still show something
+        if (renderer.tiles.atPassStart()) sceneWindow.copyTexture(!pingpong, pingpong);
+
+        // Bind current frame buffer (this way anything we render gets rendered on this FBO's texture)
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneWindow.FBOs[pingpong]);
+        glViewport(0, 0, sceneWindow.width, sceneWindow.height);
+
+        // The accumulation keeps the heatmap's counts in alpha, it must be written as is rather than blended
+        glDisable(GL_BLEND);
+        bool passComplete = renderer.renderScene(&sceneWindow, 0, &quad, sceneWindow.textures[pingpong]);
+        glEnable(GL_BLEND);
+
+        // Unbind current FBO and previous texture
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        if (passComplete)
+        {
+            exporter.onPassComplete(sceneWindow.FBOs[pingpong], sceneWindow.width, sceneWindow.height, renderer.accumulatedSamples, renderer.doGammaCorrection);
+            renderer.heatmap.onPassComplete(sceneWindow.FBOs[pingpong], sceneWindow.width, sceneWindow.height);
+
+            // Swap pingpong boolean once the pass is done
+            pingpong = !pingpong;
         }
+
+        return passComplete;
+    }
+
+    // FBO holding the last complete pass
+    GLuint lastPass() const { return sceneWindow.FBOs[!pingpong]; }
+
+    // The last complete pass over a rectangle of the window, read back synchronously
+    Image readAccumulation(int x, int y, int width, int height)
+    {
+        Image image(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, lastPass());
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(x, y, width, height, GL_RGBA, GL_FLOAT, image.pixels.data());
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return image;
     }
 
 private:
 
     GLFWwindow *window;
+    GLFWwindow *traceContext = NULL;    // Context of the render thread, NULL when tracing on the UI thread
+    RenderThread renderThread;
+    glm::ivec2 viewportSize;            // Size of the viewport the image was last asked for
+    bool lastSliceCompletedPass = false;
     FullQuad quad;
-    Window sceneWindow;
-    Renderer renderer;
+
+    // Task pool rates, sampled every half second for the data panel
+    TaskPool::Stats poolSample;
+    double poolSampleTime = 0.0;
+    double poolUtilisation = 0.0, poolTasksPerSecond = 0.0, poolStealsPerSecond = 0.0;
+    Exporter exporter;
     bool pingpong = false;
+    bool showTiles = true;
+    CameraPath cameraPath;
+    char cameraPathFile[256] = "camera.path";
+    float pathPreview = 0.0;
+    char sceneFile[256] = "scene.rtsc";
+    char meshFile[256] = "mesh.obj";
+    char environmentFile[256] = "environment.hdr";
+    int scatterMesh = 0, scatterCount = 1000;
+
+    // Profiler timeline
+    bool profilerPaused = false;
+    float profilerSpanMs = 50.0;
+    char traceFile[256] = "trace.json";
+    std::vector<Profiler::ThreadEvents> profilerView;
+    int64_t profilerViewEnd = 0;
+
+
+    // * Window
+
+    GLFWwindow *createWindow()
+    {
+        // Hidden window when headless
+        if (options.headless) return glfwCreateWindow(options.width, options.height, "Ray Tracing", NULL, NULL);
+
+        // Full-screen window
+        GLFWmonitor* primaryMonitor = glfwGetPrimaryMonitor();
+        const GLFWvidmode* mode = glfwGetVideoMode(primaryMonitor);
+        return glfwCreateWindow(mode->width, mode->height, "Ray Tracing", primaryMonitor, NULL);
+        // return glfwCreateWindow(600, 600, "Ray Tracing", NULL, NULL); // Original..
+    }
+
+
+    // * Rendering
+
+    // One frame budget of tiles converted for display, on the render thread when there is one
+    void traceSlice()
+    {
+        PROFILE_SCOPE("App::traceSlice");
+        GLuint currentTexture = sceneWindow.textures[pingpong];
+        lastSliceCompletedPass = traceFrame();
+        if (traceContext)
+        {
+            present(currentTexture, renderThread.frames.beginWrite());
+            renderThread.frames.publish();
+        }
+        else present(currentTexture, sceneWindow.displayFBO);
+        exporter.update();
+        renderer.heatmap.update();
+    }
+
+    // Runs `task` where the tracer's FBOs and VAOs live: right away without a render thread, before its next slice with one
+    void onTraceContext(std::function<void()> task)
+    {
+        if (traceContext) renderThread.post(std::move(task));
+        else task();
+    }
+
+    // Converts the linear accumulation in `texture` into the display texture attached to `FBO`
+    void present(GLuint texture, GLuint FBO)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, sceneWindow.width, sceneWindow.height);
+        quad.present(texture, renderer.doGammaCorrection);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
 
 
     // * GUI
 
     void gui()
     {
+        PROFILE_SCOPE("App::gui");
         ImGui::DockSpaceOverViewport(0, ImGui::GetMainViewport());
         
         ImGui::Begin("Data");
@@ -141,6 +395,22 @@ private:
         controlsMenu();
         ImGui::End();
 
+        ImGui::Begin("Export");
+        exportMenu();
+        ImGui::End();
+
+        ImGui::Begin("Camera Path");
+        cameraPathMenu();
+        ImGui::End();
+
+        ImGui::Begin("Scene");
+        sceneMenu();
+        ImGui::End();
+
+        ImGui::Begin("Profiler");
+        profilerMenu();
+        ImGui::End();
+
         // Menus for selected spheres
         Sphere *sphere;
         if (renderer.isSphereSelected(&sphere))
@@ -150,7 +420,15 @@ private:
             ImGui::End();
 
             ImGui::Begin("Material");
-            materialMenu(&(sphere->material));
+            materialMenu(sphere->material);
+            ImGui::End();
+        }
+
+        Instance *instance = renderer.getSelectedInstance();
+        if (instance)
+        {
+            ImGui::Begin("Instance");
+            instanceMenu(instance);
             ImGui::End();
         }
     }
@@ -158,14 +436,139 @@ private:
     void dataGui()
     {
         ImGui::Text("%20s: %-10.4f", "FPS", ImGui::GetIO().Framerate);
+        if (traceContext) ImGui::Text("%20s: %-10.1f", "Trace slices/s", renderThread.slicesPerSecond.load());
         ImGui::Text("%20s: %-10d", "Frames sampled", renderer.renderedFrameCount);
+        ImGui::Text("%20s: %-10d", "Samples per pixel", renderer.accumulatedSamples);
+        ImGui::Text("%20s: %-10.3f", "GPU ms per tile", renderer.tiles.gpuMsPerTile);
+        ImGui::Text("%20s: %-10d", "Tiles per frame", renderer.tiles.lastFrameTileCount);
+
+        // Progress of the pass that is being traced
+        char overlay[32];
+        snprintf(overlay, sizeof(overlay), "%d/%d tiles", renderer.tiles.tilesDone(), renderer.tiles.tileCount());
+        ImGui::ProgressBar(renderer.tiles.progress(), ImVec2(-FLT_MIN, 0), overlay);
+
+        TaskPool::Stats pool = TaskPool::global().stats();
+        double now = glfwGetTime();
+        if (now - poolSampleTime >= 0.5)
+        {
+            double elapsed = now - poolSampleTime;
+            poolUtilisation = (pool.busySeconds - poolSample.busySeconds) / (elapsed*std::max(pool.threads, 1));
+            poolTasksPerSecond = (pool.tasks - poolSample.tasks) / elapsed;
+            poolStealsPerSecond = (pool.steals - poolSample.steals) / elapsed;
+            poolSample = pool;
+            poolSampleTime = now;
+        }
+        ImGui::Text("%20s: %-10d", "Worker threads", pool.threads);
+        ImGui::Text("%20s: %-10.1f", "Worker use %", poolUtilisation*100.0);
+        ImGui::Text("%20s: %-10.1f", "Tasks/s", poolTasksPerSecond);
+        ImGui::Text("%20s: %-10.1f", "Steals/s", poolStealsPerSecond);
+    }
+
+    // Flame style timeline of the last `profilerSpanMs` on every thread, a row per nesting level, then the time each phase
+    // took over the span
+    void profilerMenu()
+    {
+        bool recording = Profiler::isEnabled();
+        if (ImGui::Checkbox("Record", &recording)) Profiler::setEnabled(recording);
+        ImGui::SameLine();
+        ImGui::Checkbox("Pause", &profilerPaused);
+        ImGui::SliderFloat("Span", &profilerSpanMs, 5.0f, 1000.0f, "%.0f ms", ImGuiSliderFlags_Logarithmic);
+        ImGui::InputText("Trace File", traceFile, sizeof(traceFile));
+        if (ImGui::Button("Save Chrome Trace")) Profiler::writeChromeTrace(traceFile);
+
+        int64_t span = (int64_t)(profilerSpanMs*1.0e6);
+        if (!profilerPaused)
+        {
+            profilerViewEnd = Profiler::now();
+            profilerView = Profiler::snapshot(profilerViewEnd - span);
+        }
+        int64_t viewStart = profilerViewEnd - span;
+
+        ImDrawList *drawList = ImGui::GetWindowDrawList();
+        float width = std::max(ImGui::GetContentRegionAvail().x, 1.0f), rowHeight = ImGui::GetTextLineHeight() + 4.0f;
+        double scale = width / (double)span;
+        std::vector<std::pair<const char*, double>> phases;     // Milliseconds per phase over the span
+        for (const Profiler::ThreadEvents &thread : profilerView)
+        {
+            if (thread.events.empty()) continue;
+            ImGui::TextUnformatted(thread.name.c_str());
+            ImVec2 origin = ImGui::GetCursorScreenPos();
+            int rows = 1;
+            for (const Profiler::Event &event : thread.events)
+            {
+                double start = std::max(event.start, viewStart), end = std::min(event.end, profilerViewEnd);
+                if (end < start) continue;
+                rows = std::max(rows, event.depth + 1);
+
+                auto phase = std::find_if(phases.begin(), phases.end(), [&](const std::pair<const char*, double> &p) { return p.first == event.name; });
+                if (phase == phases.end()) phase = phases.insert(phases.end(), { event.name, 0.0 });
+                phase->second += (end - start) / 1.0e6;
+
+                // Colours follow the name so a phase looks the same on every thread
+                unsigned hash = 2166136261u;
+                for (const char *c = event.name; *c; c++) hash = (hash ^ (unsigned char)*c) * 16777619u;
+                ImVec2 min(origin.x + (float)((start - viewStart)*scale), origin.y + event.depth*rowHeight);
+                ImVec2 max(std::max(origin.x + (float)((end - viewStart)*scale), min.x + 1.0f), min.y + rowHeight - 1.0f);
+                drawList->AddRectFilled(min, max, ImColor::HSV((hash % 360) / 360.0f, 0.45f, 0.65f));
+                if (max.x - min.x > 8.0f)
+                {
+                    drawList->PushClipRect(min, max, true);
+                    drawList->AddText(ImVec2(min.x + 2.0f, min.y + 2.0f), IM_COL32_WHITE, event.name);
+                    drawList->PopClipRect();
+                }
+                if (ImGui::IsMouseHoveringRect(min, max)) ImGui::SetTooltip("%s\n%.3f ms", event.name, (event.end - event.start) / 1.0e6);
+            }
+            ImGui::Dummy(ImVec2(width, rows*rowHeight));
+        }
+
+        std::sort(phases.begin(), phases.end(), [](const std::pair<const char*, double> &a, const std::pair<const char*, double> &b) { return a.second > b.second; });
+        for (const std::pair<const char*, double> &phase : phases)
+            ImGui::Text("%32s: %8.3f ms (%5.1f%%)", phase.first, phase.second, phase.second / profilerSpanMs*100.0);
+    }
+
+    void tilesOverlay()
+    {
+        // Outline the tiles traced this frame on top of the image (window coordinates have y going up)
+        ImDrawList *drawList = ImGui::GetWindowDrawList();
+        ImVec2 imagePos = ImGui::GetItemRectMin();
+        for (int i = 0; i < renderer.tiles.lastFrameTileCount; i++)
+        {
+            glm::ivec4 tile = renderer.tiles.getTile(renderer.tiles.lastFrameFirstTile + i);
+            ImVec2 min(imagePos.x + tile.x, imagePos.y + sceneWindow.height - tile.y - tile.w);
+            ImVec2 max(min.x + tile.z, min.y + tile.w);
+            drawList->AddRect(min, max, IM_COL32(255, 255, 0, 160));
+        }
     }
 
     void controlsMenu()
     {
         bool updated = false;
 
-        updated |= ImGui::Checkbox("Test", (bool*)&(renderer.test));
+        updated |= ImGui::Combo("Tracer", &renderer.tracer, WavefrontTracer::isSupported() ? "Fragment\0Wavefront (compute)\0Direct Lighting\0"
+                                                                                         : "Fragment\0Wavefront (needs OpenGL 4.3)\0Direct Lighting\0");
+        if (renderer.tracer == Renderer::DIRECT)
+        {
+            // Each sample walks the light tree once, more of them trade speed for less noise with many lights
+            updated |= ImGui::SliderInt("Light Samples", &renderer.lightSamples, 1, 16);
+            const LightTree &lights = renderer.scene.lightTree;
+            ImGui::Text("%zu lights, tree built in %.2f ms", lights.lightCount(), lights.lastBuildSeconds*1000.0);
+        }
+        if (renderer.isWavefrontActive())
+        {
+            // Persistent threads keep the closest hit kernel's workgroups pulling rays until the queue is empty
+            WavefrontTracer &wavefront = renderer.wavefront;
+            ImGui::Checkbox("Persistent Threads", &wavefront.persistentThreads);
+            if (wavefront.persistentThreads)
+            {
+                ImGui::SliderInt("Workgroups", &wavefront.persistentGroups, 1, 4096, "%d", ImGuiSliderFlags_Logarithmic);
+                ImGui::SliderInt("Batch Size", &wavefront.batchSize, 64, 4096, "%d rays", ImGuiSliderFlags_Logarithmic);
+            }
+
+            // Sorting costs three passes over the queue, it pays off once traversal and shading stop fitting in cache
+            ImGui::Checkbox("Sort Rays", &wavefront.sortRays);
+            ImGui::SameLine();
+            ImGui::Checkbox("Sort Hits", &wavefront.sortHits);
+        }
         updated |= ImGui::Checkbox("Sky", (bool*)&(renderer.sky));
         updated |= ImGui::Checkbox("Gamma Correct", (bool*)&(renderer.doGammaCorrection));
         updated |= ImGui::Checkbox("Temporal Anti-Aliasing", &(renderer.doTAA));
@@ -205,9 +608,179 @@ private:
             updated |= ImGui::SliderInt("Samples per pixel", &(renderer.samplesPerPixel), 1, 20, renderer.samplingMethod == 1 ? "%d^2" : "%d");
         }
 
+        // Replaces the sky while a map is loaded, sampling it directly cleans up small bright sources like a sun
+        ImGui::SeparatorText("Environment");
+        Environment &environment = renderer.environment;
+        ImGui::InputText("Map File", environmentFile, sizeof(environmentFile));
+        if (ImGui::Button("Load Map")) onTraceContext([this]() { renderer.loadEnvironment(environmentFile); });
+        ImGui::SameLine();
+        if (ImGui::Button("Remove Map")) onTraceContext([this]() { renderer.environment.clear(); renderer.onUpdate(); });
+        ImGui::SameLine();
+        ImGui::TextDisabled(environment.isLoaded() ? environment.path.c_str() : ".hdr or .pfm");
+        if (environment.isLoaded())
+        {
+            updated |= ImGui::SliderFloat("Strength", &environment.strength, 0.0, 10.0, "%.2f", ImGuiSliderFlags_Logarithmic);
+            updated |= ImGui::SliderFloat("Rotation", &environment.rotation, -180.0, 180.0, "%.0f deg");
+            updated |= ImGui::Checkbox("Sample Environment Directly", &environment.sampleDirectly);
+        }
+
+        // Tiled tracing, changing the layout only restarts the current pass
+        ImGui::SeparatorText("Tiled Tracing");
+        ImGui::SliderInt("Tile Size", &(renderer.tiles.tileSize), 16, 512);
+        ImGui::Combo("Tile Order", &(renderer.tiles.tileOrder), "Scanline\0Center out\0Morton\0");
+        ImGui::SliderFloat("Frame Budget (ms)", &(renderer.tiles.frameBudgetMs), 0.0, 100.0, renderer.tiles.frameBudgetMs <= 0.0 ? "Unlimited" : "%.1f");
+        ImGui::Checkbox("Show Tiles", &showTiles);
+
+        // Traversal cost per pixel, the histogram is refreshed from each complete pass
+        ImGui::SeparatorText("Heatmap");
+        Heatmap &heatmap = renderer.heatmap;
+        updated |= ImGui::Combo("Show", &heatmap.mode, "Shaded image\0Intersection tests\0BVH nodes visited\0Bounces\0");
+        if (heatmap.isOn())
+        {
+            updated |= ImGui::SliderFloat("Hottest At", &heatmap.scale, 1.0, 1024.0, "%.0f", ImGuiSliderFlags_Logarithmic);
+            if (heatmap.summaryMode == heatmap.mode)
+            {
+                ImGui::Text("Per sample: mean %.1f, max %.1f, %.1f%% of pixels at the top", heatmap.mean, heatmap.maximum, heatmap.hotShare*100.0);
+                ImGui::PlotHistogram("Pixels", heatmap.histogram.data(), heatmap.histogram.size(), 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 60));
+            }
+        }
+
         if (updated) renderer.onUpdate();
     }
 
+    void exportMenu()
+    {
+        ImGui::InputText("File", exporter.path, sizeof(exporter.path));
+        if (ImGui::Button("Export"))
+        {
+            // The last complete pass, the one in progress may only be partially traced
+            onTraceContext([this]()
+            {
+                exporter.exportImage(lastPass(), sceneWindow.width, sceneWindow.height, exporter.path, renderer.doGammaCorrection);
+            });
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled(".png for display, .exr or .pfm for linear data");
+
+        ImGui::SliderInt("Snapshot Every", &(exporter.snapshotEvery), 0, 1024, exporter.snapshotEvery ? "%d spp" : "Off");
+        if (!exporter.status.empty()) ImGui::Text("%s (%d pending, %d written)", exporter.status.c_str(), exporter.pending(), exporter.written());
+    }
+
+    void cameraPathMenu()
+    {
+        if (ImGui::Button("Add Keyframe"))
+        {
+            float time = cameraPath.empty() ? 0.0f : cameraPath.keyframes.back().time + 1.0f;
+            cameraPath.add(renderer.camera.currentKeyframe(time));
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) cameraPath.keyframes.clear();
+
+        // Keyframe list, times can be edited to change the pacing
+        for (int i = 0; i < cameraPath.size(); i++)
+        {
+            ImGui::PushID(i);
+            Keyframe &keyframe = cameraPath.keyframes[i];
+            ImGui::SetNextItemWidth(80);
+            ImGui::DragFloat("##time", &keyframe.time, 0.1, 0.0, 10000.0, "t=%.1f");
+            ImGui::SameLine();
+            ImGui::Text("(%.2f, %.2f, %.2f)", keyframe.position.x, keyframe.position.y, keyframe.position.z);
+            ImGui::SameLine();
+            if (ImGui::SmallButton("Go")) renderer.camera.applyKeyframe(keyframe);
+            ImGui::SameLine();
+            bool remove = ImGui::SmallButton("Remove");
+            ImGui::PopID();
+
+            if (remove)
+            {
+                cameraPath.keyframes.erase(cameraPath.keyframes.begin() + i);
+                i--;
+            }
+        }
+
+        if (cameraPath.size() >= 2 && ImGui::SliderFloat("Preview", &pathPreview, 0.0, 1.0))
+            renderer.camera.applyKeyframe(cameraPath.sample(pathPreview));
+
+        ImGui::InputText("Path File", cameraPathFile, sizeof(cameraPathFile));
+        if (ImGui::Button("Save")) cameraPath.save(cameraPathFile);
+        ImGui::SameLine();
+        if (ImGui::Button("Load")) cameraPath.load(cameraPathFile);
+        ImGui::TextDisabled("Render with --path %s --out frames/frame.png", cameraPathFile);
+    }
+
+    void sceneMenu()
+    {
+        Scene &scene = renderer.scene;
+        ImGui::Text("%zu spheres, %zu triangles in %zu meshes, %zu materials", scene.sphereCount(), scene.triangleCount(), scene.meshes.size(), scene.materials.size());
+        if (!scene.instances.empty())
+            ImGui::Text("%zu instances placing %zu triangles", scene.instances.size(), scene.instancedTriangleCount());
+        if (scene.loadBytes)
+            ImGui::Text("Loaded %.1f MB in %.1f ms", scene.loadBytes / 1.0e6, scene.loadSeconds*1000.0);
+
+        // Dragging a sphere refits its ancestors, a rebuild starts in the background once the SAH cost has grown too much
+        SphereBVH &tree = scene.sphereTree;
+        ImGui::Text("Sphere BVH: %zu nodes, SAH cost %.1f (%.2fx built), built in %.1f ms", tree.bvh().nodes.size(), tree.bvh().cost(),
+                    tree.bvh().degradation(), tree.lastBuildSeconds*1000.0);
+        ImGui::Text("Last refit %.3f ms, %zu nodes uploaded, %d rebuilds%s", tree.lastRefitSeconds*1000.0, tree.lastUploadNodes, tree.rebuilds,
+                    tree.isRebuilding() ? " (rebuilding)" : "");
+        const BVHStats &quality = tree.quality;
+        ImGui::Text("Leaves hold %.2f spheres, depth %d, a ray visits %.1f nodes and tests %.1f spheres", quality.averageLeafSize, quality.maxDepth,
+                    quality.expectedNodeVisits, quality.expectedPrimitiveTests);
+        if (!quality.depthHistogram.empty())
+        {
+            std::vector<float> leavesAtDepth(quality.depthHistogram.begin(), quality.depthHistogram.end());
+            ImGui::PlotHistogram("Leaf Depths", leavesAtDepth.data(), leavesAtDepth.size(), 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 50));
+        }
+        ImGui::Combo("Builder", &tree.builder, "Median split\0Linear (Morton codes)\0Binned SAH\0");
+        ImGui::SameLine();
+        if (ImGui::Button("Rebuild"))
+        {
+            tree.invalidate();
+            renderer.onUpdate();
+        }
+        ImGui::SliderFloat("Rebuild At", &tree.rebuildThreshold, 1.05, 3.0, "%.2fx cost");
+
+        ImGui::InputText("Scene File", sceneFile, sizeof(sceneFile));
+        if (ImGui::Button("Save")) scene.save(sceneFile);
+        ImGui::SameLine();
+        if (ImGui::Button("Load")) onTraceContext([this]() { renderer.loadScene(sceneFile); });
+
+        ImGui::InputText("Mesh File", meshFile, sizeof(meshFile));
+        if (ImGui::Button("Add Mesh")) renderer.loadMesh(meshFile);
+        ImGui::SameLine();
+        if (ImGui::Button("Remove Meshes"))
+        {
+            scene.clearMeshes();
+            renderer.onUpdate();
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled(".obj or .ply");
+
+        if (!scene.meshes.empty())
+        {
+            ImGui::SliderInt("Mesh", &scatterMesh, 0, scene.meshes.size() - 1);
+            ImGui::DragInt("Copies", &scatterCount, 10.0, 1, 1000000);
+            if (ImGui::Button("Scatter")) renderer.scatterInstances(scatterMesh, scatterCount);
+            ImGui::SameLine();
+            ImGui::TextDisabled("Replaces the mesh's instances with a grid of copies");
+        }
+
+        // Procedural stress scenes, the same seed and settings always give the same scene
+        ImGui::SeparatorText("Generator");
+        SceneGenerator &generator = renderer.generator;
+        ImGui::Combo("Layout", &generator.layout, "Uniform field\0Galaxies\0Weekend grid\0");
+        ImGui::InputInt("Seed", (int*)&generator.seed);
+        ImGui::DragInt("Spheres", &generator.count, 100.0, 0, 10000000);
+        ImGui::Combo("Radius", &generator.radiusDistribution, "Constant\0Random\0Power law\0");
+        ImGui::DragFloatRange2("Radius Range", &generator.minRadius, &generator.maxRadius, 0.01, 0.01, 100.0);
+        ImGui::SliderFloat("Diffuse", &generator.diffuseWeight, 0.0, 1.0);
+        ImGui::SliderFloat("Metal", &generator.metalWeight, 0.0, 1.0);
+        ImGui::SliderFloat("Glossy", &generator.glossyWeight, 0.0, 1.0);
+        ImGui::Combo("Lights", &generator.lighting, "Few large\0Many small\0");
+        if (generator.lighting == SceneGenerator::MANY_LIGHTS) ImGui::SliderFloat("Light Fraction", &generator.lightFraction, 0.0, 0.2);
+        if (ImGui::Button("Generate")) renderer.generateScene();
+    }
+
     void sphereMenu(Sphere *sphere)
     {
         bool updated = false;
@@ -215,19 +788,66 @@ private:
         updated |= ImGui::DragFloat3("Position", &(sphere->position[0]), 0.1);
         updated |= ImGui::DragFloat("Radius", &(sphere->radius), 0.1, 0.1, 100.0);
 
+        // Spheres share materials, give this one its own copy to edit it alone
+        int materialCount = renderer.scene.materials.size();
+        updated |= ImGui::SliderInt("Material", &(sphere->material), 0, materialCount - 1);
+        ImGui::SameLine();
+        if (ImGui::Button("New"))
+        {
+            sphere->material = renderer.scene.addMaterial(renderer.scene.materials[sphere->material]);
+            updated = true;
+        }
+
         if (ImGui::Button("Focus"))
         {
             updated = true;
             renderer.camera.focusSphere(renderer.getSelectedSphere());
         }
 
-        if (updated) renderer.onUpdate();
+        if (updated)
+        {
+            renderer.scene.markSphereDirty(renderer.getSelectedSphereIndex());
+            renderer.onUpdate();
+        }
     }
 
-    void materialMenu(Material *mat)
+    // Moving an instance only rebuilds the top level BVH, the mesh it places is untouched
+    void instanceMenu(Instance *instance)
     {
+        Scene &scene = renderer.scene;
         bool updated = false;
 
+        ImGui::Text("Mesh %u, %u triangles", instance->mesh, scene.meshes[instance->mesh].triangleCount);
+        updated |= ImGui::DragFloat3("Position", &(instance->position[0]), 0.05);
+        glm::vec3 degrees = glm::degrees(instance->rotation);
+        if (ImGui::DragFloat3("Rotation", &degrees[0], 1.0))
+        {
+            instance->rotation = glm::radians(degrees);
+            updated = true;
+        }
+        updated |= ImGui::DragFloat("Scale", &(instance->scale), 0.01, 0.001, 1000.0);
+        updated |= ImGui::SliderInt("Material", &(instance->material), -1, scene.materials.size() - 1, instance->material < 0 ? "Mesh's own" : "%d");
+
+        if (updated)
+        {
+            scene.markInstancesDirty();
+            renderer.onUpdate();
+        }
+
+        if (ImGui::Button("Duplicate"))
+        {
+            Instance copy = *instance;
+            copy.position.x += glm::length(scene.meshBounds(copy.mesh).extent())*copy.scale;
+            renderer.selectInstance(scene.addInstance(copy));
+            renderer.onUpdate();
+        }
+    }
+
+    void materialMenu(int materialIndex)
+    {
+        bool updated = false;
+        Material *mat = &renderer.scene.materials[materialIndex];
+
         updated |= ImGui::ColorEdit3("Albedo", &(mat->albedo[0]));
         updated |= ImGui::SliderFloat("Roughness", &(mat->roughness), 0.0, 1.0);
         updated |= ImGui::SliderFloat("Reflectivity", &(mat->reflectivity), 0.0, 1.0);
@@ -237,7 +857,11 @@ private:
         updated |= ImGui::ColorEdit3("Emission Colour", &(mat->emissionColour[0]));
         updated |= ImGui::SliderFloat("Emission Strength", &(mat->emissionStrength), 0.0, 100.0);
 
-        if (updated) renderer.camera.onUpdate();
+        if (updated)
+        {
+            renderer.scene.markMaterialsDirty();
+            renderer.camera.onUpdate();
+        }
     }
 
 
@@ -245,6 +869,7 @@ private:
 
     void beginFrame()
     {
+        PROFILE_SCOPE("App::beginFrame");
         glfwPollEvents();
         if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(window, true);
     
@@ -256,6 +881,7 @@ private:
     
     void endFrame()
     {
+        PROFILE_SCOPE("App::endFrame");
         ImGui::Render();
         int display_w, display_h;
         glfwGetFramebufferSize(window, &display_w, &display_h);
@@ -271,11 +897,14 @@ private:
             glfwMakeContextCurrent(backup_current_context);
         }
         
+        int64_t swapStart = Profiler::begin();
         glfwSwapBuffers(window);
+        Profiler::end("glfwSwapBuffers", swapStart);
     }
 
     void pollEvents()
     {
+        PROFILE_SCOPE("App::pollEvents");
         static bool isMouseDragging = false;
         static ImVec2 lastMousePos;
         
@@ -286,11 +915,17 @@ private:
         ImVec2 mousePosRelative(mousePos.x - windowPos.x, mousePos.y - windowPos.y);
         
         // Resize Window, textures, etc
-        bool windowChangedSize = (int)windowSize.x != sceneWindow.width || (int)windowSize.y != sceneWindow.height;
-        if (windowChangedSize)
+        bool windowChangedSize = (int)windowSize.x != viewportSize.x || (int)windowSize.y != viewportSize.y;
+        if (windowChangedSize && windowSize.x >= 1.0f && windowSize.y >= 1.0f)
         {
-            sceneWindow.updateDimensions((int)windowSize.x, (int)windowSize.y);
-            renderer.camera.updateDimensions(sceneWindow.aspectRatio);
+            viewportSize = glm::ivec2((int)windowSize.x, (int)windowSize.y);
+            glm::ivec2 size = viewportSize;
+            onTraceContext([this, size]()
+            {
+                sceneWindow.updateDimensions(size.x, size.y);
+                if (traceContext) renderThread.frames.resize(size.x, size.y);
+            });
+            renderer.camera.updateDimensions(size.x / (double)size.y);
         }
 
         // Camera events
@@ -321,12 +956,14 @@ private:
         // Mouse click events
         if (leftMouseClick)
         {
-            renderer.selectSphere(glm::ivec2((int)mousePosRelative.x, (int)(windowSize.y - mousePosRelative.y)));
+            glm::ivec2 windowCoord((int)mousePosRelative.x, (int)(windowSize.y - mousePosRelative.y));
+            onTraceContext([this, windowCoord]() { renderer.selectSphere(&sceneWindow, windowCoord); });
         }
     }
 
     void initImGui()
     {
+        PROFILE_SCOPE("App::initImGui");
         // Context
         IMGUI_CHECKVERSION();
         ImGui::CreateContext();
@@ -0,0 +1,102 @@
+#ifndef BATCH_MODE_H
+#define BATCH_MODE_H
+
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include "app.h"
+#include "jobs.h"
+#include "exporter.h"
+#include "readback.h"
+
+// `--jobs`: renders a file of jobs in one process
+class BatchMode
+{
+public:
+
+    // Renders every job of `options.jobsPath` back to back with the context, shaders and warm scene set up once. Jobs are
+    // JSON lines like the render server's, plus "out". Each image is read back and written while the next job traces
+    static int run(App &app)
+    {
+        const Options &options = app.options;
+        Renderer &renderer = app.renderer;
+        Window &sceneWindow = app.sceneWindow;
+
+        double setupTime = glfwGetTime();   // GLFW's clock starts at init: context, shaders and the command line scene
+
+        std::vector<Json> jobs;
+        std::vector<int> lineNumbers;
+        if (!Jobs::read(options.jobsPath, "out", jobs, lineNumbers)) return 1;
+
+        ImageWriter writer;
+        writer.start(std::max(options.encoderThreads, 1));
+        Readback readback;
+        readback.init(3);
+        const int maxBacklog = 2*std::max(options.encoderThreads, 1) + 3;
+
+        renderer.tiles.frameBudgetMs = 0.0;
+        Jobs::Defaults defaults = Jobs::defaults(app);
+        std::string loadedScene;
+        double start = glfwGetTime(), jobTime = 0.0, stallTime = 0.0;
+        int rendered = 0, sceneLoads = 0;
+
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            const Json &job = jobs[i];
+            double jobStart = glfwGetTime();
+            bool sceneReused;
+            std::string error;
+            if (!Jobs::apply(app, job, defaults, loadedScene, sceneReused, error))
+            {
+                std::cerr << "Error: Job on line " << lineNumbers[i] << " of `" << options.jobsPath << "`: " << error << "." << std::endl;
+                continue;
+            }
+            sceneLoads += !sceneReused;
+
+            int samples = std::max(job["spp"].asInt(options.samples), 1);
+            renderer.restartAccumulation();
+            while (renderer.accumulatedSamples < samples)
+            {
+                app.traceFrame();
+                readback.poll();
+            }
+            double seconds = glfwGetTime() - jobStart;
+            jobTime += seconds;
+
+            // Don't let finished images pile up in memory when encoding is slower than tracing
+            double stallStart = glfwGetTime();
+            while (readback.pending() + writer.backlog() >= maxBacklog)
+            {
+                readback.poll();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            stallTime += glfwGetTime() - stallStart;
+
+            std::string path = job["out"].asString("");
+            readback.request(app.lastPass(), sceneWindow.width, sceneWindow.height, [&, path](Image &&image)
+            {
+                writer.push(std::move(image), path, renderer.doGammaCorrection);
+            });
+            rendered++;
+            printf("Job %zu/%zu: %d spp at %dx%d in %.2fs%s, %s\n", i + 1, jobs.size(), renderer.accumulatedSamples, sceneWindow.width,
+                   sceneWindow.height, seconds, sceneReused ? "" : " (scene loaded)", path.c_str());
+        }
+
+        readback.finish();
+        writer.wait();
+        double wallTime = glfwGetTime() - start;
+
+        printf("Rendered %d/%zu jobs, wrote %d image(s), loaded %d scene(s)\n", rendered, jobs.size(), (int)writer.written, sceneLoads);
+        printf("Wall time %.2fs against %.2fs summed over the jobs (waiting on encoders %.2fs, finishing writes %.2fs), setup once %.2fs\n",
+               wallTime, jobTime, stallTime, wallTime - jobTime - stallTime, setupTime);
+        return (rendered == (int)jobs.size() && writer.written == rendered) ? 0 : 1;
+    }
+
+};
+
+#endif
@@ -0,0 +1,450 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <float.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include "taskPool.h"
+
+struct AABB
+{
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    void grow(glm::vec3 point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void grow(const AABB &other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    bool empty() const { return min.x > max.x; }
+    glm::vec3 centre() const { return 0.5f*(min + max); }
+    glm::vec3 extent() const { return max - min; }
+
+    float area() const
+    {
+        glm::vec3 e = glm::max(extent(), glm::vec3(0.0));
+        return 2.0f*(e.x*e.y + e.y*e.z + e.z*e.x);
+    }
+};
+
+// Two vec4 texels on the GPU: (min, leftOrFirst) and (max, count)
+struct BVHNode
+{
+    glm::vec3 min;
+    uint32_t leftOrFirst;       // Left child (the right one follows it) or first primitive of a leaf
+    glm::vec3 max;
+    uint32_t count;             // Primitives in a leaf, 0 for interior nodes
+
+    bool isLeaf() const { return count > 0; }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode must be two vec4 texels");
+
+// What a tree costs to trace, for comparing builders. Visit and test counts are expected values for a ray through the
+// root, each node is hit with a probability of its surface area over the root's
+struct BVHStats
+{
+    size_t nodeCount = 0, leafCount = 0;
+    double sahCost = 0.0;
+    double averageLeafSize = 0.0;
+    int maxDepth = 0;
+    std::vector<int> depthHistogram;    // Leaves at each depth
+    double expectedNodeVisits = 0.0;
+    double expectedPrimitiveTests = 0.0;
+};
+
+// Bounding volume hierarchy over primitive bounds. Leaves index `order`, so primitives are usually reordered to match it
+class BVH
+{
+public:
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> order;    // Primitive stored at each leaf slot
+
+    // Build settings
+    enum Method { MEDIAN = 0, SAH = 1 };
+    int method = MEDIAN;
+    int maxLeafSize = 4;
+    int binCount = 16;              // Candidate SAH split planes per axis, at most MAX_BINS
+
+    static constexpr int MAX_BINS = 64;
+    static constexpr float TRAVERSAL_COST = 1.0f, INTERSECTION_COST = 1.0f;
+
+    BVH() {}
+
+    // MEDIAN splits at the median centroid along the widest axis, fast and always balanced. SAH bins the centroids along
+    // each axis and takes the split plane (or leaf) with the lowest surface area heuristic cost, slower to build but
+    // cheaper to trace. The top levels are split on this thread, the subtrees below them are built in parallel and
+    // appended afterwards
+    void build(const std::vector<AABB> &bounds, int threadCount = std::thread::hardware_concurrency())
+    {
+        uint32_t count = bounds.size();
+        std::vector<Primitive> primitives(count);
+        for (uint32_t i = 0; i < count; i++) primitives[i] = Primitive{ bounds[i], bounds[i].centre(), i };
+
+        nodes.clear();
+        nodes.reserve(std::max(2*count / std::max(maxLeafSize / 2, 1), 1u));
+        nodes.push_back(BVHNode());
+
+        threadCount = std::max(threadCount, 1);
+        uint32_t subtreeSize = (threadCount > 1) ? std::max(count / (4*threadCount), 4096u) : UINT32_MAX;
+        std::vector<Task> subtrees;
+        split(primitives, nodes, Task{ 0, 0, count }, subtreeSize, &subtrees);
+
+        // Each subtree gets its own node array, rooted at 0
+        std::vector<std::vector<BVHNode>> subtreeNodes(subtrees.size());
+        TaskPool::global().parallelChunks(subtrees.size(), [&](int i)
+        {
+            subtreeNodes[i].push_back(BVHNode());
+            split(primitives, subtreeNodes[i], Task{ 0, subtrees[i].begin, subtrees[i].end }, UINT32_MAX, NULL);
+        });
+
+        // Splice them in, the root replaces the placeholder left by the top levels
+        for (size_t i = 0; i < subtrees.size(); i++)
+        {
+            uint32_t base = nodes.size() - 1;
+            for (size_t j = 0; j < subtreeNodes[i].size(); j++)
+            {
+                BVHNode node = subtreeNodes[i][j];
+                if (!node.isLeaf()) node.leftOrFirst += base;
+                if (j == 0) nodes[subtrees[i].node] = node;
+                else nodes.push_back(node);
+            }
+        }
+
+        order.resize(count);
+        for (uint32_t i = 0; i < count; i++) order[i] = primitives[i].index;
+    }
+
+    int depth() const { return nodes.empty() ? 0 : depth(0); }
+
+    // Whether the nodes reachable from `root` form a tree whose leaves lie within `primitiveCount` slots, for trees read from
+    // a file. Builders may place children before their parents, so this walks the tree and rejects any node reached twice
+    // rather than relying on the layout. `reached` carries over between calls, trees sharing a node array can't share nodes
+    static bool isTree(const BVHNode *nodes, size_t nodeCount, uint32_t root, size_t primitiveCount, std::vector<bool> &reached)
+    {
+        reached.resize(nodeCount, false);
+        std::vector<uint32_t> stack(1, root);
+        while (!stack.empty())
+        {
+            uint32_t index = stack.back();
+            stack.pop_back();
+            if (index >= nodeCount || reached[index]) return false;
+            reached[index] = true;
+
+            const BVHNode &node = nodes[index];
+            if (node.isLeaf())
+            {
+                if ((uint64_t)node.leftOrFirst + node.count > primitiveCount) return false;
+            }
+            else
+            {
+                if ((uint64_t)node.leftOrFirst + 1 >= nodeCount) return false;
+                stack.push_back(node.leftOrFirst);
+                stack.push_back(node.leftOrFirst + 1);
+            }
+        }
+        return true;
+    }
+
+
+    // * Refitting, after prepareRefit() the bounds can follow moving primitives without a rebuild
+
+    std::vector<uint32_t> parents;      // Parent of each node, UINT32_MAX for the root
+    std::vector<uint32_t> leafOf;       // Leaf holding each primitive
+
+    void prepareRefit()
+    {
+        parents.assign(nodes.size(), UINT32_MAX);
+        leafOf.assign(order.size(), 0);
+        sahSum = 0.0;
+        for (uint32_t i = 0; i < nodes.size(); i++)
+        {
+            const BVHNode &node = nodes[i];
+            if (node.isLeaf()) for (uint32_t slot = node.leftOrFirst; slot < node.leftOrFirst + node.count; slot++) leafOf[order[slot]] = i;
+            else parents[node.leftOrFirst] = parents[node.leftOrFirst + 1] = i;
+            sahSum += sahWeight(node);
+        }
+        buildCost = cost();
+    }
+
+    // Recomputes the bounds of the leaf holding `primitive` and of its ancestors from `boundsOf(primitive)`, stopping at the
+    // first node whose bounds didn't change. Every changed node is appended to `touched`
+    template <typename BoundsOf>
+    void refit(uint32_t primitive, BoundsOf boundsOf, std::vector<uint32_t> &touched)
+    {
+        uint32_t index = leafOf[primitive];
+        while (index != UINT32_MAX)
+        {
+            BVHNode &node = nodes[index];
+            AABB box;
+            if (node.isLeaf())
+            {
+                for (uint32_t slot = node.leftOrFirst; slot < node.leftOrFirst + node.count; slot++) box.grow(boundsOf(order[slot]));
+            }
+            else
+            {
+                for (int child = 0; child < 2; child++)
+                {
+                    box.grow(nodes[node.leftOrFirst + child].min);
+                    box.grow(nodes[node.leftOrFirst + child].max);
+                }
+            }
+            if (box.min == node.min && box.max == node.max) break;
+
+            sahSum -= sahWeight(node);
+            node.min = box.min;
+            node.max = box.max;
+            sahSum += sahWeight(node);
+
+            touched.push_back(index);
+            index = parents[index];
+        }
+    }
+
+    // Surface area heuristic cost: expected node visits plus primitive tests for a ray through the root
+    double cost() const
+    {
+        if (nodes.empty()) return 0.0;
+        double rootArea = nodeArea(nodes[0]);
+        return rootArea > 0.0 ? sahSum / rootArea : 0.0;
+    }
+
+    // How much worse the tree got since it was built, 1 when it's as good as new
+    double degradation() const { return buildCost > 0.0 ? cost() / buildCost : 1.0; }
+
+    BVHStats stats() const
+    {
+        BVHStats stats;
+        if (nodes.empty()) return stats;
+        double rootArea = std::max(nodeArea(nodes[0]), 1e-30);
+        size_t primitiveCount = 0;
+
+        std::vector<std::pair<uint32_t, int>> stack = { { 0, 0 } };
+        while (!stack.empty())
+        {
+            uint32_t index = stack.back().first;
+            int depth = stack.back().second;
+            stack.pop_back();
+
+            const BVHNode &node = nodes[index];
+            double probability = nodeArea(node) / rootArea;
+            stats.nodeCount++;
+            stats.expectedNodeVisits += probability;
+            stats.sahCost += probability*(node.isLeaf() ? INTERSECTION_COST*node.count : TRAVERSAL_COST);
+
+            if (node.isLeaf())
+            {
+                stats.leafCount++;
+                primitiveCount += node.count;
+                stats.expectedPrimitiveTests += probability*node.count;
+                stats.maxDepth = std::max(stats.maxDepth, depth);
+                if ((int)stats.depthHistogram.size() <= depth) stats.depthHistogram.resize(depth + 1);
+                stats.depthHistogram[depth]++;
+            }
+            else
+            {
+                stack.push_back({ node.leftOrFirst + 1, depth + 1 });
+                stack.push_back({ node.leftOrFirst, depth + 1 });
+            }
+        }
+
+        stats.averageLeafSize = stats.leafCount ? (double)primitiveCount / stats.leafCount : 0.0;
+        return stats;
+    }
+
+private:
+
+    double sahSum = 0.0, buildCost = 0.0;
+
+    static double nodeArea(const BVHNode &node)
+    {
+        AABB box;
+        box.min = node.min;
+        box.max = node.max;
+        return box.area();
+    }
+
+    static double sahWeight(const BVHNode &node) { return nodeArea(node)*(node.isLeaf() ? INTERSECTION_COST*node.count : TRAVERSAL_COST); }
+
+    // Bounds travel with the primitive so splitting touches contiguous memory
+    struct Primitive
+    {
+        AABB bounds;
+        glm::vec3 centre;
+        uint32_t index;
+    };
+
+    struct Task { uint32_t node, begin, end; };
+
+    // Splits `root` until the leaves are small enough, ranges of at most `deferSize` primitives are left in `deferred` instead
+    void split(std::vector<Primitive> &primitives, std::vector<BVHNode> &nodes, Task root, uint32_t deferSize, std::vector<Task> *deferred) const
+    {
+        std::vector<Task> stack = { root };
+        while (!stack.empty())
+        {
+            Task task = stack.back();
+            stack.pop_back();
+
+            uint32_t size = task.end - task.begin;
+            if (deferred && size <= deferSize)
+            {
+                deferred->push_back(task);
+                continue;
+            }
+
+            AABB box, centreBox;
+            for (uint32_t i = task.begin; i < task.end; i++)
+            {
+                box.grow(primitives[i].bounds);
+                centreBox.grow(primitives[i].centre);
+            }
+            if (box.empty()) box.min = box.max = glm::vec3(0.0);
+
+            BVHNode &node = nodes[task.node];
+            node.min = box.min;
+            node.max = box.max;
+
+            // Leaf when small enough or when every centre is the same point and no split can separate them
+            glm::vec3 extent = centreBox.extent();
+            int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+            bool leaf = size <= (uint32_t)maxLeafSize || (extent[axis] <= 0.0 && size <= 255);
+
+            uint32_t mid;
+            bool split = false;
+            if (!leaf && method == SAH && extent[axis] > 0.0)
+            {
+                // Small nodes may stay leaves when splitting them costs more than testing every primitive
+                float splitCost;
+                split = sahSplit(primitives, task.begin, task.end, centreBox, mid, splitCost);
+                float leafCost = INTERSECTION_COST*size*box.area();
+                leaf = split && size <= 2*(uint32_t)maxLeafSize && leafCost <= TRAVERSAL_COST*box.area() + splitCost;
+            }
+
+            if (leaf)
+            {
+                node.leftOrFirst = task.begin;
+                node.count = size;
+                continue;
+            }
+
+            if (!split)
+            {
+                mid = task.begin + size / 2;
+                std::nth_element(primitives.begin() + task.begin, primitives.begin() + mid, primitives.begin() + task.end,
+                                 [axis](const Primitive &a, const Primitive &b) { return a.centre[axis] < b.centre[axis]; });
+            }
+
+            uint32_t left = nodes.size();
+            node.leftOrFirst = left;
+            node.count = 0;
+            nodes.push_back(BVHNode());
+            nodes.push_back(BVHNode());
+
+            stack.push_back({ left + 1, mid, task.end });
+            stack.push_back({ left, task.begin, mid });
+        }
+    }
+
+    // Binned SAH over all three axes in one pass over the primitives, partitions them at the best plane. `cost` is the
+    // children's area weighted primitive count, without the traversal step
+    bool sahSplit(std::vector<Primitive> &primitives, uint32_t begin, uint32_t end, const AABB &centreBox, uint32_t &mid, float &cost) const
+    {
+        // Plain bins so only the ones in use get initialized, small nodes run through many of these
+        struct Bin { glm::vec3 min, max; uint32_t count; };
+        int bins = std::max(2, std::min(binCount, MAX_BINS));
+        Bin binned[3][MAX_BINS];
+        for (int axis = 0; axis < 3; axis++)
+            for (int b = 0; b < bins; b++) binned[axis][b] = Bin{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), 0 };
+
+        glm::vec3 extent = centreBox.extent();
+        glm::vec3 scale = glm::vec3(bins) / glm::max(extent, glm::vec3(1e-30f));
+        for (uint32_t i = begin; i < end; i++)
+        {
+            glm::vec3 position = (primitives[i].centre - centreBox.min)*scale;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                Bin &bin = binned[axis][std::min(bins - 1, std::max(0, (int)position[axis]))];
+                bin.min = glm::min(bin.min, primitives[i].bounds.min);
+                bin.max = glm::max(bin.max, primitives[i].bounds.max);
+                bin.count++;
+            }
+        }
+
+        // Sweep from both ends, the plane after bin b splits [0, b] from [b + 1, bins)
+        int bestAxis = -1, bestPlane = 0;
+        cost = FLT_MAX;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (extent[axis] <= 0.0) continue;
+
+            float leftArea[MAX_BINS];
+            uint32_t leftCount[MAX_BINS];
+            AABB left;
+            uint32_t count = 0;
+            for (int b = 0; b < bins - 1; b++)
+            {
+                const Bin &bin = binned[axis][b];
+                if (bin.count)
+                {
+                    left.grow(bin.min);
+                    left.grow(bin.max);
+                    count += bin.count;
+                }
+                leftArea[b] = left.area();
+                leftCount[b] = count;
+            }
+
+            AABB right;
+            count = 0;
+            for (int b = bins - 1; b > 0; b--)
+            {
+                const Bin &bin = binned[axis][b];
+                if (bin.count)
+                {
+                    right.grow(bin.min);
+                    right.grow(bin.max);
+                    count += bin.count;
+                }
+                if (leftCount[b - 1] == 0 || count == 0) continue;
+
+                float planeCost = INTERSECTION_COST*(leftArea[b - 1]*leftCount[b - 1] + right.area()*count);
+                if (planeCost < cost)
+                {
+                    cost = planeCost;
+                    bestAxis = axis;
+                    bestPlane = b;
+                }
+            }
+        }
+        if (bestAxis < 0) return false;
+
+        float axisMin = centreBox.min[bestAxis], axisScale = scale[bestAxis];
+        auto middle = std::partition(primitives.begin() + begin, primitives.begin() + end, [=](const Primitive &primitive)
+        {
+            return std::min(bins - 1, std::max(0, (int)((primitive.centre[bestAxis] - axisMin)*axisScale))) < bestPlane;
+        });
+        mid = middle - primitives.begin();
+        return true;
+    }
+
+    int depth(uint32_t index) const
+    {
+        const BVHNode &node = nodes[index];
+        if (node.isLeaf()) return 1;
+        return 1 + std::max(depth(node.leftOrFirst), depth(node.leftOrFirst + 1));
+    }
+
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef BVH_BENCHMARK_H
+#define BVH_BENCHMARK_H
+
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+#include "scene.h"
+#include "sphereBVH.h"
+
+// Builds BVHs over the scene's spheres with every builder and thread count, prints the build throughput and the quality
+// of the trees: SAH cost relative to the median split, leaf size, depth and the node visits and sphere tests a random
+// ray is expected to make
+class BVHBenchmark
+{
+public:
+
+    static int run(Scene &scene, int maxThreads)
+    {
+        std::vector<AABB> bounds = SphereBVH::sphereBounds(scene.spheres(), scene.sphereCount());
+        if (bounds.empty())
+        {
+            std::cerr << "Error: The scene has no spheres to build a BVH over." << std::endl;
+            return 1;
+        }
+
+        if (maxThreads <= 0) maxThreads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<int> threadCounts;
+        for (int threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+        threadCounts.push_back(maxThreads);
+
+        printf("BVH builds over %zu spheres\n", bounds.size());
+        printf("%-8s %8s %10s %10s %10s %10s %9s %6s %6s %8s %8s\n", "builder", "threads", "ms", "Mprims/s", "nodes", "SAH cost",
+               "relative", "leaf", "depth", "visits", "tests");
+
+        const char *names[] = { "median", "linear", "sah" };
+        double referenceCost = 0.0;
+        for (int builder : { (int)SphereBVH::MEDIAN, (int)SphereBVH::LINEAR, (int)SphereBVH::SAH })
+            for (int threads : threadCounts)
+            {
+                // Best of three, the first build also pays for faulting in fresh memory
+                BVH bvh;
+                double best = 1e30;
+                for (int run = 0; run < 3; run++)
+                {
+                    double start = glfwGetTime();
+                    SphereBVH::buildWith(builder, bvh, bounds, threads);
+                    best = std::min(best, glfwGetTime() - start);
+                }
+
+                BVHStats stats = bvh.stats();
+                if (referenceCost == 0.0) referenceCost = stats.sahCost;
+                printf("%-8s %8d %10.1f %10.2f %10zu %10.1f %8.2fx %6.2f %6d %8.1f %8.1f\n", names[builder], threads, best*1000.0,
+                       bounds.size() / best / 1.0e6, stats.nodeCount, stats.sahCost, stats.sahCost / referenceCost, stats.averageLeafSize,
+                       stats.maxDepth, stats.expectedNodeVisits, stats.expectedPrimitiveTests);
+            }
+
+        return 0;
+    }
+
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <glm/glm.hpp>
 #include "shader.h"
 #include "sphere.h"
+#include "cameraPath.h"
 
 class Camera
 {
@@ -99,6 +100,28 @@ public:
         // glBindBuffer(GL_UNIFORM_BUFFER, 0);
     }
 
+    // Jump to a keyframe of a camera path, paths are always in first person
+    void applyKeyframe(const Keyframe &keyframe)
+    {
+        cameraMode = FIRST_PERSON;
+        position = keyframe.position;
+        theta = keyframe.theta;
+        phi = keyframe.phi;
+        focalLength = keyframe.focalLength;
+        onUpdate();
+    }
+
+    Keyframe currentKeyframe(float time) const
+    {
+        Keyframe keyframe;
+        keyframe.time = time;
+        keyframe.position = position;
+        keyframe.theta = theta;
+        keyframe.phi = phi;
+        keyframe.focalLength = focalLength;
+        return keyframe;
+    }
+
     void selectSphere(Sphere *sphere)
     {
         selectedSphere = sphere;
@@ -111,6 +134,15 @@ public:
         onUpdate();
     }
 
+    // Looks at a bounding sphere from the current angles, far enough back to fit all of it
+    void frame(glm::vec3 center, float radius)
+    {
+        lookat = center;
+        distance = radius / sin(atan(0.5*viewport.height / focalLength));
+        position = lookat + distance*glm::vec3(cos(theta)*sin(phi), cos(phi), sin(theta)*sin(phi));
+        onUpdate();
+    }
+
     void settingsGUI()
     {
         bool updated = false;
@@ -0,0 +1,148 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <glm/glm.hpp>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "utils.h"
+
+// First person camera state at a point in time
+struct Keyframe
+{
+    float time = 0.0;
+    glm::vec3 position = glm::vec3(0.0);
+    float theta = 0.0, phi = 0.0;
+    float focalLength = 3.0;
+};
+
+// Keyframed camera path, positions follow a Catmull-Rom spline and angles take the short way around
+class CameraPath
+{
+public:
+
+    std::vector<Keyframe> keyframes;
+
+    CameraPath() {}
+
+    bool empty() const { return keyframes.empty(); }
+    int size() const { return keyframes.size(); }
+    float duration() const { return keyframes.empty() ? 0.0f : keyframes.back().time - keyframes.front().time; }
+
+    void add(const Keyframe &keyframe)
+    {
+        // Keep them sorted by time
+        auto it = keyframes.begin();
+        while (it != keyframes.end() && it->time <= keyframe.time) it++;
+        keyframes.insert(it, keyframe);
+    }
+
+    // Camera state at `t` in [0, 1] along the whole path
+    Keyframe sample(float t) const
+    {
+        if (keyframes.size() == 1) return keyframes[0];
+
+        float time = keyframes.front().time + glm::clamp(t, 0.0f, 1.0f)*duration();
+        int i = 0;
+        while (i < (int)keyframes.size() - 2 && keyframes[i + 1].time < time) i++;
+
+        const Keyframe &k1 = keyframes[i], &k2 = keyframes[i + 1];
+        const Keyframe &k0 = keyframes[std::max(i - 1, 0)], &k3 = keyframes[std::min(i + 2, (int)keyframes.size() - 1)];
+        float span = k2.time - k1.time;
+        float u = (span > 0.0) ? (time - k1.time) / span : 0.0f;
+
+        Keyframe result;
+        result.time = time;
+        result.position = catmullRom(k0.position, k1.position, k2.position, k3.position, u);
+        result.theta = k1.theta + u*wrapAngle(k2.theta - k1.theta);
+        result.phi = k1.phi + u*(k2.phi - k1.phi);
+        result.focalLength = k1.focalLength + u*(k2.focalLength - k1.focalLength);
+
+        if (result.theta < 0.0) result.theta += 2*PI;
+        else if (result.theta > 2*PI) result.theta -= 2*PI;
+
+        return result;
+    }
+
+    // Full orbit around `lookat`, one keyframe per frame so sampling `frames` frames hits them exactly
+    static CameraPath turntable(glm::vec3 lookat, float distance, float phi, float focalLength, int frames)
+    {
+        CameraPath path;
+        for (int i = 0; i < frames; i++)
+        {
+            Keyframe keyframe;
+            keyframe.time = i;
+            keyframe.theta = 2*PI*i / frames;
+            keyframe.phi = phi;
+            keyframe.focalLength = focalLength;
+
+            // First person cameras look down -w, so place the camera along w from the target
+            glm::vec3 w(cos(keyframe.theta)*sin(phi), cos(phi), sin(keyframe.theta)*sin(phi));
+            keyframe.position = lookat + distance*w;
+            path.keyframes.push_back(keyframe);
+        }
+        return path;
+    }
+
+    // One keyframe per line: `time x y z theta phi focalLength`, lines starting with # are comments
+    bool load(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cerr << "Error: Could not open camera path `" << path << "`." << std::endl;
+            return false;
+        }
+
+        keyframes.clear();
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#') continue;
+
+            Keyframe keyframe;
+            std::istringstream values(line);
+            if (values >> keyframe.time >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z >> keyframe.theta >> keyframe.phi >> keyframe.focalLength)
+                add(keyframe);
+            else
+                std::cerr << "Warning: Skipping malformed keyframe `" << line << "`." << std::endl;
+        }
+
+        return !keyframes.empty();
+    }
+
+    bool save(const std::string &path) const
+    {
+        FILE *file = fopen(path.c_str(), "w");
+        if (!file) return false;
+
+        fprintf(file, "# time x y z theta phi focalLength\n");
+        for (const Keyframe &k : keyframes)
+            fprintf(file, "%g %g %g %g %g %g %g\n", k.time, k.position.x, k.position.y, k.position.z, k.theta, k.phi, k.focalLength);
+
+        return fclose(file) == 0;
+    }
+
+private:
+
+    static glm::vec3 catmullRom(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float u)
+    {
+        float u2 = u*u, u3 = u2*u;
+        return 0.5f*((2.0f*p1) + (p2 - p0)*u + (2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3)*u2 + (3.0f*p1 - p0 - 3.0f*p2 + p3)*u3);
+    }
+
+    static float wrapAngle(float angle)
+    {
+        while (angle > PI) angle -= 2*PI;
+        while (angle < -PI) angle += 2*PI;
+        return angle;
+    }
+
+};
+
+#endif
@@ -0,0 +1,561 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <GLFW/glfw3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include "image.h"
+
+#ifndef _WIN32
+    #include <stdlib.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <signal.h>
+    #include <poll.h>
+    #include <spawn.h>
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/wait.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+    #include <netdb.h>
+
+    extern char **environ;
+#endif
+
+// Messages between a coordinator and its worker processes. Workers connect over TCP and say HELLO, get a SETUP (the
+// camera and settings followed by a scene file and the environment map's, if there is one) and then one TASK at a time,
+// each answered with a RESULT, until DONE. Both ends are expected to share the byte order and struct layout
+namespace Distributed
+{
+    const char MAGIC[4] = { 'R', 'T', 'D', 'R' };
+    const uint32_t VERSION = 2;
+    const uint64_t MAX_MESSAGE = 1ull << 36;    // Anything larger is a broken stream
+
+    enum MessageType : uint32_t { HELLO = 1, SETUP = 2, TASK = 3, RESULT = 4, DONE = 5 };
+
+    struct MessageHeader { char magic[4]; uint32_t type; uint64_t size; };
+
+    struct Hello { uint32_t version; int32_t pid; };
+
+    // What a worker needs to trace the coordinator's image, besides the files that follow it
+    struct Setup
+    {
+        int32_t width, height;
+        int32_t tracer, maxRayBounce, sky, samplesPerPixel, samplingMethod;
+        int32_t cameraMode;
+        float position[3], lookat[3];
+        float theta, phi, distance, focalLength, viewportHeight;
+        float environmentStrength, environmentRotation;
+        int32_t sampleEnvironment;
+        char environmentExtension[4];   // "hdr" or "pfm", empty without a map
+        uint64_t sceneSize;             // The scene file comes first, the rest of the message is the map
+    };
+
+    // `samples` samples per pixel of a rectangle in window coordinates (bottom row first), seeded from `firstSample` so
+    // tasks over the same pixels draw different samples. Its RESULT repeats it with the samples actually taken, followed
+    // by their average as RGBA floats
+    struct Task { uint32_t id; int32_t x, y, width, height, firstSample, samples; };
+}
+
+#ifndef _WIN32
+
+namespace Distributed
+{
+    // Empty file for a scene or map on its way to or from the workers, ending in `suffix` so its format can be told
+    inline std::string temporaryPath(const std::string &suffix = "")
+    {
+        std::string pattern = "/tmp/sceneXXXXXX" + suffix;
+        std::vector<char> path(pattern.begin(), pattern.end());
+        path.push_back('\0');
+        int file = mkstemps(path.data(), suffix.size());
+        if (file < 0) return "";
+        ::close(file);
+        return path.data();
+    }
+
+    inline bool readFile(const std::string &path, std::vector<char> &contents)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+        fseek(file, 0, SEEK_END);
+        contents.resize(ftell(file));
+        fseek(file, 0, SEEK_SET);
+        bool ok = fread(contents.data(), 1, contents.size(), file) == contents.size();
+        fclose(file);
+        return ok;
+    }
+
+    inline bool writeFile(const std::string &path, const char *data, size_t size)
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        bool ok = fwrite(data, 1, size, file) == size;
+        return (fclose(file) == 0) && ok;
+    }
+}
+
+// A blocking TCP connection carrying the messages above
+class Connection
+{
+public:
+
+    Connection() {}
+
+    explicit Connection(int socket)
+        : socket(socket)
+    {
+        int on = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    ~Connection() { close(); }
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+    Connection(Connection &&other) { *this = std::move(other); }
+
+    Connection &operator=(Connection &&other)
+    {
+        if (this != &other)
+        {
+            close();
+            std::swap(socket, other.socket);
+        }
+        return *this;
+    }
+
+    // `address` is host:port
+    bool connect(const std::string &address)
+    {
+        size_t colon = address.find_last_of(':');
+        if (colon == std::string::npos)
+        {
+            std::cerr << "Error: Expected host:port, got `" << address << "`." << std::endl;
+            return false;
+        }
+
+        addrinfo hints = {}, *found = NULL;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &found) != 0)
+        {
+            std::cerr << "Error: Could not resolve `" << address << "`." << std::endl;
+            return false;
+        }
+
+        for (addrinfo *candidate = found; candidate && socket < 0; candidate = candidate->ai_next)
+        {
+            int fd = ::socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+            if (fd < 0) continue;
+            if (::connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0) *this = Connection(fd);
+            else ::close(fd);
+        }
+        freeaddrinfo(found);
+
+        if (socket < 0) std::cerr << "Error: Could not connect to `" << address << "`." << std::endl;
+        return socket >= 0;
+    }
+
+    bool isOpen() const { return socket >= 0; }
+    int descriptor() const { return socket; }
+
+    void close()
+    {
+        if (socket >= 0) ::close(socket);
+        socket = -1;
+    }
+
+    // `extra` is sent right after `data` as part of the same message
+    bool send(Distributed::MessageType type, const void *data, size_t size, const void *extra = NULL, size_t extraSize = 0)
+    {
+        Distributed::MessageHeader header;
+        memcpy(header.magic, Distributed::MAGIC, 4);
+        header.type = type;
+        header.size = size + extraSize;
+        return writeAll(&header, sizeof(header)) && writeAll(data, size) && writeAll(extra, extraSize);
+    }
+
+    // Blocks until a whole message arrived, false if the connection closed or the stream is broken
+    bool receive(Distributed::MessageType &type, std::vector<char> &payload)
+    {
+        Distributed::MessageHeader header;
+        if (!readAll(&header, sizeof(header))) return false;
+        if (memcmp(header.magic, Distributed::MAGIC, 4) != 0 || header.size > Distributed::MAX_MESSAGE) return false;
+
+        type = (Distributed::MessageType)header.type;
+        payload.resize(header.size);
+        return readAll(payload.data(), header.size);
+    }
+
+private:
+
+    int socket = -1;
+
+    bool writeAll(const void *data, size_t size)
+    {
+        const char *bytes = (const char*)data;
+        while (size > 0)
+        {
+            // A peer that went away fails the write instead of raising SIGPIPE
+            ssize_t sent = ::send(socket, bytes, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            bytes += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    bool readAll(void *data, size_t size)
+    {
+        char *bytes = (char*)data;
+        while (size > 0)
+        {
+            ssize_t received = ::recv(socket, bytes, size, 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) return false;
+            bytes += received;
+            size -= received;
+        }
+        return true;
+    }
+
+};
+
+// Splits an image and its sample budget into tasks (a tile and a range of samples each), hands them to worker processes
+// as they become idle and merges their averages weighted by the samples they took. A worker that disconnects or dies has
+// its task put back at the front of the queue for the others. Workers are started as local processes, others can join by
+// connecting to `port`
+class Coordinator
+{
+public:
+
+    struct WorkerStats
+    {
+        int pid = 0;
+        int tasks = 0;
+        uint64_t pixelSamples = 0;
+        double busySeconds = 0.0;       // From handing out a task to merging its result
+        bool failed = false;
+    };
+
+    // Settings
+    int tileSize = 128;
+    int tasksPerWorker = 4;             // Samples are split further when there are fewer tiles than this per worker
+    int port = 0;                       // 0 listens on a free loopback port, any other on every interface
+    double connectTimeout = 60.0;       // Seconds to wait for a first worker when none are started locally
+    double stallFactor = 8.0;           // A task taking this many times the median task is taken as stuck, and requeued
+    double minStallSeconds = 5.0;       // But never before this
+    double firstTaskSeconds = 600.0;    // A worker's first task also loads the scene, only a hang takes this long
+
+    // Stats of the last render
+    std::vector<WorkerStats> workers;
+    double setupSeconds = 0.0;          // Until the first task was handed out: starting workers and compiling their shaders
+    double renderSeconds = 0.0;         // From then until the last result was merged
+    uint64_t pixelSamples = 0;
+    int reassigned = 0;
+
+    Coordinator() {}
+
+    // Renders `samples` samples per pixel of `setup` and `files` (the scene file's contents, then the map's) on
+    // `localWorkers` processes started as `program --worker <address>` and any worker that connects, into `result`
+    bool render(const Distributed::Setup &setup, const std::vector<char> &files, int samples, const std::string &program, int localWorkers,
+                Image &result)
+    {
+        double start = glfwGetTime();
+        workers.clear();
+        setupSeconds = renderSeconds = 0.0;
+        pixelSamples = 0;
+        reassigned = 0;
+
+        if (!listen()) return false;
+        std::vector<pid_t> children;
+        for (int i = 0; i < localWorkers; i++)
+        {
+            pid_t pid = spawn(program);
+            if (pid > 0) children.push_back(pid);
+        }
+        if (localWorkers > 0 && children.empty())
+        {
+            std::cerr << "Error: Could not start any worker process." << std::endl;
+            return false;
+        }
+
+        std::deque<Distributed::Task> queue = split(setup.width, setup.height, samples, std::max(localWorkers, 1));
+        size_t taskCount = queue.size(), merged = 0;
+        result = Image(setup.width, setup.height);
+        std::vector<float> weights((size_t)setup.width*setup.height, 0.0f);
+
+        std::vector<Peer> peers;
+        std::vector<double> taskSeconds;
+        double medianTask = 0.0, firstTask = -1.0;
+        bool ok = true;
+        while (merged < taskCount)
+        {
+            // Wait for a new worker or a message from a connected one
+            std::vector<pollfd> descriptors(1, pollfd{ listener, POLLIN, 0 });
+            for (Peer &peer : peers) descriptors.push_back(pollfd{ peer.connection.descriptor(), POLLIN, 0 });
+            if (poll(descriptors.data(), descriptors.size(), 100) < 0 && errno != EINTR)
+            {
+                std::cerr << "Error: Waiting on the workers failed." << std::endl;
+                ok = false;
+                break;
+            }
+
+            if (descriptors[0].revents & POLLIN)
+            {
+                int socket = accept(listener, NULL, NULL);
+                if (socket >= 0)
+                {
+                    peers.push_back(Peer());
+                    peers.back().connection = Connection(socket);
+                    peers.back().stats = workers.size();
+                    workers.push_back(WorkerStats());
+                }
+            }
+
+            // Only the peers that were polled, one accepted above has no descriptor yet
+            for (size_t i = 0; i + 1 < descriptors.size(); i++)
+            {
+                Peer &peer = peers[i];
+                if (!(descriptors[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+                Distributed::MessageType type;
+                std::vector<char> payload;
+                bool alive = peer.connection.receive(type, payload);
+                if (alive && type == Distributed::HELLO && payload.size() == sizeof(Distributed::Hello))
+                {
+                    const Distributed::Hello *hello = (const Distributed::Hello*)payload.data();
+                    workers[peer.stats].pid = hello->pid;
+                    alive = hello->version == Distributed::VERSION &&
+                            peer.connection.send(Distributed::SETUP, &setup, sizeof(setup), files.data(), files.size());
+                    peer.ready = alive;
+                }
+                else if (alive && type == Distributed::RESULT && peer.task.samples > 0)
+                {
+                    alive = mergeResult(payload, peer.task, result, weights);
+                    if (alive)
+                    {
+                        WorkerStats &stats = workers[peer.stats];
+                        const Distributed::Task *done = (const Distributed::Task*)payload.data();
+                        stats.tasks++;
+                        stats.pixelSamples += (uint64_t)done->width*done->height*done->samples;
+                        stats.busySeconds += glfwGetTime() - peer.sentAt;
+                        taskSeconds.push_back(glfwGetTime() - peer.sentAt);
+                        medianTask = median(taskSeconds);
+                        pixelSamples += (uint64_t)done->width*done->height*done->samples;
+                        peer.task.samples = 0;
+                        merged++;
+                    }
+                }
+                else alive = false;
+
+                if (!alive) fail(peer, queue);
+            }
+
+            // Only disconnects end a worker on their own, one that hangs or stalls would keep its task forever
+            double now = glfwGetTime();
+            for (Peer &peer : peers)
+            {
+                if (peer.task.samples <= 0) continue;
+                double deadline = (workers[peer.stats].tasks == 0 || taskSeconds.empty()) ? firstTaskSeconds
+                                : std::max(stallFactor*medianTask, minStallSeconds);
+                if (now - peer.sentAt <= deadline) continue;
+
+                pid_t pid = workers[peer.stats].pid;
+                std::cerr << "Warning: Worker " << peer.stats << " (pid " << pid << ") has been on task " << peer.task.id << " for "
+                          << now - peer.sentAt << "s." << std::endl;
+                if (std::find(children.begin(), children.end(), pid) != children.end()) kill(pid, SIGKILL);
+                fail(peer, queue);
+            }
+
+            // Hand the queue out to idle workers
+            for (Peer &peer : peers)
+            {
+                if (!peer.ready || peer.task.samples > 0 || queue.empty()) continue;
+                peer.task = queue.front();
+                queue.pop_front();
+                peer.sentAt = glfwGetTime();
+                if (firstTask < 0.0) firstTask = peer.sentAt;
+                if (!peer.connection.send(Distributed::TASK, &peer.task, sizeof(peer.task))) fail(peer, queue);
+            }
+            peers.erase(std::remove_if(peers.begin(), peers.end(), [](const Peer &peer) { return !peer.connection.isOpen(); }), peers.end());
+
+            // Out of workers: every local one is gone and no one else connected in time
+            reap(children);
+            bool waiting = !children.empty() || (localWorkers == 0 && workers.empty() && glfwGetTime() - start < connectTimeout);
+            if (peers.empty() && !waiting)
+            {
+                std::cerr << "Error: No workers left, " << merged << " of " << taskCount << " tasks done." << std::endl;
+                ok = false;
+                break;
+            }
+        }
+
+        for (Peer &peer : peers) peer.connection.send(Distributed::DONE, NULL, 0);
+        peers.clear();
+        ::close(listener);
+        listener = -1;
+        for (pid_t child : children) waitpid(child, NULL, 0);
+
+        double end = glfwGetTime();
+        setupSeconds = ((firstTask < 0.0) ? end : firstTask) - start;
+        renderSeconds = end - start - setupSeconds;
+        if (!ok) return false;
+
+        for (size_t i = 0; i < weights.size(); i++)
+            for (int c = 0; c < 4; c++) result.pixels[4*i + c] /= std::max(weights[i], 1.0f);
+        return true;
+    }
+
+    void print() const
+    {
+        printf("%8s %8s %8s %10s %10s %8s\n", "worker", "pid", "tasks", "Msamples", "busy s", "state");
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            const WorkerStats &worker = workers[i];
+            printf("%8zu %8d %8d %10.2f %10.2f %8s\n", i, worker.pid, worker.tasks, worker.pixelSamples / 1.0e6, worker.busySeconds,
+                   worker.failed ? "failed" : "ok");
+        }
+        printf("Setup %.2fs, rendering %.2fs: %.2f Msamples/s, %d task(s) reassigned\n", setupSeconds, renderSeconds,
+               pixelSamples / std::max(renderSeconds, 1e-9) / 1.0e6, reassigned);
+    }
+
+private:
+
+    struct Peer
+    {
+        Connection connection;
+        size_t stats = 0;               // Index into `workers`
+        bool ready = false;             // Sent the setup
+        Distributed::Task task = {};    // In flight when `samples` > 0
+        double sentAt = 0.0;
+    };
+
+    int listener = -1;
+    std::string address;
+
+    bool listen()
+    {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in bound = {};
+        bound.sin_family = AF_INET;
+        bound.sin_addr.s_addr = htonl(port ? INADDR_ANY : INADDR_LOOPBACK);
+        bound.sin_port = htons(port);
+        socklen_t length = sizeof(bound);
+        if (listener < 0 || bind(listener, (sockaddr*)&bound, sizeof(bound)) != 0 || ::listen(listener, 64) != 0 ||
+            getsockname(listener, (sockaddr*)&bound, &length) != 0)
+        {
+            std::cerr << "Error: Could not listen on port " << port << "." << std::endl;
+            if (listener >= 0) ::close(listener);
+            listener = -1;
+            return false;
+        }
+
+        address = "127.0.0.1:" + std::to_string(ntohs(bound.sin_port));
+        if (port) printf("Waiting for workers on port %d\n", ntohs(bound.sin_port));
+        return true;
+    }
+
+    pid_t spawn(const std::string &program)
+    {
+        std::string flag = "--worker";
+        char *argv[] = { (char*)program.c_str(), (char*)flag.c_str(), (char*)address.c_str(), NULL };
+        pid_t pid;
+        if (posix_spawn(&pid, program.c_str(), NULL, NULL, argv, environ) != 0)
+        {
+            std::cerr << "Warning: Could not start worker `" << program << "`." << std::endl;
+            return -1;
+        }
+        return pid;
+    }
+
+    // Forgets local workers that exited, their connections fail on their own
+    static void reap(std::vector<pid_t> &children)
+    {
+        children.erase(std::remove_if(children.begin(), children.end(), [](pid_t child) { return waitpid(child, NULL, WNOHANG) != 0; }),
+                       children.end());
+    }
+
+    static double median(std::vector<double> values)
+    {
+        std::nth_element(values.begin(), values.begin() + values.size()/2, values.end());
+        return values[values.size()/2];
+    }
+
+    void fail(Peer &peer, std::deque<Distributed::Task> &queue)
+    {
+        WorkerStats &stats = workers[peer.stats];
+        stats.failed = true;
+        if (peer.task.samples > 0)
+        {
+            std::cerr << "Warning: Worker " << peer.stats << " (pid " << stats.pid << ") failed, reassigning task " << peer.task.id << "." << std::endl;
+            queue.push_front(peer.task);
+            peer.task.samples = 0;
+            reassigned++;
+        }
+        peer.ready = false;
+        peer.connection.close();
+    }
+
+    // Tiles over the image, each split into sample ranges when there are too few tiles to keep every worker busy
+    std::deque<Distributed::Task> split(int width, int height, int samples, int workerCount) const
+    {
+        int columns = (width + tileSize - 1) / tileSize, rows = (height + tileSize - 1) / tileSize;
+        int ranges = std::min(samples, std::max(1, (tasksPerWorker*workerCount + columns*rows - 1) / (columns*rows)));
+
+        std::deque<Distributed::Task> tasks;
+        for (int range = 0; range < ranges; range++)
+        {
+            int first = samples*range / ranges, count = samples*(range + 1) / ranges - first;
+            for (int row = rows - 1; row >= 0; row--)
+            {
+                for (int column = 0; column < columns; column++)
+                {
+                    int x = column*tileSize, y = row*tileSize;
+                    tasks.push_back(Distributed::Task{ (uint32_t)tasks.size(), x, y, std::min(tileSize, width - x), std::min(tileSize, height - y),
+                                                       first, count });
+                }
+            }
+        }
+        return tasks;
+    }
+
+    // Adds a RESULT for `task` to the weighted sums, false if it doesn't match
+    static bool mergeResult(const std::vector<char> &payload, const Distributed::Task &task, Image &result, std::vector<float> &weights)
+    {
+        if (payload.size() < sizeof(Distributed::Task)) return false;
+        const Distributed::Task *done = (const Distributed::Task*)payload.data();
+        size_t pixelCount = (size_t)task.width*task.height;
+        if (done->id != task.id || done->samples <= 0 || payload.size() != sizeof(Distributed::Task) + pixelCount*4*sizeof(float)) return false;
+
+        const float *pixels = (const float*)(payload.data() + sizeof(Distributed::Task));
+        for (int y = 0; y < task.height; y++)
+        {
+            for (int x = 0; x < task.width; x++)
+            {
+                size_t target = (size_t)(task.y + y)*result.width + task.x + x;
+                for (int c = 0; c < 4; c++) result.pixels[4*target + c] += pixels[4*((size_t)y*task.width + x) + c]*done->samples;
+                weights[target] += done->samples;
+            }
+        }
+        return true;
+    }
+
+};
+
+#endif
+
+#endif
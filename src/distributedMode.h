@@ -0,0 +1,252 @@
+#ifndef DISTRIBUTED_MODE_H
+#define DISTRIBUTED_MODE_H
+
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "app.h"
+#include "distributed.h"
+
+// `--workers`, `--workers-bench` and `--worker`: renders across worker processes, or is one of them
+class DistributedMode
+{
+public:
+
+    // Renders `options.samples` spp across `options.workers` worker processes and writes the merged image
+    static int render(App &app)
+    {
+        #ifdef _WIN32
+        std::cerr << "Error: Distributed rendering needs POSIX sockets." << std::endl;
+        return 1;
+        #else
+        const Options &options = app.options;
+        Renderer &renderer = app.renderer;
+
+        Coordinator coordinator;
+        Image image;
+        if (!distribute(app, coordinator, options.workers, image)) return 1;
+        coordinator.print();
+
+        if (!ImageIO::write(options.outPath, image, renderer.doGammaCorrection))
+        {
+            std::cerr << "Error: Could not write `" << options.outPath << "`." << std::endl;
+            return 1;
+        }
+        std::cout << "Rendered " << options.samples << " spp at " << image.width << "x" << image.height << " on " << coordinator.workers.size()
+                  << " worker(s) in " << coordinator.setupSeconds + coordinator.renderSeconds << "s, wrote " << options.outPath << std::endl;
+        return 0;
+        #endif
+    }
+
+    // Renders the image with 1, 2, 4… up to `options.workersBenchmark` workers and prints how the render time scales
+    static int benchmark(App &app)
+    {
+        #ifdef _WIN32
+        std::cerr << "Error: Distributed rendering needs POSIX sockets." << std::endl;
+        return 1;
+        #else
+        const Options &options = app.options;
+        Renderer &renderer = app.renderer;
+
+        std::vector<int> counts;
+        for (int count = 1; count < options.workersBenchmark; count *= 2) counts.push_back(count);
+        counts.push_back(options.workersBenchmark);
+
+        printf("%8s %10s %10s %12s %8s %10s\n", "workers", "setup s", "render s", "Msamples/s", "speedup", "efficiency");
+        double baseline = 0.0;
+        Image image;
+        for (int count : counts)
+        {
+            Coordinator coordinator;
+            if (!distribute(app, coordinator, count, image)) return 1;
+            if (count == counts.front()) baseline = coordinator.renderSeconds*count;
+            double speedup = baseline / coordinator.renderSeconds;
+            printf("%8d %10.2f %10.2f %12.2f %7.2fx %9.0f%%\n", count, coordinator.setupSeconds, coordinator.renderSeconds,
+                   coordinator.pixelSamples / coordinator.renderSeconds / 1.0e6, speedup, speedup / count*100.0);
+        }
+
+        if (!options.outPath.empty() && !ImageIO::write(options.outPath, image, renderer.doGammaCorrection))
+        {
+            std::cerr << "Error: Could not write `" << options.outPath << "`." << std::endl;
+            return 1;
+        }
+        return 0;
+        #endif
+    }
+
+    // Traces tasks for the coordinator at `options.workerAddress` until it's done with us
+    static int runWorker(App &app)
+    {
+        #ifdef _WIN32
+        std::cerr << "Error: Distributed rendering needs POSIX sockets." << std::endl;
+        return 1;
+        #else
+        const Options &options = app.options;
+        Renderer &renderer = app.renderer;
+
+        Connection coordinator;
+        if (!coordinator.connect(options.workerAddress)) return 1;
+        Distributed::Hello hello = { Distributed::VERSION, (int32_t)getpid() };
+        if (!coordinator.send(Distributed::HELLO, &hello, sizeof(hello))) return 1;
+
+        // Nothing to keep responsive, trace whole passes
+        renderer.tiles.frameBudgetMs = 0.0;
+
+        Distributed::MessageType type;
+        std::vector<char> payload;
+        while (coordinator.receive(type, payload))
+        {
+            if (type == Distributed::DONE) return 0;
+            if (type == Distributed::SETUP)
+            {
+                if (payload.size() < sizeof(Distributed::Setup) || !applySetup(app, payload)) return 1;
+                continue;
+            }
+            if (type != Distributed::TASK || payload.size() != sizeof(Distributed::Task)) break;
+
+            Distributed::Task task = *(const Distributed::Task*)payload.data();
+            Image image = traceTask(app, task);
+            if (!coordinator.send(Distributed::RESULT, &task, sizeof(task), image.pixels.data(), image.pixels.size()*sizeof(float))) return 1;
+        }
+
+        std::cerr << "Error: Lost the coordinator at `" << options.workerAddress << "`." << std::endl;
+        return 1;
+        #endif
+    }
+
+private:
+
+    #ifndef _WIN32
+    // Hands the scene, camera and settings to `coordinator`, which renders them on `workerCount` local processes
+    static bool distribute(App &app, Coordinator &coordinator, int workerCount, Image &image)
+    {
+        const Options &options = app.options;
+        Renderer &renderer = app.renderer;
+        Window &sceneWindow = app.sceneWindow;
+
+        // Workers get the scene in its file format, through a temporary file on each side
+        std::string path = Distributed::temporaryPath();
+        std::vector<char> files;
+        bool saved = !path.empty() && renderer.scene.save(path) && Distributed::readFile(path, files);
+        if (!path.empty()) unlink(path.c_str());
+        if (!saved)
+        {
+            std::cerr << "Error: Could not write the scene for the workers." << std::endl;
+            return false;
+        }
+
+        // And the environment map as the file it was loaded from
+        const Environment &environment = renderer.environment;
+        Distributed::Setup setup = {};
+        setup.sceneSize = files.size();
+        if (environment.isLoaded())
+        {
+            std::vector<char> map;
+            std::string extension = ImageIO::extension(environment.path);
+            if (!Distributed::readFile(environment.path, map) || extension.size() >= sizeof(setup.environmentExtension))
+            {
+                std::cerr << "Error: Could not read the environment map `" << environment.path << "` for the workers." << std::endl;
+                return false;
+            }
+            files.insert(files.end(), map.begin(), map.end());
+            strcpy(setup.environmentExtension, extension.c_str());
+        }
+        setup.environmentStrength = environment.strength;
+        setup.environmentRotation = environment.rotation;
+        setup.sampleEnvironment = environment.sampleDirectly;
+
+        const Camera &camera = renderer.camera;
+        setup.width = sceneWindow.width;
+        setup.height = sceneWindow.height;
+        setup.tracer = renderer.tracer;
+        setup.maxRayBounce = renderer.maxRayBounce;
+        setup.sky = renderer.sky;
+        setup.samplesPerPixel = renderer.samplesPerPixel;
+        setup.samplingMethod = renderer.samplingMethod;
+        setup.cameraMode = camera.cameraMode;
+        for (int i = 0; i < 3; i++)
+        {
+            setup.position[i] = camera.position[i];
+            setup.lookat[i] = camera.lookat[i];
+        }
+        setup.theta = camera.theta;
+        setup.phi = camera.phi;
+        setup.distance = camera.distance;
+        setup.focalLength = camera.focalLength;
+        setup.viewportHeight = camera.viewport.height;
+
+        coordinator.tileSize = renderer.tiles.tileSize;
+        coordinator.port = options.workerPort;
+        return coordinator.render(setup, files, options.samples, options.program, workerCount, image);
+    }
+
+    // Worker side of `distribute`, the scene file and then the map follow the setup
+    static bool applySetup(App &app, const std::vector<char> &payload)
+    {
+        Renderer &renderer = app.renderer;
+        Window &sceneWindow = app.sceneWindow;
+
+        Distributed::Setup setup = *(const Distributed::Setup*)payload.data();
+        const char *scene = payload.data() + sizeof(setup);
+        size_t fileSize = payload.size() - sizeof(setup);
+        if (setup.sceneSize > fileSize) return false;
+        size_t mapSize = fileSize - setup.sceneSize;
+
+        std::string path = Distributed::temporaryPath();
+        bool loaded = !path.empty() && Distributed::writeFile(path, scene, setup.sceneSize) && renderer.loadScene(path);
+        if (!path.empty()) unlink(path.c_str());
+        if (!loaded) return false;
+
+        setup.environmentExtension[sizeof(setup.environmentExtension) - 1] = '\0';
+        if (setup.environmentExtension[0])
+        {
+            path = Distributed::temporaryPath(std::string(".") + setup.environmentExtension);
+            loaded = !path.empty() && Distributed::writeFile(path, scene + setup.sceneSize, mapSize) && renderer.loadEnvironment(path);
+            if (!path.empty()) unlink(path.c_str());
+            if (!loaded) return false;
+        }
+        else renderer.environment.clear();
+        renderer.environment.strength = setup.environmentStrength;
+        renderer.environment.rotation = setup.environmentRotation;
+        renderer.environment.sampleDirectly = setup.sampleEnvironment;
+
+        sceneWindow.updateDimensions(setup.width, setup.height);
+        renderer.tracer = setup.tracer;
+        renderer.maxRayBounce = setup.maxRayBounce;
+        renderer.sky = setup.sky;
+        renderer.samplesPerPixel = setup.samplesPerPixel;
+        renderer.samplingMethod = setup.samplingMethod;
+
+        Camera &camera = renderer.camera;
+        camera.cameraMode = (Camera::CameraMode)setup.cameraMode;
+        camera.position = glm::vec3(setup.position[0], setup.position[1], setup.position[2]);
+        camera.lookat = glm::vec3(setup.lookat[0], setup.lookat[1], setup.lookat[2]);
+        camera.theta = setup.theta;
+        camera.phi = setup.phi;
+        camera.distance = setup.distance;
+        camera.focalLength = setup.focalLength;
+        camera.viewport.height = setup.viewportHeight;
+        camera.updateDimensions(setup.width / (double)setup.height);
+        return true;
+    }
+
+    // Accumulates a task's samples over its rectangle alone and reads back their average
+    static Image traceTask(App &app, Distributed::Task &task)
+    {
+        Renderer &renderer = app.renderer;
+
+        renderer.tiles.region = glm::ivec4(task.x, task.y, task.width, task.height);
+        renderer.sampleOffset = task.firstSample;
+        renderer.restartAccumulation();
+        while (renderer.accumulatedSamples < task.samples) app.traceFrame();
+        task.samples = renderer.accumulatedSamples;
+        return app.readAccumulation(task.x, task.y, task.width, task.height);
+    }
+    #endif
+
+};
+
+#endif
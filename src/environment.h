@@ -0,0 +1,166 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "image.h"
+#include "shader.h"
+#include "taskPool.h"
+#include "profiler.h"
+
+// Equirectangular HDR map lighting the scene from infinitely far away, in place of the sky. Besides the radiance it
+// uploads a distribution proportional to each texel's luminance times its solid angle, as a marginal CDF over the rows
+// and a conditional CDF per row, so the tracers can aim rays straight at a sun instead of waiting for bounces to find it.
+// Rows are stored bottom first, the top one is the zenith (+y), and u = 0.5 looks along +x before `rotation`
+class Environment
+{
+public:
+
+    // Settings
+    float strength = 1.0f;
+    float rotation = 0.0f;              // Degrees about +y
+    bool sampleDirectly = true;         // Light every bounce from a sample of the map too, MIS weighted against the bounce
+
+    std::string path;                   // Map loaded, empty for none
+
+    Environment() {}
+
+    bool isLoaded() const { return textures[0] != 0; }
+
+    // Reads a .hdr or .pfm map, builds its distribution and uploads both. Keeps the current map on failure
+    bool load(const std::string &file)
+    {
+        PROFILE_SCOPE("Environment::load");
+        double start = glfwGetTime();
+        Image image;
+        std::string ext = ImageIO::extension(file);
+        bool read = (ext == "hdr") ? ImageIO::readHDR(file, image) : (ext == "pfm") ? ImageIO::readPFM(file, image) : false;
+        if (!read)
+        {
+            std::cerr << "Error: Could not read the environment map `" << file << "` (expected .hdr or .pfm)." << std::endl;
+            return false;
+        }
+
+        double built = glfwGetTime();
+        std::vector<glm::vec2> conditional;
+        std::vector<float> marginal;
+        float total = buildDistribution(image, conditional, marginal);
+        built = glfwGetTime() - built;
+
+        release();
+        glGenTextures(3, textures);
+        // Unfiltered, so the radiance of a direction is that of the texel its pdf comes from. Blending a sun into the sky texels
+        // around it would give them the sun's radiance at the sky's density, fireflies
+        upload(textures[0], GL_RGB32F, image.width, image.height, GL_RGBA, image.pixels.data());
+        upload(textures[1], GL_RG32F, image.width + 1, image.height, GL_RG, conditional.data());
+        upload(textures[2], GL_R32F, image.height + 1, 1, GL_RED, marginal.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        path = file;
+        samplable = total > 0.0f;
+        printf("Loaded %s: %dx%d environment in %.1f ms (distribution %.1f ms)\n", file.c_str(), image.width, image.height,
+               (glfwGetTime() - start)*1000.0, built*1000.0);
+        if (!samplable) printf("The environment map is black, it won't be sampled directly\n");
+        return true;
+    }
+
+    void clear()
+    {
+        release();
+        path.clear();
+    }
+
+    // Binds the map and its distribution to texture units `firstUnit` onwards
+    void bind(const Shader &shader, int firstUnit) const
+    {
+        const char *names[3] = { "environmentMap", "environmentConditional", "environmentMarginal" };
+        for (int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            shader.setInt(names[i], firstUnit + i);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        shader.setBool("environmentOn", isLoaded());
+        shader.setBool("environmentSampling", isLoaded() && samplable && sampleDirectly);
+        shader.setFloat("environmentStrength", strength);
+        shader.setFloat("environmentRotation", glm::radians(rotation));
+    }
+
+private:
+
+    GLuint textures[3] = { 0, 0, 0 };   // Radiance, conditional CDFs with the texel pdfs, marginal CDF
+    bool samplable = false;
+
+    void release()
+    {
+        if (isLoaded()) glDeleteTextures(3, textures);
+        textures[0] = textures[1] = textures[2] = 0;
+    }
+
+    static void upload(GLuint texture, GLint internalFormat, int width, int height, GLenum format, const void *data)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, data);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    // Row j of `conditional` holds the CDF over the row's texels (width + 1 entries, in x) and each texel's density over
+    // the unit square (in y), `marginal` the CDF over the rows. Returns the sum of the weights
+    static float buildDistribution(const Image &image, std::vector<glm::vec2> &conditional, std::vector<float> &marginal)
+    {
+        int width = image.width, height = image.height;
+        size_t stride = (size_t)width + 1;
+        conditional.assign(stride*height, glm::vec2(0.0f));
+        std::vector<double> rowSums(height, 0.0);
+
+        TaskPool::global().parallelChunks(height, [&](int y)
+        {
+            // Rows near the poles cover less solid angle
+            float sinTheta = sinf((float)M_PI*(y + 0.5f) / height);
+            glm::vec2 *row = &conditional[y*stride];
+            double sum = 0.0;
+            for (int x = 0; x < width; x++)
+            {
+                const float *texel = &image.row(y)[x*4];
+                float weight = std::max(0.2126f*texel[0] + 0.7152f*texel[1] + 0.0722f*texel[2], 0.0f)*sinTheta;
+                row[x].y = weight;
+                row[x].x = (float)sum;
+                sum += weight;
+            }
+
+            // A black row is never picked, a uniform CDF keeps its search well defined anyway
+            for (int x = 0; x <= width; x++) row[x].x = (sum > 0.0) ? (float)(row[x].x / sum) : (float)x / width;
+            row[width].x = 1.0f;
+            rowSums[y] = sum;
+        });
+
+        marginal.assign(height + 1, 0.0f);
+        double total = 0.0;
+        for (int y = 0; y < height; y++)
+        {
+            marginal[y] = (float)total;
+            total += rowSums[y];
+        }
+        for (int y = 0; y <= height; y++) marginal[y] = (total > 0.0) ? (float)(marginal[y] / total) : (float)y / height;
+        marginal[height] = 1.0f;
+
+        // Picking a row, then a texel in it, then a point in the texel has this density over the unit square
+        double scale = (total > 0.0) ? (double)width*height / total : 0.0;
+        for (glm::vec2 &entry : conditional) entry.y = (float)(entry.y*scale);
+        return (float)total;
+    }
+
+};
+
+#endif
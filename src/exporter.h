@@ -0,0 +1,346 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include "image.h"
+#include "readback.h"
+#include "taskPool.h"
+
+// Encodes and writes images on the task pool, at most `start`'s count of them at once so a long export doesn't crowd out
+// the pool's other work
+class ImageWriter
+{
+public:
+
+    std::atomic<int> written{0};
+
+    ImageWriter() {}
+
+    ~ImageWriter() { stop(); }
+
+    void start(int encoderCount = 1)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        limit = std::max(encoderCount, 1);
+    }
+
+    void push(Image &&image, const std::string &path, bool doGammaCorrection)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(Job{ std::move(image), path, doGammaCorrection });
+        if (encoders < limit)
+        {
+            encoders++;
+            group.run([this]() { drain(); });
+        }
+    }
+
+    // Blocks until every queued image is written, helping the pool meanwhile
+    void wait()
+    {
+        group.wait();
+    }
+
+    // Images queued or being written
+    int backlog()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return jobs.size() + busy;
+    }
+
+    void stop()
+    {
+        wait();
+    }
+
+private:
+
+    struct Job
+    {
+        Image image;
+        std::string path;
+        bool doGammaCorrection;
+    };
+
+    std::deque<Job> jobs;
+    std::mutex mutex;
+    int limit = 1;
+    int encoders = 0;                   // Drain tasks running or queued on the pool
+    int busy = 0;
+    TaskGroup group;
+
+    // Writes queued images until there are none left
+    void drain()
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (jobs.empty())
+                {
+                    encoders--;
+                    return;
+                }
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                busy++;
+            }
+
+            if (ImageIO::write(job.path, job.image, job.doGammaCorrection)) written++;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            busy--;
+        }
+    }
+
+};
+
+#ifdef _WIN32
+    #define popen _popen
+    #define pclose _pclose
+#else
+    #include <signal.h>
+    #include <unistd.h>
+    #include <spawn.h>
+    #include <sys/wait.h>
+
+    extern char **environ;
+#endif
+
+// Streams frames in order as raw 8 bit RGB into the stdin of an external process (e.g. ffmpeg) from a background thread
+class FramePipe
+{
+public:
+
+    std::atomic<int> written{0};
+
+    FramePipe() {}
+
+    ~FramePipe() { close(); }
+
+    // Starts `arguments[0]`, looked up on the PATH, with `arguments` as its argv. No shell sees them, so paths can hold
+    // any character
+    bool open(const std::vector<std::string> &arguments, bool doGammaCorrection)
+    {
+        this->doGammaCorrection = doGammaCorrection;
+
+        #ifdef _WIN32
+        // _popen always goes through cmd.exe, quote every argument (paths can't contain quotes on Windows)
+        std::string command;
+        for (const std::string &argument : arguments)
+        {
+            if (argument.find('"') != std::string::npos)
+            {
+                std::cerr << "Error: Invalid argument `" << argument << "`." << std::endl;
+                return false;
+            }
+            command += (command.empty() ? "\"" : " \"") + argument + "\"";
+        }
+        pipe = popen(command.c_str(), "wb");
+        #else
+        // A process that exits early should fail the write, not kill us
+        signal(SIGPIPE, SIG_IGN);
+
+        int fds[2];
+        if (::pipe(fds) == 0)
+        {
+            std::vector<char*> argv;
+            for (const std::string &argument : arguments) argv.push_back((char*)argument.c_str());
+            argv.push_back(NULL);
+
+            // The child reads the pipe as its stdin and doesn't keep our end open, or it would never see the end of input
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(&actions);
+            posix_spawn_file_actions_adddup2(&actions, fds[0], 0);
+            posix_spawn_file_actions_addclose(&actions, fds[0]);
+            posix_spawn_file_actions_addclose(&actions, fds[1]);
+            bool started = posix_spawnp(&child, argv[0], &actions, NULL, argv.data(), environ) == 0;
+            posix_spawn_file_actions_destroy(&actions);
+
+            ::close(fds[0]);
+            if (started) pipe = fdopen(fds[1], "w");
+            else ::close(fds[1]);
+        }
+        #endif
+
+        if (!pipe)
+        {
+            std::cerr << "Error: Could not start `" << arguments[0] << "`." << std::endl;
+            return false;
+        }
+
+        thread = std::thread(&FramePipe::work, this);
+        return true;
+    }
+
+    void push(Image &&image)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frames.push_back(std::move(image));
+        }
+        wakeWorker.notify_one();
+    }
+
+    int backlog()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return frames.size() + busy;
+    }
+
+    // Writes the remaining frames and waits for the process to exit, returns its exit status
+    int close()
+    {
+        if (!pipe) return 0;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeWorker.notify_all();
+        thread.join();
+
+        #ifdef _WIN32
+        int status = pclose(pipe);
+        #else
+        int status = 0;
+        fclose(pipe);
+        if (waitpid(child, &status, 0) != child) status = -1;
+        #endif
+        pipe = NULL;
+        return status;
+    }
+
+private:
+
+    FILE *pipe = NULL;
+    #ifndef _WIN32
+    pid_t child = -1;
+    #endif
+    std::thread thread;
+    std::deque<Image> frames;
+    std::mutex mutex;
+    std::condition_variable wakeWorker;
+    bool doGammaCorrection = true;
+    bool stopping = false;
+    int busy = 0;
+
+    void work()
+    {
+        std::vector<uint8_t> rgb;
+        while (true)
+        {
+            Image frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeWorker.wait(lock, [this]() { return stopping || !frames.empty(); });
+                if (frames.empty()) return;
+
+                frame = std::move(frames.front());
+                frames.pop_front();
+                busy = 1;
+            }
+
+            ImageIO::toRGB8(frame, doGammaCorrection, rgb);
+            if (fwrite(rgb.data(), 1, rgb.size(), pipe) == rgb.size()) written++;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            busy = 0;
+        }
+    }
+
+};
+
+// Saves the accumulation buffer without stalling the render loop, double buffered readback followed by encoding on a background thread
+class Exporter
+{
+public:
+
+    // Settings
+    char path[256] = "render.png";
+    int snapshotEvery = 0;                  // Samples per pixel between snapshots while rendering (0 disables them)
+
+    // States
+    std::string status;
+
+    Exporter() {}
+
+    void init()
+    {
+        readback.init(2);
+        writer.start(1);
+    }
+
+    // Queue an export of the colour attachment of `FBO`
+    void exportImage(GLuint FBO, int width, int height, const std::string &imagePath, bool doGammaCorrection)
+    {
+        if (!ImageIO::isSupported(imagePath))
+        {
+            status = "Unsupported format, use .png, .exr or .pfm";
+            return;
+        }
+
+        readback.request(FBO, width, height, [this, imagePath, doGammaCorrection](Image &&image)
+        {
+            writer.push(std::move(image), imagePath, doGammaCorrection);
+        });
+        status = "Exporting " + imagePath;
+    }
+
+    // Called after every completed pass, takes a snapshot each time the sample count crosses a multiple of `snapshotEvery`
+    void onPassComplete(GLuint FBO, int width, int height, int samples, bool doGammaCorrection)
+    {
+        if (snapshotEvery > 0 && samples / snapshotEvery > lastSnapshotSamples / snapshotEvery)
+            exportImage(FBO, width, height, numberedPath(path, samples), doGammaCorrection);
+
+        lastSnapshotSamples = samples;
+    }
+
+    // Hand finished readbacks to the writer, call once per frame
+    void update()
+    {
+        readback.poll();
+    }
+
+    // Blocks until every export is on disk
+    void finish()
+    {
+        readback.finish();
+        writer.wait();
+    }
+
+    int pending() { return readback.pending() + writer.backlog(); }
+    int written() { return writer.written; }
+
+    // "render.png" -> "render_00064.png"
+    static std::string numberedPath(const std::string &path, int number)
+    {
+        size_t dot = path.find_last_of('.');
+        std::string stem = (dot == std::string::npos) ? path : path.substr(0, dot);
+        std::string ext = (dot == std::string::npos) ? "" : path.substr(dot);
+
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "_%05d", number);
+        return stem + suffix + ext;
+    }
+
+private:
+
+    Readback readback;
+    ImageWriter writer;
+    int lastSnapshotSamples = 0;
+
+};
+
+#endif
@@ -66,6 +66,19 @@ public:
         glBindVertexArray(0);
     }
 
+    // Draws `texture` into the bound frame buffer, converting linear colours for display
+    void present(GLuint texture, bool doGammaCorrection)
+    {
+        shader.use();
+        shader.setInt("finalTexture", 0);
+        shader.setBool("doGammaCorrection", doGammaCorrection);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        render();
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
 private:
 
     Shader shader;
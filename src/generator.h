@@ -0,0 +1,204 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "utils.h"
+#include "sphere.h"
+#include "material.h"
+#include "scene.h"
+
+// Reproducible procedural scenes for scaling experiments, the same settings always give the same scene on every platform
+class SceneGenerator
+{
+public:
+
+    enum Layout { UNIFORM = 0, GALAXIES = 1, WEEKEND = 2 };
+    enum RadiusDistribution { CONSTANT = 0, RANDOM = 1, POWER_LAW = 2 };   // POWER_LAW gives many small spheres and a few large ones
+    enum Lighting { FEW_LIGHTS = 0, MANY_LIGHTS = 1 };
+
+    // Settings
+    int layout = UNIFORM;
+    unsigned int seed = 1;
+    int count = 10000;
+    int radiusDistribution = RANDOM;
+    float minRadius = 0.2, maxRadius = 0.6;
+    float diffuseWeight = 0.6, metalWeight = 0.2, glossyWeight = 0.2;      // Material mix, normalized when generating
+    int lighting = FEW_LIGHTS;
+    float lightFraction = 0.01;                                         // Share of emissive spheres with MANY_LIGHTS
+    int paletteSize = 32;                                               // Materials per kind, spheres share them to keep the table small
+
+    // Bounds of the last generated scene, to frame it with the camera
+    glm::vec3 center = glm::vec3(0.0);
+    float extent = 1.0;
+
+    SceneGenerator() {}
+
+    void generate(Scene &scene)
+    {
+        state = seed*0x9E3779B97F4A7C15ULL + 1;    // Spread small seeds over the whole state
+        std::vector<Material> materials;
+        std::vector<Sphere> spheres;
+        spheres.reserve(count + 8);
+
+        // Palette: diffuse, metal and glossy materials followed by light materials
+        for (int i = 0; i < paletteSize; i++) materials.push_back(Dielectric(randomColour(0.2, 0.9), 1.0, 0.8));
+        for (int i = 0; i < paletteSize; i++) materials.push_back(Mirror(uniform(0.85, 1.0)));
+        for (int i = 0; i < paletteSize; i++) materials.push_back(Dielectric(randomColour(0.3, 1.0), uniform(0.2, 0.6), 0.6));
+        int firstLight = materials.size();
+        for (int i = 0; i < paletteSize; i++) materials.push_back(Light(randomColour(0.6, 1.0), lighting == FEW_LIGHTS ? 30.0 : 5.0));
+        groundMaterial = materials.size();
+        materials.push_back(Dielectric(glm::vec3(0.5), 1.0, 0.5));
+
+        if (layout == UNIFORM) uniformField(spheres, firstLight);
+        else if (layout == GALAXIES) galaxies(spheres, firstLight);
+        else weekendGrid(spheres, firstLight);
+
+        // A few large lights overhead, placed after the bounds are known
+        bounds(spheres);
+        if (lighting == FEW_LIGHTS)
+        {
+            float height = center.y + extent*1.5;
+            for (int i = 0; i < 4; i++)
+            {
+                float angle = 2*PI*i / 4;
+                glm::vec3 position = center + glm::vec3(cos(angle)*extent, 0.0, sin(angle)*extent);
+                position.y = height;
+                spheres.push_back(Sphere(firstLight + i % paletteSize, position, extent*0.2));
+            }
+        }
+
+        scene.assign(std::move(materials), std::move(spheres));
+    }
+
+private:
+
+    uint64_t state = 1;
+    int groundMaterial = 0;
+
+    // xorshift64*, std distributions aren't guaranteed to give the same numbers across standard libraries
+    float random()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return ((state*0x2545F4914F6CDD1DULL) >> 40) / 16777216.0f;
+    }
+
+    float uniform(float min, float max) { return min + (max - min)*random(); }
+
+    glm::vec3 randomColour(float min, float max) { return glm::vec3(uniform(min, max), uniform(min, max), uniform(min, max)); }
+
+    float gaussian()
+    {
+        float u1 = std::max(random(), 1e-7f), u2 = random();
+        return sqrt(-2.0*log(u1))*cos(2*PI*u2);
+    }
+
+    float randomRadius()
+    {
+        if (radiusDistribution == CONSTANT) return minRadius;
+        if (radiusDistribution == RANDOM) return uniform(minRadius, maxRadius);
+
+        // Pareto with exponent 2.5 (inverse transform), clamped to the maximum
+        float radius = minRadius / pow(std::max(random(), 1e-7f), 1.0 / 2.5);
+        return std::min(radius, maxRadius);
+    }
+
+    // Picks a material from the mix (or a light with MANY_LIGHTS)
+    int randomMaterial(int firstLight)
+    {
+        if (lighting == MANY_LIGHTS && random() < lightFraction) return firstLight + (int)(random()*paletteSize) % paletteSize;
+
+        float total = diffuseWeight + metalWeight + glossyWeight;
+        float pick = random()*(total > 0.0 ? total : 1.0);
+        int kind = (pick < diffuseWeight || total <= 0.0) ? 0 : (pick < diffuseWeight + metalWeight) ? 1 : 2;
+        return kind*paletteSize + (int)(random()*paletteSize) % paletteSize;
+    }
+
+    // Spheres spread through a cube sized to keep the density constant as the count grows
+    void uniformField(std::vector<Sphere> &spheres, int firstLight)
+    {
+        float halfSize = 0.5*cbrt((float)count)*maxRadius*4.0;
+        for (int i = 0; i < count; i++)
+        {
+            glm::vec3 position(uniform(-halfSize, halfSize), uniform(-halfSize, halfSize), uniform(-halfSize, halfSize));
+            spheres.push_back(Sphere(randomMaterial(firstLight), position, randomRadius()));
+        }
+    }
+
+    // Spiral disks with dense cores, the clustering stresses acceleration structures far more than a uniform field
+    void galaxies(std::vector<Sphere> &spheres, int firstLight)
+    {
+        int galaxyCount = std::max(1, (int)cbrt(count / 1000.0));
+        float size = sqrt((float)count / galaxyCount)*maxRadius*2.0;
+        float spacing = size*3.0;
+
+        std::vector<glm::vec3> centers, normals;
+        for (int g = 0; g < galaxyCount; g++)
+        {
+            centers.push_back(glm::vec3(uniform(-1, 1), uniform(-0.3, 0.3), uniform(-1, 1))*spacing*(float)cbrt(galaxyCount));
+            normals.push_back(glm::normalize(glm::vec3(uniform(-0.4, 0.4), 1.0, uniform(-0.4, 0.4))));
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int g = i % galaxyCount;
+            glm::vec3 n = normals[g];
+            glm::vec3 t = glm::normalize(glm::cross(n, glm::vec3(1.0, 0.0, 0.0)));
+            glm::vec3 b = glm::cross(n, t);
+
+            // Two logarithmic arms, radius biased towards the core
+            float r = size*pow(random(), 2.0);
+            float arm = (random() < 0.5) ? 0.0 : PI;
+            float angle = arm + log(1.0 + r)*2.5 + gaussian()*0.3;
+            float thickness = size*0.05*exp(-r / size*3.0);
+
+            glm::vec3 position = centers[g] + r*(cos(angle)*t + sin(angle)*b) + gaussian()*thickness*n;
+            spheres.push_back(Sphere(randomMaterial(firstLight), position, randomRadius()));
+        }
+    }
+
+    // "Ray Tracing in One Weekend" style: a dense jittered grid of small spheres resting on a huge ground sphere
+    void weekendGrid(std::vector<Sphere> &spheres, int firstLight)
+    {
+        int side = std::max(1, (int)ceil(sqrt((float)count - 1)));
+        float cell = maxRadius*2.5;
+
+        // Large enough to look flat under the whole grid, but not so large that float precision breaks the intersections
+        float groundRadius = std::max(2000.0f, side*cell*2.0f);
+        spheres.push_back(Sphere(groundMaterial, glm::vec3(0.0, -groundRadius, 0.0), groundRadius));
+        for (int i = 0; i < count - 1; i++)
+        {
+            int x = i % side, z = i / side;
+            float radius = randomRadius();
+            // Jitter inside the cell without touching the neighbours
+            glm::vec3 corner((x - side*0.5)*cell, 0.0, (z - side*0.5)*cell);
+            glm::vec3 position = corner + glm::vec3(radius + random()*(cell - 2*radius), radius, radius + random()*(cell - 2*radius));
+            spheres.push_back(Sphere(randomMaterial(firstLight), position, radius));
+        }
+    }
+
+    void bounds(const std::vector<Sphere> &spheres)
+    {
+        glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+        for (const Sphere &sphere : spheres)
+        {
+            // Ignore the ground, it would swallow the bounds of the weekend grid
+            if (sphere.material == groundMaterial) continue;
+            min = glm::min(min, sphere.position - sphere.radius);
+            max = glm::max(max, sphere.position + sphere.radius);
+        }
+
+        if (min.x > max.x) min = max = glm::vec3(0.0);
+        center = 0.5f*(min + max);
+        extent = std::max(0.5f*glm::length(max - min), 1.0f);
+    }
+
+};
+
+#endif
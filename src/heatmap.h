@@ -0,0 +1,113 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include "image.h"
+#include "readback.h"
+
+// Debug view of where the tracer spends its time. The shader counts one of the metrics below per pixel, averages it over
+// the pixel's samples and shows it as a false colour ramp from blue (free) to red (`scale` or more), the raw average is
+// kept in the accumulation's alpha channel so complete passes can be read back into a histogram
+class Heatmap
+{
+public:
+
+    enum Mode { OFF = 0, TESTS = 1, NODES = 2, BOUNCES = 3 };
+    static constexpr int BUCKETS = 32;
+
+    // Settings
+    int mode = OFF;
+    float scale = 64.0;                 // Count shown as the hottest colour
+
+    // Summary of the last complete pass that was read back
+    std::vector<float> histogram = std::vector<float>(BUCKETS, 0.0f);  // Share of pixels per bucket of [0, scale], the last one holds everything above
+    double mean = 0.0, maximum = 0.0;
+    double hotShare = 0.0;              // Share of pixels at `scale` or above
+    int summaryMode = OFF;              // Mode the summary was measured in
+
+    Heatmap() {}
+
+    void init()
+    {
+        readback.init(1);
+    }
+
+    bool isOn() const { return mode != OFF; }
+
+    static const char *name(int mode)
+    {
+        const char *names[] = { "off", "tests", "nodes", "bounces" };
+        return (mode >= OFF && mode <= BOUNCES) ? names[mode] : "?";
+    }
+
+    // Called after every completed pass, reads the pass back unless the previous one is still on its way
+    void onPassComplete(GLuint FBO, int width, int height)
+    {
+        if (!isOn() || readback.pending()) return;
+
+        int measuredMode = mode;
+        float measuredScale = scale;
+        readback.request(FBO, width, height, [this, measuredMode, measuredScale](Image &&image)
+        {
+            summarize(image, measuredMode, measuredScale);
+        });
+    }
+
+    // Hands finished readbacks to the summary, call once per frame
+    void update()
+    {
+        readback.poll();
+    }
+
+    void finish()
+    {
+        readback.finish();
+    }
+
+    void summarize(const Image &image, int measuredMode, float measuredScale)
+    {
+        size_t pixelCount = (size_t)image.width*image.height;
+        std::fill(histogram.begin(), histogram.end(), 0.0f);
+        mean = maximum = hotShare = 0.0;
+        summaryMode = measuredMode;
+        if (pixelCount == 0) return;
+
+        size_t hot = 0;
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            float count = std::max(image.pixels[4*i + 3], 0.0f);
+            int bucket = std::min((int)(count / measuredScale*(BUCKETS - 1)), BUCKETS - 1);
+            histogram[bucket] += 1.0f;
+            mean += count;
+            maximum = std::max(maximum, (double)count);
+            hot += count >= measuredScale;
+        }
+
+        for (float &share : histogram) share /= pixelCount;
+        mean /= pixelCount;
+        hotShare = (double)hot / pixelCount;
+    }
+
+    void print() const
+    {
+        printf("Heatmap of %s per sample: mean %.1f, max %.1f, %.1f%% of pixels at %.0f or more\n", name(summaryMode), mean, maximum,
+               hotShare*100.0, scale);
+        for (int b = 0; b < BUCKETS; b++)
+        {
+            if (histogram[b] <= 0.0f) continue;
+            float from = scale*b / (BUCKETS - 1);
+            printf("  %7.1f%s %6.2f%% %s\n", from, (b == BUCKETS - 1) ? "+" : " ", histogram[b]*100.0f,
+                   std::string((size_t)(histogram[b]*200.0f + 0.5f), '#').c_str());
+        }
+    }
+
+private:
+
+    Readback readback;
+
+};
+
+#endif
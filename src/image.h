@@ -0,0 +1,376 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+// Linear RGBA float image, rows are stored bottom first like OpenGL reads them back
+struct Image
+{
+    int width = 0, height = 0;
+    std::vector<float> pixels;
+
+    Image() {}
+
+    Image(int width, int height)
+        : width(width)
+        , height(height)
+        , pixels((size_t)width*height*4)
+    {}
+
+    const float *row(int y) const { return &pixels[(size_t)y*width*4]; }
+};
+
+
+// * Encoders, all of them write the top row first
+
+namespace ImageIO
+{
+    inline std::string extension(const std::string &path)
+    {
+        size_t dot = path.find_last_of('.');
+        if (dot == std::string::npos) return "";
+
+        std::string ext = path.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        return ext;
+    }
+
+    inline bool isSupported(const std::string &path)
+    {
+        std::string ext = extension(path);
+        return ext == "png" || ext == "pfm" || ext == "exr";
+    }
+
+    // Portable float map, raw little endian floats with rows bottom first
+    inline bool writePFM(const std::string &path, const Image &image)
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+
+        fprintf(file, "PF\n%d %d\n-1.0\n", image.width, image.height);
+        std::vector<float> rgb((size_t)image.width*3);
+        for (int y = 0; y < image.height; y++)
+        {
+            const float *row = image.row(y);
+            for (int x = 0; x < image.width; x++)
+                for (int c = 0; c < 3; c++) rgb[x*3 + c] = row[x*4 + c];
+            fwrite(rgb.data(), sizeof(float), rgb.size(), file);
+        }
+
+        return fclose(file) == 0;
+    }
+
+    // Reads what `writePFM` writes, 3 channel PFMs of either byte order. Alpha is set to 1
+    inline bool readPFM(const std::string &path, Image &image)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+
+        int width = 0, height = 0;
+        float scale = 0.0f;
+        char magic[3] = { 0 };
+        bool ok = fscanf(file, "%2s %d %d %f", magic, &width, &height, &scale) == 4 && !strcmp(magic, "PF") && width > 0 && height > 0 &&
+                  fgetc(file) != EOF;
+        if (ok)
+        {
+            image = Image(width, height);
+            std::vector<float> rgb((size_t)width*3);
+            bool swap = (scale > 0.0f);     // Positive scale means big endian
+            for (int y = 0; y < height && ok; y++)
+            {
+                ok = fread(rgb.data(), sizeof(float), rgb.size(), file) == rgb.size();
+                float *row = &image.pixels[(size_t)y*width*4];
+                for (int x = 0; x < width && ok; x++)
+                {
+                    for (int c = 0; c < 3; c++)
+                    {
+                        float value = rgb[x*3 + c];
+                        if (swap)
+                        {
+                            uint8_t *bytes = (uint8_t*)&value;
+                            std::swap(bytes[0], bytes[3]);
+                            std::swap(bytes[1], bytes[2]);
+                        }
+                        row[x*4 + c] = value;
+                    }
+                    row[x*4 + 3] = 1.0f;
+                }
+            }
+        }
+
+        fclose(file);
+        return ok;
+    }
+
+    // Radiance RGBE (.hdr) with `-Y height +X width` scanlines, flat or run length encoded. Alpha is set to 1
+    inline bool readHDR(const std::string &path, Image &image)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file) return false;
+
+        // Header lines up to a blank one, then the resolution
+        char line[512];
+        bool ok = fgets(line, sizeof(line), file) && !strncmp(line, "#?", 2);
+        while (ok && fgets(line, sizeof(line), file) && line[0] != '\n')
+            if (!strncmp(line, "FORMAT=", 7) && strncmp(line, "FORMAT=32-bit_rle_rgbe", 22)) ok = false;
+        int width = 0, height = 0;
+        ok = ok && fgets(line, sizeof(line), file) && sscanf(line, "-Y %d +X %d", &height, &width) == 2 && width > 0 && height > 0;
+
+        std::vector<uint8_t> rgbe((size_t)width*4);
+        if (ok) image = Image(width, height);
+        for (int y = 0; y < height && ok; y++)
+        {
+            uint8_t start[4];
+            ok = fread(start, 1, 4, file) == 4;
+            if (!ok) break;
+
+            if (start[0] == 2 && start[1] == 2 && ((start[2] << 8) | start[3]) == width && width >= 8 && width < 32768)
+            {
+                // Each channel of the scanline in turn, as runs of one value (count above 128) or literal bytes
+                for (int c = 0; c < 4 && ok; c++)
+                {
+                    for (int x = 0; x < width && ok; )
+                    {
+                        int count = fgetc(file);
+                        bool run = count > 128;
+                        if (run) count -= 128;
+                        ok = count > 0 && x + count <= width;
+                        int value = run ? fgetc(file) : 0;
+                        for (int i = 0; i < count && ok; i++, x++)
+                        {
+                            if (!run) value = fgetc(file);
+                            ok = value != EOF;
+                            rgbe[x*4 + c] = (uint8_t)value;
+                        }
+                    }
+                }
+            }
+            else
+            {
+                memcpy(rgbe.data(), start, 4);
+                ok = fread(rgbe.data() + 4, 1, rgbe.size() - 4, file) == rgbe.size() - 4;
+            }
+
+            // The file's first scanline is the top one
+            float *row = &image.pixels[(size_t)(height - 1 - y)*width*4];
+            for (int x = 0; x < width && ok; x++)
+            {
+                float scale = rgbe[x*4 + 3] ? ldexpf(1.0f, rgbe[x*4 + 3] - 136) : 0.0f;
+                for (int c = 0; c < 3; c++) row[x*4 + c] = (rgbe[x*4 + c] + 0.5f)*scale;
+                row[x*4 + 3] = 1.0f;
+            }
+        }
+
+        fclose(file);
+        return ok;
+    }
+
+    // Single part scanline OpenEXR with uncompressed 32 bit float B, G, R channels
+    inline bool writeEXR(const std::string &path, const Image &image)
+    {
+        std::vector<uint8_t> header;
+        auto put = [&header](const void *data, size_t size) { header.insert(header.end(), (const uint8_t*)data, (const uint8_t*)data + size); };
+        auto putInt = [&put](int32_t value) { put(&value, 4); };
+        auto putString = [&put](const char *string) { put(string, strlen(string) + 1); };
+        auto attribute = [&putString, &putInt](const char *name, const char *type, int32_t size) { putString(name); putString(type); putInt(size); };
+
+        const int32_t magic = 20000630, version = 2;
+        put(&magic, 4);
+        put(&version, 4);
+
+        // Channels have to be sorted by name
+        attribute("channels", "chlist", 3*(2 + 16) + 1);
+        for (const char *channel : { "B", "G", "R" })
+        {
+            putString(channel);
+            putInt(2);                          // FLOAT
+            putInt(0);                          // pLinear and reserved bytes
+            putInt(1); putInt(1);               // x and y sampling
+        }
+        header.push_back(0);
+
+        attribute("compression", "compression", 1);
+        header.push_back(0);                    // NO_COMPRESSION
+
+        attribute("dataWindow", "box2i", 16);
+        putInt(0); putInt(0); putInt(image.width - 1); putInt(image.height - 1);
+        attribute("displayWindow", "box2i", 16);
+        putInt(0); putInt(0); putInt(image.width - 1); putInt(image.height - 1);
+
+        attribute("lineOrder", "lineOrder", 1);
+        header.push_back(0);                    // INCREASING_Y
+
+        float one = 1.0, zero[2] = { 0.0, 0.0 };
+        attribute("pixelAspectRatio", "float", 4);
+        put(&one, 4);
+        attribute("screenWindowCenter", "v2f", 8);
+        put(zero, 8);
+        attribute("screenWindowWidth", "float", 4);
+        put(&one, 4);
+        header.push_back(0);
+
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        fwrite(header.data(), 1, header.size(), file);
+
+        // Offset table, one block per scanline
+        int32_t lineSize = image.width*3*sizeof(float);
+        uint64_t offset = header.size() + (uint64_t)image.height*8;
+        for (int y = 0; y < image.height; y++, offset += 8 + lineSize)
+            fwrite(&offset, 8, 1, file);
+
+        std::vector<float> line((size_t)image.width*3);
+        for (int32_t y = 0; y < image.height; y++)
+        {
+            const float *row = image.row(image.height - 1 - y);
+            for (int x = 0; x < image.width; x++)
+            {
+                line[x] = row[x*4 + 2];
+                line[image.width + x] = row[x*4 + 1];
+                line[2*image.width + x] = row[x*4];
+            }
+
+            fwrite(&y, 4, 1, file);
+            fwrite(&lineSize, 4, 1, file);
+            fwrite(line.data(), sizeof(float), line.size(), file);
+        }
+
+        return fclose(file) == 0;
+    }
+
+    // Packed 8 bit RGB with the top row first, the layout display formats and raw video want
+    inline void toRGB8(const Image &image, bool doGammaCorrection, std::vector<uint8_t> &rgb)
+    {
+        rgb.resize((size_t)image.width*image.height*3);
+        for (int y = 0; y < image.height; y++)
+        {
+            const float *row = image.row(image.height - 1 - y);
+            uint8_t *out = &rgb[(size_t)y*image.width*3];
+            for (int x = 0; x < image.width; x++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    float value = std::min(std::max(row[x*4 + c], 0.0f), 1.0f);
+                    if (doGammaCorrection) value = sqrtf(value);
+                    out[x*3 + c] = (uint8_t)(value*255.0f + 0.5f);
+                }
+            }
+        }
+    }
+
+    inline uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+    {
+        // Built once, function local statics are initialized thread safely
+        struct Table { uint32_t entries[256]; };
+        static const Table table = []()
+        {
+            Table t;
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t.entries[i] = c;
+            }
+            return t;
+        }();
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++) crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    // 8 bit RGB PNG, the zlib stream uses stored (uncompressed) deflate blocks so we don't need zlib
+    inline void encodePNG(const Image &image, bool doGammaCorrection, std::vector<uint8_t> &png)
+    {
+        // Filtered scanlines, filter type 0 (None) at the start of every row
+        std::vector<uint8_t> rgb;
+        toRGB8(image, doGammaCorrection, rgb);
+        size_t stride = (size_t)image.width*3 + 1;
+        std::vector<uint8_t> raw(stride*image.height);
+        for (int y = 0; y < image.height; y++)
+        {
+            raw[y*stride] = 0;
+            memcpy(&raw[y*stride + 1], &rgb[y*(stride - 1)], stride - 1);
+        }
+
+        // zlib header, stored blocks of at most 65535 bytes and the adler32 checksum
+        std::vector<uint8_t> zlib = { 0x78, 0x01 };
+        uint32_t a = 1, b = 0;
+        for (size_t i = 0; i < raw.size(); i++)
+        {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        for (size_t pos = 0; pos < raw.size() || pos == 0; )
+        {
+            uint16_t size = (uint16_t)std::min(raw.size() - pos, (size_t)65535);
+            bool last = pos + size >= raw.size();
+            zlib.push_back(last ? 1 : 0);
+            zlib.push_back(size & 0xFF); zlib.push_back(size >> 8);
+            zlib.push_back(~size & 0xFF); zlib.push_back((~size >> 8) & 0xFF);
+            zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + size);
+            pos += size;
+            if (last) break;
+        }
+        uint32_t adler = (b << 16) | a;
+        for (int shift = 24; shift >= 0; shift -= 8) zlib.push_back((adler >> shift) & 0xFF);
+
+        auto writeChunk = [&png](const char *type, const uint8_t *data, uint32_t size)
+        {
+            uint8_t length[4] = { (uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size };
+            png.insert(png.end(), length, length + 4);
+            png.insert(png.end(), type, type + 4);
+            if (size) png.insert(png.end(), data, data + size);
+
+            uint32_t crc = crc32(data, size, crc32((const uint8_t*)type, 4));
+            uint8_t crcBytes[4] = { (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc };
+            png.insert(png.end(), crcBytes, crcBytes + 4);
+        };
+
+        png.assign({ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' });
+
+        uint8_t ihdr[13] = {
+            (uint8_t)(image.width >> 24), (uint8_t)(image.width >> 16), (uint8_t)(image.width >> 8), (uint8_t)image.width,
+            (uint8_t)(image.height >> 24), (uint8_t)(image.height >> 16), (uint8_t)(image.height >> 8), (uint8_t)image.height,
+            8, 2, 0, 0, 0   // 8 bit depth, truecolour, deflate, adaptive filtering, no interlace
+        };
+        writeChunk("IHDR", ihdr, 13);
+        writeChunk("IDAT", zlib.data(), zlib.size());
+        writeChunk("IEND", NULL, 0);
+    }
+
+    inline bool writePNG(const std::string &path, const Image &image, bool doGammaCorrection = true)
+    {
+        std::vector<uint8_t> png;
+        encodePNG(image, doGammaCorrection, png);
+
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        fwrite(png.data(), 1, png.size(), file);
+        return fclose(file) == 0;
+    }
+
+    // Picks the encoder from the file extension, PNG gets display (gamma corrected) values, PFM/EXR keep linear data
+    inline bool write(const std::string &path, const Image &image, bool doGammaCorrection = true)
+    {
+        std::string ext = extension(path);
+        bool written = false;
+
+        if (ext == "png") written = writePNG(path, image, doGammaCorrection);
+        else if (ext == "pfm") written = writePFM(path, image);
+        else if (ext == "exr") written = writeEXR(path, image);
+        else std::cerr << "Error: Unsupported image format `" << path << "`." << std::endl;
+
+        if (!written) std::cerr << "Error: Could not write `" << path << "`." << std::endl;
+        return written;
+    }
+}
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include "app.h"
+#include "json.h"
+
+// Render jobs as JSON objects, shared by the render server, batches and regression suites: reading them from JSON lines
+// files and setting up the App's scene, camera and settings for each
+class Jobs
+{
+public:
+
+    // What a job starts from when it doesn't say otherwise
+    struct Defaults
+    {
+        Camera camera;                  // Of the scene in memory, generated scenes frame their own
+        int tracer, maxRayBounce, sky;
+        std::string environment;        // Map from the command line, empty for none
+        float environmentStrength, environmentRotation;
+        bool sampleEnvironment;
+    };
+
+    static Defaults defaults(const App &app)
+    {
+        const Renderer &renderer = app.renderer;
+        const Environment &environment = renderer.environment;
+        return { renderer.camera, renderer.tracer, renderer.maxRayBounce, renderer.sky,
+                 environment.path, environment.strength, environment.rotation, environment.sampleDirectly };
+    }
+
+    // Sets up the scene, camera and settings a job asks for. The scene is only replaced when its description differs from
+    // the last job's: {"file": path}, {"generate": {"layout", "count", "seed"}} or inline "materials" and "spheres", with
+    // the "meshes" files added to any of them
+    static bool apply(App &app, const Json &request, Defaults &defaults, std::string &loadedScene, bool &sceneReused, std::string &error)
+    {
+        Renderer &renderer = app.renderer;
+        Window &sceneWindow = app.sceneWindow;
+
+        int width = request["width"].asInt(sceneWindow.width), height = request["height"].asInt(sceneWindow.height);
+        if (width <= 0 || height <= 0 || width > 16384 || height > 16384)
+        {
+            error = "width and height must be between 1 and 16384";
+            return false;
+        }
+
+        const Json &scene = request["scene"];
+        std::string description = scene.isNull() ? loadedScene : scene.dump();
+        sceneReused = description == loadedScene;
+        if (!sceneReused)
+        {
+            // Whatever happens next, the scene in memory is no longer the last one described
+            loadedScene = "-";
+            if (scene.has("file"))
+            {
+                if (!renderer.loadScene(scene["file"].asString("")))
+                {
+                    error = "could not load the scene file";
+                    return false;
+                }
+            }
+            else if (scene.has("generate"))
+            {
+                const Json &generate = scene["generate"];
+                std::string layout = generate["layout"].asString("uniform");
+                SceneGenerator &generator = renderer.generator;
+                if (layout == "uniform") generator.layout = SceneGenerator::UNIFORM;
+                else if (layout == "galaxies") generator.layout = SceneGenerator::GALAXIES;
+                else if (layout == "weekend") generator.layout = SceneGenerator::WEEKEND;
+                else
+                {
+                    error = "unknown layout `" + layout + "`";
+                    return false;
+                }
+                generator.count = std::max(generate["count"].asInt(generator.count), 0);
+                generator.seed = generate["seed"].asInt(generator.seed);
+                renderer.generateScene();
+            }
+            else if (!parseSpheres(renderer, scene, error)) return false;
+
+            // Each frames itself, the camera ends up on the last
+            for (const Json &mesh : scene["meshes"].items)
+                if (!renderer.loadMesh(mesh.asString("")))
+                {
+                    error = "could not load the mesh `" + mesh.asString("") + "`";
+                    return false;
+                }
+
+            defaults.camera = renderer.camera;
+            loadedScene = description;
+        }
+
+        if (width != sceneWindow.width || height != sceneWindow.height) sceneWindow.updateDimensions(width, height);
+
+        // Either a first person camera at `position` or a third person one orbiting `lookat`
+        Camera &camera = renderer.camera;
+        camera = defaults.camera;
+        const Json &view = request["camera"];
+        if (view.has("lookat"))
+        {
+            camera.cameraMode = Camera::THIRD_PERSON;
+            camera.lookat = view["lookat"].asVec3(camera.lookat);
+            camera.distance = view["distance"].asNumber(camera.distance);
+        }
+        else if (view.has("position"))
+        {
+            camera.cameraMode = Camera::FIRST_PERSON;
+            camera.position = view["position"].asVec3(camera.position);
+        }
+        camera.theta = view["theta"].asNumber(camera.theta);
+        camera.phi = view["phi"].asNumber(camera.phi);
+        camera.focalLength = view["focalLength"].asNumber(camera.focalLength);
+        camera.updateDimensions(sceneWindow.aspectRatio);
+
+        std::string tracer = request["tracer"].asString("");
+        renderer.tracer = (tracer == "wavefront") ? Renderer::WAVEFRONT : (tracer == "fragment") ? Renderer::FRAGMENT
+                        : (tracer == "direct") ? Renderer::DIRECT : defaults.tracer;
+        renderer.maxRayBounce = std::max(request["bounces"].asInt(defaults.maxRayBounce), 1);
+        renderer.sky = request["sky"].asBool(defaults.sky);
+
+        // {"file", "strength", "rotation", "sampleDirectly"}, an empty file removes the map. Jobs that leave it or any of
+        // its keys out get the command line's map back
+        const Json &environment = request["environment"];
+        std::string file = environment["file"].asString(defaults.environment);
+        if (file.empty()) renderer.environment.clear();
+        else if (file != renderer.environment.path && !renderer.loadEnvironment(file))
+        {
+            error = "could not load the environment map";
+            return false;
+        }
+        renderer.environment.strength = std::max((float)environment["strength"].asNumber(defaults.environmentStrength), 0.0f);
+        renderer.environment.rotation = environment["rotation"].asNumber(defaults.environmentRotation);
+        renderer.environment.sampleDirectly = environment["sampleDirectly"].asBool(defaults.sampleEnvironment);
+        renderer.tiles.region = glm::ivec4(0);
+        renderer.sampleOffset = 0;
+        return true;
+    }
+
+    // One job per line, blank lines and lines starting with # are skipped. Every job needs an image path under `imageKey`
+    static bool read(const std::string &path, const char *imageKey, std::vector<Json> &jobs, std::vector<int> &lineNumbers)
+    {
+        std::ifstream file(path);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Could not open `" << path << "`." << std::endl;
+            return false;
+        }
+
+        std::string line, error;
+        for (int number = 1; std::getline(file, line); number++)
+        {
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') continue;
+
+            Json job;
+            if (!Json::parse(line, job, error) || !job.isObject())
+            {
+                std::cerr << "Error: Line " << number << " of `" << path << "` isn't a job: " << (error.empty() ? "expected an object" : error) << "." << std::endl;
+                return false;
+            }
+            if (!ImageIO::isSupported(job[imageKey].asString("")))
+            {
+                std::cerr << "Error: The job on line " << number << " of `" << path << "` needs an \"" << imageKey << "\" path ending in .png, .exr or .pfm." << std::endl;
+                return false;
+            }
+            jobs.push_back(std::move(job));
+            lineNumbers.push_back(number);
+        }
+
+        if (jobs.empty()) std::cerr << "Error: No jobs in `" << path << "`." << std::endl;
+        return !jobs.empty();
+    }
+
+    // Writes `jobs` back over the lines they were read from, leaving the others as they were
+    static bool rewrite(const std::string &path, const std::vector<Json> &jobs, const std::vector<int> &lineNumbers)
+    {
+        std::vector<std::string> lines;
+        {
+            std::ifstream file(path);
+            std::string line;
+            while (std::getline(file, line)) lines.push_back(line);
+        }
+        for (size_t i = 0; i < jobs.size(); i++) lines[lineNumbers[i] - 1] = jobs[i].dump();
+
+        std::ofstream file(path);
+        for (const std::string &line : lines) file << line << "\n";
+        if (!file.good()) std::cerr << "Error: Could not write `" << path << "`." << std::endl;
+        return file.good();
+    }
+
+private:
+
+    // Inline scene: "materials" [{"albedo", "roughness", "reflectance", "emission", "emissionStrength"}] and "spheres"
+    // [{"center", "radius", "material"}]
+    static bool parseSpheres(Renderer &renderer, const Json &scene, std::string &error)
+    {
+        std::vector<Material> materials;
+        for (const Json &item : scene["materials"].items)
+        {
+            Material material;
+            material.albedo = item["albedo"].asVec3(material.albedo);
+            material.roughness = item["roughness"].asNumber(material.roughness);
+            material.reflectivity = item["reflectance"].asNumber(material.reflectivity);
+            material.emissionColour = item["emission"].asVec3(material.emissionColour);
+            material.emissionStrength = item["emissionStrength"].asNumber(material.emissionStrength);
+            materials.push_back(material);
+        }
+        if (materials.empty()) materials.push_back(Material());
+
+        std::vector<Sphere> spheres;
+        for (const Json &item : scene["spheres"].items)
+        {
+            int material = item["material"].asInt(0);
+            float radius = item["radius"].asNumber(1.0);
+            if (material < 0 || material >= (int)materials.size() || radius <= 0.0)
+            {
+                error = "sphere " + std::to_string(spheres.size()) + " needs a positive radius and an existing material";
+                return false;
+            }
+            spheres.push_back(Sphere(material, item["center"].asVec3(glm::vec3(0.0)), radius));
+        }
+        if (spheres.empty())
+        {
+            error = "the scene needs a \"file\", \"generate\" or \"spheres\"";
+            return false;
+        }
+
+        renderer.setScene(std::move(materials), std::move(spheres));
+        return true;
+    }
+
+};
+
+#endif
@@ -0,0 +1,303 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <glm/glm.hpp>
+
+// Just enough JSON for the render server's requests: a value tree, a parser reporting the first error and lookups with
+// defaults. Objects keep their keys in order, numbers are doubles
+class Json
+{
+public:
+
+    enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<Json> items;
+    std::vector<std::pair<std::string, Json>> members;
+
+    Json() {}
+
+    bool isNull() const { return type == NUL; }
+    bool isObject() const { return type == OBJECT; }
+    bool isArray() const { return type == ARRAY; }
+
+    // Member `key` of an object, a null value when there is none
+    const Json &operator[](const std::string &key) const
+    {
+        for (const std::pair<std::string, Json> &member : members)
+            if (member.first == key) return member.second;
+        return null();
+    }
+
+    bool has(const std::string &key) const { return !(*this)[key].isNull(); }
+
+    double asNumber(double fallback) const { return (type == NUMBER) ? number : fallback; }
+    int asInt(int fallback) const { return (type == NUMBER) ? (int)number : fallback; }
+    bool asBool(bool fallback) const { return (type == BOOLEAN) ? boolean : fallback; }
+    std::string asString(const std::string &fallback) const { return (type == STRING) ? string : fallback; }
+
+    // [x, y, z]
+    glm::vec3 asVec3(glm::vec3 fallback) const
+    {
+        if (type != ARRAY || items.size() != 3) return fallback;
+        return glm::vec3(items[0].asNumber(fallback.x), items[1].asNumber(fallback.y), items[2].asNumber(fallback.z));
+    }
+
+    static Json fromNumber(double value)
+    {
+        Json json;
+        json.type = NUMBER;
+        json.number = value;
+        return json;
+    }
+
+    static Json object()
+    {
+        Json json;
+        json.type = OBJECT;
+        return json;
+    }
+
+    // Sets member `key` of an object, adding it after the others if it's missing
+    void set(const std::string &key, const Json &value)
+    {
+        for (std::pair<std::string, Json> &member : members)
+            if (member.first == key)
+            {
+                member.second = value;
+                return;
+            }
+        members.emplace_back(key, value);
+    }
+
+    // Compact text of the value, equal values dump the same
+    std::string dump() const
+    {
+        char buffer[32];
+        switch (type)
+        {
+            case NUL: return "null";
+            case BOOLEAN: return boolean ? "true" : "false";
+            case NUMBER:
+                // The shortest of these that reads back the same number
+                snprintf(buffer, sizeof(buffer), "%.15g", number);
+                if (strtod(buffer, NULL) != number) snprintf(buffer, sizeof(buffer), "%.17g", number);
+                return buffer;
+            case STRING: return quote(string);
+            case ARRAY:
+            {
+                std::string text = "[";
+                for (size_t i = 0; i < items.size(); i++) text += (i ? "," : "") + items[i].dump();
+                return text + "]";
+            }
+            case OBJECT:
+            {
+                std::string text = "{";
+                for (size_t i = 0; i < members.size(); i++) text += (i ? "," : "") + quote(members[i].first) + ":" + members[i].second.dump();
+                return text + "}";
+            }
+        }
+        return "null";
+    }
+
+    // Parses all of `text` into `value`, on failure `error` says what and where
+    static bool parse(const std::string &text, Json &value, std::string &error)
+    {
+        Parser parser = { text, 0, "" };
+        bool ok = parser.value(value, 0);
+        parser.whitespace();
+        if (ok && parser.position != text.size()) ok = parser.fail("unexpected text after the value");
+        if (!ok) error = parser.error;
+        return ok;
+    }
+
+private:
+
+    static const Json &null()
+    {
+        static const Json value;
+        return value;
+    }
+
+    static std::string quote(const std::string &text)
+    {
+        std::string quoted = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\') quoted += '\\';
+            if ((unsigned char)c < 0x20)
+            {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                quoted += escape;
+            }
+            else quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+    struct Parser
+    {
+        const std::string &text;
+        size_t position;
+        std::string error;
+
+        bool fail(const char *reason)
+        {
+            error = std::string(reason) + " at offset " + std::to_string(position);
+            return false;
+        }
+
+        void whitespace()
+        {
+            while (position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r'))
+                position++;
+        }
+
+        bool literal(const char *word)
+        {
+            size_t length = strlen(word);
+            if (text.compare(position, length, word) != 0) return false;
+            position += length;
+            return true;
+        }
+
+        bool value(Json &value, int depth)
+        {
+            if (depth > 64) return fail("nested too deeply");
+            whitespace();
+            if (position >= text.size()) return fail("unexpected end");
+
+            char c = text[position];
+            if (c == '{') return object(value, depth);
+            if (c == '[') return array(value, depth);
+            if (c == '"')
+            {
+                value.type = STRING;
+                return string(value.string);
+            }
+            bool isTrue = literal("true");
+            if (isTrue || literal("false"))
+            {
+                value.type = BOOLEAN;
+                value.boolean = isTrue;
+                return true;
+            }
+            if (literal("null"))
+            {
+                value.type = NUL;
+                return true;
+            }
+
+            const char *start = text.c_str() + position;
+            char *end;
+            value.number = strtod(start, &end);
+            if (end == start) return fail("expected a value");
+            value.type = NUMBER;
+            position += end - start;
+            return true;
+        }
+
+        bool object(Json &value, int depth)
+        {
+            value.type = OBJECT;
+            position++;
+            whitespace();
+            if (position < text.size() && text[position] == '}')
+            {
+                position++;
+                return true;
+            }
+
+            while (true)
+            {
+                whitespace();
+                std::pair<std::string, Json> member;
+                if (position >= text.size() || text[position] != '"') return fail("expected a key");
+                if (!string(member.first)) return false;
+                whitespace();
+                if (position >= text.size() || text[position] != ':') return fail("expected ':'");
+                position++;
+                if (!this->value(member.second, depth + 1)) return false;
+                value.members.push_back(std::move(member));
+
+                whitespace();
+                if (position < text.size() && text[position] == ',') position++;
+                else if (position < text.size() && text[position] == '}') { position++; return true; }
+                else return fail("expected ',' or '}'");
+            }
+        }
+
+        bool array(Json &value, int depth)
+        {
+            value.type = ARRAY;
+            position++;
+            whitespace();
+            if (position < text.size() && text[position] == ']')
+            {
+                position++;
+                return true;
+            }
+
+            while (true)
+            {
+                value.items.push_back(Json());
+                if (!this->value(value.items.back(), depth + 1)) return false;
+
+                whitespace();
+                if (position < text.size() && text[position] == ',') position++;
+                else if (position < text.size() && text[position] == ']') { position++; return true; }
+                else return fail("expected ',' or ']'");
+            }
+        }
+
+        // Escapes are decoded, \u escapes to UTF-8 (surrogate pairs aren't joined)
+        bool string(std::string &out)
+        {
+            position++;
+            while (position < text.size() && text[position] != '"')
+            {
+                char c = text[position++];
+                if (c != '\\')
+                {
+                    out += c;
+                    continue;
+                }
+
+                if (position >= text.size()) break;
+                char escape = text[position++];
+                const char *plain = escape ? strchr("\"\\/bfnrt", escape) : NULL;
+                if (plain)
+                {
+                    const char decoded[] = "\"\\/\b\f\n\r\t";
+                    out += decoded[plain - "\"\\/bfnrt"];
+                }
+                else if (escape == 'u' && position + 4 <= text.size())
+                {
+                    unsigned code = strtoul(text.substr(position, 4).c_str(), NULL, 16);
+                    position += 4;
+                    if (code < 0x80) out += (char)code;
+                    else if (code < 0x800) { out += (char)(0xC0 | (code >> 6)); out += (char)(0x80 | (code & 0x3F)); }
+                    else { out += (char)(0xE0 | (code >> 12)); out += (char)(0x80 | ((code >> 6) & 0x3F)); out += (char)(0x80 | (code & 0x3F)); }
+                }
+                else return fail("bad escape");
+            }
+
+            if (position >= text.size()) return fail("unterminated string");
+            position++;
+            return true;
+        }
+    };
+
+};
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef LBVH_H
+#define LBVH_H
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include "bvh.h"
+#include "taskPool.h"
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// Linear BVH (Karras 2012, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees"): primitives are
+// sorted along a 63 bit Morton curve through their centres and every internal node is then found on its own from the
+// sorted codes, so each step runs in parallel. Much faster to build than splitting top down, the tree is somewhat worse
+class LinearBVHBuilder
+{
+public:
+
+    // Fills `bvh` with one primitive per leaf. An internal node whose children split the sorted range at `s` keeps them
+    // at 2s + 1 and 2s + 2, which gives the pairs (right child right after the left one) the traversal expects
+    static void build(BVH &bvh, const std::vector<AABB> &bounds, int threadCount = std::thread::hardware_concurrency())
+    {
+        uint32_t count = bounds.size();
+        threadCount = std::max(1, std::min(threadCount, (int)std::max(count / 4096, 1u)));
+        bvh.nodes.clear();
+        bvh.order.clear();
+
+        if (count <= 1)
+        {
+            BVHNode leaf = { glm::vec3(0.0), 0, glm::vec3(0.0), count };
+            if (count) { leaf.min = bounds[0].min; leaf.max = bounds[0].max; }
+            bvh.nodes.push_back(leaf);
+            bvh.order.assign(count, 0);
+            return;
+        }
+
+        // Morton codes of the centres, quantized over the bounds of all centres
+        std::vector<AABB> threadBounds(threadCount);
+        parallelFor(threadCount, count, [&](int t, uint32_t first, uint32_t last)
+        {
+            for (uint32_t i = first; i < last; i++) threadBounds[t].grow(bounds[i].centre());
+        });
+        AABB centreBounds;
+        for (const AABB &box : threadBounds) centreBounds.grow(box);
+        glm::vec3 scale = 2097151.0f / glm::max(centreBounds.extent(), glm::vec3(1e-30f));
+
+        std::vector<uint64_t> codes(count);
+        bvh.order.resize(count);
+        parallelFor(threadCount, count, [&](int, uint32_t first, uint32_t last)
+        {
+            for (uint32_t i = first; i < last; i++)
+            {
+                glm::vec3 cell = (bounds[i].centre() - centreBounds.min)*scale;
+                codes[i] = (expandBits(cell.x) << 2) | (expandBits(cell.y) << 1) | expandBits(cell.z);
+                bvh.order[i] = i;
+            }
+        });
+        radixSort(codes, bvh.order, threadCount);
+
+        // Internal nodes, each one works out its range and split from the codes alone
+        size_t nodeCount = 2*(size_t)count - 1;
+        bvh.nodes.resize(nodeCount);
+        std::vector<uint32_t> parents(nodeCount), leafSlots(count);
+        parents[0] = UINT32_MAX;
+        parallelFor(threadCount, count - 1, [&](int, uint32_t first, uint32_t last)
+        {
+            for (uint32_t i = first; i < last; i++)
+            {
+                int64_t rangeFirst, rangeLast;
+                findRange(codes, i, rangeFirst, rangeLast);
+                int64_t split = findSplit(codes, rangeFirst, rangeLast);
+
+                uint32_t slot = internalSlot(i, rangeLast);
+                uint32_t children = 2*split + 1;
+                bvh.nodes[slot].leftOrFirst = children;
+                bvh.nodes[slot].count = 0;
+                parents[children] = parents[children + 1] = slot;
+
+                // Ranges of one primitive are leaves, the other children are internal nodes that place themselves
+                if (split == rangeFirst) makeLeaf(bvh, bounds, split, children, leafSlots);
+                if (split + 1 == rangeLast) makeLeaf(bvh, bounds, split + 1, children + 1, leafSlots);
+            }
+        });
+
+        // Bounds bottom up, the second child to arrive at a node computes it and carries on
+        std::unique_ptr<std::atomic<uint32_t>[]> arrivals(new std::atomic<uint32_t>[nodeCount]);
+        for (size_t i = 0; i < nodeCount; i++) arrivals[i].store(0, std::memory_order_relaxed);
+        parallelFor(threadCount, count, [&](int, uint32_t first, uint32_t last)
+        {
+            for (uint32_t i = first; i < last; i++)
+            {
+                uint32_t node = parents[leafSlots[i]];
+                while (node != UINT32_MAX && arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 1)
+                {
+                    const BVHNode &left = bvh.nodes[bvh.nodes[node].leftOrFirst], &right = bvh.nodes[bvh.nodes[node].leftOrFirst + 1];
+                    bvh.nodes[node].min = glm::min(left.min, right.min);
+                    bvh.nodes[node].max = glm::max(left.max, right.max);
+                    node = parents[node];
+                }
+            }
+        });
+    }
+
+private:
+
+    // Spreads the low 21 bits of a quantized coordinate three bits apart
+    static uint64_t expandBits(float coordinate)
+    {
+        uint64_t x = (uint64_t)std::min(std::max(coordinate, 0.0f), 2097151.0f);
+        x = (x | x << 32) & 0x1f00000000ffffULL;
+        x = (x | x << 16) & 0x1f0000ff0000ffULL;
+        x = (x | x << 8) & 0x100f00f00f00f00fULL;
+        x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+        x = (x | x << 2) & 0x1249249249249249ULL;
+        return x;
+    }
+
+    static int countLeadingZeros(uint64_t x)
+    {
+        if (x == 0) return 64;
+        #ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, x);
+        return 63 - index;
+        #else
+        return __builtin_clzll(x);
+        #endif
+    }
+
+    // Length of the common prefix of the codes at i and j, equal codes are told apart by their index
+    static int delta(const std::vector<uint64_t> &codes, int64_t i, int64_t j)
+    {
+        if (j < 0 || j >= (int64_t)codes.size()) return -1;
+        if (codes[i] == codes[j]) return 64 + countLeadingZeros((uint64_t)(i ^ j));
+        return countLeadingZeros(codes[i] ^ codes[j]);
+    }
+
+    // The range covered by internal node i starts or ends at i and grows in the direction sharing the longer prefix
+    static void findRange(const std::vector<uint64_t> &codes, int64_t i, int64_t &first, int64_t &last)
+    {
+        int direction = (delta(codes, i, i + 1) - delta(codes, i, i - 1)) >= 0 ? 1 : -1;
+        int minimum = delta(codes, i, i - direction);
+
+        int64_t maxLength = 2;
+        while (delta(codes, i, i + maxLength*direction) > minimum) maxLength *= 2;
+
+        int64_t length = 0;
+        for (int64_t step = maxLength / 2; step >= 1; step /= 2)
+            if (delta(codes, i, i + (length + step)*direction) > minimum) length += step;
+
+        int64_t j = i + length*direction;
+        first = std::min(i, j);
+        last = std::max(i, j);
+    }
+
+    // Last index of the left half: where the highest bit differing across the range flips
+    static int64_t findSplit(const std::vector<uint64_t> &codes, int64_t first, int64_t last)
+    {
+        int prefix = delta(codes, first, last);
+        int64_t split = first, step = last - first;
+        do
+        {
+            step = (step + 1) / 2;
+            int64_t candidate = split + step;
+            if (candidate < last && delta(codes, first, candidate) > prefix) split = candidate;
+        }
+        while (step > 1);
+        return split;
+    }
+
+    // A left child's range ends at its index and a right child's starts there, the root is the only node covering [0, n)
+    static uint32_t internalSlot(uint32_t i, int64_t rangeLast)
+    {
+        if (i == 0) return 0;
+        return (i == rangeLast) ? 2*i + 1 : 2*i;
+    }
+
+    static void makeLeaf(BVH &bvh, const std::vector<AABB> &bounds, uint32_t sortedIndex, uint32_t slot, std::vector<uint32_t> &leafSlots)
+    {
+        const AABB &box = bounds[bvh.order[sortedIndex]];
+        bvh.nodes[slot] = BVHNode{ box.min, sortedIndex, box.max, 1 };
+        leafSlots[sortedIndex] = slot;
+    }
+
+    // Least significant digit first, 8 bits per pass. Each thread counts and scatters its own chunk, so the sort is stable
+    static void radixSort(std::vector<uint64_t> &keys, std::vector<uint32_t> &values, int threadCount)
+    {
+        uint32_t count = keys.size();
+        std::vector<uint64_t> keysOut(count);
+        std::vector<uint32_t> valuesOut(count);
+        std::vector<uint32_t> histograms(threadCount*256);
+
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            std::fill(histograms.begin(), histograms.end(), 0);
+            parallelFor(threadCount, count, [&](int t, uint32_t first, uint32_t last)
+            {
+                uint32_t *histogram = &histograms[t*256];
+                for (uint32_t i = first; i < last; i++) histogram[(keys[i] >> shift) & 0xFF]++;
+            });
+
+            // Skip digits every key shares, common in the high bits of small scenes
+            uint32_t total = 0;
+            for (int t = 0; t < threadCount; t++) total += histograms[t*256 + ((keys[0] >> shift) & 0xFF)];
+            if (total == count) continue;
+
+            // Exclusive prefix over (digit, thread) turns the counts into each thread's write offsets
+            uint32_t offset = 0;
+            for (int digit = 0; digit < 256; digit++)
+                for (int t = 0; t < threadCount; t++)
+                {
+                    uint32_t digitCount = histograms[t*256 + digit];
+                    histograms[t*256 + digit] = offset;
+                    offset += digitCount;
+                }
+
+            parallelFor(threadCount, count, [&](int t, uint32_t first, uint32_t last)
+            {
+                uint32_t *offsets = &histograms[t*256];
+                for (uint32_t i = first; i < last; i++)
+                {
+                    uint32_t destination = offsets[(keys[i] >> shift) & 0xFF]++;
+                    keysOut[destination] = keys[i];
+                    valuesOut[destination] = values[i];
+                }
+            });
+            keys.swap(keysOut);
+            values.swap(valuesOut);
+        }
+    }
+
+    // Splits [0, count) into one contiguous chunk per thread, run on the task pool
+    template <typename Function>
+    static void parallelFor(int threadCount, uint32_t count, Function function)
+    {
+        if (threadCount <= 1)
+        {
+            function(0, 0, count);
+            return;
+        }
+        TaskPool::global().parallelChunks(threadCount, [&](int t)
+        {
+            function(t, (uint64_t)count*t / threadCount, (uint64_t)count*(t + 1) / threadCount);
+        });
+    }
+
+};
+
+#endif
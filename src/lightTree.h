@@ -0,0 +1,180 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "sphere.h"
+#include "material.h"
+#include "shader.h"
+#include "bvh.h"
+#include "profiler.h"
+#include "textureBuffer.h"
+
+// Two vec4 texels on the GPU: (min, children or lights) and (max, power)
+struct LightNode
+{
+    glm::vec3 min;
+    uint32_t info;              // Left child (the right one follows it) or first slot of a leaf in the low 24 bits, lights
+                                // in a leaf in the high 8 (0 for interior nodes)
+    glm::vec3 max;
+    float power;                // Summed over the lights below
+
+    bool isLeaf() const { return (info >> 24) > 0; }
+};
+
+static_assert(sizeof(LightNode) == 32, "LightNode must be two vec4 texels");
+
+// Hierarchy over the emissive spheres for direct lighting. The direct tracer walks it from the root, picking each child
+// with a probability proportional to a bound on the light it sends to the shaded point: its power over the squared
+// distance, times the largest cosine its bounds make with the normal. One light costs O(log L) instead of looping over
+// all of them. Spheres emit the same way in every direction, so unlike area lights the nodes need no orientation cones
+class LightTree
+{
+public:
+
+    static const uint32_t maxLights = 1u << 23;     // Interior node indices have to fit in 24 bits
+
+    double lastBuildSeconds = 0.0;
+
+    LightTree() {}
+
+    LightTree(const LightTree &) = delete;
+    LightTree &operator=(const LightTree &) = delete;
+    LightTree(LightTree &&other) { *this = std::move(other); }
+
+    LightTree &operator=(LightTree &&other)
+    {
+        if (this == &other) return *this;
+        nodes = std::move(other.nodes);
+        lights = std::move(other.lights);
+        lastBuildSeconds = other.lastBuildSeconds;
+        for (int i = 0; i < 2; i++)
+        {
+            std::swap(buffers[i], other.buffers[i]);
+            std::swap(textures[i], other.textures[i]);
+        }
+        return *this;
+    }
+
+    size_t lightCount() const { return lights.size(); }
+
+    // Emitted power up to constant factors: radiance luminance times projected area
+    static float power(const Sphere &sphere, const Material &material)
+    {
+        glm::vec3 emission = material.emissionColour*material.emissionStrength;
+        return std::max(0.2126f*emission.x + 0.7152f*emission.y + 0.0722f*emission.z, 0.0f)*sphere.radius*sphere.radius;
+    }
+
+    void build(const Sphere *spheres, size_t count, const std::vector<Material> &materials)
+    {
+        PROFILE_SCOPE("LightTree::build");
+        double start = glfwGetTime();
+
+        std::vector<uint32_t> emissive;
+        std::vector<AABB> bounds;
+        std::vector<float> powers;
+        for (size_t i = 0; i < count; i++)
+        {
+            const Sphere &sphere = spheres[i];
+            if (sphere.material < 0 || (size_t)sphere.material >= materials.size()) continue;
+            const Material &material = materials[sphere.material];
+            float lightPower = power(sphere, material);
+            if (material.emissionStrength <= 0.0f || !(lightPower > 0.0f)) continue;
+            if (emissive.size() == maxLights)
+            {
+                std::cerr << "Warning: Only the first " << maxLights << " emissive spheres are sampled as lights." << std::endl;
+                break;
+            }
+
+            AABB box;
+            box.grow(sphere.position - sphere.radius);
+            box.grow(sphere.position + sphere.radius);
+            emissive.push_back(i);
+            bounds.push_back(box);
+            powers.push_back(lightPower);
+        }
+
+        nodes.clear();
+        lights.clear();
+        if (!emissive.empty())
+        {
+            // Small leaves keep the importance sharp, the SAH groups lights that sit close together
+            BVH bvh;
+            bvh.method = BVH::SAH;
+            bvh.maxLeafSize = 1;
+            bvh.build(bounds);
+
+            lights.resize(bvh.order.size());
+            for (size_t slot = 0; slot < bvh.order.size(); slot++) lights[slot] = emissive[bvh.order[slot]];
+
+            // Children always follow their parents, so summing backwards sees them first
+            nodes.resize(bvh.nodes.size());
+            for (size_t i = bvh.nodes.size(); i-- > 0;)
+            {
+                const BVHNode &node = bvh.nodes[i];
+                LightNode &light = nodes[i];
+                light.min = node.min;
+                light.max = node.max;
+                light.info = node.leftOrFirst | (node.count << 24);
+                if (node.isLeaf())
+                {
+                    light.power = 0.0f;
+                    for (uint32_t slot = node.leftOrFirst; slot < node.leftOrFirst + node.count; slot++) light.power += powers[bvh.order[slot]];
+                }
+                else light.power = nodes[node.leftOrFirst].power + nodes[node.leftOrFirst + 1].power;
+            }
+        }
+
+        lastBuildSeconds = glfwGetTime() - start;
+    }
+
+
+    // * GPU
+
+    void initGPU()
+    {
+        glGenBuffers(2, buffers);
+        glGenTextures(2, textures);
+    }
+
+    void release()
+    {
+        if (buffers[0]) glDeleteBuffers(2, buffers);
+        if (textures[0]) glDeleteTextures(2, textures);
+        buffers[0] = buffers[1] = textures[0] = textures[1] = 0;
+    }
+
+    void upload()
+    {
+        uploadTextureBuffer(buffers[0], textures[0], GL_RGBA32UI, nodes.data(), nodes.size()*sizeof(LightNode));
+        uploadTextureBuffer(buffers[1], textures[1], GL_R32UI, lights.data(), lights.size()*sizeof(uint32_t));
+    }
+
+    void bind(const Shader &shader, int firstUnit) const
+    {
+        const char *names[2] = { "lightNodeData", "lightData" };
+        for (int i = 0; i < 2; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            shader.setInt(names[i], firstUnit + i);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("lightCount", lights.size());
+    }
+
+private:
+
+    std::vector<LightNode> nodes;
+    std::vector<uint32_t> lights;       // Sphere stored at each leaf slot
+
+    GLuint buffers[2] = { 0 }, textures[2] = { 0 };     // Nodes and leaf lights
+
+};
+
+#endif
@@ -1,9 +1,31 @@
 #include <iostream>
 #include "app.h"
+#include "sequenceMode.h"
+#include "distributedMode.h"
+#include "serverMode.h"
+#include "batchMode.h"
+#include "regressionMode.h"
 
-int main()
+int main(int argc, char **argv)
 {
-    App app(1000, 800);
+    Options options = parseOptions(argc, argv);
+    Profiler::setEnabled(!options.profilePath.empty());
+    Profiler::beginStartup();
+    TaskPool::configure(options.poolThreads, options.pinThreads);
+    App app(options);
+
+    if (options.bvhBenchmarkThreads >= 0) return app.benchmarkBVH();
+    if (!options.workerAddress.empty()) return DistributedMode::runWorker(app);
+    if (options.workersBenchmark > 0) return DistributedMode::benchmark(app);
+    if (options.saveOnly) return 0;
+    if (options.servePort > 0) return ServerMode::run(app);
+    if (!options.jobsPath.empty()) return BatchMode::run(app);
+    if (!options.regressPath.empty()) return RegressionMode::run(app);
+
+    if (options.workers > 0 || options.workerPort > 0) return DistributedMode::render(app);
+
+    if (options.sequence) return SequenceMode::run(app);
+    if (options.headless) return app.renderHeadless();
     app.loop();
     
     return 0;
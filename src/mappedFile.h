@@ -0,0 +1,143 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <string>
+#include <iostream>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// Read only view of a whole file, private (copy-on-write) so the contents can be edited in place without reaching the file
+class MappedFile
+{
+public:
+
+    MappedFile() {}
+
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) { *this = std::move(other); }
+
+    MappedFile &operator=(MappedFile &&other)
+    {
+        if (this == &other) return *this;
+        close();
+
+        mapping = other.mapping;
+        mappingSize = other.mappingSize;
+        other.mapping = NULL;
+        other.mappingSize = 0;
+        #ifdef _WIN32
+        fileHandle = other.fileHandle; mappingHandle = other.mappingHandle;
+        other.fileHandle = other.mappingHandle = NULL;
+        #endif
+        return *this;
+    }
+
+    char *data() const { return (char*)mapping; }
+    size_t size() const { return mappingSize; }
+    bool isOpen() const { return mapping != NULL; }
+
+    #ifdef _WIN32
+
+    bool open(const std::string &path)
+    {
+        close();
+
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            std::cerr << "Error: Could not open `" << path << "`." << std::endl;
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        HANDLE fileMapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        void *view = fileMapping ? MapViewOfFile(fileMapping, FILE_MAP_COPY, 0, 0, 0) : NULL;
+        if (!view)
+        {
+            std::cerr << "Error: Could not map `" << path << "`." << std::endl;
+            if (fileMapping) CloseHandle(fileMapping);
+            CloseHandle(file);
+            return false;
+        }
+
+        mapping = view;
+        mappingSize = fileSize.QuadPart;
+        fileHandle = file;
+        mappingHandle = fileMapping;
+        return true;
+    }
+
+    void close()
+    {
+        if (mapping) UnmapViewOfFile(mapping);
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle) CloseHandle(fileHandle);
+        mapping = NULL;
+        mappingSize = 0;
+        mappingHandle = fileHandle = NULL;
+    }
+
+    #else
+
+    bool open(const std::string &path)
+    {
+        close();
+
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0)
+        {
+            std::cerr << "Error: Could not open `" << path << "`." << std::endl;
+            return false;
+        }
+
+        struct stat info;
+        fstat(file, &info);
+        size_t size = info.st_size;
+
+        void *view = (size > 0) ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0) : MAP_FAILED;
+        ::close(file);
+        if (view == MAP_FAILED)
+        {
+            std::cerr << "Error: Could not map `" << path << "`." << std::endl;
+            return false;
+        }
+
+        // Files are read front to back right after being mapped
+        madvise(view, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+        mapping = view;
+        mappingSize = size;
+        return true;
+    }
+
+    void close()
+    {
+        if (mapping) munmap(mapping, mappingSize);
+        mapping = NULL;
+        mappingSize = 0;
+    }
+
+    #endif
+
+private:
+
+    void *mapping = NULL;
+    size_t mappingSize = 0;
+    #ifdef _WIN32
+    HANDLE fileHandle = NULL, mappingHandle = NULL;
+    #endif
+
+};
+
+#endif
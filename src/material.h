@@ -14,7 +14,11 @@ public:
     float emissionStrength;
     
     float reflectivity;
-    float _pad[3];
+    float _pad[3] = { 0.0, 0.0, 0.0 };
+
+    Material()
+        : Material(glm::vec3(0.5), 0.5, glm::vec3(0.0), 0.0, 0.5)
+    {}
 
     Material(glm::vec3 albedo, float roughness, glm::vec3 emissionColour, float emissionStrength, float reflectance)
         : albedo(albedo)
@@ -0,0 +1,708 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <iostream>
+#include "bvh.h"
+#include "mappedFile.h"
+#include "taskPool.h"
+
+// Triangle mesh in flat buffers, triangles are (v0, v1, v2, material) and ordered to match the leaves of `nodes`
+struct Mesh
+{
+    std::vector<glm::vec4> vertices;        // w is unused, vec4 so the GPU can fetch a vertex in one texel
+    std::vector<glm::uvec4> triangles;
+    std::vector<BVHNode> nodes;
+    AABB bounds;
+
+    size_t triangleCount() const { return triangles.size(); }
+
+    void buildBVH()
+    {
+        std::vector<AABB> triangleBounds(triangles.size());
+        bounds = AABB();
+        for (size_t i = 0; i < triangles.size(); i++)
+        {
+            for (int k = 0; k < 3; k++) triangleBounds[i].grow(glm::vec3(vertices[triangles[i][k]]));
+            bounds.grow(triangleBounds[i]);
+        }
+
+        BVH bvh;
+        bvh.build(triangleBounds);
+
+        // Reorder the triangles so leaves index them directly
+        std::vector<glm::uvec4> ordered(triangles.size());
+        for (size_t i = 0; i < triangles.size(); i++) ordered[i] = triangles[bvh.order[i]];
+        triangles = std::move(ordered);
+        nodes = std::move(bvh.nodes);
+    }
+};
+
+// Loads Wavefront OBJ and PLY (ascii and binary) meshes, splitting the parsing of large files across threads
+class MeshLoader
+{
+public:
+
+    static bool load(const std::string &path, Mesh &mesh, int threadCount = std::thread::hardware_concurrency())
+    {
+        MappedFile file;
+        if (!file.open(path)) return false;
+
+        threadCount = std::max(threadCount, 1);
+        mesh = Mesh();
+
+        std::string ext = path.substr(path.find_last_of('.') + 1);
+        for (char &c : ext) c = tolower(c);
+
+        bool loaded;
+        if (ext == "obj") loaded = loadOBJ(file.data(), file.data() + file.size(), mesh, threadCount);
+        else if (ext == "ply") loaded = loadPLY(file.data(), file.data() + file.size(), mesh, threadCount);
+        else
+        {
+            std::cerr << "Error: Unsupported mesh format `" << path << "`, use .obj or .ply." << std::endl;
+            return false;
+        }
+
+        // Drop faces pointing at vertices that don't exist
+        size_t vertexCount = mesh.vertices.size();
+        mesh.triangles.erase(std::remove_if(mesh.triangles.begin(), mesh.triangles.end(), [vertexCount](const glm::uvec4 &t)
+        {
+            return t.x >= vertexCount || t.y >= vertexCount || t.z >= vertexCount;
+        }), mesh.triangles.end());
+
+        if (!loaded || mesh.triangles.empty())
+        {
+            std::cerr << "Error: Could not load a mesh from `" << path << "`." << std::endl;
+            return false;
+        }
+
+        mesh.buildBVH();
+        return true;
+    }
+
+private:
+
+    // * Parsing helpers, faster than strtof and independent of the locale
+
+    static const char *skipSpaces(const char *p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        return p;
+    }
+
+    static const char *nextLine(const char *p, const char *end)
+    {
+        const char *newline = (const char*)memchr(p, '\n', end - p);
+        return newline ? newline + 1 : end;
+    }
+
+    static const char *parseFloat(const char *p, const char *end, float *value)
+    {
+        p = skipSpaces(p, end);
+        bool negative = (p < end && *p == '-');
+        if (p < end && (*p == '-' || *p == '+')) p++;
+
+        double number = 0.0;
+        while (p < end && *p >= '0' && *p <= '9') number = number*10.0 + (*p++ - '0');
+        if (p < end && *p == '.')
+        {
+            p++;
+            double scale = 0.1;
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                number += (*p++ - '0')*scale;
+                scale *= 0.1;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            p++;
+            bool negativeExponent = (p < end && *p == '-');
+            if (p < end && (*p == '-' || *p == '+')) p++;
+            int exponent = 0;
+            while (p < end && *p >= '0' && *p <= '9') exponent = exponent*10 + (*p++ - '0');
+            number *= pow(10.0, negativeExponent ? -exponent : exponent);
+        }
+
+        *value = negative ? -number : number;
+        return p;
+    }
+
+    static const char *parseInt(const char *p, const char *end, long *value, bool *found)
+    {
+        p = skipSpaces(p, end);
+        bool negative = (p < end && *p == '-');
+        if (p < end && (*p == '-' || *p == '+')) p++;
+
+        long number = 0;
+        *found = (p < end && *p >= '0' && *p <= '9');
+        while (p < end && *p >= '0' && *p <= '9') number = number*10 + (*p++ - '0');
+        *value = negative ? -number : number;
+        return p;
+    }
+
+    // Start of the line containing `p`, or of the next one, so every thread starts on a line boundary
+    static const char *alignToLine(const char *begin, const char *p, const char *end)
+    {
+        if (p <= begin) return begin;
+        if (p >= end) return end;
+        return (p[-1] == '\n') ? p : nextLine(p, end);
+    }
+
+
+    // * OBJ
+
+    struct OBJChunk
+    {
+        const char *begin, *end;
+        size_t vertexCount = 0, firstVertex = 0;
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec4> triangles;
+    };
+
+    static bool loadOBJ(const char *begin, const char *end, Mesh &mesh, int threadCount)
+    {
+        // Small files aren't worth the threads
+        if (end - begin < (1 << 20)) threadCount = 1;
+
+        std::vector<OBJChunk> chunks(threadCount);
+        for (int i = 0; i < threadCount; i++)
+        {
+            chunks[i].begin = alignToLine(begin, begin + (end - begin)*i / threadCount, end);
+            chunks[i].end = alignToLine(begin, begin + (end - begin)*(i + 1) / threadCount, end);
+        }
+
+        // Faces can use negative (relative) indices, so each chunk needs to know how many vertices come before it
+        parallelFor(threadCount, [&](int i) { chunks[i].vertexCount = countOBJVertices(chunks[i].begin, chunks[i].end); });
+        for (int i = 1; i < threadCount; i++) chunks[i].firstVertex = chunks[i - 1].firstVertex + chunks[i - 1].vertexCount;
+
+        parallelFor(threadCount, [&](int i) { parseOBJ(chunks[i]); });
+
+        size_t vertexCount = 0, triangleCount = 0;
+        for (OBJChunk &chunk : chunks)
+        {
+            vertexCount += chunk.vertices.size();
+            triangleCount += chunk.triangles.size();
+        }
+
+        mesh.vertices.reserve(vertexCount);
+        mesh.triangles.reserve(triangleCount);
+        for (OBJChunk &chunk : chunks)
+        {
+            mesh.vertices.insert(mesh.vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+            mesh.triangles.insert(mesh.triangles.end(), chunk.triangles.begin(), chunk.triangles.end());
+        }
+
+        return true;
+    }
+
+    static size_t countOBJVertices(const char *p, const char *end)
+    {
+        size_t count = 0;
+        while (p < end)
+        {
+            p = skipSpaces(p, end);
+            if (end - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) count++;
+            p = nextLine(p, end);
+        }
+        return count;
+    }
+
+    static void parseOBJ(OBJChunk &chunk)
+    {
+        const char *p = chunk.begin, *end = chunk.end;
+        std::vector<uint32_t> face;
+        size_t vertexIndex = chunk.firstVertex;
+
+        while (p < end)
+        {
+            p = skipSpaces(p, end);
+            const char *lineEnd = nextLine(p, end);
+
+            if (lineEnd - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                glm::vec4 vertex(0.0, 0.0, 0.0, 1.0);
+                const char *q = p + 2;
+                for (int k = 0; k < 3; k++) q = parseFloat(q, lineEnd, &vertex[k]);
+                chunk.vertices.push_back(vertex);
+                vertexIndex++;
+            }
+            else if (lineEnd - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                // `f v`, `f v/vt`, `f v//vn` or `f v/vt/vn`, only positions are used
+                face.clear();
+                const char *q = p + 2;
+                while (true)
+                {
+                    long index;
+                    bool found;
+                    q = parseInt(q, lineEnd, &index, &found);
+                    if (!found) break;
+
+                    face.push_back(index < 0 ? vertexIndex + index : index - 1);
+                    while (q < lineEnd && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n') q++;
+                }
+
+                // Fan triangulation of polygons
+                for (size_t k = 2; k < face.size(); k++) chunk.triangles.push_back(glm::uvec4(face[0], face[k - 1], face[k], 0));
+            }
+
+            p = lineEnd;
+        }
+    }
+
+
+    // * PLY
+
+    enum PLYType { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64, INVALID };
+
+    struct PLYProperty
+    {
+        std::string name;
+        PLYType type = INVALID;
+        PLYType countType = INVALID;        // Set for lists
+    };
+
+    struct PLYElement
+    {
+        std::string name;
+        size_t count = 0;
+        std::vector<PLYProperty> properties;
+    };
+
+    static PLYType plyType(const std::string &name)
+    {
+        if (name == "char" || name == "int8") return INT8;
+        if (name == "uchar" || name == "uint8") return UINT8;
+        if (name == "short" || name == "int16") return INT16;
+        if (name == "ushort" || name == "uint16") return UINT16;
+        if (name == "int" || name == "int32") return INT32;
+        if (name == "uint" || name == "uint32") return UINT32;
+        if (name == "float" || name == "float32") return FLOAT32;
+        if (name == "double" || name == "float64") return FLOAT64;
+        return INVALID;
+    }
+
+    static int plySize(PLYType type)
+    {
+        static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+        return sizes[type];
+    }
+
+    // Longest list a face may hold, a larger count means a corrupt file rather than a huge polygon
+    static const size_t MAX_PLY_LIST = 1024;
+
+    // Whether a face list can have `count` entries, the vertex indices must make at least a triangle
+    static bool plyListFits(double count, bool indices)
+    {
+        return count >= (indices ? 3 : 0) && count <= MAX_PLY_LIST;
+    }
+
+    static double readBinary(const char *p, PLYType type, bool swap)
+    {
+        char bytes[8];
+        int size = plySize(type);
+        for (int i = 0; i < size; i++) bytes[i] = swap ? p[size - 1 - i] : p[i];
+
+        switch (type)
+        {
+            case INT8: return *(int8_t*)bytes;
+            case UINT8: return *(uint8_t*)bytes;
+            case INT16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+            case UINT16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+            case INT32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+            case UINT32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+            case FLOAT32: { float v; memcpy(&v, bytes, 4); return v; }
+            case FLOAT64: { double v; memcpy(&v, bytes, 8); return v; }
+            default: return 0.0;
+        }
+    }
+
+    static bool loadPLY(const char *begin, const char *end, Mesh &mesh, int threadCount)
+    {
+        // Header
+        const char *p = begin;
+        std::vector<PLYElement> elements;
+        std::string format;
+        bool headerDone = false;
+        while (p < end && !headerDone)
+        {
+            const char *lineEnd = nextLine(p, end);
+            std::string line(p, lineEnd);
+            while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
+            p = lineEnd;
+
+            char word[64] = "", a[64] = "", b[64] = "", c[64] = "";
+            sscanf(line.c_str(), "%63s %63s %63s %63s", word, a, b, c);
+            if (!strcmp(word, "format")) format = a;
+            else if (!strcmp(word, "element"))
+            {
+                PLYElement element;
+                element.name = a;
+                element.count = strtoull(b, NULL, 10);
+                elements.push_back(element);
+            }
+            else if (!strcmp(word, "property") && !elements.empty())
+            {
+                PLYProperty property;
+                if (!strcmp(a, "list"))
+                {
+                    property.countType = plyType(b);
+                    property.type = plyType(c);
+                    sscanf(line.c_str(), "%*s %*s %*s %*s %63s", word);
+                    property.name = word;
+                }
+                else
+                {
+                    property.type = plyType(a);
+                    property.name = b;
+                }
+
+                if (property.type == INVALID) return false;
+                elements.back().properties.push_back(property);
+            }
+            else if (!strcmp(word, "end_header")) headerDone = true;
+        }
+        if (!headerDone) return false;
+
+        bool ascii = (format == "ascii");
+        bool swap = (format == "binary_big_endian");
+        if (!ascii && !swap && format != "binary_little_endian") return false;
+
+        for (const PLYElement &element : elements)
+        {
+            // Small elements aren't worth the threads
+            int threads = (element.count < (1 << 16)) ? 1 : threadCount;
+            if (element.name == "vertex") p = ascii ? readPLYVerticesASCII(p, end, element, mesh, threads) : readPLYVerticesBinary(p, end, element, swap, mesh, threads);
+            else if (element.name == "face") p = ascii ? readPLYFacesASCII(p, end, element, mesh, threads) : readPLYFacesBinary(p, end, element, swap, mesh, threads);
+            else p = ascii ? skipPLYASCII(p, end, element) : skipPLYBinary(p, end, element, swap);
+
+            if (!p) return false;
+        }
+
+        return true;
+    }
+
+    static int findProperty(const PLYElement &element, const char *name)
+    {
+        for (size_t i = 0; i < element.properties.size(); i++)
+            if (element.properties[i].name == name) return i;
+        return -1;
+    }
+
+    static int findFaceIndices(const PLYElement &element)
+    {
+        int index = findProperty(element, "vertex_indices");
+        return (index >= 0) ? index : findProperty(element, "vertex_index");
+    }
+
+    static const char *readPLYVerticesBinary(const char *p, const char *end, const PLYElement &element, bool swap, Mesh &mesh, int threadCount)
+    {
+        // Vertices without list properties have a fixed stride, so they decode in parallel
+        int stride = 0;
+        int offsets[3] = { -1, -1, -1 };
+        PLYType types[3] = { INVALID, INVALID, INVALID };
+        const char *names[3] = { "x", "y", "z" };
+        for (const PLYProperty &property : element.properties)
+        {
+            if (property.countType != INVALID) return NULL;
+            for (int k = 0; k < 3; k++)
+                if (property.name == names[k])
+                {
+                    offsets[k] = stride;
+                    types[k] = property.type;
+                }
+            stride += plySize(property.type);
+        }
+        if (offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0) return NULL;
+        if ((size_t)(end - p) < element.count*stride) return NULL;
+
+        mesh.vertices.resize(element.count);
+        parallelFor(threadCount, [&](int t)
+        {
+            size_t first = element.count*t / threadCount, last = element.count*(t + 1) / threadCount;
+            for (size_t i = first; i < last; i++)
+            {
+                const char *vertex = p + i*stride;
+                for (int k = 0; k < 3; k++) mesh.vertices[i][k] = readBinary(vertex + offsets[k], types[k], swap);
+                mesh.vertices[i].w = 1.0;
+            }
+        });
+
+        return p + element.count*stride;
+    }
+
+    // Size of the face starting at `p`, 0 if it runs past `end` or a list count doesn't fit. `listCounts` gets the length
+    // of each list property
+    static size_t plyRecordSize(const char *p, const char *end, const PLYElement &element, int indicesProperty, bool swap, size_t *listCounts)
+    {
+        const char *record = p;
+        for (size_t j = 0; j < element.properties.size(); j++)
+        {
+            const PLYProperty &property = element.properties[j];
+            size_t count = 1;
+            if (property.countType != INVALID)
+            {
+                if (end - p < plySize(property.countType)) return 0;
+                double listCount = readBinary(p, property.countType, swap);
+                if (!plyListFits(listCount, (int)j == indicesProperty)) return 0;
+                count = listCount;
+                p += plySize(property.countType);
+                listCounts[j] = count;
+            }
+            if ((size_t)(end - p) < count*plySize(property.type)) return 0;
+            p += count*plySize(property.type);
+        }
+        return p - record;
+    }
+
+    // Where the entries of list `list` start in a face whose lists have `listCounts` entries
+    static size_t plyListOffset(const PLYElement &element, int list, const size_t *listCounts)
+    {
+        size_t offset = 0;
+        for (int j = 0; j < list; j++)
+        {
+            const PLYProperty &property = element.properties[j];
+            offset += (property.countType != INVALID) ? plySize(property.countType) + listCounts[j]*plySize(property.type) : plySize(property.type);
+        }
+        return offset + plySize(element.properties[list].countType);
+    }
+
+    static void addPLYFace(const char *indices, size_t count, PLYType type, bool swap, std::vector<uint32_t> &face, std::vector<glm::uvec4> &triangles)
+    {
+        face.resize(count);
+        for (size_t k = 0; k < count; k++) face[k] = readBinary(indices + k*plySize(type), type, swap);
+        for (size_t k = 2; k < count; k++) triangles.push_back(glm::uvec4(face[0], face[k - 1], face[k], 0));
+    }
+
+    static const char *readPLYFacesBinary(const char *p, const char *end, const PLYElement &element, bool swap, Mesh &mesh, int threadCount)
+    {
+        int indicesProperty = findFaceIndices(element);
+        if (indicesProperty < 0) return NULL;
+        if (element.count == 0) return p;
+
+        const PLYProperty &indices = element.properties[indicesProperty];
+        size_t propertyCount = element.properties.size();
+        std::vector<size_t> firstCounts(propertyCount, 0);
+        size_t stride = plyRecordSize(p, end, element, indicesProperty, swap, firstCounts.data());
+        if (stride == 0) return NULL;
+
+        // Faces with lists have no fixed size, so a thread can't tell where its first face starts. Most files only hold
+        // triangles though: assume every face is laid out like the first one and decode at a fixed stride, checking each
+        // list count on the way
+        std::vector<std::vector<glm::uvec4>> triangles(threadCount);
+        std::vector<char> fits(threadCount, (size_t)(end - p) / stride >= element.count);
+        if (fits[0])
+        {
+            std::vector<size_t> countOffsets;
+            for (size_t j = 0; j < propertyCount; j++)
+                if (element.properties[j].countType != INVALID) countOffsets.push_back(plyListOffset(element, j, firstCounts.data()) - plySize(element.properties[j].countType));
+            size_t indexOffset = plyListOffset(element, indicesProperty, firstCounts.data()), faceSize = firstCounts[indicesProperty];
+
+            parallelFor(threadCount, [&](int t)
+            {
+                size_t first = element.count*t / threadCount, last = element.count*(t + 1) / threadCount;
+                std::vector<uint32_t> face;
+                triangles[t].reserve((last - first)*(std::max(faceSize, (size_t)2) - 2));
+                for (size_t i = first; i < last; i++)
+                {
+                    const char *record = p + i*stride;
+                    for (size_t j = 0, list = 0; j < propertyCount; j++)
+                    {
+                        const PLYProperty &property = element.properties[j];
+                        if (property.countType == INVALID) continue;
+                        if ((size_t)readBinary(record + countOffsets[list++], property.countType, swap) != firstCounts[j]) fits[t] = false;
+                    }
+                    if (!fits[t]) return;
+                    addPLYFace(record + indexOffset, faceSize, indices.type, swap, face, triangles[t]);
+                }
+            });
+        }
+        if (std::find(fits.begin(), fits.end(), 0) == fits.end())
+        {
+            appendTriangles(triangles, mesh);
+            return p + element.count*stride;
+        }
+
+        // Mixed face sizes: walk the list counts once to find where each thread starts, which is much cheaper than decoding
+        std::vector<const char*> starts(threadCount + 1);
+        std::vector<size_t> counts(propertyCount, 0);
+        const char *q = p;
+        for (int t = 0; t < threadCount; t++)
+        {
+            starts[t] = q;
+            for (size_t i = element.count*t / threadCount; i < element.count*(t + 1) / threadCount; i++)
+            {
+                size_t size = plyRecordSize(q, end, element, indicesProperty, swap, counts.data());
+                if (size == 0) return NULL;
+                q += size;
+            }
+        }
+        starts[threadCount] = q;
+
+        parallelFor(threadCount, [&](int t)
+        {
+            std::vector<size_t> counts(propertyCount, 0);
+            std::vector<uint32_t> face;
+            triangles[t].clear();
+            for (const char *record = starts[t]; record < starts[t + 1];)
+            {
+                size_t size = plyRecordSize(record, end, element, indicesProperty, swap, counts.data());
+                addPLYFace(record + plyListOffset(element, indicesProperty, counts.data()), counts[indicesProperty], indices.type, swap, face, triangles[t]);
+                record += size;
+            }
+        });
+
+        appendTriangles(triangles, mesh);
+        return q;
+    }
+
+    static const char *skipPLYBinary(const char *p, const char *end, const PLYElement &element, bool swap)
+    {
+        for (size_t i = 0; i < element.count; i++)
+            for (const PLYProperty &property : element.properties)
+            {
+                size_t count = 1;
+                if (property.countType != INVALID)
+                {
+                    if (end - p < plySize(property.countType)) return NULL;
+                    double listCount = readBinary(p, property.countType, swap);
+                    if (!plyListFits(listCount, false)) return NULL;
+                    count = listCount;
+                    p += plySize(property.countType);
+                }
+                if ((size_t)(end - p) < count*plySize(property.type)) return NULL;
+                p += count*plySize(property.type);
+            }
+        return p;
+    }
+
+    // Splits the next `count` lines into `threadCount` runs of whole lines. Finding the newlines is a memchr per line,
+    // far cheaper than parsing the numbers on them
+    static std::vector<const char*> splitPLYLines(const char *p, const char *end, size_t count, int threadCount)
+    {
+        std::vector<const char*> starts(threadCount + 1);
+        for (int t = 0; t < threadCount; t++)
+        {
+            starts[t] = p;
+            for (size_t i = count*t / threadCount; i < count*(t + 1) / threadCount && p < end; i++) p = nextLine(p, end);
+        }
+        starts[threadCount] = p;
+        return starts;
+    }
+
+    static const char *readPLYVerticesASCII(const char *p, const char *end, const PLYElement &element, Mesh &mesh, int threadCount)
+    {
+        int x = findProperty(element, "x"), y = findProperty(element, "y"), z = findProperty(element, "z");
+        if (x < 0 || y < 0 || z < 0) return NULL;
+
+        mesh.vertices.assign(element.count, glm::vec4(0.0, 0.0, 0.0, 1.0));
+        std::vector<const char*> starts = splitPLYLines(p, end, element.count, threadCount);
+        parallelFor(threadCount, [&](int t)
+        {
+            const char *q = starts[t];
+            for (size_t i = element.count*t / threadCount; q < starts[t + 1]; i++)
+            {
+                const char *lineEnd = nextLine(q, end);
+                for (int j = 0; j < (int)element.properties.size(); j++)
+                {
+                    float value;
+                    q = parseFloat(q, lineEnd, &value);
+                    if (j == x) mesh.vertices[i].x = value;
+                    else if (j == y) mesh.vertices[i].y = value;
+                    else if (j == z) mesh.vertices[i].z = value;
+                }
+                q = lineEnd;
+            }
+        });
+        return starts[threadCount];
+    }
+
+    static const char *readPLYFacesASCII(const char *p, const char *end, const PLYElement &element, Mesh &mesh, int threadCount)
+    {
+        int indicesProperty = findFaceIndices(element);
+        if (indicesProperty < 0) return NULL;
+
+        std::vector<const char*> starts = splitPLYLines(p, end, element.count, threadCount);
+        std::vector<std::vector<glm::uvec4>> triangles(threadCount);
+        std::vector<char> valid(threadCount, true);
+        parallelFor(threadCount, [&](int t)
+        {
+            std::vector<uint32_t> face;
+            triangles[t].reserve(element.count / threadCount + 1);
+            for (const char *q = starts[t]; q < starts[t + 1];)
+            {
+                const char *lineEnd = nextLine(q, end);
+                for (int j = 0; j < (int)element.properties.size(); j++)
+                {
+                    long value;
+                    bool found;
+                    size_t count = 1;
+                    if (element.properties[j].countType != INVALID)
+                    {
+                        q = parseInt(q, lineEnd, &value, &found);
+                        if (!found || !plyListFits(value, j == indicesProperty))
+                        {
+                            valid[t] = false;
+                            return;
+                        }
+                        count = value;
+                    }
+
+                    // A list longer than its line is cut short there rather than reading the next face
+                    face.clear();
+                    for (size_t k = 0; k < count && q < lineEnd; k++)
+                    {
+                        // Indices are integers, other scalar properties only need skipping
+                        q = parseInt(q, lineEnd, &value, &found);
+                        while (q < lineEnd && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n') q++;
+                        if (found) face.push_back(value);
+                    }
+
+                    if (j == indicesProperty)
+                        for (size_t k = 2; k < face.size(); k++) triangles[t].push_back(glm::uvec4(face[0], face[k - 1], face[k], 0));
+                }
+                q = lineEnd;
+            }
+        });
+
+        if (std::find(valid.begin(), valid.end(), 0) != valid.end()) return NULL;
+        appendTriangles(triangles, mesh);
+        return starts[threadCount];
+    }
+
+    static const char *skipPLYASCII(const char *p, const char *end, const PLYElement &element)
+    {
+        for (size_t i = 0; i < element.count && p < end; i++) p = nextLine(p, end);
+        return p;
+    }
+
+
+    // Appends the triangles each thread parsed, in file order
+    static void appendTriangles(std::vector<std::vector<glm::uvec4>> &chunks, Mesh &mesh)
+    {
+        size_t count = mesh.triangles.size();
+        for (const std::vector<glm::uvec4> &chunk : chunks) count += chunk.size();
+        mesh.triangles.reserve(count);
+        for (const std::vector<glm::uvec4> &chunk : chunks) mesh.triangles.insert(mesh.triangles.end(), chunk.begin(), chunk.end());
+    }
+
+    // Runs `function(i)` for every chunk i in [0, count) on the task pool
+    template <typename Function>
+    static void parallelFor(int count, Function function)
+    {
+        TaskPool::global().parallelChunks(count, function);
+    }
+
+};
+
+#endif
@@ -0,0 +1,409 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "generator.h"
+#include "heatmap.h"
+
+// Command line options
+struct Options
+{
+    int width = 1000, height = 800;     // Size of the rendered image
+    bool headless = false;              // Render without showing a window
+    bool renderThread = true;           // The editor traces on a thread of its own
+    std::string scenePath;              // Binary scene file to render instead of the default scene
+    std::string saveScenePath;          // Write the scene here (without --out only the file is written)
+    bool saveOnly = false;
+    std::vector<std::string> meshPaths;  // OBJ or PLY meshes added to the scene
+    int instances = 1;                  // Copies of each mesh, laid out on a grid when more than one
+    std::string environmentPath;        // Equirectangular map lighting the scene instead of the sky
+    float environmentStrength = 1.0;
+
+    // Procedural scenes
+    bool generate = false;
+    SceneGenerator generator;
+
+    // Export
+    std::string outPath;                // Render headless and write the result here (.png, .exr or .pfm)
+    int samples = 64;                   // Samples per pixel accumulated before writing `outPath`
+    int snapshotEvery = 0;              // Also write a numbered snapshot every N samples per pixel
+
+    // Sequences
+    bool sequence = false;              // Render a camera path instead of a single image
+    std::string cameraPath;             // Keyframe file to follow
+    int turntableFrames = 0;            // Orbit the scene in this many frames instead of following a file
+    int frames = 0;                     // Frames to sample along the path (0 uses one per keyframe)
+    std::string ffmpegOut;              // Pipe raw frames into ffmpeg writing this video instead of writing images
+    int fps = 30;
+    int encoderThreads = 4;
+
+    // Distributed rendering
+    int workers = 0;                    // Render `outPath` on this many local worker processes
+    int workersBenchmark = 0;           // Time the render with 1, 2, 4… up to this many workers
+    int workerPort = 0;                 // Coordinator port workers on other machines can connect to (0 for local workers only)
+    std::string workerAddress;          // Run as a worker of the coordinator at host:port
+    std::string program;                // This executable, started again for local workers
+
+    int servePort = 0;                  // Run the render server on this localhost port
+    std::string jobsPath;               // Render the jobs listed in this file back to back
+
+    // Regression checks
+    std::string regressPath;            // Suite of cases to check against their reference images and baseline times
+    bool regressUpdate = false;         // Record the references and baselines instead
+    std::string regressBaselinesPath;   // Timing baselines of this machine, kept apart from the suite
+    int regressRuns = 5;                // Timed renders of each case, the median counts
+    float perfThreshold = 25.0;         // Slowdown over the baseline that fails a case, in percent
+    float perfSlack = 0.05;             // Seconds a case may lose before the threshold applies, timer noise on short cases
+    float perfNoiseBands = 4.0;         // Or this many times the spread of the runs, on noisy machines
+
+    int poolThreads = 0;                // Task pool workers for loading, BVH builds and encoding (0 for one per core)
+    bool pinThreads = false;            // Pin each worker to a core
+
+    int sphereBuilder = -1;             // SphereBVH::Builder for the sphere BVH, -1 keeps the default or the tree stored with the scene
+
+    int tracer = 0;                     // Renderer::Tracer
+    int maxRayBounce = 0;               // Overrides the renderer's default when above 0
+    int persistentGroups = 0;           // Wavefront extend with this many persistent workgroups (0 launches a thread per ray)
+    int batchSize = 256;                // Rays a persistent workgroup takes at once
+    bool sortRays = false, sortHits = false;    // Wavefront ray and hit reordering
+
+    // Debugging
+    std::string profilePath;            // Record the profiler from startup and write a Chrome trace here on exit
+    int heatmap = 0;                    // Heatmap::Mode, renders traversal cost instead of the shaded image
+    float heatmapScale = 64.0;
+
+    // Benchmarks
+    int bvhBenchmarkThreads = -1;       // Compare BVH builders over the scene's spheres with up to this many threads (0 for all cores)
+};
+
+inline void printUsage(const char *program)
+{
+    std::cout
+        << "Usage: " << program << " [options]\n"
+        << "\n"
+        << "  --scene <file.rtsc>     Load a binary scene file\n"
+        << "  --mesh <file>           Add an .obj or .ply mesh to the scene (can be repeated)\n"
+        << "  --instances <n>         Place n copies of each mesh on a grid, they share its triangles and BVH\n"
+        << "  --env <file>            Light the scene with an equirectangular .hdr or .pfm map, importance sampled\n"
+        << "  --env-strength <f>      Multiplier of the environment map's radiance (default 1)\n"
+        << "  --save-scene <file>     Write the scene to a binary scene file, exits after if nothing is rendered\n"
+        << "  --generate <layout>     Generate a scene: uniform, galaxies or weekend\n"
+        << "  --count <n>             Spheres to generate (default 10000)\n"
+        << "  --seed <n>              Seed of the generated scene (default 1)\n"
+        << "  --radius <min> <max>    Radius range of generated spheres (default 0.2 0.6)\n"
+        << "  --radius-dist <dist>    constant (min), random or power (many small, few large)\n"
+        << "  --mix <d> <m> <g>       Weights of diffuse, metal and glossy materials (default 0.6 0.2 0.2)\n"
+        << "  --lights <n>            few (4 large lights) or many (a share of the spheres glow)\n"
+        << "  --light-fraction <f>    Share of glowing spheres with --lights many (default 0.01)\n"
+        << "  --out <file>            Render headless and write the image (.png, .exr or .pfm)\n"
+        << "  --spp <n>               Samples per pixel to accumulate before writing (default 64)\n"
+        << "  --snapshot-every <n>    Write a numbered snapshot every n samples per pixel\n"
+        << "  --path <file>           Render a sequence following a camera path (time x y z theta phi focalLength per line)\n"
+        << "  --turntable <n>         Render an n frame orbit around the scene\n"
+        << "  --frames <n>            Frames to sample along the path (default one per keyframe)\n"
+        << "  --ffmpeg <video>        Pipe the sequence into ffmpeg instead of writing numbered images\n"
+        << "  --fps <n>               Frame rate given to ffmpeg (default 30)\n"
+        << "  --encoders <n>          Images encoded at once in sequences (default 4)\n"
+        << "  --single-thread         Trace on the editor's UI thread instead of a render thread\n"
+        << "  --workers <n>           Render --out on n local worker processes, tiles and sample ranges are merged\n"
+        << "  --workers-bench <n>     Time the distributed render with 1, 2, 4... up to n workers\n"
+        << "  --worker-port <port>    Also accept workers from other machines on this port\n"
+        << "  --worker <host:port>    Run as a worker of a coordinator\n"
+        << "  --serve <port>          Run a render server on localhost: POST /render takes a JSON job, GET /metrics\n"
+        << "  --jobs <file>           Render a batch of jobs, one JSON object per line like --serve's plus \"out\"\n"
+        << "  --regress <suite>       Render each case with fixed seeds, compare to its reference image and baseline time\n"
+        << "  --regress-update        Record the suite's reference images and baseline times instead\n"
+        << "  --regress-baselines <f> Read and record the timing baselines in this file instead of the suite\n"
+        << "  --regress-runs <n>      Timed renders per case, the median counts (default 5)\n"
+        << "  --perf-threshold <pct>  Slowdown over the baseline that fails a case (default 25)\n"
+        << "  --perf-slack <seconds>  Slowdown too small to fail a case whatever its percentage (default 0.05)\n"
+        << "  --perf-noise <n>        Neither can a slowdown within n times the spread of the timed runs (default 4)\n"
+        << "  --profile <trace.json>  Record CPU frame phases from startup, write a Chrome trace on exit\n"
+        << "  --threads <n>           Worker threads for loading, BVH builds and encoding (default one per core)\n"
+        << "  --pin-threads           Pin each worker thread to a core (Linux)\n"
+        << "  --tracer <tracer>       fragment (default), wavefront (compute kernels, needs OpenGL 4.3) or direct (light tree)\n"
+        << "  --persistent <groups>   Run the wavefront's closest hit kernel as this many persistent workgroups\n"
+        << "  --batch <rays>          Rays a persistent workgroup takes from the queue at once (default 256)\n"
+        << "  --sort <what>           Reorder the wavefront's queues: off (default), rays, hits or both\n"
+        << "  --bounces <n>           Maximum bounces per path (default 5)\n"
+        << "  --heatmap <metric>      Render the cost of each pixel instead: tests, nodes or bounces per sample, prints a histogram\n"
+        << "  --heatmap-scale <n>     Count shown as the hottest heatmap colour (default 64)\n"
+        << "  --bvh <builder>         Build the sphere BVH with median, linear (fast to build) or sah (fast to trace)\n"
+        << "  --bvh-bench <threads>   Time the BVH builders over the scene's spheres with up to this many threads (0 for all)\n"
+        << "  --width <n>             Image width (default 1000)\n"
+        << "  --height <n>            Image height (default 800)\n"
+        << "  --help                  Show this message\n";
+}
+
+inline Options parseOptions(int argc, char **argv)
+{
+    Options options;
+
+    // Local workers run this executable again, on Linux even when it was found through the PATH
+    #ifdef __linux__
+    options.program = "/proc/self/exe";
+    #else
+    options.program = argv[0];
+    #endif
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+
+        // Every option but the flags takes a value
+        auto value = [&]() -> const char*
+        {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: Missing value for `" << arg << "`." << std::endl;
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (!strcmp(arg, "--help"))
+        {
+            printUsage(argv[0]);
+            exit(0);
+        }
+        else if (!strcmp(arg, "--scene")) options.scenePath = value();
+        else if (!strcmp(arg, "--env")) options.environmentPath = value();
+        else if (!strcmp(arg, "--env-strength")) options.environmentStrength = std::max((float)atof(value()), 0.0f);
+        else if (!strcmp(arg, "--bvh-bench"))
+        {
+            options.bvhBenchmarkThreads = std::max(atoi(value()), 0);
+            options.headless = true;
+        }
+        else if (!strcmp(arg, "--single-thread")) options.renderThread = false;
+        else if (!strcmp(arg, "--pin-threads")) options.pinThreads = true;
+        else if (!strcmp(arg, "--workers")) options.workers = std::max(atoi(value()), 0);
+        else if (!strcmp(arg, "--workers-bench"))
+        {
+            options.workersBenchmark = std::max(atoi(value()), 1);
+            options.headless = true;
+        }
+        else if (!strcmp(arg, "--worker-port")) options.workerPort = atoi(value());
+        else if (!strcmp(arg, "--worker"))
+        {
+            options.workerAddress = value();
+            options.headless = true;
+        }
+        else if (!strcmp(arg, "--serve"))
+        {
+            options.servePort = atoi(value());
+            options.headless = true;
+        }
+        else if (!strcmp(arg, "--jobs"))
+        {
+            options.jobsPath = value();
+            options.headless = true;
+        }
+        else if (!strcmp(arg, "--regress"))
+        {
+            options.regressPath = value();
+            options.headless = true;
+        }
+        else if (!strcmp(arg, "--regress-update")) options.regressUpdate = true;
+        else if (!strcmp(arg, "--regress-runs")) options.regressRuns = std::max(atoi(value()), 1);
+        else if (!strcmp(arg, "--perf-threshold")) options.perfThreshold = atof(value());
+        else if (!strcmp(arg, "--regress-baselines")) options.regressBaselinesPath = value();
+        else if (!strcmp(arg, "--perf-noise")) options.perfNoiseBands = std::max((float)atof(value()), 0.0f);
+        else if (!strcmp(arg, "--perf-slack")) options.perfSlack = std::max((float)atof(value()), 0.0f);
+        else if (!strcmp(arg, "--profile")) options.profilePath = value();
+        else if (!strcmp(arg, "--threads")) options.poolThreads = atoi(value());
+        else if (!strcmp(arg, "--tracer"))
+        {
+            const char *tracer = value();
+            if (!strcmp(tracer, "fragment")) options.tracer = 0;
+            else if (!strcmp(tracer, "wavefront")) options.tracer = 1;
+            else if (!strcmp(tracer, "direct")) options.tracer = 2;
+            else
+            {
+                std::cerr << "Error: Unknown tracer `" << tracer << "`, use fragment, wavefront or direct." << std::endl;
+                exit(1);
+            }
+        }
+        else if (!strcmp(arg, "--persistent")) options.persistentGroups = std::max(atoi(value()), 0);
+        else if (!strcmp(arg, "--batch")) options.batchSize = std::max(atoi(value()), 1);
+        else if (!strcmp(arg, "--sort"))
+        {
+            const char *what = value();
+            bool known = !strcmp(what, "off") || !strcmp(what, "rays") || !strcmp(what, "hits") || !strcmp(what, "both");
+            if (!known)
+            {
+                std::cerr << "Error: Unknown sort `" << what << "`, use off, rays, hits or both." << std::endl;
+                exit(1);
+            }
+            options.sortRays = !strcmp(what, "rays") || !strcmp(what, "both");
+            options.sortHits = !strcmp(what, "hits") || !strcmp(what, "both");
+        }
+        else if (!strcmp(arg, "--bounces")) options.maxRayBounce = std::max(atoi(value()), 1);
+        else if (!strcmp(arg, "--heatmap"))
+        {
+            const char *metric = value();
+            options.heatmap = -1;
+            for (int m = 1; m <= Heatmap::BOUNCES; m++) if (!strcmp(metric, Heatmap::name(m))) options.heatmap = m;
+            if (options.heatmap < 0)
+            {
+                std::cerr << "Error: Unknown heatmap metric `" << metric << "`, use tests, nodes or bounces." << std::endl;
+                exit(1);
+            }
+        }
+        else if (!strcmp(arg, "--heatmap-scale")) options.heatmapScale = std::max((float)atof(value()), 1.0f);
+        else if (!strcmp(arg, "--bvh"))
+        {
+            const char *builder = value();
+            const char *builders[] = { "median", "linear", "sah" };
+            options.sphereBuilder = -1;
+            for (int b = 0; b < 3; b++) if (!strcmp(builder, builders[b])) options.sphereBuilder = b;
+            if (options.sphereBuilder < 0)
+            {
+                std::cerr << "Error: Unknown BVH builder `" << builder << "`, use median, linear or sah." << std::endl;
+                exit(1);
+            }
+        }
+        else if (!strcmp(arg, "--mesh")) options.meshPaths.push_back(value());
+        else if (!strcmp(arg, "--instances")) options.instances = std::max(atoi(value()), 1);
+        else if (!strcmp(arg, "--save-scene")) options.saveScenePath = value();
+        else if (!strcmp(arg, "--generate"))
+        {
+            const char *layout = value();
+            const char *layouts[] = { "uniform", "galaxies", "weekend" };
+            options.generate = true;
+            options.generator.layout = -1;
+            for (int l = 0; l < 3; l++) if (!strcmp(layout, layouts[l])) options.generator.layout = l;
+            if (options.generator.layout < 0)
+            {
+                std::cerr << "Error: Unknown layout `" << layout << "`, use uniform, galaxies or weekend." << std::endl;
+                exit(1);
+            }
+        }
+        else if (!strcmp(arg, "--count")) options.generator.count = atoi(value());
+        else if (!strcmp(arg, "--seed")) options.generator.seed = strtoul(value(), NULL, 10);
+        else if (!strcmp(arg, "--radius"))
+        {
+            options.generator.minRadius = atof(value());
+            options.generator.maxRadius = atof(value());
+        }
+        else if (!strcmp(arg, "--radius-dist"))
+        {
+            const char *dist = value();
+            if (!strcmp(dist, "constant")) options.generator.radiusDistribution = SceneGenerator::CONSTANT;
+            else if (!strcmp(dist, "random")) options.generator.radiusDistribution = SceneGenerator::RANDOM;
+            else if (!strcmp(dist, "power")) options.generator.radiusDistribution = SceneGenerator::POWER_LAW;
+            else
+            {
+                std::cerr << "Error: Unknown radius distribution `" << dist << "`, use constant, random or power." << std::endl;
+                exit(1);
+            }
+        }
+        else if (!strcmp(arg, "--mix"))
+        {
+            options.generator.diffuseWeight = atof(value());
+            options.generator.metalWeight = atof(value());
+            options.generator.glossyWeight = atof(value());
+        }
+        else if (!strcmp(arg, "--lights"))
+        {
+            const char *lights = value();
+            if (!strcmp(lights, "few")) options.generator.lighting = SceneGenerator::FEW_LIGHTS;
+            else if (!strcmp(lights, "many")) options.generator.lighting = SceneGenerator::MANY_LIGHTS;
+            else
+            {
+                std::cerr << "Error: Unknown lighting `" << lights << "`, use few or many." << std::endl;
+                exit(1);
+            }
+        }
+        else if (!strcmp(arg, "--light-fraction")) options.generator.lightFraction = atof(value());
+        else if (!strcmp(arg, "--out"))
+        {
+            options.outPath = value();
+            options.headless = true;
+        }
+        else if (!strcmp(arg, "--spp")) options.samples = atoi(value());
+        else if (!strcmp(arg, "--snapshot-every")) options.snapshotEvery = atoi(value());
+        else if (!strcmp(arg, "--path")) options.cameraPath = value();
+        else if (!strcmp(arg, "--turntable")) options.turntableFrames = atoi(value());
+        else if (!strcmp(arg, "--frames")) options.frames = atoi(value());
+        else if (!strcmp(arg, "--ffmpeg"))
+        {
+            options.ffmpegOut = value();
+            options.headless = true;
+        }
+        else if (!strcmp(arg, "--fps")) options.fps = atoi(value());
+        else if (!strcmp(arg, "--encoders")) options.encoderThreads = atoi(value());
+        else if (!strcmp(arg, "--width")) options.width = atoi(value());
+        else if (!strcmp(arg, "--height")) options.height = atoi(value());
+        else
+        {
+            std::cerr << "Error: Unknown option `" << arg << "`." << std::endl;
+            printUsage(argv[0]);
+            exit(1);
+        }
+    }
+
+    options.sequence = !options.cameraPath.empty() || options.turntableFrames > 0;
+    if ((options.workers > 0 || options.workerPort > 0) && (options.outPath.empty() || options.sequence))
+    {
+        std::cerr << "Error: Distributed rendering renders a single image, use --out <file>." << std::endl;
+        exit(1);
+    }
+    if (options.servePort < 0 || options.servePort > 65535 || (options.servePort > 0 && (!options.outPath.empty() || options.sequence)))
+    {
+        std::cerr << "Error: --serve takes a port and renders what it's sent, not --out or a sequence." << std::endl;
+        exit(1);
+    }
+    if (!options.jobsPath.empty() && (!options.outPath.empty() || options.sequence || options.servePort > 0))
+    {
+        std::cerr << "Error: --jobs gives each image its own output, it can't be used with --out, a sequence or --serve." << std::endl;
+        exit(1);
+    }
+    if (!options.regressPath.empty() && (!options.outPath.empty() || options.sequence || options.servePort > 0 || !options.jobsPath.empty()))
+    {
+        std::cerr << "Error: --regress renders its own cases, it can't be used with --out, a sequence, --serve or --jobs." << std::endl;
+        exit(1);
+    }
+    if (options.regressUpdate && options.regressPath.empty())
+    {
+        std::cerr << "Error: --regress-update needs a suite, use --regress <suite>." << std::endl;
+        exit(1);
+    }
+    if (options.sequence && !options.headless)
+    {
+        std::cerr << "Error: Sequences need an output, use --out <file> or --ffmpeg <video>." << std::endl;
+        exit(1);
+    }
+    if (!options.ffmpegOut.empty() && !options.sequence)
+    {
+        std::cerr << "Error: --ffmpeg needs a sequence, use --path <file> or --turntable <n>." << std::endl;
+        exit(1);
+    }
+
+    if (options.generate && !options.scenePath.empty())
+    {
+        std::cerr << "Error: Use either --scene or --generate." << std::endl;
+        exit(1);
+    }
+    if (options.generator.count < 0 || options.generator.minRadius <= 0.0 || options.generator.maxRadius < options.generator.minRadius)
+    {
+        std::cerr << "Error: The sphere count can't be negative and the radius range must be positive." << std::endl;
+        exit(1);
+    }
+
+    // Writing the scene alone doesn't need a visible window
+    if (!options.saveScenePath.empty() && !options.headless && !options.sequence) options.headless = options.saveOnly = true;
+
+    if (options.width <= 0 || options.height <= 0 || options.samples <= 0)
+    {
+        std::cerr << "Error: Image size and sample count must be positive." << std::endl;
+        exit(1);
+    }
+
+    return options;
+}
+
+#endif
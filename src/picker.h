@@ -0,0 +1,67 @@
+#ifndef PICKER_H
+#define PICKER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "window.h"
+
+// Reads the object ID under the cursor through a pixel buffer object, the result is picked up a frame later so we never stall
+class Picker
+{
+public:
+
+    Picker() {}
+
+    void init()
+    {
+        glGenBuffers(1, &PBO);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLint), NULL, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // Queue a read of the object ID texel at `windowCoord` (window coordinates, y going up)
+    void request(const Window *window, glm::ivec2 windowCoord)
+    {
+        if (windowCoord.x < 0 || windowCoord.y < 0 || windowCoord.x >= window->width || windowCoord.y >= window->height) return;
+        if (fence) glDeleteSync(fence);
+
+        // Copy the texel into the PBO, glReadPixels returns immediately since it's writing to a buffer
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, window->FBOs[0]);
+        glReadBuffer(GL_COLOR_ATTACHMENT1);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+        glReadPixels(windowCoord.x, windowCoord.y, 1, 1, GL_RED_INTEGER, GL_INT, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+
+    // Returns true (and the picked ID) once a requested read has landed in the PBO
+    bool poll(int *id)
+    {
+        if (!fence) return false;
+
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+
+        glDeleteSync(fence);
+        fence = 0;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+        glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(GLint), id);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        return true;
+    }
+
+private:
+
+    GLuint PBO;
+    GLsync fence = 0;
+
+};
+
+#endif
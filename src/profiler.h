@@ -0,0 +1,223 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+// CPU timers for the phases of a frame. Each thread records into a ring of its own with no locks, so timing the UI thread
+// doesn't stall the trace thread, and a scope costs one relaxed load while profiling is off. Readers copy the rings and
+// drop whatever the writer overwrote meanwhile. Events are named by string literals, only the pointer is stored
+class Profiler
+{
+public:
+
+    struct Event
+    {
+        const char *name;
+        int64_t start, end;             // Nanoseconds since the profiler's first use
+        int depth;                      // Scopes open around it on the same thread
+    };
+
+    struct ThreadEvents
+    {
+        std::string name;
+        int id;
+        std::vector<Event> events;      // Oldest first
+    };
+
+    static const int capacity = 8192;   // Events kept per thread
+
+    static bool isEnabled() { return enabled().load(std::memory_order_relaxed); }
+
+    static void setEnabled(bool on) { enabled().store(on, std::memory_order_relaxed); }
+
+    static int64_t now()
+    {
+        static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Opens a scope on this thread, returns its start or -1 while profiling is off
+    static int64_t begin()
+    {
+        if (!isEnabled()) return -1;
+        local().depth++;
+        return now();
+    }
+
+    // Closes a scope opened by `begin`, which returned `start`
+    static void end(const char *name, int64_t start)
+    {
+        if (start < 0) return;
+        Local &thread = local();
+        thread.depth--;
+        record(name, start, now(), thread.depth);
+    }
+
+    // Timer for the enclosing block
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name) : name(name), start(begin()) {}
+        ~Scope() { end(name, start); }
+
+    private:
+        const char *name;
+        int64_t start;
+    };
+
+    // Shown for this thread in the timeline and the trace
+    static void nameThread(const std::string &name)
+    {
+        Local &thread = local();
+        thread.name = name;
+        if (!thread.buffer) return;
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        thread.buffer->name = name;
+    }
+
+    // Startup, from `main` until the editor presents its first frame
+    static void beginStartup() { startupStart() = begin(); }
+
+    static void endStartup()
+    {
+        end("startup: main to first frame", startupStart());
+        startupStart() = -1;
+    }
+
+    // Every thread's events that ended at `since` or later
+    static std::vector<ThreadEvents> snapshot(int64_t since = 0)
+    {
+        Registry &threads = registry();
+        std::lock_guard<std::mutex> lock(threads.mutex);
+        std::vector<ThreadEvents> snapshots;
+        for (const std::unique_ptr<Buffer> &buffer : threads.buffers)
+        {
+            ThreadEvents snapshot;
+            snapshot.name = buffer->name;
+            snapshot.id = buffer->id;
+
+            // Newest first until the events end too early, then keep those the writer hasn't lapped in the meantime
+            uint64_t head = buffer->head.load(std::memory_order_acquire);
+            uint64_t oldest = (head > (uint64_t)capacity) ? head - capacity : 0, first = head;
+            while (first > oldest && buffer->events[(first - 1) % capacity].end >= since) first--;
+            for (uint64_t i = first; i < head; i++) snapshot.events.push_back(buffer->events[i % capacity]);
+
+            uint64_t lapped = buffer->head.load(std::memory_order_acquire);
+            if (lapped > first + capacity)
+                snapshot.events.erase(snapshot.events.begin(), snapshot.events.begin() + std::min<uint64_t>(lapped - first - capacity, snapshot.events.size()));
+            snapshots.push_back(std::move(snapshot));
+        }
+        return snapshots;
+    }
+
+    // Chrome's trace_event format, opens in chrome://tracing or Perfetto
+    static bool writeChromeTrace(const std::string &path)
+    {
+        FILE *file = fopen(path.c_str(), "w");
+        if (!file)
+        {
+            std::cerr << "Error: Could not write `" << path << "`." << std::endl;
+            return false;
+        }
+
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Ray Tracing\"}}");
+        size_t count = 0;
+        for (const ThreadEvents &thread : snapshot())
+        {
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", thread.id, thread.name.c_str());
+            fprintf(file, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}", thread.id, thread.id);
+            for (const Event &event : thread.events)
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", event.name, thread.id, event.start / 1000.0,
+                        (event.end - event.start) / 1000.0);
+            count += thread.events.size();
+        }
+        fprintf(file, "\n]}\n");
+
+        bool written = fclose(file) == 0;
+        if (written) printf("Wrote %zu profiler events to %s\n", count, path.c_str());
+        return written;
+    }
+
+private:
+
+    struct Buffer
+    {
+        std::string name;
+        int id;
+        Event events[capacity];
+        std::atomic<uint64_t> head{0};  // Events ever written, only the owning thread writes
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Buffer>> buffers;   // Kept after their threads exit, so readers never see one freed
+    };
+
+    struct Local
+    {
+        Buffer *buffer = NULL;
+        int depth = 0;
+        std::string name;
+    };
+
+    static std::atomic<bool> &enabled()
+    {
+        static std::atomic<bool> on{false};
+        return on;
+    }
+
+    static Registry &registry()
+    {
+        static Registry threads;
+        return threads;
+    }
+
+    static Local &local()
+    {
+        static thread_local Local thread;
+        return thread;
+    }
+
+    static int64_t &startupStart()
+    {
+        static int64_t start = -1;
+        return start;
+    }
+
+    static void record(const char *name, int64_t start, int64_t end, int depth)
+    {
+        Local &thread = local();
+        if (!thread.buffer)
+        {
+            Registry &threads = registry();
+            std::lock_guard<std::mutex> lock(threads.mutex);
+            threads.buffers.push_back(std::unique_ptr<Buffer>(new Buffer()));
+            thread.buffer = threads.buffers.back().get();
+            thread.buffer->id = threads.buffers.size();
+            thread.buffer->name = thread.name.empty() ? "Thread " + std::to_string(thread.buffer->id) : thread.name;
+        }
+
+        Buffer &buffer = *thread.buffer;
+        uint64_t head = buffer.head.load(std::memory_order_relaxed);
+        buffer.events[head % capacity] = Event{ name, start, end, depth };
+        buffer.head.store(head + 1, std::memory_order_release);
+    }
+
+};
+
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) Profiler::Scope PROFILER_CONCAT(profileScope, __LINE__)(name)
+
+#endif
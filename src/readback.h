@@ -0,0 +1,130 @@
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <GL/glew.h>
+#include <string.h>
+#include <vector>
+#include <functional>
+#include "image.h"
+
+// Asynchronous texture readback through a ring of pixel buffer objects guarded by fences
+class Readback
+{
+public:
+
+    typedef std::function<void(Image &&image)> Callback;
+
+    Readback() {}
+
+    void init(int slotCount)
+    {
+        slots.resize(slotCount);
+        for (Slot &slot : slots) glGenBuffers(1, &slot.PBO);
+    }
+
+    // Start copying the colour attachment of `FBO` into a free PBO (waiting for the oldest copy if all of them are busy)
+    void request(GLuint FBO, int width, int height, Callback onComplete)
+    {
+        Slot *slot = freeSlot();
+        if (!slot)
+        {
+            completeOldest(true);
+            slot = freeSlot();
+        }
+
+        size_t size = (size_t)width*height*4*sizeof(float);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->PBO);
+        if (slot->capacity < size)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+            slot->capacity = size;
+        }
+
+        // Returns immediately, the copy happens on the GPU once the commands before it are done
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot->width = width;
+        slot->height = height;
+        slot->sequence = nextSequence++;
+        slot->onComplete = onComplete;
+        glFlush();
+    }
+
+    // Hands finished copies to their callbacks, always in the order they were requested
+    void poll()
+    {
+        while (completeOldest(false));
+    }
+
+    // Blocks until every requested copy is finished
+    void finish()
+    {
+        while (completeOldest(true));
+    }
+
+    int pending() const
+    {
+        int count = 0;
+        for (const Slot &slot : slots) count += slot.fence != 0;
+        return count;
+    }
+
+private:
+
+    struct Slot
+    {
+        GLuint PBO = 0;
+        GLsync fence = 0;
+        size_t capacity = 0;
+        int width = 0, height = 0;
+        unsigned long sequence = 0;
+        Callback onComplete;
+    };
+
+    std::vector<Slot> slots;
+    unsigned long nextSequence = 0;
+
+    Slot *freeSlot()
+    {
+        for (Slot &slot : slots)
+            if (!slot.fence) return &slot;
+        return NULL;
+    }
+
+    bool completeOldest(bool wait)
+    {
+        Slot *oldest = NULL;
+        for (Slot &slot : slots)
+            if (slot.fence && (!oldest || slot.sequence < oldest->sequence)) oldest = &slot;
+        if (!oldest) return false;
+
+        GLenum status = glClientWaitSync(oldest->fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+        while (wait && status == GL_TIMEOUT_EXPIRED) status = glClientWaitSync(oldest->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+
+        glDeleteSync(oldest->fence);
+        oldest->fence = 0;
+
+        // The copy out of the mapped buffer is the only part that costs the GL thread anything
+        Image image(oldest->width, oldest->height);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, oldest->PBO);
+        void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image.pixels.size()*sizeof(float), GL_MAP_READ_BIT);
+        if (data) memcpy(image.pixels.data(), data, image.pixels.size()*sizeof(float));
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        Callback onComplete = oldest->onComplete;
+        oldest->onComplete = nullptr;
+        if (data && onComplete) onComplete(std::move(image));
+
+        return true;
+    }
+
+};
+
+#endif
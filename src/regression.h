@@ -0,0 +1,86 @@
+#ifndef REGRESSION_H
+#define REGRESSION_H
+
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "image.h"
+
+// Image comparison for `--regress`, on the values a PNG of the images would show
+namespace Regression
+{
+    struct Difference
+    {
+        double rmse = 0.0;              // Over every RGB channel, in [0, 1]
+        double outliers = 0.0;          // Share of pixels where some channel is off by more than `outlierThreshold`
+        double maxError = 0.0;
+    };
+
+    const double outlierThreshold = 0.1;
+
+    inline double displayValue(float value, bool doGammaCorrection)
+    {
+        value = std::min(std::max(value, 0.0f), 1.0f);
+        return doGammaCorrection ? sqrtf(value) : value;
+    }
+
+    // RMSE catches noise and shifts spread over the image, the outlier share catches a few broken pixels it would average away
+    inline Difference compare(const Image &image, const Image &reference, bool doGammaCorrection)
+    {
+        Difference difference;
+        size_t pixelCount = (size_t)image.width*image.height, outliers = 0;
+        double squares = 0.0;
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            double worst = 0.0;
+            for (int c = 0; c < 3; c++)
+            {
+                double error = fabs(displayValue(image.pixels[i*4 + c], doGammaCorrection) - displayValue(reference.pixels[i*4 + c], doGammaCorrection));
+                squares += error*error;
+                worst = std::max(worst, error);
+            }
+            outliers += worst > outlierThreshold;
+            difference.maxError = std::max(difference.maxError, worst);
+        }
+
+        if (pixelCount == 0) return difference;
+        difference.rmse = sqrt(squares / (pixelCount*3));
+        difference.outliers = outliers / (double)pixelCount;
+        return difference;
+    }
+
+    const int retimeRounds = 2;         // Times a case that looks slower is timed again before it fails
+
+    // Timed renders of a case, summed up so that one slow run doesn't move it
+    struct Timing
+    {
+        double seconds = 0.0;           // Median run
+        double noise = 0.0;             // Median distance of the runs from it
+    };
+
+    inline double median(std::vector<double> values)
+    {
+        if (values.empty()) return 0.0;
+        std::nth_element(values.begin(), values.begin() + values.size()/2, values.end());
+        return values[values.size()/2];
+    }
+
+    inline Timing measure(const std::vector<double> &runs)
+    {
+        Timing timing;
+        timing.seconds = median(runs);
+        std::vector<double> deviations;
+        for (double run : runs) deviations.push_back(fabs(run - timing.seconds));
+        timing.noise = median(deviations);
+        return timing;
+    }
+
+    // How much slower than `baseline` a case may get: `threshold` percent, but never less than `slack` seconds or `bands`
+    // times the noise the two measurements showed
+    inline double allowedSlowdown(const Timing &timing, const Timing &baseline, double threshold, double slack, double bands)
+    {
+        return std::max({ baseline.seconds*threshold/100.0, slack, bands*(timing.noise + baseline.noise) });
+    }
+}
+
+#endif
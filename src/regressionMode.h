@@ -0,0 +1,192 @@
+#ifndef REGRESSION_MODE_H
+#define REGRESSION_MODE_H
+
+#include <GLFW/glfw3.h>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <algorithm>
+#include "app.h"
+#include "jobs.h"
+#include "regression.h"
+
+// `--regress`: renders a suite of cases and checks their images and timings
+class RegressionMode
+{
+public:
+
+    // Renders each case of the suite `options.regressPath` with fixed seeds, then checks the image against its reference
+    // and the median of `options.regressRuns` timings against its baseline. With `options.regressUpdate` it records both
+    // instead. Cases are jobs like `BatchMode`'s, with a .pfm "reference" instead of "out", and optional "name",
+    // "maxRmse" and "maxOutliers". Baselines are kept in the suite as "baselineSeconds" and "baselineNoise", or by case
+    // name in `options.regressBaselinesPath`, where the cases it doesn't have yet are timed and added
+    static int run(App &app)
+    {
+        const Options &options = app.options;
+        Renderer &renderer = app.renderer;
+        Window &sceneWindow = app.sceneWindow;
+
+        std::vector<Json> cases;
+        std::vector<int> lineNumbers;
+        if (!Jobs::read(options.regressPath, "reference", cases, lineNumbers)) return 1;
+        for (size_t i = 0; i < cases.size(); i++)
+            if (ImageIO::extension(cases[i]["reference"].asString("")) != "pfm")
+            {
+                std::cerr << "Error: The reference on line " << lineNumbers[i] << " must be a .pfm, it keeps the linear values." << std::endl;
+                return 1;
+            }
+
+        bool separateBaselines = !options.regressBaselinesPath.empty(), baselinesChanged = false;
+        Json baselines;
+        if (separateBaselines)
+        {
+            std::ifstream file(options.regressBaselinesPath);
+            std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()), error;
+            if (file.is_open() && (!Json::parse(text, baselines, error) || !baselines.isObject()))
+            {
+                std::cerr << "Error: `" << options.regressBaselinesPath << "` isn't a baselines file: " << (error.empty() ? "expected an object" : error) << "." << std::endl;
+                return 1;
+            }
+            if (!baselines.isObject()) baselines = Json::object();
+        }
+
+        renderer.tiles.frameBudgetMs = 0.0;
+        renderer.fixedSeed = true;
+        Jobs::Defaults defaults = Jobs::defaults(app);
+        std::string loadedScene;
+        int failures = 0;
+
+        printf("%-24s %9s %9s %9s %9s %8s  %s\n", "case", "rmse", "outliers", "seconds", "baseline", "change", "result");
+        for (size_t i = 0; i < cases.size(); i++)
+        {
+            Json &test = cases[i];
+            std::string name = test["name"].asString("line " + std::to_string(lineNumbers[i]));
+            std::string referencePath = test["reference"].asString("");
+            bool sceneReused;
+            std::string error;
+            if (!Jobs::apply(app, test, defaults, loadedScene, sceneReused, error))
+            {
+                printf("%-24s %s\n", name.c_str(), ("FAILED: " + error).c_str());
+                failures++;
+                continue;
+            }
+
+            // An untimed render first, it also pays for compiling the shaders and uploading the scene
+            int samples = std::max(test["spp"].asInt(options.samples), 1);
+            auto timeCase = [&]()
+            {
+                std::vector<double> runs;
+                for (int run = -1; run < std::max(options.regressRuns, 1); run++)
+                {
+                    double start = glfwGetTime();
+                    renderer.restartAccumulation();
+                    while (renderer.accumulatedSamples < samples) app.traceFrame();
+                    glFinish();
+                    if (run >= 0) runs.push_back(glfwGetTime() - start);
+                }
+                return Regression::measure(runs);
+            };
+            Regression::Timing timing = timeCase();
+
+            // A baseline is kept for good, so it's the middle of several rounds rather than a lucky or unlucky one
+            bool recording = options.regressUpdate || (separateBaselines && !baselines.has(name));
+            if (recording)
+            {
+                std::vector<Regression::Timing> rounds(1, timing);
+                for (int round = 0; round < Regression::retimeRounds; round++) rounds.push_back(timeCase());
+                std::sort(rounds.begin(), rounds.end(), [](const Regression::Timing &a, const Regression::Timing &b) { return a.seconds < b.seconds; });
+                timing = rounds[rounds.size()/2];
+            }
+            Image image = app.readAccumulation(0, 0, sceneWindow.width, sceneWindow.height);
+
+            Json recorded = Json::object();
+            recorded.set("seconds", Json::fromNumber(round(timing.seconds*10000.0) / 10000.0));
+            recorded.set("noise", Json::fromNumber(round(timing.noise*10000.0) / 10000.0));
+            if (options.regressUpdate)
+            {
+                bool written = ImageIO::writePFM(referencePath, image);
+                if (separateBaselines) baselines.set(name, recorded);
+                else
+                {
+                    test.set("baselineSeconds", recorded["seconds"]);
+                    test.set("baselineNoise", recorded["noise"]);
+                }
+                baselinesChanged = true;
+                printf("%-24s %9s %9s %9.3f %9s %8s  %s\n", name.c_str(), "", "", timing.seconds, "", "", written ? "recorded" : "FAILED: could not write the reference");
+                failures += !written;
+                continue;
+            }
+
+            Image reference;
+            if (!ImageIO::readPFM(referencePath, reference) || reference.width != image.width || reference.height != image.height)
+            {
+                printf("%-24s %9s %9s %9.3f %9s %8s  FAILED: no %dx%d reference at %s\n", name.c_str(), "", "", timing.seconds, "", "", image.width,
+                       image.height, referencePath.c_str());
+                failures++;
+                continue;
+            }
+
+            Regression::Difference difference = Regression::compare(image, reference, renderer.doGammaCorrection);
+            bool imageOk = difference.rmse <= test["maxRmse"].asNumber(0.01) && difference.outliers <= test["maxOutliers"].asNumber(0.001);
+
+            Regression::Timing baseline;
+            const Json &stored = separateBaselines ? baselines[name] : test;
+            baseline.seconds = stored[separateBaselines ? "seconds" : "baselineSeconds"].asNumber(0.0);
+            baseline.noise = stored[separateBaselines ? "noise" : "baselineNoise"].asNumber(0.0);
+            bool timed = baseline.seconds > 0.0 && !recording;
+            if (recording)
+            {
+                baselines.set(name, recorded);
+                baselinesChanged = true;
+            }
+            // Whatever else the machine was busy with passes, a slower build stays slower when it's timed again
+            auto slower = [&]()
+            {
+                return timing.seconds - baseline.seconds > Regression::allowedSlowdown(timing, baseline, options.perfThreshold, options.perfSlack,
+                                                                                       options.perfNoiseBands);
+            };
+            for (int round = 0; timed && round < Regression::retimeRounds && slower(); round++)
+            {
+                Regression::Timing again = timeCase();
+                if (again.seconds < timing.seconds) timing = again;
+            }
+            bool timeOk = !timed || !slower();
+
+            std::string result = (imageOk && timeOk) ? "ok" : "FAILED: ";
+            if (!imageOk) result += "image differs";
+            if (!timeOk) result += imageOk ? "slower than the baseline" : ", slower than the baseline";
+            if (recording) result += ", baseline recorded";
+            char changeText[16] = "";
+            if (timed) snprintf(changeText, sizeof(changeText), "%+.1f%%", (timing.seconds / baseline.seconds - 1.0)*100.0);
+            printf("%-24s %9.5f %9.5f %9.3f %9.3f %8s  %s\n", name.c_str(), difference.rmse, difference.outliers, timing.seconds, baseline.seconds,
+                   changeText, result.c_str());
+            failures += !(imageOk && timeOk);
+        }
+
+        if (baselinesChanged && separateBaselines)
+        {
+            std::ofstream file(options.regressBaselinesPath);
+            file << baselines.dump() << "\n";
+            if (!file.good())
+            {
+                std::cerr << "Error: Could not write `" << options.regressBaselinesPath << "`." << std::endl;
+                return 1;
+            }
+        }
+        if (options.regressUpdate)
+        {
+            if (!separateBaselines && !Jobs::rewrite(options.regressPath, cases, lineNumbers)) return 1;
+            printf("Recorded %zu reference(s) and baseline(s)\n", cases.size() - failures);
+        }
+        else printf("%zu/%zu cases passed (%.0f%%, %.3fs or %.0f noise bands of slowdown allowed)\n", cases.size() - failures, cases.size(),
+                    options.perfThreshold, options.perfSlack, options.perfNoiseBands);
+        return failures ? 1 : 0;
+    }
+
+};
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <utility>
+#include "profiler.h"
+
+// Display images handed from the trace thread to the UI thread, each drawing with a GL context of its own. Three
+// textures rotate between being drawn by the tracer, waiting to be shown and being shown, a fence on each makes one
+// context's GPU work on a texture finish before the other context uses it
+class FrameMailbox
+{
+public:
+
+    FrameMailbox() {}
+
+    // On the trace context, the FBOs only exist there
+    void init(int width, int height)
+    {
+        glGenTextures(3, textures);
+        glGenFramebuffers(3, FBOs);
+        resize(width, height);
+    }
+
+    // On the trace context. The UI keeps showing its current image until the next one is published. The texture it
+    // holds between `acquire` and `release` may still have draws pending on its context, it's resized once it comes
+    // back round to be drawn into
+    void resize(int width, int height)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        this->width = width;
+        this->height = height;
+        for (int i = 0; i < 3; i++)
+            if (!(showing && i == front)) allocate(i);
+        fresh = false;
+    }
+
+    // Trace thread: FBO to draw the next image into, the GPU waits for the UI to be done showing it first
+    GLuint beginWrite()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (sizes[back] != glm::ivec2(width, height)) allocate(back);
+        else waitFor(back);
+        return FBOs[back];
+    }
+
+    // Trace thread: the image drawn since `beginWrite` replaces any that wasn't shown yet
+    void publish()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        signal(back);
+        std::swap(back, ready);
+        fresh = true;
+    }
+
+    // UI thread: texture with the newest image, call once per frame before drawing it
+    GLuint acquire()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (fresh)
+        {
+            std::swap(front, ready);
+            fresh = false;
+        }
+        waitFor(front);
+        showing = true;
+        return textures[front];
+    }
+
+    // UI thread: after submitting the frame that drew the acquired texture
+    void release()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        signal(front);
+        showing = false;
+    }
+
+private:
+
+    std::mutex mutex;
+    GLuint textures[3] = { 0 }, FBOs[3] = { 0 };
+    GLsync fences[3] = { 0 };           // Last use of each texture by the other context
+    glm::ivec2 sizes[3];                // Each texture's current storage
+    int width = 0, height = 0;          // Size the textures should have
+    int back = 0, ready = 1, front = 2;
+    bool fresh = false;                 // `ready` holds an image the UI hasn't picked up
+    bool showing = false;               // The UI acquired `front` and hasn't released it yet
+
+    // Respecifies texture `i` at the current size. Storage another context still uses can't be replaced, so this waits
+    // on the CPU until the UI's last draw from it has finished
+    void allocate(int i)
+    {
+        if (fences[i])
+        {
+            while (glClientWaitSync(fences[i], 0, 1000000000) == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBOs[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        sizes[i] = glm::ivec2(width, height);
+    }
+
+    // Fences are shared between the contexts, the flush makes sure the other one can see this one signal
+    void signal(int i)
+    {
+        if (fences[i]) glDeleteSync(fences[i]);
+        fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+
+    // Server side, the GPU waits and the calling thread doesn't
+    void waitFor(int i)
+    {
+        if (!fences[i]) return;
+        glWaitSync(fences[i], 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fences[i]);
+        fences[i] = 0;
+    }
+
+};
+
+// Runs the path tracer on its own thread and GL context, so a slow pass doesn't hold up the UI and the UI's vsync doesn't
+// hold up tracing. The thread keeps calling `slice` (one frame budget of tiles) with `lock` held, the UI thread holds it
+// while it runs the GUI and reads input. GL work the UI needs on the trace context (its FBOs, VAOs and queries aren't
+// shared) is handed over with `post` and runs before the next slice
+class RenderThread
+{
+public:
+
+    std::mutex lock;                    // Guards the renderer, the scene and the accumulation targets
+    FrameMailbox frames;
+
+    // Stats
+    std::atomic<double> slicesPerSecond{0.0};
+
+    RenderThread() {}
+
+    ~RenderThread() { stop(); }
+
+    // A hidden window whose context shares objects with `window`'s, NULL if the driver won't share. Uses the window hints
+    // `window` was created with
+    static GLFWwindow *createContext(GLFWwindow *window)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        GLFWwindow *context = glfwCreateWindow(1, 1, "Tracer", NULL, window);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        return context;
+    }
+
+    // `context` must not be current on any other thread
+    void start(GLFWwindow *context, std::function<void()> slice)
+    {
+        running = true;
+        thread = std::thread([this, context, slice]()
+        {
+            glfwMakeContextCurrent(context);
+            Profiler::nameThread("Trace");
+            GLsync sliceDone = 0;
+            double rateStart = glfwGetTime();
+            int slices = 0;
+
+            while (running)
+            {
+                // One slice in flight at most, a backlog on the GPU would make the UI's draws queue up behind it
+                if (sliceDone)
+                {
+                    PROFILE_SCOPE("Wait for the last slice");
+                    while (glClientWaitSync(sliceDone, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED && running);
+                    glDeleteSync(sliceDone);
+                    sliceDone = 0;
+                }
+
+                // std::mutex isn't fair, a waiting UI thread goes first
+                while (uiWaiting && running) std::this_thread::yield();
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    PROFILE_SCOPE("Slice");
+                    for (std::function<void()> &task : posted) task();
+                    posted.clear();
+                    slice();
+                }
+                sliceDone = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                glFlush();
+
+                slices++;
+                double now = glfwGetTime();
+                if (now - rateStart >= 0.5)
+                {
+                    slicesPerSecond = slices / (now - rateStart);
+                    rateStart = now;
+                    slices = 0;
+                }
+            }
+
+            if (sliceDone) glDeleteSync(sliceDone);
+            glFinish();
+            glfwMakeContextCurrent(NULL);
+        });
+    }
+
+    void stop()
+    {
+        running = false;
+        if (thread.joinable()) thread.join();
+    }
+
+    bool isRunning() const { return thread.joinable(); }
+
+    // Locks the renderer for the UI thread, ahead of the trace thread's next slice
+    std::unique_lock<std::mutex> acquire()
+    {
+        PROFILE_SCOPE("Wait for the trace thread");
+        uiWaiting = true;
+        std::unique_lock<std::mutex> guard(lock);
+        uiWaiting = false;
+        return guard;
+    }
+
+    // Runs `task` on the trace context before the next slice, call with `lock` held
+    void post(std::function<void()> task)
+    {
+        posted.push_back(std::move(task));
+    }
+
+private:
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> uiWaiting{false};
+    std::vector<std::function<void()>> posted;
+
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <glm/glm.hpp>
 #include <stdlib.h>
+#include <stdio.h>
 #include <vector>
 #include "imgui/imgui.h"
 #include "utils.h"
@@ -11,21 +12,42 @@
 #include "material.h"
 #include "fullQuad.h"
 #include "sphere.h"
+#include "scene.h"
+#include "generator.h"
 #include "camera.h"
+#include "tiles.h"
+#include "picker.h"
+#include "heatmap.h"
+#include "wavefront.h"
+#include "environment.h"
+#include "profiler.h"
 
 class Renderer
 {
 public:
 
     Camera camera;
+    TileScheduler tiles;
+    Scene scene;
+    SceneGenerator generator;
+    Heatmap heatmap;
+    WavefrontTracer wavefront;
+    Environment environment;
+
+    enum Tracer { FRAGMENT = 0, WAVEFRONT = 1, DIRECT = 2 };
 
     // Renderer settings
+    int tracer = FRAGMENT;              // WAVEFRONT needs OpenGL 4.3, the fragment tracer is used without it. DIRECT only
+                                        // lights the first hit, from emissive spheres picked through the scene's light tree
+    int lightSamples = 1;               // Lights sampled per hit by the direct tracer
     int maxRayBounce = 5;
     int sky = 0;
     float u_time;
     int renderedFrameCount = 0;
+    int accumulatedSamples = 0;         // Samples per pixel in the last complete pass
+    int sampleOffset = 0;               // Added to the pass seeds, so renderers sharing an image draw different samples
+    bool fixedSeed = false;             // Seed passes by their index rather than the clock, so a render repeats exactly
     int samplesPerPixel = 1;
-    int test = 0;
     int doGammaCorrection = 1;
     int doTemporalAntiAliasing = 1;
     int samplingMethod = 0;
@@ -44,6 +66,10 @@ public:
         rayTracingShader = Shader("./src/shaders/quad.vert", "./src/shaders/RayTracing.frag");
         pbrShader = Shader("./src/shaders/quad.vert", "./src/shaders/pbr.frag");
         activeRenderingShader = rayTracingShader;
+        tiles.init();
+        picker.init();
+        heatmap.init();
+        scene.initGPU();
         // // Create data UBO
         // glGenBuffers(1, &uboData);
         // glBindBuffer(GL_UNIFORM_BUFFER, uboData);
@@ -61,27 +87,83 @@ public:
     void onUpdate()
     {
         renderedFrameCount = 0;
+        accumulatedSamples = 0;
         skipAA = 2;  // Skip anti aliasing for the next 2 frames
+        tiles.restart();
+    }
+
+    // Starts accumulating from scratch without the passes `onUpdate` skips anti aliasing for, nothing is moving
+    void restartAccumulation()
+    {
+        renderedFrameCount = 0;
+        accumulatedSamples = 0;
+        skipAA = 0;
+        tiles.restart();
     }
     
-    void renderScene(const Window *window, int prevTextureUnit, FullQuad *quad)
+    // Traces the tiles of the current pass that fit in this frame into `target` (the texture of the bound FBO), returns
+    // true when the pass is complete
+    bool renderScene(const Window *window, int prevTextureUnit, FullQuad *quad, GLuint target)
     {
-        debugMenu();
+        PROFILE_SCOPE("Renderer::renderScene");
+
+        // Apply a pick requested on an earlier frame
+        int pickedSphere;
+        if (picker.poll(&pickedSphere)) applySelection(pickedSphere);
         
         // Check if camera was updated
         if (camera.didUpdateThisFrame) onUpdate();
         // TODO: Check if scene was updated (Once scene is moved to another class)
+
+        // Per pass settings, every tile of a pass has to see the same ones
+        if (tiles.atPassStart())
+        {
+            doTemporalAntiAliasing = skipAA ? --skipAA > 1 : doTAA;
+            u_time = (fixedSeed ? 1.0f + 0.016f*(renderedFrameCount + sampleOffset) : (float)glfwGetTime()) / 1000.0f;
+        }
         
-        // Set uniforms
-        camera.setUniforms(activeRenderingShader, window);
-        setSceneUniforms();
-        setSettingsUniforms(prevTextureUnit);
+        // Set uniforms, upload whatever was edited first
+        int64_t uniformsStart = Profiler::begin();
+        scene.upload();
+        if (tracer == DIRECT) scene.uploadLights();
+        bool useWavefront = isWavefrontActive();
+        if (useWavefront && !wavefront.isInitialized()) wavefront.init();
+        Shader *fragmentShader = (tracer == DIRECT) ? &pbrShader : &activeRenderingShader;
+        std::vector<Shader*> programs = useWavefront ? wavefront.programs() : std::vector<Shader*>{ fragmentShader };
+        for (Shader *program : programs)
+        {
+            program->use();
+            camera.setUniforms(*program, window);
+            setSceneUniforms(*program);
+            setSettingsUniforms(*program, prevTextureUnit);
+        }
+        Profiler::end("Set uniforms", uniformsStart);
 
         // Render scene
-        activeRenderingShader.use();
-        quad->render();
+        int64_t tilesStart = Profiler::begin();
+        bool passComplete;
+        if (useWavefront)
+        {
+            int samples = samplesPerPass();
+            wavefront.sceneBounds = scene.bounds();
+            passComplete = tiles.render(window, [&](glm::ivec4 tile) { wavefront.traceTile(tile, target, window->idTexture, samples, maxRayBounce); });
+        }
+        else passComplete = tiles.render(window, [quad](glm::ivec4) { quad->render(); });
+        Profiler::end("Draw tiles", tilesStart);
+        scene.markInUse();
+        if (passComplete)
+        {
+            renderedFrameCount++;
+            accumulatedSamples = doTemporalAntiAliasing ? accumulatedSamples + samplesPerPass() : samplesPerPass();
+        }
+
+        return passComplete;
+    }
 
-        renderedFrameCount++;
+    int samplesPerPass() const
+    {
+        if (!doTAA && !doPixelSampling) return 1;
+        return (samplingMethod == 0) ? samplesPerPixel : samplesPerPixel*samplesPerPixel;
     }
 
     void debugMenu()
@@ -102,103 +184,132 @@ public:
         }
     }
 
-    void setSettingsUniforms(GLint prevTextureUnit)
+    bool isWavefrontActive() const { return tracer == WAVEFRONT && WavefrontTracer::isSupported(); }
+
+    void setSettingsUniforms(const Shader &shader, GLint prevTextureUnit)
     {
         // TODO: Add all these uniforms in a UBO
-        doTemporalAntiAliasing = skipAA ? --skipAA > 1 : doTAA;
-        activeRenderingShader.setBool("sky", sky);
-        activeRenderingShader.setBool("test", test);
-        activeRenderingShader.setBool("doPixelSampling", doPixelSampling);
-        activeRenderingShader.setBool("doGammaCorrection", doGammaCorrection);
-        activeRenderingShader.setBool("doTemporalAntiAliasing", doTemporalAntiAliasing);
-
-        u_time = (float)glfwGetTime() / 1000.0f;
-        activeRenderingShader.setFloat("u_time", u_time);
-
-        activeRenderingShader.setInt("maxRayBounce", maxRayBounce);
-        activeRenderingShader.setInt("samplingMethod", samplingMethod);
-        activeRenderingShader.setInt("renderedFrameCount", renderedFrameCount);
-        activeRenderingShader.setInt("samplesPerPixel", samplesPerPixel);
-        activeRenderingShader.setInt("previousFrame", prevTextureUnit);
+        shader.setBool("sky", sky);
+        shader.setInt("heatmap", heatmap.mode);
+        shader.setFloat("heatmapScale", heatmap.scale);
+        shader.setBool("doPixelSampling", doPixelSampling);
+        shader.setBool("doTemporalAntiAliasing", doTemporalAntiAliasing);
+
+        shader.setFloat("u_time", u_time);
+
+        shader.setInt("maxRayBounce", maxRayBounce);
+        shader.setInt("samplingMethod", samplingMethod);
+        shader.setInt("renderedFrameCount", renderedFrameCount);
+        shader.setInt("frameSeed", renderedFrameCount + sampleOffset);
+        shader.setInt("samplesPerPixel", samplesPerPixel);
+        shader.setInt("lightSamples", lightSamples);
+        shader.setInt("previousFrame", prevTextureUnit);
     }
 
-    void setSceneUniforms()
+    void setSceneUniforms(const Shader &shader)
     {
-        // Set sphere array uniform
-        glBindBuffer(GL_UNIFORM_BUFFER, uboSpheres);
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Sphere)*spheres.size(), spheres.data());
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-        activeRenderingShader.setInt("spheresSize", spheres.size());
-        activeRenderingShader.setInt("selectedSphere", selectedSphere);
+        // Bind the scene buffers after the previous frame texture
+        scene.bind(shader, 1);
+        environment.bind(shader, 13);
+        shader.setInt("selectedSphere", selectedSphere);
+        shader.setInt("selectedInstance", selectedInstance);
     }
-    
-    void selectSphere(glm::ivec2 windowCoord)
-    {
-        // Create ray from window coordinates
-        glm::vec2 pos = glm::vec2(windowCoord.x, windowCoord.y);
-        glm::vec3 pixelSample = camera.viewport.pixelOrigin + (pos.x * camera.viewport.pixelDH) + (pos.y * camera.viewport.pixelDV);
-        glm::vec3 rayPos = camera.position;
-        glm::vec3 rayDir = pixelSample - camera.position;
 
-        auto hitSphere = [rayDir, rayPos](Sphere sphere, float *t) -> bool
-        {
-            glm::vec3 oc = sphere.position - rayPos;
-            float a = glm::dot(rayDir, rayDir);
-            float h = glm::dot(rayDir, oc);
-            float c = glm::dot(oc, oc) - sphere.radius*sphere.radius;
+    // Replaces the scene with a scene file
+    bool loadScene(const std::string &path)
+    {
+        PROFILE_SCOPE("Renderer::loadScene");
+        if (!scene.load(path)) return false;
 
-            float discriminant = h*h - a*c;
-            if (discriminant < 0) return false;
+        applySelection(-1);
+        onUpdate();
+        return true;
+    }
+    
+    // Lights the scene with an equirectangular .hdr or .pfm map instead of the sky
+    bool loadEnvironment(const std::string &path)
+    {
+        if (!environment.load(path)) return false;
+        onUpdate();
+        return true;
+    }
+    
+    // Replaces the scene with a procedural one and frames it
+    void generateScene()
+    {
+        PROFILE_SCOPE("Renderer::generateScene");
+        double start = glfwGetTime();
+        generator.generate(scene);
+        printf("Generated %zu spheres, %zu materials in %.1f ms\n", scene.sphereCount(), scene.materials.size(), (glfwGetTime() - start)*1000.0);
+
+        applySelection(-1);
+        camera.frame(generator.center, generator.extent);
+        onUpdate();
+    }
 
-            float sqrtd = sqrt(discriminant);
+    // Replaces the scene with `spheres` made of `materials`
+    void setScene(std::vector<Material> &&materials, std::vector<Sphere> &&spheres)
+    {
+        scene.assign(std::move(materials), std::move(spheres));
+        applySelection(-1);
+        onUpdate();
+    }
 
-            // Find the nearest root that lies in the acceptable range.
-            float root = (h - sqrtd) / a;
-            if (root <= 0.001 || FLT_MAX <= root) {
-            
-                root = (h + sqrtd) / a;
-                if (root <= 0.001 || FLT_MAX <= root)
-                    return false;
-            }
+    // Adds an OBJ or PLY mesh with a material of its own, places one instance of it where it was modelled and frames it
+    bool loadMesh(const std::string &path)
+    {
+        PROFILE_SCOPE("Renderer::loadMesh");
+        double start = glfwGetTime();
+        Mesh mesh;
+        if (!MeshLoader::load(path, mesh)) return false;
+
+        int material = scene.addMaterial(Dielectric(glm::vec3(0.8), 1.0, 0.5));
+        scene.addInstance(Instance(scene.addMesh(mesh, material), glm::vec3(0.0)));
+        double seconds = glfwGetTime() - start;
+        printf("Loaded %s: %zu triangles, %zu vertices, %zu BVH nodes in %.2fs (%.2f Mtriangles/s)\n", path.c_str(), mesh.triangleCount(),
+               mesh.vertices.size(), mesh.nodes.size(), seconds, mesh.triangleCount() / seconds / 1.0e6);
+
+        camera.frame(mesh.bounds.centre(), 0.5f*glm::length(mesh.bounds.extent()));
+        onUpdate();
+        return true;
+    }
 
-            *t = root;
+    // Replaces the instances of `mesh` with `count` copies on a grid, with varying heading and size, and frames them
+    void scatterInstances(int mesh, int count)
+    {
+        if (mesh < 0 || mesh >= (int)scene.meshes.size()) return;
 
-            return true;
-        };
+        std::vector<Instance> &instances = scene.instances;
+        instances.erase(std::remove_if(instances.begin(), instances.end(), [mesh](const Instance &instance) { return (int)instance.mesh == mesh; }),
+                        instances.end());
 
-        // Find closest intersection of the new ray (this will be the sphere that gets selected)
-        bool doesHit = false;
-        float lowest_t = FLT_MAX;
-        for (int i = 0; i < spheres.size(); i++)
+        AABB bounds = scene.meshBounds(mesh);
+        float spacing = glm::length(bounds.extent())*1.5f;
+        int side = std::max(1, (int)ceil(sqrt((float)count)));
+        for (int i = 0; i < count; i++)
         {
-            float t;
-            if (hitSphere(spheres[i], &t))
-            {
-                doesHit = true;
-                if (t < lowest_t)
-                {
-                    selectedSphere = i;
-                    lowest_t = t;
-                }
-            }
+            float offsetX = (i % side - 0.5f*(side - 1))*spacing, offsetZ = (i / side - 0.5f*(side - 1))*spacing;
+            float heading = fmod(i*2.39996323f, 2.0f*(float)PI);     // Golden angle steps, never lines up with the grid
+            float scale = 0.75f + 0.5f*fmod(i*0.618034f, 1.0f);
+            scene.addInstance(Instance(mesh, glm::vec3(offsetX, 0.0, offsetZ) - bounds.centre(), scale, glm::vec3(0.0, heading, 0.0)));
         }
 
-        if (!doesHit)
-        {
-            selectedSphere = -1;
-            camera.selectSphere(NULL);
-        }
-        else
-        {
-            camera.selectSphere(&(spheres[selectedSphere]));
-        }
+        applySelection(-1);
+        camera.frame(glm::vec3(0.0), 0.75f*side*spacing);
+        onUpdate();
+    }
+
+    // Picks the sphere under `windowCoord` from the object ID buffer, the selection changes once the read lands
+    void selectSphere(const Window *window, glm::ivec2 windowCoord)
+    {
+        picker.request(window, windowCoord);
     }
 
     bool isSphereSelected(Sphere **sphere)
     {
         if (selectedSphere != -1)
         {
-            *sphere = &spheres[selectedSphere];
+            *sphere = &scene.sphere(selectedSphere);
             return true;
         }
 
@@ -207,9 +318,18 @@ public:
 
     Sphere *getSelectedSphere()
     {
-        return (selectedSphere != -1) ? &(spheres[selectedSphere]) : NULL;
+        return (selectedSphere != -1) ? &scene.sphere(selectedSphere) : NULL;
+    }
+
+    int getSelectedSphereIndex() const { return selectedSphere; }
+
+    Instance *getSelectedInstance()
+    {
+        return (selectedInstance != -1) ? &scene.instances[selectedInstance] : NULL;
     }
 
+    void selectInstance(int instance) { applySelection(instance >= 0 ? scene.sphereCount() + instance : -1); }
+
 private:
 
     // Shader programs
@@ -217,38 +337,34 @@ private:
     Shader activeRenderingShader;
     // GLuint uboData, uboDataBindingPoint = 0;
 
-    // Sphere array implementation
-    // TODO: Implement `spheresSize`
-    int spheresSize, maxSphereAmount = 20, selectedSphere = -1; // Index (-1) means no selected sphere
-    std::vector<Sphere> spheres;
-    GLuint uboSpheres, uboSpheresBindingPoint = 1;
+    int selectedSphere = -1; // Index (-1) means no selected sphere
+    int selectedInstance = -1;
     
     // States
     int skipAA = 0;
+    Picker picker;
 
-    void createWorld()
+    // Object IDs count the spheres first, then the mesh instances
+    void applySelection(int objectID)
     {
-        // Create UBO
-        glGenBuffers(1, &uboSpheres);
-        glBindBuffer(GL_UNIFORM_BUFFER, uboSpheres);
-        glBufferData(GL_UNIFORM_BUFFER, sizeof(Sphere)*maxSphereAmount, NULL, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-        // Bind the sphere UBO to a binding point
-        GLuint blockIndex = glGetUniformBlockIndex(activeRenderingShader.ID, "Spheres");
-        glUniformBlockBinding(activeRenderingShader.ID, blockIndex, uboSpheresBindingPoint);
-        glBindBufferBase(GL_UNIFORM_BUFFER, uboSpheresBindingPoint, uboSpheres);
+        int sphereCount = scene.sphereCount(), instance = objectID - sphereCount;
+        selectedSphere = (objectID >= 0 && objectID < sphereCount) ? objectID : -1;
+        selectedInstance = (instance >= 0 && instance < (int)scene.instances.size()) ? instance : -1;
+        camera.selectSphere(getSelectedSphere());
+    }
 
+    void createWorld()
+    {
         // Create the world!
-        Dielectric orange(glm::vec3(0.9, 0.5, 0.0), 1.0, 0.5);
-        Dielectric blue(glm::vec3(0.1, 0.95, 0.8), 1.0, 0.5);
-        Mirror mirror(1.0);
-        Light light(glm::vec3(1.0, 1.0, 1.0), 20.0);
+        int orange = scene.addMaterial(Dielectric(glm::vec3(0.9, 0.5, 0.0), 1.0, 0.5));
+        int blue = scene.addMaterial(Dielectric(glm::vec3(0.1, 0.95, 0.8), 1.0, 0.5));
+        int mirror = scene.addMaterial(Mirror(1.0));
+        int light = scene.addMaterial(Light(glm::vec3(1.0, 1.0, 1.0), 20.0));
         
-        spheres.push_back(Sphere(blue, glm::vec3(0.0, -2000, 0.0), 2000.0));
-        spheres.push_back(Sphere(light,  glm::vec3(-4.3, 14, -15.5), 7.0));
-        spheres.push_back(Sphere(orange, glm::vec3(0.0, 1.0, 0.0), 1.0));
-        spheres.push_back(Sphere(mirror, glm::vec3(2.5, 1.5, 0.0), 1.5));
+        scene.addSphere(Sphere(blue, glm::vec3(0.0, -2000, 0.0), 2000.0));
+        scene.addSphere(Sphere(light,  glm::vec3(-4.3, 14, -15.5), 7.0));
+        scene.addSphere(Sphere(orange, glm::vec3(0.0, 1.0, 0.0), 1.0));
+        scene.addSphere(Sphere(mirror, glm::vec3(2.5, 1.5, 0.0), 1.5));
     }
 
 };
@@ -0,0 +1,771 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include "sphere.h"
+#include "material.h"
+#include "shader.h"
+#include "bvh.h"
+#include "sphereBVH.h"
+#include "lightTree.h"
+#include "mesh.h"
+#include "mappedFile.h"
+#include "taskPool.h"
+#include "textureBuffer.h"
+
+// Binary scene file: a header, a section table and the sections themselves, each stored with its in-memory (and GPU) layout
+namespace SceneFile
+{
+    const char MAGIC[4] = { 'R', 'T', 'S', 'C' };
+    const uint32_t VERSION = 1;
+    const uint64_t ALIGNMENT = 64;          // Sections start on cache line boundaries
+
+    enum SectionType : uint32_t { MATERIALS = 1, SPHERES = 2, BVH_NODES = 3, VERTICES = 4, TRIANGLES = 5, MESHES = 6, INSTANCES = 7, SPHERE_NODES = 8, SPHERE_ORDER = 9 };
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t sectionCount;
+        uint32_t _reserved;
+    };
+
+    struct Section
+    {
+        uint32_t type;
+        uint32_t elementSize;               // Checked on load so a layout change can't be misread
+        uint64_t offset;                    // From the start of the file
+        uint64_t count;
+    };
+
+    static_assert(sizeof(Header) == 16 && sizeof(Section) == 24, "Scene file structs must be packed");
+}
+
+// A mesh inside the scene's shared triangle buffers, all of its indices are already offset into them
+struct MeshInfo
+{
+    uint32_t rootNode;
+    uint32_t firstTriangle;
+    uint32_t triangleCount;
+    uint32_t material;
+};
+
+static_assert(sizeof(MeshInfo) == 16, "MeshInfo must be one vec4 texel");
+
+// A placed copy of a mesh, instances share the mesh's triangles and BVH
+struct Instance
+{
+    glm::vec3 position = glm::vec3(0.0);
+    float scale = 1.0;
+    glm::vec3 rotation = glm::vec3(0.0);        // Euler angles in radians, applied around X, then Y, then Z
+    int32_t material = -1;                      // Replaces the mesh's materials when set
+    uint32_t mesh = 0;
+    uint32_t _pad[3] = { 0, 0, 0 };
+
+    Instance() {}
+
+    Instance(uint32_t mesh, glm::vec3 position, float scale = 1.0, glm::vec3 rotation = glm::vec3(0.0), int material = -1)
+        : position(position), scale(scale), rotation(rotation), material(material), mesh(mesh) {}
+
+    glm::mat4 objectToWorld() const
+    {
+        glm::mat4 transform = glm::translate(glm::mat4(1.0), position);
+        transform = glm::rotate(transform, rotation.z, glm::vec3(0.0, 0.0, 1.0));
+        transform = glm::rotate(transform, rotation.y, glm::vec3(0.0, 1.0, 0.0));
+        transform = glm::rotate(transform, rotation.x, glm::vec3(1.0, 0.0, 0.0));
+        return glm::scale(transform, glm::vec3(scale));
+    }
+};
+
+static_assert(sizeof(Instance) == 48, "Instance must be 48 bytes");
+
+// An instance as the shaders read it, 4 texels: the world to object transform's rows and (mesh, material, instance, 0)
+struct GPUInstance
+{
+    glm::vec4 worldToObject[3];
+    glm::uvec4 info;
+};
+
+// Spheres, triangle meshes and their material table, on the CPU and in GPU buffer textures. Meshes are placed through
+// instances: a top level BVH over the instances' world bounds leads to each mesh's own BVH, so moving an instance only
+// rebuilds the top level
+class Scene
+{
+public:
+
+    std::vector<Material> materials;
+
+    // Meshes, every mesh has its own BVH in `meshNodes`
+    std::vector<glm::vec4> vertices;
+    std::vector<glm::uvec4> triangles;     // (v0, v1, v2, material)
+    std::vector<BVHNode> meshNodes;
+    std::vector<MeshInfo> meshes;
+    std::vector<Instance> instances;
+
+    // Spheres are traced through this BVH, it's refitted as they're edited
+    SphereBVH sphereTree;
+
+    // Emissive spheres for the direct tracer, only rebuilt while it runs
+    LightTree lightTree;
+
+    // Load stats
+    double loadSeconds = 0.0;
+    size_t loadBytes = 0;
+
+    Scene() {}
+
+    // GL objects are only freed while a context is current, the app destroys its window before its members
+    ~Scene()
+    {
+        if (glfwGetCurrentContext()) release();
+        else unmap();
+    }
+
+    Scene(const Scene &) = delete;
+    Scene &operator=(const Scene &) = delete;
+    Scene(Scene &&other) { *this = std::move(other); }
+
+    Scene &operator=(Scene &&other)
+    {
+        if (this == &other) return *this;
+        release();
+
+        materials = std::move(other.materials);
+        vertices = std::move(other.vertices);
+        triangles = std::move(other.triangles);
+        meshNodes = std::move(other.meshNodes);
+        meshes = std::move(other.meshes);
+        instances = std::move(other.instances);
+        sphereTree = std::move(other.sphereTree);
+        lightTree = std::move(other.lightTree);
+        ownedSpheres = std::move(other.ownedSpheres);
+        file = std::move(other.file);
+        mappedSpheres = other.mappedSpheres; mappedCount = other.mappedCount;
+        sphereBuffer = other.sphereBuffer; sphereTexture = other.sphereTexture;
+        materialBuffer = other.materialBuffer; materialTexture = other.materialTexture;
+        for (int i = 0; i < 4; i++)
+        {
+            meshBuffers[i] = other.meshBuffers[i];
+            meshTextures[i] = other.meshTextures[i];
+            other.meshBuffers[i] = other.meshTextures[i] = 0;
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            instanceBuffers[i] = other.instanceBuffers[i];
+            instanceTextures[i] = other.instanceTextures[i];
+            other.instanceBuffers[i] = other.instanceTextures[i] = 0;
+        }
+        persistentSpheres = other.persistentSpheres; bufferCapacity = other.bufferCapacity;
+        usePersistentMapping = other.usePersistentMapping;
+        lastUse = other.lastUse;
+        structureChanged = other.structureChanged; materialsChanged = other.materialsChanged; meshesChanged = other.meshesChanged;
+        instancesChanged = other.instancesChanged; lightsChanged = other.lightsChanged;
+        dirtyBegin = other.dirtyBegin; dirtyEnd = other.dirtyEnd;
+        loadSeconds = other.loadSeconds; loadBytes = other.loadBytes;
+
+        other.mappedSpheres = NULL; other.mappedCount = 0;
+        other.sphereBuffer = other.sphereTexture = other.materialBuffer = other.materialTexture = 0;
+        other.persistentSpheres = NULL;
+        other.lastUse = 0;
+        return *this;
+    }
+
+
+    // * Spheres
+
+    Sphere *spheres() { return mappedSpheres ? mappedSpheres : ownedSpheres.data(); }
+    size_t sphereCount() const { return mappedSpheres ? mappedCount : ownedSpheres.size(); }
+    Sphere &sphere(int i) { return spheres()[i]; }
+
+    void addSphere(const Sphere &sphere)
+    {
+        // A mapped file can't grow, move its spheres into memory we own first
+        if (mappedSpheres)
+        {
+            ownedSpheres.assign(mappedSpheres, mappedSpheres + mappedCount);
+            unmap();
+        }
+
+        ownedSpheres.push_back(sphere);
+        sphereTree.invalidate();
+        structureChanged = lightsChanged = true;
+    }
+
+    int addMaterial(const Material &material)
+    {
+        materials.push_back(material);
+        materialsChanged = lightsChanged = true;
+        return materials.size() - 1;
+    }
+
+    // Appends a mesh (with its BVH built) to the shared triangle buffers, returns its index. It isn't drawn until instanced
+    int addMesh(const Mesh &mesh, int material)
+    {
+        uint32_t firstVertex = vertices.size(), firstTriangle = triangles.size(), firstNode = meshNodes.size();
+
+        vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+        for (glm::uvec4 triangle : mesh.triangles)
+            triangles.push_back(glm::uvec4(triangle.x + firstVertex, triangle.y + firstVertex, triangle.z + firstVertex, material));
+        for (BVHNode node : mesh.nodes)
+        {
+            node.leftOrFirst += node.isLeaf() ? firstTriangle : firstNode;
+            meshNodes.push_back(node);
+        }
+
+        meshes.push_back(MeshInfo{ firstNode, firstTriangle, (uint32_t)mesh.triangles.size(), (uint32_t)material });
+        meshesChanged = instancesChanged = true;
+        return meshes.size() - 1;
+    }
+
+    int addInstance(const Instance &instance)
+    {
+        instances.push_back(instance);
+        instancesChanged = true;
+        return instances.size() - 1;
+    }
+
+    // Bounds of a mesh in its own space, from the root of its BVH
+    AABB meshBounds(int mesh) const
+    {
+        const BVHNode &root = meshNodes[meshes[mesh].rootNode];
+        AABB bounds;
+        bounds.grow(root.min);
+        bounds.grow(root.max);
+        return bounds;
+    }
+
+    // World bounds of the spheres and instances, from the roots of their BVHs as of the last upload
+    AABB bounds() const
+    {
+        AABB bounds;
+        const BVH &tree = sphereTree.bvh();
+        if (sphereCount() && !tree.nodes.empty()) bounds.grow(AABB{ tree.nodes[0].min, tree.nodes[0].max });
+        if (!instances.empty() && !topLevel.nodes.empty()) bounds.grow(AABB{ topLevel.nodes[0].min, topLevel.nodes[0].max });
+        return bounds;
+    }
+
+    AABB instanceBounds(const Instance &instance) const
+    {
+        AABB local = meshBounds(instance.mesh), bounds;
+        glm::mat4 transform = instance.objectToWorld();
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 point((corner & 1) ? local.max.x : local.min.x, (corner & 2) ? local.max.y : local.min.y, (corner & 4) ? local.max.z : local.min.z);
+            bounds.grow(glm::vec3(transform*glm::vec4(point, 1.0)));
+        }
+        return bounds;
+    }
+
+    size_t triangleCount() const { return triangles.size(); }
+
+    // Triangles the instances place in the world, what the scene would cost without sharing
+    size_t instancedTriangleCount() const
+    {
+        size_t count = 0;
+        for (const Instance &instance : instances) count += meshes[instance.mesh].triangleCount;
+        return count;
+    }
+
+    // Replaces the whole scene
+    void assign(std::vector<Material> &&newMaterials, std::vector<Sphere> &&newSpheres)
+    {
+        unmap();
+        clearMeshes();
+        materials = std::move(newMaterials);
+        ownedSpheres = std::move(newSpheres);
+        sphereTree.invalidate();
+        structureChanged = materialsChanged = lightsChanged = true;
+        loadSeconds = 0.0;
+        loadBytes = 0;
+    }
+
+    void clear()
+    {
+        unmap();
+        clearMeshes();
+        ownedSpheres.clear();
+        materials.clear();
+        sphereTree.invalidate();
+        structureChanged = materialsChanged = lightsChanged = true;
+    }
+
+    void clearMeshes()
+    {
+        vertices.clear();
+        triangles.clear();
+        meshNodes.clear();
+        meshes.clear();
+        instances.clear();
+        meshesChanged = instancesChanged = true;
+    }
+
+    void markSphereDirty(int i)
+    {
+        sphereTree.moved(i);
+        lightsChanged = true;
+        dirtyBegin = std::min(dirtyBegin, (size_t)i);
+        dirtyEnd = std::max(dirtyEnd, (size_t)i + 1);
+    }
+
+    void markMaterialsDirty() { materialsChanged = lightsChanged = true; }
+
+    // An instance moved or changed material, only the top level is rebuilt
+    void markInstancesDirty() { instancesChanged = true; }
+
+
+    // * Files
+
+    // Maps the file copy-on-write, so the spheres are used in place and can still be edited
+    bool load(const std::string &path)
+    {
+        double start = glfwGetTime();
+
+        MappedFile newFile;
+        if (!newFile.open(path)) return false;
+        const char *data = newFile.data();
+        size_t size = newFile.size();
+
+        const SceneFile::Header *header = (const SceneFile::Header*)data;
+        if (size < sizeof(SceneFile::Header) || memcmp(header->magic, SceneFile::MAGIC, 4) != 0)
+            return loadError(path, "not a scene file");
+        if (header->version > SceneFile::VERSION)
+            return loadError(path, "written by a newer version");
+        if (sizeof(SceneFile::Header) + header->sectionCount*sizeof(SceneFile::Section) > size)
+            return loadError(path, "truncated section table");
+
+        // Expected element size of each known section
+        const uint32_t elementSizes[] = { 0, sizeof(Material), sizeof(Sphere), sizeof(BVHNode), sizeof(glm::vec4), sizeof(glm::uvec4), sizeof(MeshInfo),
+                                        sizeof(Instance), sizeof(BVHNode), sizeof(uint32_t) };
+        const SceneFile::Section *found[10] = { NULL };
+
+        const SceneFile::Section *sections = (const SceneFile::Section*)(header + 1);
+        for (uint32_t i = 0; i < header->sectionCount; i++)
+        {
+            const SceneFile::Section &section = sections[i];
+            if (section.offset > size || (section.elementSize && section.count > (size - section.offset) / section.elementSize))
+                return loadError(path, "truncated section");
+
+            // Sections this version doesn't know are optional, skip them
+            if (section.type == 0 || section.type > SceneFile::SPHERE_ORDER) continue;
+            if (section.elementSize != elementSizes[section.type]) return loadError(path, "unexpected section layout");
+            found[section.type] = &section;
+        }
+
+        auto sectionData = [&](SceneFile::SectionType type) { return found[type] ? data + found[type]->offset : NULL; };
+        auto sectionCount = [&](SceneFile::SectionType type) { return found[type] ? found[type]->count : 0; };
+
+        // Everything the shaders index with has to be in range, a broken file would have them read past the buffers
+        size_t materialCount = sectionCount(SceneFile::MATERIALS), vertexCount = sectionCount(SceneFile::VERTICES);
+        size_t triangleCount = sectionCount(SceneFile::TRIANGLES), nodeCount = sectionCount(SceneFile::BVH_NODES);
+        const Sphere *fileSpheres = (const Sphere*)sectionData(SceneFile::SPHERES);
+        if (!allOf(sectionCount(SceneFile::SPHERES), [&](size_t i) { return fileSpheres[i].material >= 0 && (size_t)fileSpheres[i].material < materialCount; }))
+            return loadError(path, "sphere with a missing material");
+
+        const glm::uvec4 *fileTriangles = (const glm::uvec4*)sectionData(SceneFile::TRIANGLES);
+        if (!allOf(triangleCount, [&](size_t i)
+            {
+                const glm::uvec4 &triangle = fileTriangles[i];
+                return triangle.x < vertexCount && triangle.y < vertexCount && triangle.z < vertexCount && triangle.w < materialCount;
+            }))
+            return loadError(path, "triangle with a missing vertex or material");
+
+        const BVHNode *fileNodes = (const BVHNode*)sectionData(SceneFile::BVH_NODES);
+        const MeshInfo *fileMeshes = (const MeshInfo*)sectionData(SceneFile::MESHES);
+        std::vector<bool> reachedNodes;
+        for (size_t i = 0; i < sectionCount(SceneFile::MESHES); i++)
+        {
+            const MeshInfo &mesh = fileMeshes[i];
+            if (mesh.rootNode >= nodeCount || (uint64_t)mesh.firstTriangle + mesh.triangleCount > triangleCount || mesh.material >= materialCount)
+                return loadError(path, "mesh out of range");
+            if (!BVH::isTree(fileNodes, nodeCount, mesh.rootNode, triangleCount, reachedNodes)) return loadError(path, "mesh BVH node out of range");
+        }
+
+        const Instance *fileInstances = (const Instance*)sectionData(SceneFile::INSTANCES);
+        for (size_t i = 0; i < sectionCount(SceneFile::INSTANCES); i++)
+        {
+            if (fileInstances[i].mesh >= sectionCount(SceneFile::MESHES)) return loadError(path, "instance of a missing mesh");
+            if (fileInstances[i].material < -1 || fileInstances[i].material >= (int64_t)materialCount) return loadError(path, "instance with a missing material");
+        }
+
+        double checked = glfwGetTime();
+        unmap();
+        const Material *fileMaterials = (const Material*)sectionData(SceneFile::MATERIALS);
+        materials.assign(fileMaterials, fileMaterials + sectionCount(SceneFile::MATERIALS));
+        ownedSpheres.clear();
+        mappedSpheres = (Sphere*)sectionData(SceneFile::SPHERES);
+        mappedCount = sectionCount(SceneFile::SPHERES);
+
+        // Meshes are copied, they're uploaded once and never edited in place
+        copySection(vertices, sectionData(SceneFile::VERTICES), sectionCount(SceneFile::VERTICES));
+        copySection(triangles, sectionData(SceneFile::TRIANGLES), sectionCount(SceneFile::TRIANGLES));
+        copySection(meshNodes, sectionData(SceneFile::BVH_NODES), sectionCount(SceneFile::BVH_NODES));
+        copySection(meshes, sectionData(SceneFile::MESHES), sectionCount(SceneFile::MESHES));
+        copySection(instances, sectionData(SceneFile::INSTANCES), sectionCount(SceneFile::INSTANCES));
+
+        // Files from before instancing place every mesh once where it was loaded
+        if (!found[SceneFile::INSTANCES])
+            for (size_t i = 0; i < meshes.size(); i++) instances.push_back(Instance(i, glm::vec3(0.0)));
+
+        // Files carry the sphere BVH so large scenes don't wait for a build, older files get one on the first upload
+        if (!sphereTree.assign((const BVHNode*)sectionData(SceneFile::SPHERE_NODES), sectionCount(SceneFile::SPHERE_NODES),
+                               (const uint32_t*)sectionData(SceneFile::SPHERE_ORDER), mappedCount) && found[SceneFile::SPHERE_NODES])
+            std::cerr << "Warning: The sphere BVH in `" << path << "` doesn't match its spheres, rebuilding it." << std::endl;
+
+        file = std::move(newFile);
+        structureChanged = materialsChanged = meshesChanged = instancesChanged = lightsChanged = true;
+        double assigned = glfwGetTime();
+
+        // Copy straight from the mapping into the GPU buffer
+        upload();
+        glFinish();                         // So the printed upload time covers the copy, not just queueing it
+
+        loadSeconds = glfwGetTime() - start;
+        loadBytes = size;
+        printf("Loaded %s: %zu spheres, %zu triangles in %zu meshes (%zu instances), %zu materials, %.1f MB in %.1f ms (%.2f GB/s): checks %.1f ms, "
+               "copies and sphere BVH %.1f ms, upload %.1f ms\n", path.c_str(), sphereCount(), triangles.size(), meshes.size(), instances.size(),
+               materials.size(), size / 1.0e6, loadSeconds*1000.0, size / loadSeconds / 1.0e9, (checked - start)*1000.0, (assigned - checked)*1000.0,
+               (glfwGetTime() - assigned)*1000.0);
+
+        return true;
+    }
+
+    bool save(const std::string &path)
+    {
+        FILE *output = fopen(path.c_str(), "wb");
+        if (!output)
+        {
+            std::cerr << "Error: Could not write `" << path << "`." << std::endl;
+            return false;
+        }
+
+        if (!sphereTree.isValid()) sphereTree.build(spheres(), sphereCount());
+        else sphereTree.refit(spheres(), sphereCount());
+        const BVH &tree = sphereTree.bvh();
+
+        const int sectionCount = 9;
+        struct { SceneFile::SectionType type; uint32_t elementSize; const void *data; uint64_t count; } contents[sectionCount] = {
+            { SceneFile::MATERIALS, sizeof(Material), materials.data(), materials.size() },
+            { SceneFile::SPHERES, sizeof(Sphere), spheres(), sphereCount() },
+            { SceneFile::VERTICES, sizeof(glm::vec4), vertices.data(), vertices.size() },
+            { SceneFile::TRIANGLES, sizeof(glm::uvec4), triangles.data(), triangles.size() },
+            { SceneFile::BVH_NODES, sizeof(BVHNode), meshNodes.data(), meshNodes.size() },
+            { SceneFile::MESHES, sizeof(MeshInfo), meshes.data(), meshes.size() },
+            { SceneFile::INSTANCES, sizeof(Instance), instances.data(), instances.size() },
+            { SceneFile::SPHERE_NODES, sizeof(BVHNode), tree.nodes.data(), tree.nodes.size() },
+            { SceneFile::SPHERE_ORDER, sizeof(uint32_t), tree.order.data(), tree.order.size() }
+        };
+
+        SceneFile::Header header = { { 'R', 'T', 'S', 'C' }, SceneFile::VERSION, sectionCount, 0 };
+        SceneFile::Section sections[sectionCount];
+        uint64_t offset = sizeof(header) + sectionCount*sizeof(SceneFile::Section);
+        for (int i = 0; i < sectionCount; i++)
+        {
+            offset = align(offset);
+            sections[i] = { contents[i].type, contents[i].elementSize, offset, contents[i].count };
+            offset += contents[i].count*contents[i].elementSize;
+        }
+
+        fwrite(&header, sizeof(header), 1, output);
+        fwrite(sections, sizeof(SceneFile::Section), sectionCount, output);
+        for (int i = 0; i < sectionCount; i++)
+        {
+            pad(output, sections[i].offset);
+            fwrite(contents[i].data, contents[i].elementSize, contents[i].count, output);
+        }
+
+        return fclose(output) == 0;
+    }
+
+
+    // * GPU
+
+    void initGPU()
+    {
+        // Persistently mapped buffers (GL 4.4) let us copy into GPU memory without an intermediate driver copy
+        usePersistentMapping = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+        glGenTextures(1, &sphereTexture);
+        glGenTextures(1, &materialTexture);
+        glGenBuffers(1, &materialBuffer);
+        glGenTextures(4, meshTextures);
+        glGenBuffers(4, meshBuffers);
+        glGenTextures(2, instanceTextures);
+        glGenBuffers(2, instanceBuffers);
+        sphereTree.initGPU();
+        lightTree.initGPU();
+    }
+
+    // Sends whatever changed since the last upload to the GPU
+    void upload()
+    {
+        if (structureChanged) uploadSpheres();
+        else if (dirtyBegin < dirtyEnd) updateSpheres(dirtyBegin, dirtyEnd);
+        dirtyBegin = SIZE_MAX;
+        dirtyEnd = 0;
+
+        sphereTree.refit(spheres(), sphereCount());
+        sphereTree.upload();
+
+        if (materialsChanged)
+        {
+            uploadTextureBuffer(materialBuffer, materialTexture, GL_RGBA32F, materials.data(), materials.size()*sizeof(Material));
+            materialsChanged = false;
+        }
+
+        if (meshesChanged)
+        {
+            uploadTextureBuffer(meshBuffers[0], meshTextures[0], GL_RGBA32F, vertices.data(), vertices.size()*sizeof(glm::vec4));
+            uploadTextureBuffer(meshBuffers[1], meshTextures[1], GL_RGBA32UI, triangles.data(), triangles.size()*sizeof(glm::uvec4));
+            uploadTextureBuffer(meshBuffers[2], meshTextures[2], GL_RGBA32UI, meshNodes.data(), meshNodes.size()*sizeof(BVHNode));
+            uploadTextureBuffer(meshBuffers[3], meshTextures[3], GL_RGBA32UI, meshes.data(), meshes.size()*sizeof(MeshInfo));
+            meshesChanged = false;
+        }
+
+        if (instancesChanged)
+        {
+            buildTopLevel();
+            uploadTextureBuffer(instanceBuffers[0], instanceTextures[0], GL_RGBA32UI, gpuInstances.data(), gpuInstances.size()*sizeof(GPUInstance));
+            uploadTextureBuffer(instanceBuffers[1], instanceTextures[1], GL_RGBA32UI, topLevel.nodes.data(), topLevel.nodes.size()*sizeof(BVHNode));
+            instancesChanged = false;
+        }
+    }
+
+    // Rebuilds the light tree after any sphere or material edit, only the direct tracer needs it
+    void uploadLights()
+    {
+        if (!lightsChanged) return;
+        lightTree.build(spheres(), sphereCount(), materials);
+        lightTree.upload();
+        lightsChanged = false;
+    }
+
+    // Binds the scene's buffer textures starting at texture unit `firstUnit`
+    void bind(const Shader &shader, int firstUnit)
+    {
+        const char *names[8] = { "sphereData", "materialData", "vertexData", "triangleData", "meshNodeData", "meshData", "instanceData", "instanceNodeData" };
+        GLuint textures[8] = { sphereTexture, materialTexture, meshTextures[0], meshTextures[1], meshTextures[2], meshTextures[3],
+                               instanceTextures[0], instanceTextures[1] };
+        for (int i = 0; i < 8; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            shader.setInt(names[i], firstUnit + i);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        sphereTree.bind(shader, firstUnit + 8);
+        lightTree.bind(shader, firstUnit + 10);
+
+        shader.setInt("spheresSize", sphereCount());
+        shader.setInt("instanceCount", instances.size());
+    }
+
+    // Called after draws that read the scene, persistent writes wait for them before touching the buffer
+    void markInUse()
+    {
+        if (!persistentSpheres) return;
+        if (lastUse) glDeleteSync(lastUse);
+        lastUse = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+
+    std::vector<Sphere> ownedSpheres;
+
+    // File mapping
+    MappedFile file;
+    Sphere *mappedSpheres = NULL;
+    size_t mappedCount = 0;
+
+    // GPU buffers
+    GLuint sphereBuffer = 0, sphereTexture = 0, materialBuffer = 0, materialTexture = 0;
+    GLuint meshBuffers[4] = { 0 }, meshTextures[4] = { 0 };     // Vertices, triangles, BVH nodes and mesh table
+    GLuint instanceBuffers[2] = { 0 }, instanceTextures[2] = { 0 };   // Instances and top level BVH nodes
+    Sphere *persistentSpheres = NULL;
+    size_t bufferCapacity = 0;
+    bool usePersistentMapping = false;
+    GLsync lastUse = 0;
+
+    // Changes waiting for an upload
+    bool structureChanged = true, materialsChanged = true, meshesChanged = true, instancesChanged = true, lightsChanged = true;
+
+    // Top level, its leaves index `gpuInstances` which is kept in leaf order
+    BVH topLevel;
+    std::vector<GPUInstance> gpuInstances;
+    size_t dirtyBegin = SIZE_MAX, dirtyEnd = 0;
+
+    void uploadSpheres()
+    {
+        size_t count = sphereCount(), size = std::max(count, (size_t)1)*sizeof(Sphere);
+
+        GLint maxTexels;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        if (2*count > (size_t)maxTexels)
+            std::cerr << "Warning: " << count << " spheres exceed the buffer texture limit of " << maxTexels / 2 << "." << std::endl;
+
+        if (usePersistentMapping)
+        {
+            // Immutable storage can't be resized, make a new buffer when it's too small
+            if (size > bufferCapacity)
+            {
+                waitForGPU();
+                if (sphereBuffer) glDeleteBuffers(1, &sphereBuffer);
+                glGenBuffers(1, &sphereBuffer);
+                glBindBuffer(GL_TEXTURE_BUFFER, sphereBuffer);
+
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(GL_TEXTURE_BUFFER, size, NULL, flags);
+                persistentSpheres = (Sphere*)glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, flags);
+                bufferCapacity = size;
+            }
+
+            waitForGPU();
+            memcpy(persistentSpheres, spheres(), count*sizeof(Sphere));
+        }
+        else
+        {
+            if (!sphereBuffer) glGenBuffers(1, &sphereBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, sphereBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, size, spheres(), GL_DYNAMIC_DRAW);
+            bufferCapacity = size;
+        }
+
+        glBindTexture(GL_TEXTURE_BUFFER, sphereTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, sphereBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        structureChanged = false;
+    }
+
+    // Only the spheres in [begin, end) changed
+    void updateSpheres(size_t begin, size_t end)
+    {
+        end = std::min(end, sphereCount());
+        if (begin >= end) return;
+
+        if (persistentSpheres)
+        {
+            waitForGPU();
+            memcpy(persistentSpheres + begin, spheres() + begin, (end - begin)*sizeof(Sphere));
+        }
+        else
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, sphereBuffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, begin*sizeof(Sphere), (end - begin)*sizeof(Sphere), spheres() + begin);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+    }
+
+    void buildTopLevel()
+    {
+        std::vector<AABB> bounds(instances.size());
+        for (size_t i = 0; i < instances.size(); i++) bounds[i] = instanceBounds(instances[i]);
+
+        topLevel.maxLeafSize = 2;
+        topLevel.build(bounds);
+
+        gpuInstances.resize(instances.size());
+        for (size_t slot = 0; slot < instances.size(); slot++)
+        {
+            uint32_t index = topLevel.order[slot];
+            const Instance &instance = instances[index];
+            glm::mat4 worldToObject = glm::inverse(instance.objectToWorld());
+
+            GPUInstance &gpu = gpuInstances[slot];
+            for (int row = 0; row < 3; row++)
+                gpu.worldToObject[row] = glm::vec4(worldToObject[0][row], worldToObject[1][row], worldToObject[2][row], worldToObject[3][row]);
+            gpu.info = glm::uvec4(instance.mesh, (uint32_t)instance.material, index, 0);
+        }
+    }
+
+    // Whether `valid(i)` holds for every i in [0, count), in parallel since the sphere section can be hundreds of MB
+    template <typename Predicate>
+    static bool allOf(size_t count, Predicate valid)
+    {
+        std::atomic<bool> ok(true);
+        TaskPool::global().parallelFor(0, count, 1 << 16, [&ok, &valid](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last && ok.load(std::memory_order_relaxed); i++)
+                if (!valid(i)) ok = false;
+        });
+        return ok;
+    }
+
+    // Large sections are copied in parallel, page faults on the mapping are what a single thread waits on
+    template <typename T>
+    static void copySection(std::vector<T> &destination, const char *data, size_t count)
+    {
+        destination.resize(count);
+        char *target = (char*)destination.data();
+        TaskPool::global().parallelFor(0, count*sizeof(T), 4 << 20, [target, data](size_t first, size_t last)
+        {
+            memcpy(target + first, data + first, last - first);
+        });
+    }
+
+    void waitForGPU()
+    {
+        if (!lastUse) return;
+        while (glClientWaitSync(lastUse, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(lastUse);
+        lastUse = 0;
+    }
+
+    void release()
+    {
+        unmap();
+        sphereTree.release();
+        lightTree.release();
+        if (lastUse) glDeleteSync(lastUse);
+        if (sphereBuffer) glDeleteBuffers(1, &sphereBuffer);
+        if (materialBuffer) glDeleteBuffers(1, &materialBuffer);
+        if (sphereTexture) glDeleteTextures(1, &sphereTexture);
+        if (materialTexture) glDeleteTextures(1, &materialTexture);
+        if (meshBuffers[0]) glDeleteBuffers(4, meshBuffers);
+        if (meshTextures[0]) glDeleteTextures(4, meshTextures);
+        if (instanceBuffers[0]) glDeleteBuffers(2, instanceBuffers);
+        if (instanceTextures[0]) glDeleteTextures(2, instanceTextures);
+        lastUse = 0;
+        sphereBuffer = materialBuffer = sphereTexture = materialTexture = 0;
+        for (int i = 0; i < 4; i++) meshBuffers[i] = meshTextures[i] = 0;
+        for (int i = 0; i < 2; i++) instanceBuffers[i] = instanceTextures[i] = 0;
+        persistentSpheres = NULL;
+        bufferCapacity = 0;
+    }
+
+    static uint64_t align(uint64_t offset) { return (offset + SceneFile::ALIGNMENT - 1) & ~(SceneFile::ALIGNMENT - 1); }
+
+    static void pad(FILE *output, uint64_t offset)
+    {
+        static const char zeros[SceneFile::ALIGNMENT] = { 0 };
+        long position = ftell(output);
+        if ((uint64_t)position < offset) fwrite(zeros, 1, offset - position, output);
+    }
+
+    bool loadError(const std::string &path, const char *reason)
+    {
+        std::cerr << "Error: Could not load `" << path << "`: " << reason << "." << std::endl;
+        return false;
+    }
+
+    void unmap()
+    {
+        file.close();
+        mappedSpheres = NULL;
+        mappedCount = 0;
+    }
+
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef SEQUENCE_MODE_H
+#define SEQUENCE_MODE_H
+
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include "app.h"
+#include "cameraPath.h"
+#include "exporter.h"
+#include "readback.h"
+
+// `--path` and `--turntable`: renders a camera path to numbered images or a video
+class SequenceMode
+{
+public:
+
+    // Renders every frame of a camera path to `options.samples` spp. Tracing frame N+1 overlaps the readback and encoding of frame N
+    static int run(App &app)
+    {
+        const Options &options = app.options;
+        Renderer &renderer = app.renderer;
+        Window &sceneWindow = app.sceneWindow;
+
+        CameraPath path;
+        if (options.turntableFrames > 0)
+        {
+            Camera &camera = renderer.camera;
+            path = CameraPath::turntable(camera.lookat, camera.distance, camera.phi, camera.focalLength, options.turntableFrames);
+        }
+        else if (!path.load(options.cameraPath)) return 1;
+
+        bool toVideo = !options.ffmpegOut.empty();
+        if (!toVideo && !ImageIO::isSupported(options.outPath))
+        {
+            std::cerr << "Error: Unsupported image format `" << options.outPath << "`, use .png, .exr or .pfm." << std::endl;
+            return 1;
+        }
+
+        // Encoders, either numbered images written by a pool of threads or raw frames piped into ffmpeg in order
+        ImageWriter writer;
+        FramePipe pipe;
+        if (toVideo)
+        {
+            std::vector<std::string> command = { "ffmpeg", "-y", "-loglevel", "error", "-f", "rawvideo", "-pix_fmt", "rgb24",
+                                                 "-s", std::to_string(sceneWindow.width) + "x" + std::to_string(sceneWindow.height),
+                                                 "-r", std::to_string(options.fps), "-i", "-", "-pix_fmt", "yuv420p", options.ffmpegOut };
+            if (!pipe.open(command, renderer.doGammaCorrection)) return 1;
+        }
+        else writer.start(std::max(options.encoderThreads, 1));
+
+        // Ring of PBOs, frames are handed to the encoders once their copy has landed
+        Readback readback;
+        readback.init(3);
+        const int maxBacklog = 2*std::max(options.encoderThreads, 1) + 3;
+        auto backlog = [&]() { return readback.pending() + (toVideo ? pipe.backlog() : writer.backlog()); };
+
+        renderer.tiles.frameBudgetMs = 0.0;
+        int frames = (options.frames > 0) ? options.frames : path.size();
+        double start = glfwGetTime(), traceTime = 0.0, stallTime = 0.0;
+
+        for (int frame = 0; frame < frames; frame++)
+        {
+            renderer.camera.applyKeyframe(path.sample(frames > 1 ? frame / (float)(frames - 1) : 0.0f));
+            renderer.onUpdate();
+
+            double frameStart = glfwGetTime();
+            while (renderer.accumulatedSamples < options.samples)
+            {
+                app.traceFrame();
+                readback.poll();
+            }
+            traceTime += glfwGetTime() - frameStart;
+
+            // Don't let finished frames pile up in memory when encoding is slower than tracing
+            double stallStart = glfwGetTime();
+            while (backlog() >= maxBacklog)
+            {
+                readback.poll();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            stallTime += glfwGetTime() - stallStart;
+
+            std::string framePath = toVideo ? "" : Exporter::numberedPath(options.outPath, frame);
+            readback.request(app.lastPass(), sceneWindow.width, sceneWindow.height, [&, framePath](Image &&image)
+            {
+                if (toVideo) pipe.push(std::move(image));
+                else writer.push(std::move(image), framePath, renderer.doGammaCorrection);
+            });
+
+            double elapsed = glfwGetTime() - start;
+            printf("\rFrame %d/%d, %.1f frames/hour", frame + 1, frames, (frame + 1) / elapsed * 3600.0);
+            fflush(stdout);
+        }
+
+        readback.finish();
+        int written, status = 0;
+        if (toVideo)
+        {
+            status = pipe.close();
+            written = pipe.written;
+        }
+        else
+        {
+            writer.wait();
+            written = writer.written;
+        }
+        double totalTime = glfwGetTime() - start;
+
+        printf("\nRendered %d frames at %d spp in %.2fs: %.1f frames/hour (tracing %.2fs, waiting on encoders %.2fs), wrote %d frame(s)\n",
+               frames, options.samples, totalTime, frames / totalTime * 3600.0, traceTime, stallTime, written);
+
+        return (written == frames && status == 0) ? 0 : 1;
+    }
+
+};
+
+#endif
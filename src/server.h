@@ -0,0 +1,340 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <GLFW/glfw3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <algorithm>
+#include "json.h"
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <errno.h>
+    #include <poll.h>
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/time.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+#endif
+
+#ifndef _WIN32
+
+// HTTP front end of the headless render server, bound to localhost. A thread accepts requests, answers `/metrics` right
+// away and queues `POST /render` jobs by priority, then arrival. The render loop takes the jobs on the GL thread and
+// answers them on the job's socket, which the job owns from then on
+class RenderServer
+{
+public:
+
+    struct Job
+    {
+        uint64_t id = 0;
+        int priority = 0;               // Higher starts first
+        double queuedAt = 0.0;
+        Json request;
+        int client = -1;
+    };
+
+    enum Outcome { DONE = 0, FAILED = 1, CANCELLED = 2 };   // Cancelled jobs lost their client
+
+    RenderServer() {}
+
+    ~RenderServer() { stop(); }
+
+    bool start(int port)
+    {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+        {
+            std::cerr << "Error: Could not listen on port " << port << "." << std::endl;
+            if (listener >= 0) close(listener);
+            listener = -1;
+            return false;
+        }
+
+        startedAt = glfwGetTime();
+        running = true;
+        thread = std::thread(&RenderServer::accept, this);
+        printf("Serving on http://127.0.0.1:%d (POST /render, GET /metrics, POST /shutdown)\n", port);
+        fflush(stdout);
+        return true;
+    }
+
+    void stop()
+    {
+        running = false;
+        if (thread.joinable()) thread.join();
+        if (listener >= 0) close(listener);
+        listener = -1;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!queue.empty())
+        {
+            respond(queue.top().job.client, 503, "text/plain", "Server stopped\n");
+            queue.pop();
+        }
+    }
+
+    // Blocks until there is a job, highest priority first. False once shut down and the queue is drained
+    bool next(Job &job)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this]() { return !queue.empty() || shuttingDown || !running; });
+        if (queue.empty()) return false;
+
+        job = queue.top().job;
+        queue.pop();
+        double latency = glfwGetTime() - job.queuedAt;
+        latencySum += latency;
+        latencyMax = std::max(latencyMax, latency);
+        started++;
+        return true;
+    }
+
+    void finished(Outcome outcome, double renderSeconds, uint64_t pixelSamples, bool sceneReused)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        outcomes[outcome]++;
+        renderSum += renderSeconds;
+        pixelSampleCount += pixelSamples;
+        (sceneReused ? sceneReuses : sceneLoads)++;
+    }
+
+
+    // * Responses, for the render loop too
+
+    // Headers of a response whose body follows, without a length the body ends when the connection closes
+    static bool sendHeader(int client, int status, const char *contentType, long contentLength = -1)
+    {
+        std::string header = "HTTP/1.1 " + std::to_string(status) + " " + reason(status) + "\r\nContent-Type: " + contentType +
+                             "\r\nCache-Control: no-cache\r\nConnection: close\r\n";
+        if (contentLength >= 0) header += "Content-Length: " + std::to_string(contentLength) + "\r\n";
+        return sendAll(client, header.data(), header.size()) && sendAll(client, "\r\n", 2);
+    }
+
+    static bool sendAll(int client, const void *data, size_t size)
+    {
+        const char *bytes = (const char*)data;
+        while (size > 0)
+        {
+            ssize_t sent = send(client, bytes, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            bytes += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    // Whole response, then closes the connection
+    static void respond(int client, int status, const char *contentType, const std::string &body)
+    {
+        if (sendHeader(client, status, contentType, body.size())) sendAll(client, body.data(), body.size());
+        close(client);
+    }
+
+private:
+
+    struct Queued
+    {
+        Job job;
+        uint64_t sequence;
+
+        bool operator<(const Queued &other) const
+        {
+            return (job.priority != other.job.priority) ? job.priority < other.job.priority : sequence > other.sequence;
+        }
+    };
+
+    int listener = -1;
+    std::thread thread;
+    std::atomic<bool> running{false};
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::priority_queue<Queued> queue;
+    bool shuttingDown = false;
+    uint64_t sequence = 0;
+
+    // Metrics
+    double startedAt = 0.0;
+    uint64_t started = 0, outcomes[3] = { 0, 0, 0 };
+    double latencySum = 0.0, latencyMax = 0.0, renderSum = 0.0;
+    uint64_t pixelSampleCount = 0, sceneLoads = 0, sceneReuses = 0;
+
+    static const char *reason(int status)
+    {
+        switch (status)
+        {
+            case 200: return "OK";
+            case 400: return "Bad Request";
+            case 404: return "Not Found";
+            case 405: return "Method Not Allowed";
+            case 413: return "Payload Too Large";
+            case 500: return "Internal Server Error";
+            case 503: return "Service Unavailable";
+        }
+        return "Unknown";
+    }
+
+    void accept()
+    {
+        while (running)
+        {
+            pollfd descriptor = { listener, POLLIN, 0 };
+            if (poll(&descriptor, 1, 200) <= 0) continue;
+
+            int client = ::accept(listener, NULL, NULL);
+            if (client < 0) continue;
+
+            // A stalled client can't hold up the others for long
+            timeval timeout = { 5, 0 };
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            handle(client);
+        }
+    }
+
+    void handle(int client)
+    {
+        std::string method, path, body;
+        int status = read(client, method, path, body);
+        if (status != 200)
+        {
+            respond(client, status, "text/plain", std::string(reason(status)) + "\n");
+            return;
+        }
+
+        if (path == "/metrics")
+        {
+            if (method != "GET") respond(client, 405, "text/plain", "Use GET\n");
+            else respond(client, 200, "text/plain; version=0.0.4", metrics());
+        }
+        else if (path == "/render")
+        {
+            Job job;
+            std::string error;
+            if (method != "POST") respond(client, 405, "text/plain", "Use POST\n");
+            else if (!Json::parse(body, job.request, error) || !job.request.isObject())
+                respond(client, 400, "text/plain", "Bad job: " + (error.empty() ? std::string("expected an object") : error) + "\n");
+            else
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (shuttingDown)
+                {
+                    respond(client, 503, "text/plain", "Shutting down\n");
+                    return;
+                }
+                job.id = ++sequence;
+                job.priority = job.request["priority"].asInt(0);
+                job.queuedAt = glfwGetTime();
+                job.client = client;
+                queue.push(Queued{ job, job.id });
+                wake.notify_one();
+            }
+        }
+        else if (path == "/shutdown" && method == "POST")
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                shuttingDown = true;
+            }
+            wake.notify_all();
+            respond(client, 200, "text/plain", "Finishing queued jobs\n");
+        }
+        else respond(client, 404, "text/plain", "Not found\n");
+    }
+
+    // Request line, headers and a Content-Length body. Returns the status to fail with, 200 when the request is complete
+    static int read(int client, std::string &method, std::string &path, std::string &body)
+    {
+        const size_t maxHeader = 64 << 10, maxBody = 256 << 20;
+        std::string data;
+        size_t headerEnd;
+        char buffer[16384];
+        while ((headerEnd = data.find("\r\n\r\n")) == std::string::npos)
+        {
+            if (data.size() > maxHeader) return 413;
+            ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0) return 400;
+            data.append(buffer, received);
+        }
+
+        size_t lineEnd = data.find("\r\n");
+        std::string line = data.substr(0, lineEnd);
+        size_t first = line.find(' '), second = line.find(' ', first + 1);
+        if (first == std::string::npos || second == std::string::npos) return 400;
+        method = line.substr(0, first);
+        path = line.substr(first + 1, second - first - 1);
+        path = path.substr(0, path.find('?'));
+
+        // Header names are case insensitive
+        std::string headers = data.substr(lineEnd, headerEnd - lineEnd);
+        std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+        size_t length = 0, field = headers.find("\r\ncontent-length:");
+        if (field != std::string::npos) length = strtoull(headers.c_str() + field + 17, NULL, 10);
+        if (length > maxBody) return 413;
+
+        body = data.substr(headerEnd + 4);
+        while (body.size() < length)
+        {
+            ssize_t received = recv(client, buffer, std::min(sizeof(buffer), length - body.size()), 0);
+            if (received <= 0) return 400;
+            body.append(buffer, received);
+        }
+        body.resize(length);
+        return 200;
+    }
+
+    // Prometheus text format
+    std::string metrics()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t finished = outcomes[DONE] + outcomes[FAILED] + outcomes[CANCELLED];
+        char text[2048];
+        snprintf(text, sizeof(text),
+                 "# HELP render_queue_length Jobs waiting to start.\n# TYPE render_queue_length gauge\nrender_queue_length %zu\n"
+                 "# HELP render_jobs_running Jobs being rendered.\n# TYPE render_jobs_running gauge\nrender_jobs_running %llu\n"
+                 "# HELP render_jobs_total Finished jobs by outcome.\n# TYPE render_jobs_total counter\n"
+                 "render_jobs_total{outcome=\"done\"} %llu\nrender_jobs_total{outcome=\"failed\"} %llu\nrender_jobs_total{outcome=\"cancelled\"} %llu\n"
+                 "# HELP render_queue_latency_seconds Time from queueing a job to starting it.\n# TYPE render_queue_latency_seconds summary\n"
+                 "render_queue_latency_seconds_sum %.6f\nrender_queue_latency_seconds_count %llu\n"
+                 "# HELP render_queue_latency_max_seconds Longest wait of any job.\n# TYPE render_queue_latency_max_seconds gauge\n"
+                 "render_queue_latency_max_seconds %.6f\n"
+                 "# HELP render_job_seconds Time spent rendering jobs.\n# TYPE render_job_seconds summary\n"
+                 "render_job_seconds_sum %.6f\nrender_job_seconds_count %llu\n"
+                 "# HELP render_pixel_samples_total Samples traced over all jobs.\n# TYPE render_pixel_samples_total counter\n"
+                 "render_pixel_samples_total %llu\n"
+                 "# HELP render_pixel_samples_per_second Throughput while rendering.\n# TYPE render_pixel_samples_per_second gauge\n"
+                 "render_pixel_samples_per_second %.1f\n"
+                 "# HELP render_scene_loads_total Jobs that replaced the scene, the others reused the warm one.\n# TYPE render_scene_loads_total counter\n"
+                 "render_scene_loads_total %llu\nrender_scene_reuses_total %llu\n"
+                 "# HELP render_uptime_seconds Time since the server started.\n# TYPE render_uptime_seconds gauge\nrender_uptime_seconds %.3f\n",
+                 queue.size(), (unsigned long long)(started - finished), (unsigned long long)outcomes[DONE], (unsigned long long)outcomes[FAILED],
+                 (unsigned long long)outcomes[CANCELLED], latencySum, (unsigned long long)started, latencyMax, renderSum, (unsigned long long)finished,
+                 (unsigned long long)pixelSampleCount, (renderSum > 0.0) ? pixelSampleCount / renderSum : 0.0, (unsigned long long)sceneLoads,
+                 (unsigned long long)sceneReuses, glfwGetTime() - startedAt);
+        return text;
+    }
+
+};
+
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef SERVER_MODE_H
+#define SERVER_MODE_H
+
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include "app.h"
+#include "jobs.h"
+#include "server.h"
+
+// `--serve`: renders the jobs posted to the render server
+class ServerMode
+{
+public:
+
+    // Renders the jobs posted to the server on `options.servePort` one at a time, until it's shut down. The shaders, the
+    // accumulation targets and the last job's scene stay loaded between jobs
+    static int run(App &app)
+    {
+        #ifdef _WIN32
+        std::cerr << "Error: The render server needs POSIX sockets." << std::endl;
+        return 1;
+        #else
+        const Options &options = app.options;
+        Renderer &renderer = app.renderer;
+        Window &sceneWindow = app.sceneWindow;
+
+        RenderServer server;
+        if (!server.start(options.servePort)) return 1;
+
+        // Nothing to keep responsive, trace whole passes
+        renderer.tiles.frameBudgetMs = 0.0;
+        Jobs::Defaults defaults = Jobs::defaults(app);
+        std::string loadedScene;        // Description of the scene in memory, empty for the one from the command line
+
+        RenderServer::Job job;
+        while (server.next(job))
+        {
+            double start = glfwGetTime();
+            bool sceneReused = true;
+            std::string error;
+            if (!Jobs::apply(app, job.request, defaults, loadedScene, sceneReused, error))
+            {
+                RenderServer::respond(job.client, 400, "text/plain", "Bad job: " + error + "\n");
+                server.finished(RenderServer::FAILED, glfwGetTime() - start, 0, sceneReused);
+                continue;
+            }
+
+            bool delivered = renderJob(app, job);
+            uint64_t pixelSamples = (uint64_t)renderer.accumulatedSamples*sceneWindow.width*sceneWindow.height;
+            double seconds = glfwGetTime() - start;
+            server.finished(delivered ? RenderServer::DONE : RenderServer::CANCELLED, seconds, pixelSamples, sceneReused);
+            printf("Job %llu (priority %d): %d spp at %dx%d in %.2fs%s%s\n", (unsigned long long)job.id, job.priority, renderer.accumulatedSamples,
+                   sceneWindow.width, sceneWindow.height, seconds, sceneReused ? ", scene reused" : "", delivered ? "" : ", client gone");
+            fflush(stdout);
+        }
+
+        server.stop();
+        return 0;
+        #endif
+    }
+
+private:
+
+    #ifndef _WIN32
+    // Accumulates the job's samples and answers with the PNG. With "stream": "png" the answer is a multipart/x-mixed-replace
+    // stream instead, with a part every "previewEvery" samples and the final image last. False if the client went away
+    static bool renderJob(App &app, const RenderServer::Job &job)
+    {
+        const Options &options = app.options;
+        Renderer &renderer = app.renderer;
+
+        const Json &request = job.request;
+        int samples = std::max(request["spp"].asInt(options.samples), 1);
+        bool streaming = request["stream"].asString("none") == "png";
+        int previewEvery = std::max(request["previewEvery"].asInt(std::max(samples / 8, 1)), 1);
+
+        bool delivered = !streaming || RenderServer::sendHeader(job.client, 200, "multipart/x-mixed-replace; boundary=frame");
+        renderer.restartAccumulation();
+        int nextPreview = previewEvery;
+        while (delivered && renderer.accumulatedSamples < samples)
+        {
+            app.traceFrame();
+            if (streaming && renderer.accumulatedSamples >= nextPreview && renderer.accumulatedSamples < samples)
+            {
+                delivered = sendPreview(app, job.client);
+                nextPreview = renderer.accumulatedSamples + previewEvery;
+            }
+        }
+
+        if (delivered && streaming) delivered = sendPreview(app, job.client) && RenderServer::sendAll(job.client, "--frame--\r\n", 11);
+        else if (delivered)
+        {
+            std::vector<uint8_t> png = accumulationPNG(app);
+            delivered = RenderServer::sendHeader(job.client, 200, "image/png", png.size()) && RenderServer::sendAll(job.client, png.data(), png.size());
+        }
+        close(job.client);
+        return delivered;
+    }
+
+    // One part of a streamed job, the image so far
+    static bool sendPreview(App &app, int client)
+    {
+        Renderer &renderer = app.renderer;
+
+        std::vector<uint8_t> png = accumulationPNG(app);
+        std::string header = "--frame\r\nContent-Type: image/png\r\nContent-Length: " + std::to_string(png.size()) +
+                             "\r\nX-Samples: " + std::to_string(renderer.accumulatedSamples) + "\r\n\r\n";
+        return RenderServer::sendAll(client, header.data(), header.size()) && RenderServer::sendAll(client, png.data(), png.size()) &&
+               RenderServer::sendAll(client, "\r\n", 2);
+    }
+
+    static std::vector<uint8_t> accumulationPNG(App &app)
+    {
+        Renderer &renderer = app.renderer;
+        Window &sceneWindow = app.sceneWindow;
+
+        std::vector<uint8_t> png;
+        ImageIO::encodePNG(app.readAccumulation(0, 0, sceneWindow.width, sceneWindow.height), renderer.doGammaCorrection, png);
+        return png;
+    }
+    #endif
+
+};
+
+#endif
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "profiler.h"
 
 class Shader
 {
@@ -20,36 +21,10 @@ public:
 
     Shader(const char *vertexPath, const char *fragmentPath)
     {
-        // Retrieve the vertex and fragment shader code from filepaths
-        std::string vertexCode, fragmentCode;
-        std::ifstream vShaderFile, fShaderFile;
+        PROFILE_SCOPE("Shader compile");
 
-        // Ensure ifstream objects can throw exceptions
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try
-        {
-            // Open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-
-            // Read file contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-
-            // Close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-
-            // Convert code into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-        }
-        catch (std::ifstream::failure e)
-        {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-        }
+        // Retrieve the vertex and fragment shader code from filepaths
+        std::string vertexCode = readSource(vertexPath), fragmentCode = readSource(fragmentPath);
         const char *vShaderCode = vertexCode.c_str();
         const char *fShaderCode = fragmentCode.c_str();
 
@@ -103,6 +78,73 @@ public:
         glDeleteShader(fragment);
     }
 
+    // Compute program
+    Shader(const char *computePath)
+    {
+        PROFILE_SCOPE("Shader compile");
+
+        std::string computeCode = readSource(computePath);
+        const char *cShaderCode = computeCode.c_str();
+
+        GLuint compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+
+        GLint success;
+        char infoLog[512];
+        glGetShaderiv(compute, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(compute, 512, NULL, infoLog);
+            std::cerr << "ERROR::COMPUTE_SHADER::COMPILATION_FAILED (" << computePath << ")\n" << infoLog << std::endl;
+            exit(1);
+        }
+
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(ID, 512, NULL, infoLog);
+            std::cerr << "ERROR::PROGRAM::LINKING_FAILED (" << computePath << ")\n" << infoLog << std::endl;
+            exit(1);
+        }
+
+        glDeleteShader(compute);
+    }
+
+    // Reads a shader file, replacing `#include "file"` lines (relative to the including file) with the file's contents.
+    // #line directives keep compiler messages pointing at the right line, the source number is the include depth
+    static std::string readSource(const std::string &path, int depth = 0)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ (" << path << ")" << std::endl;
+            return "";
+        }
+
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        std::stringstream source;
+        std::string line;
+        for (int number = 1; std::getline(file, line); number++)
+        {
+            size_t open = line.find('"');
+            if (line.compare(0, 8, "#include") != 0 || open == std::string::npos || depth > 8)
+            {
+                source << line << '\n';
+                continue;
+            }
+
+            std::string included = line.substr(open + 1, line.find('"', open + 1) - open - 1);
+            source << "#line 1 " << depth + 1 << '\n' << readSource(directory + included, depth + 1);
+            source << "#line " << number + 1 << ' ' << depth << '\n';
+        }
+        return source.str();
+    }
+
     void use()
     {
         glUseProgram(ID);
@@ -223,6 +265,14 @@ public:
     }
 
 
+    // * UINT * //
+
+    void setUint(const std::string &name, GLuint value) const
+    {
+        glUniform1ui(getLocation(name), value);
+    }
+
+
     // * BOOL * //
     
     void setBool(const std::string &name, bool value) const
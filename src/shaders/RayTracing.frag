@@ -2,19 +2,10 @@
 
 // * Inputs / Outputs
 in vec2 TexCoords;
-out vec4 FragColour;
+layout(location = 0) out vec4 FragColour;
+layout(location = 1) out int ObjectID;      // Sphere hit by the pixel's first primary ray (-1 for none), read back for picking
 
-// * Macrodefinitions
-#define FLOAT_MAX 3.402823466e+38
-#define FLOAT_MIN 1.175494351e-38
-#define PI 3.14159265358979323846
-#define MAX_SPHERE_AMOUNT 20
-
-// * Struct definitions
-struct Ray { vec3 position, direction; };
-struct Material { vec3 albedo; float roughness; vec3 emissionColour; float emissionStrength; float reflectivity; };
-struct Sphere { Material material; vec3 position; float radius; };
-struct RayHit { vec3 normal; float t; vec3 intersection; bool selected; Material material; };
+#include "tracing.glsl"
 
 // * Uniforms
 
@@ -30,62 +21,44 @@ uniform vec3 pixelOrigin;
 uniform bool doTemporalAntiAliasing;
 uniform bool doPixelSampling;
 uniform int samplingMethod;
-uniform bool doGammaCorrection;
-uniform bool test;
-uniform bool sky;
+uniform int heatmap;                // 0 traces normally, 1 shows intersection tests, 2 BVH nodes visited, 3 bounces per sample
+uniform float heatmapScale;         // Count shown as the hottest colour
 uniform float u_time;
 uniform int maxRayBounce;
 uniform int renderedFrameCount;
+uniform int frameSeed;
 uniform int samplesPerPixel;
 uniform sampler2D previousFrame;
 
-// Scene UBO (only an array of spheres for now)
-layout(std140) uniform Spheres { Sphere spheres[MAX_SPHERE_AMOUNT]; };
-uniform int spheresSize;
-uniform int selectedSphere;
-
-// * Spheres
-bool hitSphere(Sphere sphere, Ray ray, out RayHit hit)
-{
-    vec3 oc = sphere.position - ray.position;
-    float a = dot(ray.direction, ray.direction);
-    float h = dot(ray.direction, oc);
-    float c = dot(oc, oc) - sphere.radius*sphere.radius;
-
-    float discriminant = h*h - a*c;
-    if (discriminant < 0) return false;
-
-    float sqrtd = sqrt(discriminant);
-
-    // Find the nearest root that lies in the acceptable range.
-    float root = (h - sqrtd) / a;
-    if (root <= 0.001 || FLOAT_MAX <= root)
-    {
-        root = (h + sqrtd) / a;
-        if (root <= 0.001 || FLOAT_MAX <= root)
-            return false;
-    }
-
-    hit.t = root;
-    hit.intersection = ray.position + hit.t*ray.direction;
-    hit.material = sphere.material;
+// Set by the first primary ray traced for this pixel
+bool recordPrimaryHit = true;
+int primaryHit = -1;
 
-    vec3 outwardNormal = (hit.intersection - sphere.position) / sphere.radius;  // Normalizes it
-    bool frontFace = dot(ray.direction, outwardNormal) < 0;
-    hit.normal = frontFace ? outwardNormal : -outwardNormal;
+// Work done for this pixel over all its samples beyond the traversal, for the heatmap
+int bounces = 0;
+int samplesTraced = 0;
 
-    return true;
+// * Utility functions
+float rand()
+{
+    return fract(sin(dot(gl_FragCoord.xy, vec2(12.9898, 78.233)) * u_time) * 43758.5453);
 }
 
-// * Utility functions
-float rand(vec2 co)
+// PCG hash (Jarzynski and Olano 2020) stepping a state per pixel, for bounces and environment samples. They have to
+// differ between the bounces and samples of a pass, `rand` only changes between passes
+uint rngState;
+
+uint pcg(uint v)
 {
-    return fract(sin(dot(co.xy, vec2(12.9898, 78.233)) * u_time) * 43758.5453);
+    uint state = v*747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state)*277803737u;
+    return (word >> 22u) ^ word;
 }
 
-float rand()
+float random()
 {
-    return fract(sin(dot(gl_FragCoord.xy, vec2(12.9898, 78.233)) * u_time) * 43758.5453);
+    rngState = pcg(rngState);
+    return float(rngState >> 8) / 16777216.0;
 }
 
 vec2 boxMuller(vec2 u)
@@ -97,8 +70,8 @@ vec2 boxMuller(vec2 u)
 
 vec3 randGaussianVec()
 {
-    vec2 u1 = vec2(rand(gl_FragCoord.xy), rand(gl_FragCoord.yx));
-    vec2 u2 = vec2(rand(gl_FragCoord.yx + 0.5), rand(gl_FragCoord.xy + 0.5));
+    vec2 u1 = vec2(max(random(), 1e-7), random());
+    vec2 u2 = vec2(max(random(), 1e-7), random());
     vec2 gauss1 = boxMuller(u1);
     vec2 gauss2 = boxMuller(u2);
     return vec3(gauss1.x, gauss1.y, gauss2.x);
@@ -115,19 +88,9 @@ vec3 randInHemisphere(vec3 normal)
     return (dot(randomDir, normal) > 0.0) ? randomDir : -randomDir;
 }
 
-vec3 gammaCorrect(vec3 linear)
-{
-    return vec3(sqrt(linear.x), sqrt(linear.y), sqrt(linear.z));
-}
-
 vec3 postProcess(vec3 colour)
 {
-
-    if (doGammaCorrection)
-    {
-        colour = gammaCorrect(colour);
-    }
-    
+    // Colours stay linear here, gamma correction happens when the accumulation is displayed
     if (doTemporalAntiAliasing)
     {
         // Average colour with previous frame
@@ -140,69 +103,47 @@ vec3 postProcess(vec3 colour)
 }
 
 // * Ray tracing
-bool findClosestIntersection(Ray ray, out RayHit closestHit)
-{
-    bool doesHit = false;
-    float lowest_t = FLOAT_MAX;
-    
-    for (int i = 0; i < spheresSize; i++)
-    {
-        RayHit hit;
-        if (hitSphere(spheres[i], ray, hit))
-        {
-            doesHit = true;
-            hit.selected = (selectedSphere == i);
-            
-            if (hit.t < lowest_t) {
-
-                lowest_t = hit.t;
-                closestHit = hit;
-            }
-        }
-    }
-
-    return doesHit;
-}
-
-vec3 missColour(Ray ray, vec3 rayColour)
-{
-    if (sky)
-    {
-        vec3 unitDirection = normalize(ray.direction);
-        float alpha = 0.5*(2*unitDirection.y + 1.0);
-        return ((1.0 - alpha)*vec3(1.0) + alpha*vec3(0.5, 0.7, 1.0))*rayColour;
-    }
-    else
-    {
-        return vec3(0.0)*rayColour;
-    }
-}
-
 vec3 traceRay(Ray ray)
 {
     vec3 incomingColour = vec3(0.0);
     vec3 rayColour = vec3(1.0);
+    float scatterPdf = -1.0;            // Of the last bounce, for weighting the environment map against its light samples
     
     RayHit hit;
     
     for (int i = 0; i < maxRayBounce; i++)
     {
-        if (!findClosestIntersection(ray, hit))
+        bounces++;
+        bool doesHit = findClosestIntersection(ray, hit);
+        if (recordPrimaryHit)
+        {
+            primaryHit = doesHit ? hit.id : -1;
+            recordPrimaryHit = false;
+        }
+
+        if (!doesHit)
         {
-            incomingColour += missColour(ray, rayColour);
+            incomingColour += missColour(ray, rayColour, scatterPdf);
             break;
         }
 
         // Accumulate light colour
-        Material material = hit.material;
+        Material material = getMaterial(hit.material);
         vec3 emittedLight = material.emissionColour * material.emissionStrength;
         incomingColour += emittedLight * rayColour;
-        rayColour *= material.albedo*material.reflectivity;
+        vec3 reflectance = material.albedo*material.reflectivity;
+
+        // Bounce ray, lit by the environment map directly when the bounce itself gets traced
+        vec3 incoming = ray.direction;
+        ray.position = ray.position + hit.t*ray.direction + hit.normal*0.0001;
+        bool sampleLight = environmentSampling && i + 1 < maxRayBounce;
+        if (sampleLight)
+            incomingColour += sampleEnvironmentLight(ray.position, incoming, hit.normal, material.roughness, reflectance, rayColour, vec2(random(), random()));
+        rayColour *= reflectance;
 
-        // Bounce ray
-        ray.position = hit.intersection + hit.normal*0.0001;
         vec3 perfectReflection = reflect(ray.direction, hit.normal);
         ray.direction = mix(perfectReflection, randInHemisphere(hit.normal), material.roughness);
+        scatterPdf = sampleLight ? bouncePdf(incoming, hit.normal, material.roughness, ray.direction) : -1.0;
     }
 
     return incomingColour;
@@ -212,6 +153,7 @@ vec3 calculateColour(vec2 coord)
 {
     vec3 pixelSample = pixelOrigin + (coord.x * pixelDH) + (coord.y * pixelDV);
     Ray ray = Ray(lookfrom, pixelSample - lookfrom);
+    samplesTraced++;
     return traceRay(ray);
 }
 
@@ -279,6 +221,7 @@ vec3 jitteredGridSample()
 
 void main()
 {
+    rngState = pcg((uint(gl_FragCoord.y)*65536u + uint(gl_FragCoord.x)) ^ pcg(uint(frameSeed)*131u));
 
     vec3 currentColour;
 
@@ -298,6 +241,17 @@ void main()
         currentColour = calculateColour(gl_FragCoord.xy + 0.5);
     }
 
+    ObjectID = primaryHit;
+    if (heatmap != 0)
+    {
+        // The average count per sample accumulates in alpha like colours do, the colour is redone from it
+        int count = (heatmap == 1) ? intersectionTests : (heatmap == 2) ? nodeVisits : bounces;
+        float cost = float(count) / float(max(samplesTraced, 1));
+        if (doTemporalAntiAliasing) cost = mix(texture(previousFrame, TexCoords).a, cost, 1.0 / (renderedFrameCount + 1));
+        FragColour = vec4(heatmapColour(cost / heatmapScale), cost);
+        return;
+    }
+
     currentColour = postProcess(currentColour);
     FragColour = vec4(currentColour, 1.0);
 }
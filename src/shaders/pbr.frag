@@ -2,19 +2,10 @@
 
 // * Inputs / Outputs
 in vec2 TexCoords;
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out int ObjectID;      // Sphere hit by the pixel's first primary ray (-1 for none), read back for picking
 
-// * Macrodefinitions
-#define FLOAT_MAX 3.402823466e+38
-#define FLOAT_MIN 1.175494351e-38
-#define PI 3.14159265358979323846
-#define MAX_SPHERE_AMOUNT 20
-
-// * Struct definitions
-struct Ray { vec3 position, direction; };
-struct Material { vec3 albedo; float roughness; vec3 emissionColour; float emissionStrength; float reflectivity; };
-struct Sphere { Material material; vec3 position; float radius; };
-struct RayHit { vec3 normal; float t; vec3 intersection; bool selected; Material material; };
+#include "tracing.glsl"
 
 // * Uniforms
 
@@ -28,140 +19,134 @@ uniform vec3 pixelOrigin;
 
 // TODO: Renderer settings UBO
 uniform bool doTemporalAntiAliasing;
-uniform bool doGammaCorrection;
-uniform bool test;
-uniform bool sky;
-uniform float u_time;
-uniform int maxRayBounce;
 uniform int renderedFrameCount;
+uniform int frameSeed;
 uniform int samplesPerPixel;
+uniform int lightSamples;
 uniform sampler2D previousFrame;
 
-// Scene UBO (only an array of spheres for now)
-layout(std140) uniform Spheres { Sphere spheres[MAX_SPHERE_AMOUNT]; };
-uniform int spheresSize;
-uniform int selectedSphere;
-
-// * Spheres
-bool hitSphere(Sphere sphere, Ray ray, out RayHit hit) {
+// Light tree over the emissive spheres, nodes are 2 texels: (min, children or lights) and (max, power). A node's info
+// holds its left child (the right one follows it) or a leaf's first slot in `lightData` in the low 24 bits, and the
+// leaf's light count in the high 8
+uniform usamplerBuffer lightNodeData;
+uniform usamplerBuffer lightData;
+uniform int lightCount;
 
-    vec3 oc = sphere.position - ray.position;
-    float a = dot(ray.direction, ray.direction);
-    float h = dot(ray.direction, oc);
-    float c = dot(oc, oc) - sphere.radius*sphere.radius;
+// Set by the first primary ray traced for this pixel
+bool recordPrimaryHit = true;
+int primaryHit = -1;
 
-    float discriminant = h*h - a*c;
-    if (discriminant < 0) return false;
+// * Utility functions
 
-    float sqrtd = sqrt(discriminant);
+// PCG hash (Jarzynski and Olano 2020) stepping a state per pixel, every light pick needs its own numbers
+uint rngState;
 
-    // Find the nearest root that lies in the acceptable range.
-    float root = (h - sqrtd) / a;
-    if (root <= 0.001 || FLOAT_MAX <= root) {
-    
-        root = (h + sqrtd) / a;
-        if (root <= 0.001 || FLOAT_MAX <= root)
-            return false;
-    }
+uint pcg(uint v) {
 
-    hit.t = root;
-    hit.intersection = ray.position + hit.t*ray.direction;
-    hit.material = sphere.material;
+    uint state = v*747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state)*277803737u;
+    return (word >> 22u) ^ word;
+}
 
-    vec3 outwardNormal = (hit.intersection - sphere.position) / sphere.radius;  // Normalizes it
-    bool frontFace = dot(ray.direction, outwardNormal) < 0;
-    hit.normal = frontFace ? outwardNormal : -outwardNormal;
+float random() {
 
-    return true;
+    rngState = pcg(rngState);
+    return float(rngState >> 8) / 16777216.0;
 }
 
-// * Utility functions
-float rand(vec2 co) {
-    return fract(sin(dot(co.xy, vec2(12.9898, 78.233)) * u_time) * 43758.5453);
-}
-float rand() {
-    return fract(sin(dot(gl_FragCoord.xy, vec2(12.9898, 78.233)) * u_time) * 43758.5453);
-}
-vec2 boxMuller(vec2 u) {
-    float r = sqrt(-2.0 * log(u.x));
-    float theta = 2.0 * PI * u.y;
-    return r * vec2(cos(theta), sin(theta));
-}
-vec3 randGaussianVec() {
-    vec2 u1 = vec2(rand(gl_FragCoord.xy), rand(gl_FragCoord.yx));
-    vec2 u2 = vec2(rand(gl_FragCoord.yx + 0.5), rand(gl_FragCoord.xy + 0.5));
-    vec2 gauss1 = boxMuller(u1);
-    vec2 gauss2 = boxMuller(u2);
-    return vec3(gauss1.x, gauss1.y, gauss2.x);
-}
-vec3 randGaussianUnitVec() {
-    return normalize(randGaussianVec());
-}
-vec3 randInHemisphere(vec3 normal) {
-    vec3 randomDir = randGaussianUnitVec();
-    return (dot(randomDir, normal) > 0.0) ? randomDir : -randomDir;
-}
-vec3 gammaCorrect(vec3 linear) {
-    return vec3(sqrt(linear.x), sqrt(linear.y), sqrt(linear.z));
-}
+// * Lights
 
-// * Ray tracing
-int countLights() {
-    int lights = 0;
-    for (int i = 0; i < spheresSize; i++) {
-        if (spheres[i].material.emissionStrength > 0.0) {
-            lights++;
-        }
-    }
-    return lights;
-}
+// Bound on the light a cluster of power `power` inside the sphere (centre, radius) sends to a point facing `normal`: the
+// power over the squared distance, times the cosine of the smallest angle between the normal and the cluster. Zero only
+// when every light in it is behind the point
+float lightImportance(vec3 position, vec3 normal, vec3 centre, float radius, float power) {
 
-bool findClosestIntersection(Ray ray, out RayHit closestHit) {
+    vec3 toCentre = centre - position;
+    float distance2 = dot(toCentre, toCentre);
+    float radius2 = radius*radius;
+    if (distance2 <= radius2) return power / max(radius2, FLOAT_MIN);
 
-    bool doesHit = false;
-    float lowest_t = FLOAT_MAX;
-    
-    for (int i = 0; i < spheresSize; i++) {
+    float distance = sqrt(distance2);
+    float cosNormal = dot(normal, toCentre) / distance;
+    float sinBound = radius / distance;
+    float cosBound = sqrt(1.0 - sinBound*sinBound);
+    float cosClosest = (cosNormal >= cosBound) ? 1.0 : cosNormal*cosBound + sqrt(max(1.0 - cosNormal*cosNormal, 0.0))*sinBound;
+    return power*max(cosClosest, 0.0) / distance2;
+}
 
-        RayHit hit;
-        if (hitSphere(spheres[i], ray, hit)) {
+float lightNodeImportance(int node, vec3 position, vec3 normal, out uint info) {
 
-            doesHit = true;
-            hit.selected = (selectedSphere == i);
-            
-            if (hit.t < lowest_t) {
+    uvec4 a = texelFetch(lightNodeData, 2*node);
+    uvec4 b = texelFetch(lightNodeData, 2*node + 1);
+    vec3 boxMin = uintBitsToFloat(a.xyz), boxMax = uintBitsToFloat(b.xyz);
+    info = a.w;
+    return lightImportance(position, normal, 0.5*(boxMin + boxMax), 0.5*length(boxMax - boxMin), uintBitsToFloat(b.w));
+}
 
-                lowest_t = hit.t;
-                closestHit = hit;
-            }
-        }
-    }
+float sphereLightImportance(int i, vec3 position, vec3 normal) {
 
-    return doesHit;
+    Sphere sphere = getSphere(i);
+    Material material = getMaterial(sphere.material);
+    vec3 emission = material.emissionColour*material.emissionStrength;
+    float power = max(dot(emission, vec3(0.2126, 0.7152, 0.0722)), 0.0)*sphere.radius*sphere.radius;
+    return lightImportance(position, normal, sphere.position, sphere.radius, power);
 }
 
-vec3 missColour(Ray ray) {
+// Walks the light tree down from the root, taking each child with a probability proportional to its importance. Returns
+// the sphere picked and the probability of picking it, or -1 when no light can reach the point
+int sampleLight(vec3 position, vec3 normal, out float pdf) {
 
-    if (sky) {
+    pdf = 1.0;
+    if (lightCount == 0) return -1;
 
-        vec3 unitDirection = normalize(ray.direction);
-        float alpha = 0.5*(2*unitDirection.y + 1.0);
-        return ((1.0 - alpha)*vec3(1.0) + alpha*vec3(0.5, 0.7, 1.0));
+    uint info;
+    if (lightNodeImportance(0, position, normal, info) <= 0.0) return -1;
+    while ((info >> 24) == 0u) {
+
+        int left = int(info & 0xFFFFFFu);
+        uint leftInfo, rightInfo;
+        float leftImportance = lightNodeImportance(left, position, normal, leftInfo);
+        float rightImportance = lightNodeImportance(left + 1, position, normal, rightInfo);
+        float total = leftImportance + rightImportance;
+        if (total <= 0.0) return -1;
+
+        float leftProbability = leftImportance / total;
+        bool goLeft = random() < leftProbability;
+        pdf *= goLeft ? leftProbability : 1.0 - leftProbability;
+        info = goLeft ? leftInfo : rightInfo;
     }
-    else {
 
-        return vec3(0.0);
+    // Leaves hold a few lights at most, pick one of them the same way
+    int first = int(info & 0xFFFFFFu), count = int(info >> 24);
+    float total = 0.0;
+    for (int slot = first; slot < first + count; slot++)
+        total += sphereLightImportance(int(texelFetch(lightData, slot).x), position, normal);
+    if (total <= 0.0) return -1;
+
+    float target = random()*total;
+    for (int slot = first; slot < first + count; slot++) {
+
+        int light = int(texelFetch(lightData, slot).x);
+        float importance = sphereLightImportance(light, position, normal);
+        if (target < importance || slot == first + count - 1) {
+            pdf *= importance / total;
+            return importance > 0.0 ? light : -1;
+        }
+        target -= importance;
     }
+    return -1;
 }
 
-vec3 CookTorranceBRDF(vec3 P, vec3 L, vec3 V, vec3 N, RayHit hit) {
+// * Ray tracing
+vec3 CookTorranceBRDF(vec3 P, vec3 L, vec3 V, vec3 N, Material material) {
     
-    float a = hit.material.roughness;
+    float a = max(material.roughness, 0.05);     // Lights are picked without looking at the BRDF, sharper highlights
+                                                // would only show up as fireflies (and a mirror divides 0 by 0)
     vec3 h = normalize(L + V);
 
     // Normal distribution (D)
     float a2 = a*a;
-    float NdotH = max(dot(N, h), 0.0);
+    float NdotH = clamp(dot(N, h), 0.0, 1.0);       // Rounding can push it past 1, the Fresnel term would take a negative power
     float NdotH2 = NdotH*NdotH;
     float nom = a2;
     float denom = NdotH2*(a2 - 1.0) + 1.0;
@@ -185,51 +170,64 @@ vec3 CookTorranceBRDF(vec3 P, vec3 L, vec3 V, vec3 N, RayHit hit) {
     vec3 Kd = vec3(1.0) - Ks;
 
     // Final BRDF calculation
-    vec3 f_Lambert = hit.material.albedo / PI;
+    vec3 f_Lambert = material.albedo / PI;
     vec3 f_CookTorrance = (D*F*G) / (2.0*NdotV*NdotL + 0.0001);
     vec3 BRDF = Kd*f_Lambert + f_CookTorrance;
 
     return BRDF;
 }
 
-vec4 directIllumination(Ray ray, int lightsCount) {
+// Radiance a sampled light sends back along V, over the probability of having picked it. The sphere is treated as seen
+// from its centre: radiance times the solid angle it covers
+vec3 lightContribution(int i, float pdf, vec3 P, vec3 V, vec3 N, Material surface) {
+
+    Sphere lightSphere = getSphere(i);
+    Material light = getMaterial(lightSphere.material);
+
+    // Incoming light vector
+    vec3 toLight = lightSphere.position - P;
+    float distance2 = dot(toLight, toLight);
+    vec3 L = toLight*inversesqrt(distance2);
+    float NdotL = dot(N, L);
+    if (NdotL <= 0.0) return vec3(0.0);
+
+    // Check for light obstruction, anything hit before the light itself blocks it
+    RayHit obstructionHit;
+    if (!findClosestIntersection(Ray(P + N*0.0001, L), obstructionHit) || obstructionHit.id != i) return vec3(0.0);
+
+    float solidAngle = 2.0*PI*(1.0 - sqrt(max(1.0 - lightSphere.radius*lightSphere.radius / distance2, 0.0)));
+    vec3 fr = CookTorranceBRDF(P, L, V, N, surface);
+    vec3 Li = light.emissionColour * light.emissionStrength;
+    return fr*Li*NdotL*solidAngle / pdf;
+}
+
+vec4 directIllumination(Ray ray) {
     
     RayHit hit;
-    if (!findClosestIntersection(ray, hit))
-        return vec4(missColour(ray), 1.0);
+    bool doesHit = findClosestIntersection(ray, hit);
+    if (recordPrimaryHit) {
+        primaryHit = doesHit ? hit.id : -1;
+        recordPrimaryHit = false;
+    }
+    if (!doesHit)
+        return vec4(missColour(ray, vec3(1.0), -1.0), 1.0);
 
     vec3 V = -normalize(ray.direction);
-    vec3 P = hit.intersection;
+    vec3 P = ray.position + hit.t*ray.direction;
     vec3 N = hit.normal;
+    Material surface = getMaterial(hit.material);
 
-    vec3 outgoingRadiance = hit.material.emissionColour * hit.material.emissionStrength;
-    float dWi = 1.0 / float(lightsCount);
-
-    for (int i = 0; i < spheresSize; i++) {
-
-        // Check if the sphere is emissive
-        Material light = spheres[i].material;
-        if (light.emissionStrength <= 0.0) continue;
-
-        // Incoming light vector
-        vec3 L = normalize(spheres[i].position - P);
-        
-        // Check for light obstruction
-        int lightCoeff = 1;
-        for (int j = 0; j < spheresSize; j++) {
-            if (spheres[j] == spheres[i]) continue;
-            Ray hitToLight = Ray(P, L);
-            RayHit obstructionHit;
-            if (hitSphere(spheres[j], hitToLight, obstructionHit))
-                lightCoeff = 0;
-        }
+    vec3 outgoingRadiance = surface.emissionColour * surface.emissionStrength;
+
+    // Integrate over the lights, a few picked through the light tree stand in for all of them
+    vec3 lightRadiance = vec3(0.0);
+    for (int i = 0; i < lightSamples; i++) {
 
-        // Integrate over each light
-        float NdotL = max(dot(N, L), 0.0);
-        vec3 fr = CookTorranceBRDF(P, L, V, N, hit); 
-        vec3 Li = light.emissionColour * light.emissionStrength;
-        outgoingRadiance += lightCoeff*fr*Li*NdotL*dWi;
+        float pdf;
+        int light = sampleLight(P, N, pdf);
+        if (light >= 0) lightRadiance += lightContribution(light, pdf, P, V, N, surface);
     }
+    outgoingRadiance += lightRadiance / float(max(lightSamples, 1));
 
     return vec4(outgoingRadiance, 1.0);
 }
@@ -237,8 +235,8 @@ vec4 directIllumination(Ray ray, int lightsCount) {
 // * Main
 void main() {
 
-    // Calculate number of lights
-    int lightsCount = countLights();
+    uint x = uint(gl_FragCoord.x), y = uint(gl_FragCoord.y);
+    rngState = pcg((y*65536u + x) ^ pcg(uint(frameSeed)*131u));
 
     // Create ray from camera
     vec4 currentColour = vec4(0.0);
@@ -246,19 +244,19 @@ void main() {
 
         // Create ray from window coordinates
         vec2 pos = vec2(gl_FragCoord.x, gl_FragCoord.y);
-        vec3 offset = vec3(rand() - 0.5, rand() - 0.5, 0.0);
+        vec3 offset = vec3(random() - 0.5, random() - 0.5, 0.0);
         vec3 pixelSample = pixelOrigin + ((pos.x + offset.x) * pixelDH) + ((pos.y + offset.y) * pixelDV);
         Ray ray = Ray(lookfrom, pixelSample - lookfrom);
 
         // Calculate ray colour
-        currentColour += directIllumination(ray, lightsCount);
+        currentColour += directIllumination(ray);
     }
     currentColour /= samplesPerPixel;
-    currentColour = doGammaCorrection ? vec4(gammaCorrect(currentColour.xyz), 1.0) : currentColour;
 
     // Output averaged colour
     if (doTemporalAntiAliasing) {
         vec4 previousColour = texture(previousFrame, TexCoords);
         FragColor = mix(previousColour, currentColour, 1.0 / (renderedFrameCount + 1));
     } else FragColor = currentColour;
+    ObjectID = primaryHit;
 }
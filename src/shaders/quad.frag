@@ -5,8 +5,11 @@ in vec2 TexCoords;
 out vec4 FragColor;
 
 uniform sampler2D finalTexture;
+uniform bool doGammaCorrection;
 
 void main()
 {
-    FragColor = texture(finalTexture, TexCoords);
+    // The accumulation is linear, gamma correct it only for display
+    vec3 colour = max(texture(finalTexture, TexCoords).rgb, vec3(0.0));
+    FragColor = vec4(doGammaCorrection ? sqrt(colour) : colour, 1.0);
 }
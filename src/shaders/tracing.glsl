@@ -0,0 +1,603 @@
+// Shared by the ray tracing fragment shader and the wavefront kernels: scene access, BVH traversal and the shading
+// helpers both tracers agree on. Included after the #version line, it declares the scene uniforms itself
+
+// * Macrodefinitions
+#define FLOAT_MAX 3.402823466e+38
+#define FLOAT_MIN 1.175494351e-38
+#define PI 3.14159265358979323846
+#define BVH_STACK_SIZE 64
+
+// * Struct definitions
+struct Ray { vec3 position, direction; };
+struct Material { vec3 albedo; float roughness; vec3 emissionColour; float emissionStrength; float reflectivity; };
+struct Sphere { vec3 position; float radius; int material; };
+struct RayHit { vec3 normal; float t; int id; int material; };     // The hit point is rebuilt from t
+
+// * Uniforms
+uniform bool sky;
+
+// Scene buffers, spheres are 2 texels (position and radius, material index) and materials are 3
+uniform usamplerBuffer sphereData;
+uniform samplerBuffer materialData;
+uniform int spheresSize;
+uniform int selectedSphere;
+
+// Sphere BVH, its leaves index sphereOrderData which holds the sphere indices
+uniform usamplerBuffer sphereNodeData;
+uniform usamplerBuffer sphereOrderData;
+
+// Meshes share flat buffers: vertices (1 texel), triangles (v0, v1, v2, material), BVH nodes (2 texels) and a table of
+// (root node, first triangle, triangle count, material) per mesh
+uniform samplerBuffer vertexData;
+uniform usamplerBuffer triangleData;
+uniform usamplerBuffer meshNodeData;
+uniform usamplerBuffer meshData;
+
+// Instances place the meshes: 4 texels each (world to object rows, then mesh, material, instance index) in the order the
+// leaves of the top level BVH (instanceNodeData) reference them
+uniform usamplerBuffer instanceData;
+uniform usamplerBuffer instanceNodeData;
+uniform int instanceCount;
+uniform int selectedInstance;
+
+// Work done by the traversal, for the heatmap
+int intersectionTests = 0;
+int nodeVisits = 0;
+
+// * Scene
+Sphere getSphere(int i)
+{
+    // Stored as raw bits so the material index survives exactly
+    uvec4 a = texelFetch(sphereData, 2*i);
+    uvec4 b = texelFetch(sphereData, 2*i + 1);
+    return Sphere(uintBitsToFloat(a.xyz), uintBitsToFloat(a.w), int(b.x));
+}
+
+Material getMaterial(int i)
+{
+    vec4 a = texelFetch(materialData, 3*i);
+    vec4 b = texelFetch(materialData, 3*i + 1);
+    vec4 c = texelFetch(materialData, 3*i + 2);
+    return Material(a.xyz, a.w, b.xyz, b.w, c.x);
+}
+
+// * Spheres
+bool hitSphere(Sphere sphere, Ray ray, out RayHit hit)
+{
+    vec3 oc = sphere.position - ray.position;
+    float a = dot(ray.direction, ray.direction);
+    float h = dot(ray.direction, oc);
+    float c = dot(oc, oc) - sphere.radius*sphere.radius;
+
+    float discriminant = h*h - a*c;
+    if (discriminant < 0) return false;
+
+    float sqrtd = sqrt(discriminant);
+
+    // Find the nearest root that lies in the acceptable range.
+    float root = (h - sqrtd) / a;
+    if (root <= 0.001 || FLOAT_MAX <= root)
+    {
+        root = (h + sqrtd) / a;
+        if (root <= 0.001 || FLOAT_MAX <= root)
+            return false;
+    }
+
+    hit.t = root;
+    vec3 intersection = ray.position + hit.t*ray.direction;
+
+    vec3 outwardNormal = (intersection - sphere.position) / sphere.radius;  // Normalizes it
+    bool frontFace = dot(ray.direction, outwardNormal) < 0;
+    hit.normal = frontFace ? outwardNormal : -outwardNormal;
+
+    return true;
+}
+
+// * Triangles
+
+// Per ray part of the watertight ray-triangle test (Woop, Benthin and Wald 2013): the ray is sheared onto +z so all
+// triangles sharing an edge compute the exact same edge function and rays can't slip between them
+struct TriangleRay { vec3 origin; int kx, ky, kz; vec3 shear; };
+
+TriangleRay setupTriangleRay(Ray ray)
+{
+    vec3 d = ray.direction;
+    vec3 a = abs(d);
+    int kz = (a.x > a.y) ? ((a.x > a.z) ? 0 : 2) : ((a.y > a.z) ? 1 : 2);
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+
+    // Keep the winding when the ray points down the dominant axis
+    if (d[kz] < 0.0) { int swap = kx; kx = ky; ky = swap; }
+
+    return TriangleRay(ray.position, kx, ky, kz, vec3(d[kx] / d[kz], d[ky] / d[kz], 1.0 / d[kz]));
+}
+
+bool hitTriangle(TriangleRay ray, vec3 p0, vec3 p1, vec3 p2, float tMax, out float t)
+{
+    vec3 A = p0 - ray.origin, B = p1 - ray.origin, C = p2 - ray.origin;
+
+    float Ax = A[ray.kx] - ray.shear.x*A[ray.kz], Ay = A[ray.ky] - ray.shear.y*A[ray.kz];
+    float Bx = B[ray.kx] - ray.shear.x*B[ray.kz], By = B[ray.ky] - ray.shear.y*B[ray.kz];
+    float Cx = C[ray.kx] - ray.shear.x*C[ray.kz], Cy = C[ray.ky] - ray.shear.y*C[ray.kz];
+
+    // Edge functions, a hit needs all of them with the same sign (edges count as inside)
+    float U = Cx*By - Cy*Bx;
+    float V = Ax*Cy - Ay*Cx;
+    float W = Bx*Ay - By*Ax;
+    if ((U < 0.0 || V < 0.0 || W < 0.0) && (U > 0.0 || V > 0.0 || W > 0.0)) return false;
+
+    float det = U + V + W;
+    if (det == 0.0) return false;
+
+    float T = U*ray.shear.z*A[ray.kz] + V*ray.shear.z*B[ray.kz] + W*ray.shear.z*C[ray.kz];
+    t = T / det;
+    return t > 0.001 && t < tMax;
+}
+
+vec3 getVertex(uint i)
+{
+    return texelFetch(vertexData, int(i)).xyz;
+}
+
+void getNode(usamplerBuffer nodes, int i, out vec3 boxMin, out vec3 boxMax, out int leftOrFirst, out int count)
+{
+    uvec4 a = texelFetch(nodes, 2*i);
+    uvec4 b = texelFetch(nodes, 2*i + 1);
+    boxMin = uintBitsToFloat(a.xyz);
+    boxMax = uintBitsToFloat(b.xyz);
+    leftOrFirst = int(a.w);
+    count = int(b.w);
+}
+
+// Slab test, `tNear` is where the ray enters the box
+bool hitBox(vec3 boxMin, vec3 boxMax, vec3 origin, vec3 invDirection, float tMax, out float tNear)
+{
+    vec3 t0 = (boxMin - origin)*invDirection;
+    vec3 t1 = (boxMax - origin)*invDirection;
+    vec3 tSmall = min(t0, t1), tLarge = max(t0, t1);
+    tNear = max(max(tSmall.x, tSmall.y), max(tSmall.z, 0.0));
+    float tFar = min(min(tLarge.x, tLarge.y), min(tLarge.z, tMax));
+    return tNear <= tFar;
+}
+
+// Walks a mesh's BVH nearest child first, shrinking `closestT` as hits are found
+bool hitMesh(int mesh, TriangleRay triangleRay, vec3 invDirection, inout float closestT, out int closestTriangle)
+{
+    bool doesHit = false;
+    int node = int(texelFetch(meshData, mesh).x);
+
+    vec3 boxMin, boxMax;
+    int leftOrFirst, count;
+    float tNear;
+    getNode(meshNodeData, node, boxMin, boxMax, leftOrFirst, count);
+    if (!hitBox(boxMin, boxMax, triangleRay.origin, invDirection, closestT, tNear)) return false;
+
+    int stack[BVH_STACK_SIZE];
+    float stackNear[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    while (true)
+    {
+        nodeVisits++;
+        getNode(meshNodeData, node, boxMin, boxMax, leftOrFirst, count);
+
+        if (count > 0)
+        {
+            // Leaf
+            for (int i = leftOrFirst; i < leftOrFirst + count; i++)
+            {
+                uvec4 triangle = texelFetch(triangleData, i);
+                float t;
+                intersectionTests++;
+                if (hitTriangle(triangleRay, getVertex(triangle.x), getVertex(triangle.y), getVertex(triangle.z), closestT, t))
+                {
+                    closestT = t;
+                    closestTriangle = i;
+                    doesHit = true;
+                }
+            }
+        }
+        else
+        {
+            // Interior, visit the nearer child next and come back for the other one
+            vec3 leftMin, leftMax, rightMin, rightMax;
+            int unused0, unused1;
+            getNode(meshNodeData, leftOrFirst, leftMin, leftMax, unused0, unused1);
+            getNode(meshNodeData, leftOrFirst + 1, rightMin, rightMax, unused0, unused1);
+
+            float leftNear, rightNear;
+            bool hitLeft = hitBox(leftMin, leftMax, triangleRay.origin, invDirection, closestT, leftNear);
+            bool hitRight = hitBox(rightMin, rightMax, triangleRay.origin, invDirection, closestT, rightNear);
+
+            if (hitLeft && hitRight)
+            {
+                bool leftFirst = leftNear <= rightNear;
+                if (stackSize < BVH_STACK_SIZE)
+                {
+                    stack[stackSize] = leftFirst ? leftOrFirst + 1 : leftOrFirst;
+                    stackNear[stackSize] = leftFirst ? rightNear : leftNear;
+                    stackSize++;
+                }
+                node = leftFirst ? leftOrFirst : leftOrFirst + 1;
+                continue;
+            }
+            if (hitLeft || hitRight)
+            {
+                node = hitLeft ? leftOrFirst : leftOrFirst + 1;
+                continue;
+            }
+        }
+
+        // Pop the next subtree that can still hold a closer hit
+        bool found = false;
+        while (stackSize > 0 && !found)
+        {
+            stackSize--;
+            found = stackNear[stackSize] < closestT;
+            node = stack[stackSize];
+        }
+        if (!found) break;
+    }
+
+    return doesHit;
+}
+
+// Rows of the instance's world to object transform
+void getInstanceTransform(int slot, out vec4 row0, out vec4 row1, out vec4 row2)
+{
+    row0 = uintBitsToFloat(texelFetch(instanceData, 4*slot));
+    row1 = uintBitsToFloat(texelFetch(instanceData, 4*slot + 1));
+    row2 = uintBitsToFloat(texelFetch(instanceData, 4*slot + 2));
+}
+
+// Walks the top level BVH, rays are moved into each instance's object space (direction left unnormalized so distances
+// stay in world units) and traced through the instance's mesh
+bool hitInstances(Ray ray, inout float closestT, out int closestSlot, out int closestTriangle)
+{
+    bool doesHit = false;
+    vec3 invDirection = 1.0 / ray.direction;
+    int node = 0;
+
+    vec3 boxMin, boxMax;
+    int leftOrFirst, count;
+    float tNear;
+    getNode(instanceNodeData, node, boxMin, boxMax, leftOrFirst, count);
+    if (!hitBox(boxMin, boxMax, ray.position, invDirection, closestT, tNear)) return false;
+
+    int stack[BVH_STACK_SIZE];
+    float stackNear[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    while (true)
+    {
+        nodeVisits++;
+        getNode(instanceNodeData, node, boxMin, boxMax, leftOrFirst, count);
+
+        if (count > 0)
+        {
+            for (int slot = leftOrFirst; slot < leftOrFirst + count; slot++)
+            {
+                vec4 row0, row1, row2;
+                getInstanceTransform(slot, row0, row1, row2);
+                vec4 position = vec4(ray.position, 1.0), direction = vec4(ray.direction, 0.0);
+                Ray local = Ray(vec3(dot(row0, position), dot(row1, position), dot(row2, position)),
+                                vec3(dot(row0, direction), dot(row1, direction), dot(row2, direction)));
+
+                int mesh = int(texelFetch(instanceData, 4*slot + 3).x);
+                int triangle;
+                if (hitMesh(mesh, setupTriangleRay(local), 1.0 / local.direction, closestT, triangle))
+                {
+                    closestSlot = slot;
+                    closestTriangle = triangle;
+                    doesHit = true;
+                }
+            }
+        }
+        else
+        {
+            vec3 leftMin, leftMax, rightMin, rightMax;
+            int unused0, unused1;
+            getNode(instanceNodeData, leftOrFirst, leftMin, leftMax, unused0, unused1);
+            getNode(instanceNodeData, leftOrFirst + 1, rightMin, rightMax, unused0, unused1);
+
+            float leftNear, rightNear;
+            bool hitLeft = hitBox(leftMin, leftMax, ray.position, invDirection, closestT, leftNear);
+            bool hitRight = hitBox(rightMin, rightMax, ray.position, invDirection, closestT, rightNear);
+
+            if (hitLeft && hitRight)
+            {
+                bool leftFirst = leftNear <= rightNear;
+                if (stackSize < BVH_STACK_SIZE)
+                {
+                    stack[stackSize] = leftFirst ? leftOrFirst + 1 : leftOrFirst;
+                    stackNear[stackSize] = leftFirst ? rightNear : leftNear;
+                    stackSize++;
+                }
+                node = leftFirst ? leftOrFirst : leftOrFirst + 1;
+                continue;
+            }
+            if (hitLeft || hitRight)
+            {
+                node = hitLeft ? leftOrFirst : leftOrFirst + 1;
+                continue;
+            }
+        }
+
+        bool found = false;
+        while (stackSize > 0 && !found)
+        {
+            stackSize--;
+            found = stackNear[stackSize] < closestT;
+            node = stack[stackSize];
+        }
+        if (!found) break;
+    }
+
+    return doesHit;
+}
+
+// Walks the sphere BVH, returns the index of the closest sphere hit or -1
+int hitSpheres(Ray ray, inout float closestT, out RayHit closestHit)
+{
+    int closestSphere = -1;
+    vec3 invDirection = 1.0 / ray.direction;
+    int node = 0;
+
+    vec3 boxMin, boxMax;
+    int leftOrFirst, count;
+    float tNear;
+    getNode(sphereNodeData, node, boxMin, boxMax, leftOrFirst, count);
+    if (!hitBox(boxMin, boxMax, ray.position, invDirection, closestT, tNear)) return -1;
+
+    int stack[BVH_STACK_SIZE];
+    float stackNear[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    while (true)
+    {
+        nodeVisits++;
+        getNode(sphereNodeData, node, boxMin, boxMax, leftOrFirst, count);
+
+        if (count > 0)
+        {
+            for (int slot = leftOrFirst; slot < leftOrFirst + count; slot++)
+            {
+                int i = int(texelFetch(sphereOrderData, slot).x);
+                RayHit hit;
+                intersectionTests++;
+                if (hitSphere(getSphere(i), ray, hit) && hit.t < closestT)
+                {
+                    closestT = hit.t;
+                    closestHit = hit;
+                    closestSphere = i;
+                }
+            }
+        }
+        else
+        {
+            vec3 leftMin, leftMax, rightMin, rightMax;
+            int unused0, unused1;
+            getNode(sphereNodeData, leftOrFirst, leftMin, leftMax, unused0, unused1);
+            getNode(sphereNodeData, leftOrFirst + 1, rightMin, rightMax, unused0, unused1);
+
+            float leftNear, rightNear;
+            bool hitLeft = hitBox(leftMin, leftMax, ray.position, invDirection, closestT, leftNear);
+            bool hitRight = hitBox(rightMin, rightMax, ray.position, invDirection, closestT, rightNear);
+
+            if (hitLeft && hitRight)
+            {
+                bool leftFirst = leftNear <= rightNear;
+                if (stackSize < BVH_STACK_SIZE)
+                {
+                    stack[stackSize] = leftFirst ? leftOrFirst + 1 : leftOrFirst;
+                    stackNear[stackSize] = leftFirst ? rightNear : leftNear;
+                    stackSize++;
+                }
+                node = leftFirst ? leftOrFirst : leftOrFirst + 1;
+                continue;
+            }
+            if (hitLeft || hitRight)
+            {
+                node = hitLeft ? leftOrFirst : leftOrFirst + 1;
+                continue;
+            }
+        }
+
+        bool found = false;
+        while (stackSize > 0 && !found)
+        {
+            stackSize--;
+            found = stackNear[stackSize] < closestT;
+            node = stack[stackSize];
+        }
+        if (!found) break;
+    }
+
+    return closestSphere;
+}
+
+// * Ray tracing
+bool findClosestIntersection(Ray ray, out RayHit closestHit)
+{
+    bool doesHit = false;
+    float lowest_t = FLOAT_MAX;
+    
+    int sphere = (spheresSize > 0) ? hitSpheres(ray, lowest_t, closestHit) : -1;
+    if (sphere >= 0)
+    {
+        doesHit = true;
+        closestHit.id = sphere;
+        closestHit.material = getSphere(sphere).material;
+    }
+
+    // Mesh instances, their ids follow the spheres'
+    int slot, triangle;
+    if (instanceCount > 0 && hitInstances(ray, lowest_t, slot, triangle))
+    {
+        uvec4 vertices = texelFetch(triangleData, triangle);
+        vec3 p0 = getVertex(vertices.x);
+        vec3 objectNormal = cross(getVertex(vertices.y) - p0, getVertex(vertices.z) - p0);
+
+        // Normals go back to world space with the transpose of the world to object transform
+        vec4 row0, row1, row2;
+        getInstanceTransform(slot, row0, row1, row2);
+        vec3 outwardNormal = normalize(row0.xyz*objectNormal.x + row1.xyz*objectNormal.y + row2.xyz*objectNormal.z);
+        uvec4 info = texelFetch(instanceData, 4*slot + 3);
+
+        doesHit = true;
+        closestHit.t = lowest_t;
+        closestHit.normal = dot(ray.direction, outwardNormal) < 0.0 ? outwardNormal : -outwardNormal;
+        closestHit.id = spheresSize + int(info.z);
+        closestHit.material = (info.y != 0xFFFFFFFFu) ? int(info.y) : int(vertices.w);
+    }
+
+    return doesHit;
+}
+
+// * Environment
+
+// Equirectangular radiance with rows bottom first, the top one at the zenith (+y). The conditional texture holds a CDF
+// over each row's texels in x (width + 1 entries) and the texel's density over the unit square in y, the marginal one
+// the CDF over the rows
+uniform bool environmentOn;
+uniform bool environmentSampling;       // Sample the map at every bounce, MIS weighted against the bounce direction
+uniform sampler2D environmentMap;
+uniform sampler2D environmentConditional;
+uniform sampler2D environmentMarginal;
+uniform float environmentStrength;
+uniform float environmentRotation;      // Radians about +y
+
+vec2 environmentUV(vec3 direction)
+{
+    direction = normalize(direction);
+    float phi = atan(direction.z, direction.x) - environmentRotation;
+    return vec2(fract(phi / (2.0*PI) + 0.5), 1.0 - acos(clamp(direction.y, -1.0, 1.0)) / PI);
+}
+
+vec3 environmentRadiance(vec3 direction)
+{
+    return texture(environmentMap, environmentUV(direction)).rgb*environmentStrength;
+}
+
+// Density of `direction` per solid angle when sampled by `sampleEnvironment`
+float environmentPdf(vec3 direction)
+{
+    ivec2 size = textureSize(environmentMap, 0);
+    vec2 uv = environmentUV(direction);
+    float sinTheta = sin(PI*uv.y);
+    if (sinTheta <= 0.0) return 0.0;
+    ivec2 texel = min(ivec2(uv*vec2(size)), size - 1);
+    return texelFetch(environmentConditional, texel, 0).y / (2.0*PI*PI*sinTheta);
+}
+
+// Last entry of CDF row `row` at or below `x`, out of `count` intervals
+int searchCDF(sampler2D cdf, int row, int count, float x)
+{
+    int low = 0, high = count;
+    while (low + 1 < high)
+    {
+        int middle = (low + high) / 2;
+        if (texelFetch(cdf, ivec2(middle, row), 0).x <= x) low = middle;
+        else high = middle;
+    }
+    return low;
+}
+
+// Picks a direction towards the map in proportion to its luminance from two uniform numbers, returns its pdf per solid angle
+float sampleEnvironment(vec2 xi, out vec3 direction)
+{
+    ivec2 size = textureSize(environmentMap, 0);
+    int y = searchCDF(environmentMarginal, 0, size.y, xi.y);
+    float rowStart = texelFetch(environmentMarginal, ivec2(y, 0), 0).x, rowEnd = texelFetch(environmentMarginal, ivec2(y + 1, 0), 0).x;
+    int x = searchCDF(environmentConditional, y, size.x, xi.x);
+    float texelStart = texelFetch(environmentConditional, ivec2(x, y), 0).x, texelEnd = texelFetch(environmentConditional, ivec2(x + 1, y), 0).x;
+
+    // Spread uniformly over the texel
+    vec2 uv = (vec2(x, y) + clamp(vec2((xi.x - texelStart) / max(texelEnd - texelStart, 1e-12), (xi.y - rowStart) / max(rowEnd - rowStart, 1e-12)),
+              0.0, 1.0)) / vec2(size);
+    float theta = PI*(1.0 - uv.y), phi = 2.0*PI*(uv.x - 0.5) + environmentRotation;
+    float sinTheta = sin(theta);
+    direction = vec3(sinTheta*cos(phi), cos(theta), sinTheta*sin(phi));
+    if (sinTheta <= 0.0) return 0.0;
+    return texelFetch(environmentConditional, ivec2(x, y), 0).y / (2.0*PI*PI*sinTheta);
+}
+
+// Density per solid angle of the bounce both tracers take, normalize(mix(reflection, u, roughness)) with u uniform on
+// the hemisphere around `normal` and `reflection` as long as the incoming direction. The directions come from the sphere
+// of radius `roughness` around (1 - roughness)*reflection: each point of it along `direction` contributes the density
+// of u times the Jacobian of projecting the sphere onto directions. Zero for mirrors, whose bounce is a delta
+float bouncePdf(vec3 incoming, vec3 normal, float roughness, vec3 direction)
+{
+    if (roughness <= 0.0) return 0.0;
+    vec3 centre = (1.0 - roughness)*reflect(incoming, normal);
+    direction = normalize(direction);
+    float b = dot(direction, centre), c = dot(centre, centre) - roughness*roughness;
+    float discriminant = b*b - c;
+    if (discriminant < 0.0) return 0.0;
+
+    float pdf = 0.0, root = sqrt(discriminant);
+    for (int k = 0; k < 2; k++)
+    {
+        float t = (k == 0) ? b + root : b - root;
+        vec3 u = (t*direction - centre) / roughness;
+        float cosine = abs(dot(u, direction));
+        if (t > 0.0 && dot(u, normal) > 0.0 && cosine > 1e-6) pdf += t*t / (roughness*roughness*cosine*2.0*PI);
+    }
+    return pdf;
+}
+
+// Power heuristic weight of the strategy that drew the sample with density `pdf`
+float powerHeuristic(float pdf, float otherPdf)
+{
+    return (pdf*pdf) / max(pdf*pdf + otherPdf*otherPdf, 1e-30);
+}
+
+// Light from the map towards a surface the path reached with `rayColour` and whose bounce scales it by `reflectance`:
+// one sample of the map, kept if nothing blocks it and weighted against the bounce having picked the same direction.
+// The bounce's f*cos/pdf is `reflectance` for every direction, so f*cos is reflectance*bouncePdf
+vec3 sampleEnvironmentLight(vec3 position, vec3 incoming, vec3 normal, float roughness, vec3 reflectance, vec3 rayColour, vec2 xi)
+{
+    vec3 direction;
+    float lightPdf = sampleEnvironment(xi, direction);
+    if (lightPdf <= 0.0 || dot(direction, normal) <= 0.0) return vec3(0.0);
+    float scatterPdf = bouncePdf(incoming, normal, roughness, direction);
+    if (scatterPdf <= 0.0) return vec3(0.0);
+
+    RayHit blocker;
+    if (findClosestIntersection(Ray(position, direction), blocker)) return vec3(0.0);
+    return environmentRadiance(direction)*reflectance*rayColour*scatterPdf / lightPdf*powerHeuristic(lightPdf, scatterPdf);
+}
+
+// Light reaching a ray that left the scene. `scatterPdf` is the density the last bounce picked its direction with when
+// the map was sampled at that bounce too, negative for rays no light sample competed with
+vec3 missColour(Ray ray, vec3 rayColour, float scatterPdf)
+{
+    if (environmentOn)
+    {
+        float weight = (environmentSampling && scatterPdf > 0.0) ? powerHeuristic(scatterPdf, environmentPdf(ray.direction)) : 1.0;
+        return environmentRadiance(ray.direction)*rayColour*weight;
+    }
+    else if (sky)
+    {
+        vec3 unitDirection = normalize(ray.direction);
+        float alpha = 0.5*(2*unitDirection.y + 1.0);
+        return ((1.0 - alpha)*vec3(1.0) + alpha*vec3(0.5, 0.7, 1.0))*rayColour;
+    }
+    else
+    {
+        return vec3(0.0)*rayColour;
+    }
+}
+
+// * Debugging
+
+// Blue through cyan, green and yellow to red, white past the top of the scale
+vec3 heatmapColour(float value)
+{
+    if (value > 1.0) return vec3(1.0);
+    const vec3 stops[5] = vec3[5](vec3(0.0, 0.0, 0.5), vec3(0.0, 0.6, 1.0), vec3(0.0, 0.9, 0.2), vec3(1.0, 0.9, 0.0), vec3(1.0, 0.0, 0.0));
+    float x = clamp(value, 0.0, 1.0)*4.0;
+    int i = min(int(x), 3);
+    return mix(stops[i], stops[i + 1], x - float(i));
+}
@@ -0,0 +1,127 @@
+// Buffers connecting the wavefront kernels. A wave is one tile: every pixel of it owns a path, paths keep their state in
+// `paths` and have at most one ray in flight, queued in `rays` (read by extend and shade) while shade appends the next
+// bounces to `nextRays`. The queues swap bindings after every bounce.
+// Every live ray streams its records through memory several times per bounce, so they are packed: directions and
+// normals are octahedral encoded into 2x16 bits, throughput is half precision and hit points are rebuilt from `t`.
+// Scalar members keep std430 from padding vec3s to 16 bytes
+
+struct PathState                        // 36 bytes
+{
+    float radiance[3];                  // Summed over the pass's samples
+    uint rng;
+    uint throughput[2];                 // Half precision rgb, then the last bounce's pdf for weighting environment hits
+    uint work[3];                       // Intersection tests, nodes visited and bounces over the pass, for the heatmap
+};
+
+struct QueuedRay                        // 20 bytes
+{
+    float position[3];
+    uint path;
+    uint direction;                     // Octahedral, unit length
+};
+
+struct HitRecord                        // 16 bytes
+{
+    float t;                            // Along the unit direction, negative for a miss
+    uint normal;                        // Octahedral
+    int id;
+    int material;
+};
+
+layout(std430, binding = 0) buffer PathBuffer { PathState paths[]; };
+layout(std430, binding = 1) buffer RayQueue { QueuedRay rays[]; };
+layout(std430, binding = 2) buffer NextRayQueue { QueuedRay nextRays[]; };
+layout(std430, binding = 3) buffer HitBuffer { HitRecord hits[]; };
+
+// Sizes the indirect dispatches of extend and shade, rewritten after every bounce
+layout(std430, binding = 4) buffer QueueState
+{
+    uint groupsX, groupsY, groupsZ;
+    uint persistentX, persistentY, persistentZ;     // Persistent extend, never more groups than there are batches
+    uint rayCount;                      // Rays in `rays`
+    uint nextRayCount;                  // Rays appended to `nextRays` so far
+    uint rayCursor;                     // Next ray of `rays` a persistent workgroup will take
+};
+
+#define QUEUE_GROUP_SIZE 64
+
+// The wave being traced, in window coordinates
+uniform ivec2 tileOrigin;
+uniform ivec2 tileSize;
+uniform int pathSample;                 // Sample of the pass being traced
+uniform int bounce;
+
+ivec2 pathPixel(uint path)
+{
+    return tileOrigin + ivec2(int(path) % tileSize.x, int(path) / tileSize.x);
+}
+
+// * Packing
+
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Octahedral encoding (Cigolle et al. 2014): the unit sphere is folded onto an octahedron and flattened into a square,
+// 16 bits per coordinate keep directions within about 0.01 degrees
+uint encodeDirection(vec3 v)
+{
+    v /= abs(v.x) + abs(v.y) + abs(v.z);
+    vec2 folded = (v.z >= 0.0) ? v.xy : (1.0 - abs(v.yx))*signNotZero(v.xy);
+    return packSnorm2x16(folded);
+}
+
+vec3 decodeDirection(uint encoded)
+{
+    vec2 folded = unpackSnorm2x16(encoded);
+    vec3 v = vec3(folded, 1.0 - abs(folded.x) - abs(folded.y));
+    if (v.z < 0.0) v.xy = (1.0 - abs(v.yx))*signNotZero(v.xy);
+    return normalize(v);
+}
+
+QueuedRay packRay(vec3 position, vec3 direction, uint path)
+{
+    return QueuedRay(float[3](position.x, position.y, position.z), path, encodeDirection(normalize(direction)));
+}
+
+vec3 rayPosition(QueuedRay queued)
+{
+    return vec3(queued.position[0], queued.position[1], queued.position[2]);
+}
+
+vec3 getThroughput(PathState path)
+{
+    return vec3(unpackHalf2x16(path.throughput[0]), unpackHalf2x16(path.throughput[1]).x);
+}
+
+void setThroughput(inout PathState path, vec3 throughput)
+{
+    path.throughput[0] = packHalf2x16(throughput.rg);
+    path.throughput[1] = packHalf2x16(vec2(throughput.b, unpackHalf2x16(path.throughput[1]).y));
+}
+
+// Negative when no light sample competed with the bounce, clamped below the largest half since sharp bounces get huge
+float getScatterPdf(PathState path)
+{
+    return unpackHalf2x16(path.throughput[1]).y;
+}
+
+void setScatterPdf(inout PathState path, float pdf)
+{
+    path.throughput[1] = packHalf2x16(vec2(unpackHalf2x16(path.throughput[1]).x, min(pdf, 65000.0)));
+}
+
+// PCG hash (Jarzynski and Olano 2020), each path steps its own state
+uint pcg(uint v)
+{
+    uint state = v*747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state)*277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(inout uint state)
+{
+    state = pcg(state);
+    return float(state >> 8) / 16777216.0;
+}
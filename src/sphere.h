@@ -6,14 +6,15 @@
 
 struct Sphere
 {
-    Material material = Dielectric(glm::vec3(0.5), 0.5, 0.5);  // sizeof(Material) = 16*3
-
     glm::vec3 position = glm::vec3(0.0);
     float radius = 1.0;
+
+    int material = 0;       // Index into the scene's material table
+    int _pad[3] = { 0 };
     
     Sphere() {}
     
-    Sphere(Material material, glm::vec3 position, float radius)
+    Sphere(int material, glm::vec3 position, float radius)
         : position(position)
         , radius(radius)
         , material(material)
@@ -21,4 +22,8 @@ struct Sphere
 
 };
 
-#endif
\ No newline at end of file
+// The GPU buffers and scene files use this exact layout
+static_assert(sizeof(Sphere) == 32, "Sphere must be two vec4 texels");
+static_assert(sizeof(Material) == 48, "Material must be three vec4 texels");
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef SPHERE_BVH_H
+#define SPHERE_BVH_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "sphere.h"
+#include "shader.h"
+#include "bvh.h"
+#include "lbvh.h"
+#include "taskPool.h"
+#include "textureBuffer.h"
+
+// BVH over the scene's spheres that follows edits by refitting: only the ancestors of a moved sphere are recomputed and
+// only those nodes are uploaded. Refitting lets the tree's quality drift, once its SAH cost grows past `rebuildThreshold`
+// a fresh tree is built on the task pool and swapped in when it's ready. The spheres themselves are never
+// reordered, leaves index them through `order` (uploaded next to the nodes) so sphere indices and object IDs stay stable
+class SphereBVH
+{
+public:
+
+    enum Builder { MEDIAN = 0, LINEAR = 1, SAH = 2 };
+
+    int builder = LINEAR;               // LINEAR builds in parallel and is much faster on large scenes, SAH builds the
+                                        // cheapest trees to trace and suits scenes that don't change
+    float rebuildThreshold = 1.3;       // SAH cost relative to the freshly built tree that triggers a rebuild
+
+    // Stats
+    size_t lastUploadNodes = 0;         // Nodes sent to the GPU by the last upload that sent any
+    double lastRefitSeconds = 0.0;
+    double lastBuildSeconds = 0.0;
+    int rebuilds = 0;                   // Background rebuilds swapped in
+    BVHStats quality;                   // Of the last tree built or assigned, refitting doesn't update it
+
+    SphereBVH() {}
+
+    ~SphereBVH() { waitForRebuild(); }
+
+    SphereBVH(const SphereBVH &) = delete;
+    SphereBVH &operator=(const SphereBVH &) = delete;
+    SphereBVH(SphereBVH &&other) { *this = std::move(other); }
+
+    SphereBVH &operator=(SphereBVH &&other)
+    {
+        if (this == &other) return *this;
+        waitForRebuild();
+        other.waitForRebuild();
+
+        tree = std::move(other.tree);
+        pending = std::move(other.pending);
+        valid = other.valid; fullUpload = other.fullUpload;
+        builder = other.builder; rebuildThreshold = other.rebuildThreshold;
+        lastUploadNodes = other.lastUploadNodes; lastRefitSeconds = other.lastRefitSeconds;
+        lastBuildSeconds = other.lastBuildSeconds; rebuilds = other.rebuilds; quality = other.quality;
+        for (int i = 0; i < 2; i++)
+        {
+            std::swap(buffers[i], other.buffers[i]);
+            std::swap(textures[i], other.textures[i]);
+        }
+        other.valid = false;
+        return *this;
+    }
+
+    const BVH &bvh() const { return tree; }
+    bool isValid() const { return valid; }
+    bool isRebuilding() const { return rebuilding; }
+
+    // The spheres were added, removed or replaced, the tree is rebuilt before the next use
+    void invalidate()
+    {
+        waitForRebuild();
+        valid = false;
+        pending.clear();
+    }
+
+    void build(const Sphere *spheres, size_t count)
+    {
+        waitForRebuild();
+        double start = glfwGetTime();
+        tree = buildTree(sphereBounds(spheres, count), builder);
+        lastBuildSeconds = glfwGetTime() - start;
+        quality = tree.stats();
+
+        valid = fullUpload = true;
+        pending.clear();
+    }
+
+    // Uses a tree stored with the scene, returns false (leaving the tree invalid) if it doesn't fit `count` spheres
+    bool assign(const BVHNode *nodes, size_t nodeCount, const uint32_t *order, size_t count)
+    {
+        invalidate();
+        if (nodeCount == 0 || !nodes || (count && !order)) return false;
+
+        for (size_t i = 0; i < count; i++)
+            if (order[i] >= count) return false;
+        std::vector<bool> reached;
+        if (!BVH::isTree(nodes, nodeCount, 0, count, reached)) return false;
+
+        tree.nodes.assign(nodes, nodes + nodeCount);
+        tree.order.assign(order, order + count);
+        tree.prepareRefit();
+        quality = tree.stats();
+        valid = fullUpload = true;
+        return true;
+    }
+
+    // Sphere `i` moved or changed size
+    void moved(size_t i)
+    {
+        if (valid) pending.push_back(i);
+    }
+
+    // Refits the moved spheres, swaps in a finished rebuild and starts a new one when the tree has degraded too much
+    void refit(const Sphere *spheres, size_t count)
+    {
+        if (!valid)
+        {
+            build(spheres, count);
+            return;
+        }
+
+        double start = glfwGetTime();
+        if (rebuildDone)
+        {
+            rebuild.wait();
+            rebuilding = rebuildDone = false;
+            tree = std::move(rebuilt);
+            lastBuildSeconds = rebuildSeconds;
+            quality = rebuiltQuality;
+            fullUpload = true;
+            rebuilds++;
+
+            // The new tree was built from a snapshot, catch it up with the edits made since
+            pending.insert(pending.end(), movedDuringRebuild.begin(), movedDuringRebuild.end());
+            movedDuringRebuild.clear();
+        }
+
+        auto boundsOf = [spheres](uint32_t i) { return sphereBounds(spheres[i]); };
+        for (size_t i : pending)
+        {
+            if (i >= count) continue;
+            tree.refit(i, boundsOf, touched);
+            if (isRebuilding()) movedDuringRebuild.push_back(i);
+        }
+        bool refitted = !pending.empty();
+        pending.clear();
+        if (refitted) lastRefitSeconds = glfwGetTime() - start;
+
+        if (!isRebuilding() && tree.degradation() > rebuildThreshold)
+        {
+            // The task only sees the snapshot, the spheres can keep changing while it builds. Scoring the tree follows
+            // as a continuation, the rebuild counts as done after that
+            std::vector<AABB> bounds = sphereBounds(spheres, count);
+            rebuilding = true;
+            rebuild.run([this, bounds, builder = builder]()
+            {
+                double start = glfwGetTime();
+                rebuilt = buildTree(bounds, builder);
+                rebuildSeconds = glfwGetTime() - start;
+            });
+            rebuild.then([this]()
+            {
+                rebuiltQuality = rebuilt.stats();
+                rebuildDone = true;
+            });
+        }
+    }
+
+
+    // * GPU
+
+    void initGPU()
+    {
+        glGenBuffers(2, buffers);
+        glGenTextures(2, textures);
+    }
+
+    void release()
+    {
+        waitForRebuild();
+        if (buffers[0]) glDeleteBuffers(2, buffers);
+        if (textures[0]) glDeleteTextures(2, textures);
+        buffers[0] = buffers[1] = textures[0] = textures[1] = 0;
+    }
+
+    // Sends the whole tree after a build, otherwise only the nodes refitting touched
+    void upload()
+    {
+        if (fullUpload)
+        {
+            uploadTextureBuffer(buffers[0], textures[0], GL_RGBA32UI, tree.nodes.data(), tree.nodes.size()*sizeof(BVHNode), GL_DYNAMIC_DRAW);
+            uploadTextureBuffer(buffers[1], textures[1], GL_R32UI, tree.order.data(), tree.order.size()*sizeof(uint32_t), GL_DYNAMIC_DRAW);
+            lastUploadNodes = tree.nodes.size();
+            fullUpload = false;
+            touched.clear();
+            return;
+        }
+        if (touched.empty()) return;
+
+        // Ancestors are shared between edits, send each node once and merge neighbouring ones into one call
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+        for (size_t begin = 0; begin < touched.size();)
+        {
+            size_t end = begin + 1;
+            while (end < touched.size() && touched[end] == touched[end - 1] + 1) end++;
+            glBufferSubData(GL_TEXTURE_BUFFER, touched[begin]*sizeof(BVHNode), (end - begin)*sizeof(BVHNode), &tree.nodes[touched[begin]]);
+            begin = end;
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        lastUploadNodes = touched.size();
+        touched.clear();
+    }
+
+    void bind(const Shader &shader, int firstUnit) const
+    {
+        const char *names[2] = { "sphereNodeData", "sphereOrderData" };
+        for (int i = 0; i < 2; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            shader.setInt(names[i], firstUnit + i);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    static AABB sphereBounds(const Sphere &sphere)
+    {
+        AABB bounds;
+        bounds.grow(sphere.position - sphere.radius);
+        bounds.grow(sphere.position + sphere.radius);
+        return bounds;
+    }
+
+    static std::vector<AABB> sphereBounds(const Sphere *spheres, size_t count)
+    {
+        std::vector<AABB> bounds(count);
+        for (size_t i = 0; i < count; i++) bounds[i] = sphereBounds(spheres[i]);
+        return bounds;
+    }
+
+    static void buildWith(int builder, BVH &bvh, const std::vector<AABB> &bounds, int threadCount = std::thread::hardware_concurrency())
+    {
+        if (builder == LINEAR)
+        {
+            LinearBVHBuilder::build(bvh, bounds, threadCount);
+            return;
+        }
+        bvh.method = (builder == SAH) ? BVH::SAH : BVH::MEDIAN;
+        bvh.maxLeafSize = 2;
+        bvh.build(bounds, threadCount);
+    }
+
+private:
+
+    BVH tree;
+    bool valid = false, fullUpload = true;
+    std::vector<uint32_t> touched;          // Nodes changed since the last upload
+    std::vector<size_t> pending;            // Spheres moved since the last refit
+
+    // Background rebuild
+    TaskGroup rebuild;
+    bool rebuilding = false;
+    std::atomic<bool> rebuildDone{false};
+    BVH rebuilt;
+    BVHStats rebuiltQuality;
+    double rebuildSeconds = 0.0;
+    std::vector<size_t> movedDuringRebuild;
+
+    GLuint buffers[2] = { 0 }, textures[2] = { 0 };     // Nodes and leaf order
+
+    static BVH buildTree(const std::vector<AABB> &bounds, int builder)
+    {
+        BVH bvh;
+        buildWith(builder, bvh, bounds);
+        bvh.prepareRefit();
+        return bvh;
+    }
+
+    // Finishes (and drops) a rebuild in progress
+    void waitForRebuild()
+    {
+        rebuild.wait();
+        rebuilding = rebuildDone = false;
+        movedDuringRebuild.clear();
+    }
+
+};
+
+#endif
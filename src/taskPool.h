@@ -0,0 +1,380 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <algorithm>
+
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+class TaskGroup;
+
+// Work-stealing scheduler for the engine's CPU work: scene loading, BVH builds and image encoding. Every worker owns a
+// deque, it pushes and pops its own tasks at the back so nested work stays in its cache, and idle workers steal from the
+// front of the others', which holds the oldest and usually largest pieces. Tasks submitted from other threads go through
+// a shared queue. A thread waiting on a TaskGroup runs tasks meanwhile instead of blocking, so tasks can wait on the tasks
+// they spawn without tying up a worker. Threads outside the pool only help with the group they wait on, so a long task
+// submitted by someone else (a background BVH rebuild, say) can't stall them
+class TaskPool
+{
+public:
+
+    struct Stats
+    {
+        int threads = 0;
+        uint64_t tasks = 0;             // Run by the workers, waiting threads help with more
+        uint64_t steals = 0;            // Taken from another worker's deque
+        double busySeconds = 0.0;       // Summed over the workers
+    };
+
+    // `threadCount` workers (0 for one per core, less the calling thread's), pinned to a core each if `pinThreads` (Linux)
+    explicit TaskPool(int threadCount = 0, bool pinThreads = false)
+    {
+        if (threadCount <= 0) threadCount = std::max((int)std::thread::hardware_concurrency() - 1, 1);
+        for (int i = 0; i < threadCount; i++) workers.push_back(std::unique_ptr<Worker>(new Worker()));
+        for (int i = 0; i < threadCount; i++)
+        {
+            workers[i]->thread = std::thread(&TaskPool::work, this, i);
+            if (pinThreads) pin(workers[i]->thread, i + 1);
+        }
+    }
+
+    ~TaskPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::unique_ptr<Worker> &worker : workers) worker->thread.join();
+    }
+
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    // Shared by the whole engine, created on first use with the settings of `configure`
+    static TaskPool &global()
+    {
+        static TaskPool pool(settings().threadCount, settings().pinThreads);
+        return pool;
+    }
+
+    // Call before the first use of `global`
+    static void configure(int threadCount, bool pinThreads)
+    {
+        settings().threadCount = threadCount;
+        settings().pinThreads = pinThreads;
+    }
+
+    int threadCount() const { return workers.size(); }
+
+    Stats stats() const
+    {
+        Stats total;
+        total.threads = workers.size();
+        for (const std::unique_ptr<Worker> &worker : workers)
+        {
+            total.tasks += worker->executed;
+            total.steals += worker->steals;
+            total.busySeconds += worker->busyNs / 1.0e9;
+        }
+        return total;
+    }
+
+    // Calls `function(first, last)` over [begin, end) in pieces of at most `grain`. Ranges are halved as they're split
+    // off, so a thief takes half of what's left rather than one piece at a time
+    template <typename Function>
+    void parallelFor(size_t begin, size_t end, size_t grain, Function function);
+
+    // Calls `function(i)` for every i in [0, count) in parallel, for work already cut into chunks
+    template <typename Function>
+    void parallelChunks(int count, Function function)
+    {
+        parallelFor(0, std::max(count, 0), 1, [&function](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++) function((int)i);
+        });
+    }
+
+private:
+
+    friend class TaskGroup;
+
+    struct Task
+    {
+        std::function<void()> function;
+        TaskGroup *group;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> busyNs{0};
+    };
+
+    struct Settings { int threadCount = 0; bool pinThreads = false; };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex injectedMutex;
+    std::deque<Task> injected;          // Submitted from outside the pool
+    std::atomic<int> queued{0};         // Tasks waiting in any queue
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static Settings &settings()
+    {
+        static Settings settings;
+        return settings;
+    }
+
+    // Index of the calling thread's worker in this pool, -1 on other threads
+    int currentWorker() const
+    {
+        const CurrentWorker &current = currentWorkerSlot();
+        return (current.pool == this) ? current.index : -1;
+    }
+
+    struct CurrentWorker { const TaskPool *pool; int index; };
+
+    static CurrentWorker &currentWorkerSlot()
+    {
+        static thread_local CurrentWorker current = { NULL, -1 };
+        return current;
+    }
+
+    void submit(Task &&task)
+    {
+        int self = currentWorker();
+        if (self >= 0)
+        {
+            std::lock_guard<std::mutex> lock(workers[self]->mutex);
+            workers[self]->tasks.push_back(std::move(task));
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            injected.push_back(std::move(task));
+        }
+        queued++;
+
+        // Taking the lock orders this with a worker about to sleep, so the wake up isn't lost
+        { std::lock_guard<std::mutex> lock(sleepMutex); }
+        wake.notify_one();
+    }
+
+    // The back of the caller's own deque, else the oldest submitted task, else the front of another worker's deque. With
+    // `only` set, the oldest task of that group in each queue instead
+    bool take(Task &task, const TaskGroup *only = NULL)
+    {
+        if (queued <= 0) return false;
+        int self = currentWorker();
+        if (self >= 0 && popBack(*workers[self], task)) return true;
+
+        auto matches = [only](const Task &candidate) { return !only || candidate.group == only; };
+        {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            std::deque<Task>::iterator found = std::find_if(injected.begin(), injected.end(), matches);
+            if (found != injected.end())
+            {
+                task = std::move(*found);
+                injected.erase(found);
+                queued--;
+                return true;
+            }
+        }
+
+        int count = workers.size(), first = (self >= 0) ? self + 1 : 0;
+        for (int i = 0; i < count; i++)
+        {
+            Worker &victim = *workers[(first + i) % count];
+            if (&victim == (self >= 0 ? workers[self].get() : NULL)) continue;
+
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            std::deque<Task>::iterator found = std::find_if(victim.tasks.begin(), victim.tasks.end(), matches);
+            if (found == victim.tasks.end()) continue;
+            task = std::move(*found);
+            victim.tasks.erase(found);
+            queued--;
+            if (self >= 0) workers[self]->steals++;
+            return true;
+        }
+        return false;
+    }
+
+    bool popBack(Worker &worker, Task &task)
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) return false;
+        task = std::move(worker.tasks.back());
+        worker.tasks.pop_back();
+        queued--;
+        return true;
+    }
+
+    // Runs one queued task if there is any (of group `only`, if set), returns false otherwise
+    bool runOne(const TaskGroup *only = NULL);
+
+    void work(int index)
+    {
+        currentWorkerSlot() = { this, index };
+        Worker &worker = *workers[index];
+        while (true)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (runOne())
+            {
+                worker.executed++;
+                worker.busyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            if (stopping) return;
+            wake.wait(lock, [this]() { return stopping || queued > 0; });
+            if (stopping) return;
+        }
+    }
+
+    static void pin(std::thread &thread, int core)
+    {
+        #ifdef __linux__
+        int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core % cores, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+        #else
+        (void)thread;
+        (void)core;
+        #endif
+    }
+
+};
+
+// Tasks that can be waited on together. `then` adds a continuation: a task that runs once everything run on the group so
+// far has finished, and which the group's `wait` also covers
+class TaskGroup
+{
+public:
+
+    explicit TaskGroup(TaskPool &pool = TaskPool::global())
+        : pool(pool)
+    {}
+
+    ~TaskGroup() { wait(); }
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    void run(std::function<void()> task)
+    {
+        pending++;
+        pool.submit(TaskPool::Task{ std::move(task), this });
+    }
+
+    void then(std::function<void()> continuation)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending > 0)
+        {
+            continuations.push_back(std::move(continuation));
+            return;
+        }
+        pending++;
+        pool.submit(TaskPool::Task{ std::move(continuation), this });
+    }
+
+    bool isDone() const { return pending == 0; }
+
+    // Runs queued tasks until the group's are done. Workers take any task, other threads only this group's, since
+    // another group's task could keep them long after this one finished
+    void wait()
+    {
+        const TaskGroup *only = (pool.currentWorker() >= 0) ? NULL : this;
+        while (pending > 0)
+            if (!pool.runOne(only)) std::this_thread::yield();
+
+        // The last task may still be inside `finish`, holding the lock
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+
+private:
+
+    friend class TaskPool;
+
+    TaskPool &pool;
+    std::atomic<int> pending{0};
+    std::mutex mutex;
+    std::vector<std::function<void()>> continuations;
+
+    // The continuations are counted before the last task is, so the group never looks done in between
+    void finish()
+    {
+        std::vector<std::function<void()>> next;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending == 1 && !continuations.empty())
+            {
+                next.swap(continuations);
+                pending += next.size();
+            }
+            pending--;
+        }
+        for (std::function<void()> &continuation : next) pool.submit(TaskPool::Task{ std::move(continuation), this });
+    }
+
+};
+
+inline bool TaskPool::runOne(const TaskGroup *only)
+{
+    Task task;
+    if (!take(task, only)) return false;
+    task.function();
+    if (task.group) task.group->finish();
+    return true;
+}
+
+template <typename Function>
+void TaskPool::parallelFor(size_t begin, size_t end, size_t grain, Function function)
+{
+    if (begin >= end) return;
+    grain = std::max(grain, (size_t)1);
+    if (end - begin <= grain)
+    {
+        function(begin, end);
+        return;
+    }
+
+    // Keep halving the range, handing the upper half to the pool, until a piece is small enough to run here
+    TaskGroup group(*this);
+    std::function<void(size_t, size_t)> split = [&](size_t first, size_t last)
+    {
+        while (last - first > grain)
+        {
+            size_t middle = first + (last - first) / 2;
+            group.run([&split, middle, last]() { split(middle, last); });
+            last = middle;
+        }
+        function(first, last);
+    };
+    split(begin, end);
+    group.wait();
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef TEXTURE_BUFFER_H
+#define TEXTURE_BUFFER_H
+
+#include <GL/glew.h>
+#include <stddef.h>
+
+// Uploads `size` bytes as the whole of `buffer` and points the buffer texture `texture` at it. Empty buffers still get a
+// texel so the texture is complete
+inline void uploadTextureBuffer(GLuint buffer, GLuint texture, GLenum format, const void *data, size_t size, GLenum usage = GL_STATIC_DRAW)
+{
+    static const char empty[16] = { 0 };
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, size ? size : sizeof(empty), size ? data : empty, usage);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+#endif
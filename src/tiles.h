@@ -0,0 +1,185 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include "window.h"
+#include "fullQuad.h"
+
+class TileScheduler
+{
+public:
+
+    enum TileOrder { SCANLINE = 0, CENTER_OUT = 1, MORTON = 2 };
+
+    // Settings
+    int tileSize = 128;
+    int tileOrder = CENTER_OUT;
+    float frameBudgetMs = 12.0;         // GPU time tracing may take each frame (<= 0 traces the whole pass at once)
+    glm::ivec4 region = glm::ivec4(0);  // Part of the window a pass covers (x, y, width, height), all of it when empty
+
+    // Stats
+    float gpuMsPerTile = 0.0;           // Moving average of the measured GPU time of one tile
+    int lastFrameFirstTile = 0, lastFrameTileCount = 0;
+
+    TileScheduler() {}
+
+    void init()
+    {
+        glGenQueries(QUERY_COUNT, queries);
+    }
+
+    // Start the current pass over from the first tile
+    void restart()
+    {
+        nextTile = 0;
+    }
+
+    bool atPassStart() const { return nextTile == 0; }
+    int tileCount() const { return tiles.size(); }
+    int tilesDone() const { return nextTile; }
+    float progress() const { return tiles.empty() ? 0.0f : nextTile / (float)tiles.size(); }
+    glm::ivec4 getTile(int i) const { return tiles[i]; }
+
+    // Traces as many tiles of the current pass as the frame budget allows, returns true once the pass is complete.
+    // `traceTile(tile)` traces one, with the scissor rectangle set to it
+    template <typename TraceTile>
+    bool render(const Window *window, TraceTile traceTile)
+    {
+        updateLayout(window->width, window->height);
+        readTimings();
+
+        int count = std::min(tilesForBudget(), (int)tiles.size() - nextTile);
+        lastFrameFirstTile = nextTile;
+        lastFrameTileCount = count;
+
+        glBeginQuery(GL_TIME_ELAPSED, queries[queryIndex]);
+        glEnable(GL_SCISSOR_TEST);
+        for (int i = 0; i < count; i++, nextTile++)
+        {
+            glm::ivec4 tile = tiles[nextTile];
+            glScissor(tile.x, tile.y, tile.z, tile.w);
+            traceTile(tile);
+
+            // Submit every tile on its own so no single command batch runs long enough to trip the driver watchdog
+            glFlush();
+        }
+        glDisable(GL_SCISSOR_TEST);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        queryTiles[queryIndex] = count;
+        queryIndex = (queryIndex + 1) % QUERY_COUNT;
+
+        if (nextTile >= (int)tiles.size())
+        {
+            nextTile = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+private:
+
+    static const int QUERY_COUNT = 4;   // Timer queries in flight, results are read a few frames late to avoid stalling
+
+    std::vector<glm::ivec4> tiles;      // (x, y, width, height) in window coordinates, in tracing order
+    int nextTile = 0;
+    int layoutWidth = 0, layoutHeight = 0, layoutTileSize = 0, layoutOrder = -1;
+    glm::ivec4 layoutRegion = glm::ivec4(0);
+
+    GLuint queries[QUERY_COUNT];
+    int queryTiles[QUERY_COUNT] = { 0 };
+    int queryIndex = 0;
+
+    int tilesForBudget() const
+    {
+        if (frameBudgetMs <= 0.0 || gpuMsPerTile <= 0.0) return (frameBudgetMs <= 0.0) ? tiles.size() : 1;
+
+        // Grow at most by a factor of 2 per frame so a bad estimate can't submit a huge batch at once
+        int estimate = (int)(frameBudgetMs / gpuMsPerTile);
+        return std::max(1, std::min(estimate, 2*std::max(lastFrameTileCount, 1)));
+    }
+
+    void readTimings()
+    {
+        for (int i = 0; i < QUERY_COUNT; i++)
+        {
+            if (queryTiles[i] == 0) continue;
+
+            GLint available = 0;
+            glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) continue;
+
+            GLuint64 elapsed;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+            float msPerTile = (elapsed / 1.0e6) / queryTiles[i];
+            gpuMsPerTile = (gpuMsPerTile <= 0.0) ? msPerTile : 0.8f*gpuMsPerTile + 0.2f*msPerTile;
+            queryTiles[i] = 0;
+        }
+    }
+
+    void updateLayout(int width, int height)
+    {
+        if (width == layoutWidth && height == layoutHeight && tileSize == layoutTileSize && tileOrder == layoutOrder && region == layoutRegion) return;
+
+        layoutWidth = width;
+        layoutHeight = height;
+        layoutTileSize = tileSize;
+        layoutOrder = tileOrder;
+        layoutRegion = region;
+
+        // Clip the region to the window
+        glm::ivec2 origin(0), end(width, height);
+        if (region.z > 0 && region.w > 0)
+        {
+            origin = glm::clamp(glm::ivec2(region.x, region.y), glm::ivec2(0), end);
+            end = glm::clamp(glm::ivec2(region.x + region.z, region.y + region.w), origin, end);
+        }
+
+        // Split the region into tiles, the top row first
+        tiles.clear();
+        int columns = (end.x - origin.x + tileSize - 1) / tileSize;
+        int rows = (end.y - origin.y + tileSize - 1) / tileSize;
+        for (int row = rows - 1; row >= 0; row--)
+        {
+            for (int column = 0; column < columns; column++)
+            {
+                int x = origin.x + column*tileSize, y = origin.y + row*tileSize;
+                tiles.push_back(glm::ivec4(x, y, std::min(tileSize, end.x - x), std::min(tileSize, end.y - y)));
+            }
+        }
+
+        if (tileOrder == CENTER_OUT)
+        {
+            // Trace the middle of the screen first, that's where we're usually looking
+            glm::vec2 center(0.5f*(origin.x + end.x), 0.5f*(origin.y + end.y));
+            auto distance = [center](const glm::ivec4 &tile)
+            {
+                glm::vec2 tileCenter(tile.x + tile.z / 2.0f, tile.y + tile.w / 2.0f);
+                return glm::dot(tileCenter - center, tileCenter - center);
+            };
+            std::stable_sort(tiles.begin(), tiles.end(), [&distance](const glm::ivec4 &a, const glm::ivec4 &b) { return distance(a) < distance(b); });
+        }
+        else if (tileOrder == MORTON)
+        {
+            // Z-order curve over tile coordinates keeps consecutive tiles close together
+            int tileSize = this->tileSize;
+            auto morton = [tileSize, rows, origin](const glm::ivec4 &tile)
+            {
+                unsigned x = (tile.x - origin.x) / tileSize, y = rows - 1 - (tile.y - origin.y) / tileSize, code = 0;
+                for (int bit = 0; bit < 16; bit++)
+                    code |= ((x >> bit) & 1u) << (2*bit) | ((y >> bit) & 1u) << (2*bit + 1);
+                return code;
+            };
+            std::sort(tiles.begin(), tiles.end(), [&morton](const glm::ivec4 &a, const glm::ivec4 &b) { return morton(a) < morton(b); });
+        }
+
+        nextTile = 0;
+    }
+
+};
+
+#endif
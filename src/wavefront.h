@@ -0,0 +1,220 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+#include "shader.h"
+#include "bvh.h"
+
+// Path tracer split into compute kernels (OpenGL 4.3) instead of one fragment shader running whole paths: generate
+// starts a path per pixel of a tile, then every bounce runs extend (closest hit) and shade (light and the next ray) over
+// a queue of the rays still alive, and accumulate blends the tile into the image. Kernels only see live rays, so lanes
+// aren't left idle by paths that ended early, and the queue sizes stay on the GPU through indirect dispatches.
+// The fragment tracer remains the fallback where compute shaders aren't available
+class WavefrontTracer
+{
+public:
+
+    // Settings
+    bool persistentThreads = false;     // Extend with persistent workgroups instead of a thread per ray
+    int persistentGroups = 256;         // Workgroups launched, enough to keep every core of the GPU busy
+    int batchSize = 256;                // Rays a persistent workgroup takes from the queue at once
+    bool sortRays = false;              // Bin secondary rays by direction octant and origin cell before extend
+    bool sortHits = false;              // Bin hits by material before shade
+    AABB sceneBounds;                   // Quantizes ray origins for sorting, set by the renderer
+
+    // Stats
+    size_t raysQueued = 0;              // Capacity of each ray queue, the largest tile traced so far
+
+    WavefrontTracer() {}
+
+    static bool isSupported() { return GLEW_VERSION_4_3; }
+
+    void init()
+    {
+        generate = Shader("./src/shaders/wavefront/generate.comp");
+        extend = Shader("./src/shaders/wavefront/extend.comp");
+        shade = Shader("./src/shaders/wavefront/shade.comp");
+        queue = Shader("./src/shaders/wavefront/queue.comp");
+        accumulate = Shader("./src/shaders/wavefront/accumulate.comp");
+        sort = Shader("./src/shaders/wavefront/sort.comp");
+
+        glGenBuffers(BUFFER_COUNT, buffers);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[QUEUE_STATE]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(QueueState), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        initialized = true;
+    }
+
+    bool isInitialized() const { return initialized; }
+
+    // Programs that need the camera, scene and settings uniforms, set once per frame by the renderer
+    std::vector<Shader*> programs() { return { &generate, &extend, &shade, &accumulate }; }
+
+    // Traces `samples` samples of every pixel of `tile` (x, y, width, height) and blends them into `target`. The object
+    // ID of each pixel's first primary ray goes to `objectIDs`
+    void traceTile(glm::ivec4 tile, GLuint target, GLuint objectIDs, int samples, int maxBounces)
+    {
+        size_t pathCount = (size_t)tile.z*tile.w;
+        if (pathCount == 0) return;
+        reserve(pathCount);
+
+        for (Shader *program : { &generate, &extend, &shade, &queue, &accumulate, &sort })
+        {
+            program->use();
+            program->setVec2i("tileOrigin", tile.x, tile.y);
+            program->setVec2i("tileSize", tile.z, tile.w);
+        }
+
+        if (sortRays || sortHits)
+        {
+            glm::vec3 boundsMin = sceneBounds.empty() ? glm::vec3(0.0) : sceneBounds.min;
+            glm::vec3 extent = sceneBounds.empty() ? glm::vec3(1.0) : glm::max(sceneBounds.extent(), glm::vec3(1e-6f));
+            sort.use();
+            sort.setVec3f("boundsMin", boundsMin);
+            sort.setVec3f("cellScale", 8.0f / extent);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, buffers[SORT_STATE]);
+        }
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffers[PATHS]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, buffers[HITS]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, buffers[QUEUE_STATE]);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffers[QUEUE_STATE]);
+        glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+        glBindImageTexture(1, objectIDs, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32I);
+
+        persistentGroups = std::max(persistentGroups, 1);
+        uint32_t batch = std::max(batchSize / QUEUE_GROUP_SIZE, 1)*QUEUE_GROUP_SIZE;
+        extend.use();
+        extend.setBool("persistent", persistentThreads);
+        extend.setUint("batchSize", batch);
+        queue.use();
+        queue.setUint("persistentGroups", persistentGroups);
+        queue.setUint("batchSize", batch);
+
+        glm::uvec2 groups((tile.z + 7) / 8, (tile.w + 7) / 8);
+        for (int sample = 0; sample < samples; sample++)
+        {
+            // Every pixel starts with a camera ray in the first queue
+            QueueState state = { (uint32_t)((pathCount + QUEUE_GROUP_SIZE - 1) / QUEUE_GROUP_SIZE), 1, 1,
+                                 std::min((uint32_t)persistentGroups, (uint32_t)((pathCount + batch - 1) / batch)), 1, 1, (uint32_t)pathCount, 0, 0 };
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            glBufferSubData(GL_DISPATCH_INDIRECT_BUFFER, 0, sizeof(state), &state);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers[RAYS_A]);
+
+            generate.use();
+            generate.setInt("pathSample", sample);
+            glDispatchCompute(groups.x, groups.y, 1);
+
+            for (int bounce = 0; bounce < maxBounces; bounce++)
+            {
+                // Whichever ray and hit buffers aren't being read from or appended to hold the sorted copies
+                GLuint rays = buffers[RAYS_A + bounce % 2], spareRays = buffers[RAYS_SORTED];
+                GLuint hits = buffers[HITS], spareHits = buffers[HITS_SORTED];
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers[RAYS_A + 1 - bounce % 2]);
+
+                // Camera rays leave each tile in pixel order, which is already coherent
+                if (sortRays && bounce > 0) sortQueue(DIRECTION_KEY, rays, hits, spareRays, spareHits);
+                for (Shader *kernel : { &extend, &shade })
+                {
+                    if (kernel == &shade && sortHits) sortQueue(MATERIAL_KEY, rays, hits, spareRays, spareHits);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, rays);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, hits);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+                    kernel->use();
+                    kernel->setInt("pathSample", sample);
+                    kernel->setInt("bounce", bounce);
+                    glDispatchComputeIndirect((kernel == &extend && persistentThreads) ? offsetof(QueueState, persistentX) : 0);
+                }
+
+                // Once the queue is empty the remaining bounces dispatch no groups
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                queue.use();
+                glDispatchCompute(1, 1, 1);
+            }
+        }
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        accumulate.use();
+        accumulate.setInt("samplesPerPass", samples);
+        glDispatchCompute(groups.x, groups.y, 1);
+
+        // The image is read as a texture, blitted and read back afterwards
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    }
+
+    void release()
+    {
+        if (buffers[0]) glDeleteBuffers(BUFFER_COUNT, buffers);
+        for (GLuint &buffer : buffers) buffer = 0;
+    }
+
+private:
+
+    static const int QUEUE_GROUP_SIZE = 64;     // Matches the compute kernels
+    static const int SORT_BINS = 4096;          // Matches sort.comp
+    enum SortStage { COUNT = 0, SCAN = 1, SCATTER = 2 };
+    enum SortKey { DIRECTION_KEY = 0, MATERIAL_KEY = 1 };
+
+    // std430 layouts of the kernels' buffers (wavefront.glsl), directions, normals and throughput are packed
+    struct PathState { float radiance[3]; uint32_t rng; uint32_t throughput[2]; uint32_t work[3]; };
+    struct QueuedRay { float position[3]; uint32_t path; uint32_t direction; };
+    struct HitRecord { float t; uint32_t normal; int32_t id, material; };
+    struct QueueState { uint32_t groupsX, groupsY, groupsZ, persistentX, persistentY, persistentZ, rayCount, nextRayCount, rayCursor; };
+
+    enum Buffer { PATHS, RAYS_A, RAYS_B, HITS, RAYS_SORTED, HITS_SORTED, SORT_STATE, QUEUE_STATE, BUFFER_COUNT };
+
+    Shader generate, extend, shade, queue, accumulate, sort;
+    GLuint buffers[BUFFER_COUNT] = { 0 };
+    bool initialized = false;
+
+    // Grows the per path buffers to hold `pathCount` paths
+    void reserve(size_t pathCount)
+    {
+        if (pathCount <= raysQueued) return;
+        raysQueued = pathCount;
+
+        const size_t sizes[BUFFER_COUNT] = { sizeof(PathState), sizeof(QueuedRay), sizeof(QueuedRay), sizeof(HitRecord), sizeof(QueuedRay),
+                                             sizeof(HitRecord), sizeof(uint32_t), 0 };
+        for (int i = 0; i < QUEUE_STATE; i++)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, pathCount*sizes[i] + ((i == SORT_STATE) ? 2*SORT_BINS*sizeof(uint32_t) : 0), NULL, GL_DYNAMIC_COPY);
+        }
+
+        // The sort expects its bin counts zeroed, each sort leaves them that way
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[SORT_STATE]);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Counting sort of the queue in `rays` (and `hits` for MATERIAL_KEY) into the spare buffers, which then swap places
+    // with the sorted ones
+    void sortQueue(SortKey key, GLuint &rays, GLuint &hits, GLuint &spareRays, GLuint &spareHits)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, rays);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, hits);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, spareRays);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, spareHits);
+        sort.use();
+        sort.setInt("sortKey", key);
+        for (int stage : { COUNT, SCAN, SCATTER })
+        {
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+            sort.setInt("stage", stage);
+            if (stage == SCAN) glDispatchCompute(1, 1, 1);
+            else glDispatchComputeIndirect(0);
+        }
+
+        std::swap(rays, spareRays);
+        if (key == MATERIAL_KEY) std::swap(hits, spareHits);
+    }
+
+};
+
+#endif
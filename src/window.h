@@ -11,7 +11,9 @@ public:
 
     int width, height;
     double aspectRatio;
-    GLuint textures[2], FBOs[2];
+    GLuint textures[2], FBOs[2];        // Linear float accumulation targets
+    GLuint idTexture;                   // Index of the sphere hit by each pixel's primary ray (shared by both FBOs)
+    GLuint displayTexture, displayFBO;  // 8 bit, gamma corrected copy of the accumulation that gets shown
 
     Window () {}
 
@@ -29,38 +31,86 @@ public:
         aspectRatio = width / (float)height;
 
         // Update texture sizes
+        glBindTexture(GL_TEXTURE_2D, idTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, width, height, 0, GL_RED_INTEGER, GL_INT, NULL);
+        glBindTexture(GL_TEXTURE_2D, displayTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
         for (int i = 0; i < 2; i++)
         {
             glBindTexture(GL_TEXTURE_2D, textures[i]);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+            // Clear the new storage, tiles that haven't been traced yet would show garbage otherwise
+            glBindFramebuffer(GL_FRAMEBUFFER, FBOs[i]);
+            clearAttachments();
         }
         glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Copies the contents of texture `src` into texture `dst` through their FBOs
+    void copyTexture(int src, int dst)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBOs[src]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBOs[dst]);
+
+        // Blit into the colour attachment only, blits between float and integer attachments aren't allowed
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glDrawBuffers(2, drawBuffers);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
 private:
 
+    static constexpr GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+
     void initFBOs()
     {
         // Create FBOs and textures
         glGenFramebuffers(2, FBOs);
         glGenTextures(2, textures);
 
+        // Object ID texture, integer textures can't be filtered
+        glGenTextures(1, &idTexture);
+        glBindTexture(GL_TEXTURE_2D, idTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, width, height, 0, GL_RED_INTEGER, GL_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // Display target
+        glGenFramebuffers(1, &displayFBO);
+        glGenTextures(1, &displayTexture);
+        glBindTexture(GL_TEXTURE_2D, displayTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, displayFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, displayTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "Frame buffer not complete" << std::endl;
+
         for (int i = 0; i < 2; i++)
         {
             // Set texture parameters
             glBindTexture(GL_TEXTURE_2D, textures[i]);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             
             // Attach textures to FBOs
             glBindFramebuffer(GL_FRAMEBUFFER, FBOs[i]);
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, idTexture, 0);
+            glDrawBuffers(2, drawBuffers);
 
             if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
                 std::cerr << "Frame buffer not complete" << std::endl;
+
+            clearAttachments();
         }
         
         // Unbind texture and frame buffers
@@ -68,6 +118,15 @@ private:
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
+    // Clears the colour and object ID attachments of the bound FBO
+    void clearAttachments()
+    {
+        const GLfloat colour[4] = { 0.0, 0.0, 0.0, 0.0 };
+        const GLint noSphere[4] = { -1, 0, 0, 0 };
+        glClearBufferfv(GL_COLOR, 0, colour);
+        glClearBufferiv(GL_COLOR, 1, noSphere);
+    }
+
 };
 
 #endif
\ No newline at end of file